@@ -14,9 +14,13 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>		// for offsetof()
 
 #include "dawft.h"
 #include "bmp.h"
+#include "png.h"
+#include "qoi.h"
+#include "jpeg.h"
 
 const char * ImgCompressionStr[8] = { "NONE", "RLE_LINE", "RLE_BASIC", "RESERVED", "RESERVED", "RESERVED", "RESERVED", "TRY_RLE" };
 
@@ -37,7 +41,7 @@ static RGBTrip RGB565to888(u16 pixel) {
 	return output;
 }
 
-static u16 RGB888to565(u8 * buf) {
+static u16 RGB888to565(const u8 * buf) {
     u16 output = 0;
 	u8 b = buf[0];
 	u8 g = buf[1];
@@ -93,7 +97,7 @@ void setBMPHeaderClassic(BMPHeaderClassic * dest, u32 width, u32 height, u8 bpp)
 
 
 
-// Set up a BMP header. bpp must be 16 or 24.
+// Set up a BMP header. bpp must be 16, 24 or 32 (ARGB8888).
 void setBMPHeaderV4(BMPHeaderV4 * dest, u32 width, u32 height, u8 bpp) {
 	*dest = (BMPHeaderV4){ 0 };
 	dest->sig = 0x4D42;
@@ -111,6 +115,12 @@ void setBMPHeaderV4(BMPHeaderV4 * dest, u32 width, u32 height, u8 bpp) {
 		dest->RGBAmasks[2] = 0x001F;	
 	} else if(bpp == 24) {
 		dest->compressionType = 0; 					// BI_RGB=0
+	} else if(bpp == 32) {
+		dest->compressionType = 3; 					// BI_BITFIELDS=3
+		dest->RGBAmasks[0] = 0x00FF0000;
+		dest->RGBAmasks[1] = 0x0000FF00;
+		dest->RGBAmasks[2] = 0x000000FF;
+		dest->RGBAmasks[3] = 0xFF000000;
 	}
 	dest->imageDataSize = rowSize * height;
 	dest->fileSize = dest->imageDataSize + sizeof(BMPHeaderV4);
@@ -132,383 +142,635 @@ void setBMPHeaderV4(BMPHeaderV4 * dest, u32 width, u32 height, u8 bpp) {
 	}
 */
 
-int dumpBMP16(char * filename, u8 * srcData, size_t srcDataSize, u32 imgWidth, u32 imgHeight, bool basicRLE) {	
+// Allocate a whole 16bpp bmp file of imgWidth x imgHeight, with the header filled in, and *pixels pointing at the image
+// data. Returns NULL for failure.
+static Bytes * newBMP16(u32 imgWidth, u32 imgHeight, size_t * destRowSize, u8 ** pixels) {
+	BMPHeaderV4 bmpHeader;
+	setBMPHeaderV4(&bmpHeader, imgWidth, imgHeight, 16);
+
+	// row width is equal to imageDataSize / imgHeight
+	*destRowSize = bmpHeader.imageDataSize / imgHeight;
+
+	size_t fileSize = sizeof(bmpHeader) + *destRowSize * imgHeight;
+	Bytes * b = malloc(sizeof(Bytes) + fileSize);
+	if(b == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		return NULL;
+	}
+	b->size = fileSize;
+	memcpy(b->data, &bmpHeader, sizeof(bmpHeader));
+	// b->data is only declared with 16 bytes, so the image data is addressed from b itself to keep -Warray-bounds quiet
+	*pixels = (u8 *)b + offsetof(Bytes, data) + sizeof(bmpHeader);
+	return b;
+}
+
+// Spread big-endian RGB565 rows, packed at the start of pixels, out to their padded size, and swap byte order.
+// This goes last row first so nothing is overwritten.
+static void spreadBMP16Rows(u8 * pixels, u32 imgWidth, u32 imgHeight, size_t destRowSize) {
+	size_t srcRowSize = (size_t)imgWidth * 2;
+	for(u32 y=imgHeight; y-- > 0; ) {
+		u8 * dest = &pixels[y * destRowSize];
+		memmove(dest, &pixels[y * srcRowSize], srcRowSize);
+		for(size_t x=0; x<srcRowSize; x+=2) {
+			u8 temp = dest[x];
+			dest[x] = dest[x+1];
+			dest[x+1] = temp;
+		}
+		memset(&dest[srcRowSize], 0, destRowSize - srcRowSize);
+	}
+}
+
+// Build a whole 16bpp bmp file in memory from blob data, in *out. Returns 0 for success. Delete *out with deleteBytes.
+int newBMP16FromData(const u8 * srcData, size_t srcDataSize, u32 imgWidth, u32 imgHeight, bool basicRLE, Bytes ** out) {	
 	// Check we have at least a little data available
 	if(srcDataSize < 2) {
-		printf("ERROR: srcDataSize < 2 bytes!\n");
+		d_printf("ERROR: srcDataSize < 2 bytes!\n");
 		return 100;
 	}
 
 	// Check if this bitmap has the RLE encoded identifier
 	u16 identifier = get_u16(&srcData[0]);
 	int isRLE = (identifier == 0x2108);
+	u32 compression = isRLE ? (basicRLE ? RLE_BASIC : RLE_LINE) : NONE;
 
-	BMPHeaderV4 bmpHeader;
-	setBMPHeaderV4(&bmpHeader, imgWidth, imgHeight, 16);
+	// check the size makes sense before allocating for it (and newBMP16 divides by the height)
+	if(!imgFitsData(srcDataSize, imgWidth, imgHeight, compression)) {
+		d_printf("ERROR: %ux%u image doesn't fit in %zu bytes of srcData.\n", imgWidth, imgHeight, srcDataSize);
+		return 104;
+	}
 
-	// row width is equal to imageDataSize / imgHeight
-	u32 destRowSize = bmpHeader.imageDataSize / imgHeight;
+	// the whole file is assembled in memory
+	size_t destRowSize = 0;
+	u8 * pixels = NULL;
+	Bytes * b = newBMP16(imgWidth, imgHeight, &destRowSize, &pixels);
+	if(b == NULL) {
+		return 3;
+	}
+
+	// decode to big-endian RGB565, packed at the start of the image data
+	int r = decodeImgData(srcData, srcDataSize, imgWidth, imgHeight, compression, pixels, destRowSize * imgHeight);
+	if(r != 0) {
+		free(b);
+		return r;
+	}
 
-	u8 buf[8192];
-	if(destRowSize > sizeof(buf)) {
-		printf("ERROR: Image width exceeds buffer size!\n");
+	spreadBMP16Rows(pixels, imgWidth, imgHeight, destRowSize);
+	*out = b;
+	return 0; // SUCCESS
+}
+
+// Build a whole 16bpp bmp file in memory from imgWidth*imgHeight big-endian RGB565 pixels, in *out.
+// Returns 0 for success. Delete *out with deleteBytes.
+int newBMP16FromPixels(const u8 * pixels, u32 imgWidth, u32 imgHeight, Bytes ** out) {
+	size_t destRowSize = 0;
+	u8 * dest = NULL;
+	Bytes * b = newBMP16(imgWidth, imgHeight, &destRowSize, &dest);
+	if(b == NULL) {
 		return 3;
 	}
+	memcpy(dest, pixels, (size_t)imgWidth * imgHeight * 2);
+	spreadBMP16Rows(dest, imgWidth, imgHeight, destRowSize);
+	*out = b;
+	return 0; // SUCCESS
+}
 
-	// open the dump file
+int dumpBMP16(char * filename, u8 * srcData, size_t srcDataSize, u32 imgWidth, u32 imgHeight, bool basicRLE) {	
+	Bytes * b = NULL;
+	int r = newBMP16FromData(srcData, srcDataSize, imgWidth, imgHeight, basicRLE, &b);
+	if(r != 0) {
+		return r;
+	}
+
+	// write the dump file, all at once
 	FILE * dumpFile = fopen(filename,"wb");
 	if(dumpFile==NULL) {
+		deleteBytes(b);
 		return 1;
 	}
-
-	// write the header 	
-	size_t rval = fwrite(&bmpHeader,1,sizeof(bmpHeader),dumpFile);
-	if(rval != sizeof(bmpHeader)) {
-		fclose(dumpFile);
+	size_t rval = fwrite(b->data, 1, b->size, dumpFile);
+	bool ok = (rval == b->size);
+	deleteBytes(b);
+	if(fclose(dumpFile) != 0 || !ok) {
 		remove(filename);
 		return 2;
 	}
 
-	if(isRLE && !basicRLE) {
-		// The newer RLE style has a table at the start with the offsets of each row. (RLE_LINE)
-		u8 * lineEndOffset = &srcData[2];
-		size_t srcIdx = (2 * imgHeight) + 2; // offset from start of RLEImage to RLEData
+	return 0; // SUCCESS
+}
 
-		// The srcDataSize must be at least get_u16(&lineEndOffset[imgHeight*2]) 
-		size_t dataEnd = get_u16(&lineEndOffset[(imgHeight-1)*2]) - 1;		// This marks the last byte location, plus one.
-		if(srcIdx > srcDataSize || dataEnd > srcDataSize) {
-			printf("ERROR: Insufficient srcData to decode RLE image.\n");
-			fclose(dumpFile);
-			remove(filename);
-			return 101;
-		}
 
-		// for each row
-		for(u32 y=0; y<imgHeight; y++) {
-			memset(buf, 0, destRowSize);
-			u32 bufIdx = 0;
+//----------------------------------------------------------------------------
+//  DECODEIMGDATA - decode blob data to big-endian RGB565 pixels
+//----------------------------------------------------------------------------
+
+// Copy the part of a run of count pixels starting at column x that is inside columns [spanX, spanX + spanWidth) of
+// a span, into row (the first pixel of the span's row)
+static inline void copyRunToSpan(const u8 * pixel, u32 x, u32 count, u32 spanX, u32 spanWidth, u8 * row) {
+	u32 x0 = (x > spanX) ? x : spanX;
+	u32 x1 = (x + count < spanX + spanWidth) ? x + count : spanX + spanWidth;
+	for(u32 i=x0; i<x1; i++) {
+		row[(i - spanX) * 2] = pixel[0];
+		row[(i - spanX) * 2 + 1] = pixel[1];
+	}
+}
+
+// Returns true if an imgWidth x imgHeight image, with neither of them 0, could be stored as compression (NONE, RLE_LINE
+// or RLE_BASIC) in srcDataSize bytes. An RLE run is 3 bytes, for at most 255 pixels.
+bool imgFitsData(size_t srcDataSize, u32 imgWidth, u32 imgHeight, u32 compression) {
+	if(imgWidth == 0 || imgHeight == 0) {
+		return false;
+	}
+	u64 pixels = (u64)imgWidth * imgHeight;
+	if(compression == NONE) {
+		return pixels * 2 <= srcDataSize;
+	}
+	return pixels <= (u64)(srcDataSize / 3) * 255;
+}
 
-			//printf("line %d, srcIdx %lu, lineEndOffset %d, first color 0x%04x, first count %d\n", y, srcIdx, get_u16(&lineEndOffset[y*2]), 0, srcData[srcIdx+2]);
+// Decode the spanWidth x spanHeight rectangle at spanX, spanY of an image stored as compression (NONE, RLE_LINE or
+// RLE_BASIC) into dst, as big-endian RGB565 pixels, with rows dstStride bytes apart. RLE_LINE images start each row
+// from the line end offset table, so only the rows wanted are read. RLE_BASIC images have no table, so the rows
+// before the span are skipped a run at a time. Returns 0 for success.
+int decodeImgSpan(const u8 * srcData, size_t srcDataSize, u32 imgWidth, u32 imgHeight, u32 compression, u32 spanX, u32 spanY, u32 spanWidth, u32 spanHeight, u8 * dst, size_t dstStride) {
+	if(spanWidth == 0 || spanHeight == 0 || (u64)spanX + spanWidth > imgWidth || (u64)spanY + spanHeight > imgHeight || dstStride < (size_t)spanWidth * 2) {
+		return 3;
+	}
+	if(!imgFitsData(srcDataSize, imgWidth, imgHeight, compression)) {
+		d_printf("ERROR: %ux%u image doesn't fit in %zu bytes of srcData.\n", imgWidth, imgHeight, srcDataSize);
+		return 104;
+	}
+	for(u32 y=0; y<spanHeight; y++) {
+		memset(&dst[y * dstStride], 0, (size_t)spanWidth * 2);
+	}
 
-			
-			while(srcIdx < get_u16(&lineEndOffset[y*2])) { // built in end-of-line detection
+	if(compression == RLE_LINE) {
+		// The newer RLE style has a table at the start with the offsets of each row.
+		if(srcDataSize < 2 + 2 * (size_t)imgHeight) {
+			d_printf("ERROR: Insufficient srcData to decode RLE image.\n");
+			return 101;
+		}
+		const u8 * lineEndOffset = &srcData[2];
+		size_t dataStart = (2 * imgHeight) + 2; // offset from start of RLEImage to RLEData
+		size_t dataEnd = get_u16(&lineEndOffset[(imgHeight-1)*2]) - 1;		// This marks the last byte location, plus one.
+		if(dataStart > srcDataSize || dataEnd > srcDataSize) {
+			d_printf("ERROR: Insufficient srcData to decode RLE image.\n");
+			return 101;
+		}
+		for(u32 y=spanY; y<spanY+spanHeight; y++) {
+			u8 * row = &dst[(y - spanY) * dstStride];
+			size_t srcIdx = (y == 0) ? dataStart : get_u16(&lineEndOffset[(y-1)*2]);
+			size_t lineEnd = get_u16(&lineEndOffset[y*2]);
+			u32 x = 0;
+			while(srcIdx < lineEnd && srcIdx + 2 < srcDataSize && x < spanX + spanWidth) { // built in end-of-line detection
 				u8 count = srcData[srcIdx + 2];
-				u8 pixel0 = srcData[srcIdx + 1];
-				u8 pixel1 = srcData[srcIdx + 0];
-
-				for(int j=0; j<count; j++) {	// fill out this color
-					if(bufIdx+1 >= sizeof(buf)) {
-						break;		// don't write past end of buffer. only a problem with erroneous files.      TODO: CHECK THIS... and the other tests I put in here!
-					}
-					buf[bufIdx] = pixel0;
-					buf[bufIdx+1] = pixel1;
-					bufIdx += 2;
-				}
+				copyRunToSpan(&srcData[srcIdx], x, count, spanX, spanWidth, row);
+				x += count;
 				srcIdx += 3; // next block of data
 			}
-
-			rval = fwrite(buf,1,destRowSize,dumpFile);
-			if(rval != destRowSize) {
-				fclose(dumpFile);
-				remove(filename);
-				return 2;
-			}
 		}
-	} else if(isRLE && basicRLE) {
-		// This is an OLD RLE style, with no offsets at the start, and no concern for row boundaries. RLE_BASIC.
-		u32 srcIdx = 2;		
-		u8 pixel0 = 0;
-		u8 pixel1 = 0;
-		u8 count = 0;
-		for(u32 y=0; y<imgHeight; y++) {
-			memset(buf, 0, destRowSize);
-			u32 pixelCount = 0;
-			u32 i = 0;
-			if(count > 0) {
-				// still some pixels leftover from last row
-				while(i < count && i < imgWidth) {
-					buf[i*2] = pixel0;
-					buf[i*2+1] = pixel1;
-					i++;
-					pixelCount++;
-				}
+	} else if(compression == RLE_BASIC) {
+		// The old RLE style, with no offsets at the start, and no concern for row boundaries.
+		size_t srcIdx = 2;
+		u64 pos = 0;								// pixels so far
+		u64 spanEnd = (u64)(spanY + spanHeight - 1) * imgWidth + spanX + spanWidth;
+		while(pos < spanEnd) {
+			if(srcIdx+2 >= srcDataSize) {	// Check we have enough data to continue
+				d_printf("ERROR: Insufficient srcData for RLE_BASIC image.\n");
+				return 102;
 			}
-			while(pixelCount < imgWidth) {
-				if(srcIdx+2 >= srcDataSize) {	// Check we have enough data to continue
-					printf("ERROR: Insufficient srcData for RLE_BASIC image.\n");
-					return 102;
-				}
-				count = srcData[srcIdx + 2];
-				pixel0 = srcData[srcIdx + 1];
-				pixel1 = srcData[srcIdx + 0];
-
-				i = 0;
-				while(i < count && pixelCount < imgWidth) {
-					buf[pixelCount*2] = pixel0;
-					buf[pixelCount*2+1] = pixel1;
-					i++;
-					pixelCount++;
+			const u8 * pixel = &srcData[srcIdx];
+			u32 count = srcData[srcIdx + 2];
+			srcIdx += 3;
+			// a run can carry on into the following rows
+			while(count > 0 && pos < spanEnd) {
+				u32 y = (u32)(pos / imgWidth);
+				u32 x = (u32)(pos % imgWidth);
+				u32 n = (count < imgWidth - x) ? count : imgWidth - x;
+				if(y >= spanY) {
+					copyRunToSpan(pixel, x, n, spanX, spanWidth, &dst[(y - spanY) * dstStride]);
 				}
-				srcIdx += 3;
-			}
-			if(count>i) {
-				count -= i;		// some pixels left over
-			} else {
-				count = 0;		// no pixels left over
-			}
-			rval = fwrite(buf, 1, destRowSize, dumpFile);
-			if(rval != destRowSize) {
-				fclose(dumpFile);
-				remove(filename);
-				return 2;
+				pos += n;
+				count -= n;
 			}
 		}
 	} else {
 		// Basic RGB565 data
-		if(imgHeight * imgWidth * 2 > srcDataSize) {
-			printf("ERROR: Insufficient srcData for RGB565 image.\n");
+		const size_t rowSize = (size_t)imgWidth * 2;
+		if(rowSize * imgHeight > srcDataSize) {
+			d_printf("ERROR: Insufficient srcData for RGB565 image.\n");
 			return 103;
 		}
-		// for each row
-		const u32 srcRowSize = imgWidth * 2;
-		size_t srcIdx = 0;
-		for(u32 y=0; y<imgHeight; y++) {
-			memset(buf, 0, destRowSize);
-			u8 * srcPtr = &srcData[srcIdx];
-			// for each pixel
-			for(u32 x=0; x<imgWidth; x++) {
-				u16 pixel = swap_bo_u16(get_u16(&srcPtr[x*2]));
-				buf[2*x] = pixel & 0xFF;
-				buf[2*x+1] = pixel >> 8;
-			}
-
-			rval = fwrite(buf,1,destRowSize,dumpFile);
-			if(rval != destRowSize) {
-				fclose(dumpFile);
-				remove(filename);
-				return 2;
-			}
-			srcIdx += srcRowSize;
+		for(u32 y=0; y<spanHeight; y++) {
+			memcpy(&dst[y * dstStride], &srcData[(spanY + y) * rowSize + (size_t)spanX * 2], (size_t)spanWidth * 2);
 		}
 	}
 
-	// close the dump file
-	fclose(dumpFile);
-
 	return 0; // SUCCESS
 }
 
+// Decode an image stored as compression (NONE, RLE_LINE or RLE_BASIC) into dst, as w*h big-endian RGB565
+// pixels, the same as uncompressed blobs. Returns 0 for success.
+int decodeImgData(const u8 * srcData, size_t srcDataSize, u32 imgWidth, u32 imgHeight, u32 compression, u8 * dst, size_t dstSize) {
+	const size_t rowSize = (size_t)imgWidth * 2;
+	if(rowSize * imgHeight > dstSize) {
+		return 3;
+	}
+	return decodeImgSpan(srcData, srcDataSize, imgWidth, imgHeight, compression, 0, 0, imgWidth, imgHeight, dst, rowSize);
+}
+
 
 //----------------------------------------------------------------------------
 //  IMG, newIMG, deleteIMG - read bitmap file into basic RGB565 data format
 //----------------------------------------------------------------------------
 
-// Allocate Img and fill it with pixels from a bmp file. Returns NULL for failure. Delete with deleteImg.
-// If bmp file has alpha, and backgroundImg != NULL, use the alpha channel to blend.
-Img * newImgFromFile(char * filename, Img * backgroundImg, u32 bpx, u32 bpy) {
-    // read in the whole file
-	Bytes * bytes = newBytesFromFile(filename);
-	if(bytes==NULL) {
-		printf("ERROR: Unable to read file.\n");
-		return NULL;
+// Returns true if the bmp file data is ARGB8888, and so would be blended against a background image.
+bool bmpNeedsBackground(const Bytes * bytes) {
+	if(bytes->size < BASIC_BMP_HEADER_SIZE) {
+		return false;
 	}
+	const BMPHeaderClassic * h = (const BMPHeaderClassic *)bytes->data;
+	return h->sig == 0x4D42 && h->bpp == 32 && h->dibHeaderSize > 40;
+}
 
-	if(bytes->size < BASIC_BMP_HEADER_SIZE) {
-		printf("ERROR: File is too small.\n");
-		deleteBytes(bytes);
-		return NULL;
+// Check the bmp header (the first headerSize bytes of a file of fileSize bytes), and set up r to read its rows.
+// Returns 0 for success.
+static int initBMPReader(BMPReader * r, const u8 * headerData, size_t headerSize, size_t fileSize) {
+	if(headerSize < BASIC_BMP_HEADER_SIZE) {
+		d_printf("ERROR: File is too small.\n");
+		return 1;
 	}
 
-    // process the header
+    // process the header (take a copy, as we normalise some fields)
 
-	BMPHeaderClassic * h = (BMPHeaderClassic *)bytes->data;
+	memcpy(&r->header, headerData, headerSize < sizeof(r->header) ? headerSize : sizeof(r->header));
+	BMPHeaderClassic * h = (BMPHeaderClassic *)&r->header;
 
 	int fail = 0;
 	if(h->sig != 0x4D42) {
-		printf("ERROR: BMP file is not a bitmap.\n");
+		d_printf("ERROR: BMP file is not a bitmap.\n");
 		fail = 1;
 	}
 
 	if(h->dibHeaderSize != 40 && h->dibHeaderSize != 108 && h->dibHeaderSize != 124) {
-		printf("ERROR: BMP header format unrecognised.\n");
+		d_printf("ERROR: BMP header format unrecognised.\n");
 		fail = 1;
 	}
 
 	if(h->planes != 1 || h->reserved1 != 0 || h->reserved2 != 0) {
-		printf("ERROR: BMP is unusual, can't read it.\n");
+		d_printf("ERROR: BMP is unusual, can't read it.\n");
 		fail = 1;
 	}
 
 	if(h->bpp != 16 && h->bpp != 24 && h->bpp != 32) {
-		printf("ERROR: BMP must be RGB565 or RGB888 or ARGB8888.\n");
+		d_printf("ERROR: BMP must be RGB565 or RGB888 or ARGB8888.\n");
 		fail = 1;
 	}
 	
 	if(h->bpp == 16 && h->compressionType != 3) {
-		printf("ERROR: BMP of 16bpp doesn't have bitfields.\n");
+		d_printf("ERROR: BMP of 16bpp doesn't have bitfields.\n");
 		fail = 1;
 	}
 	
 	if((h->bpp == 24 || h->bpp == 32) && (h->compressionType != 0 && h->compressionType != 3)) {
-		printf("ERROR: BMP of 24/32bpp must be uncompressed.\n");
+		d_printf("ERROR: BMP of 24/32bpp must be uncompressed.\n");
 		fail = 1;
 	}
 
 	if(fail) {
-		deleteBytes(bytes);
-		return NULL;
+		return 1;
 	}
 
 	// Check if it's a top-down or bottom-up BMP. Normalise height to be positive.
-	bool topDown = false;
+	r->topDown = false;
 	if(h->height < 0) {
-		topDown = true;
+		r->topDown = true;
 		h->height = -h->height;
 	}
 
 	if(h->height < 1 || h->width < 1) {
-		printf("ERROR: BMP has no dimensions!\n");
-		deleteBytes(bytes);
-		return NULL;
+		d_printf("ERROR: BMP has no dimensions!\n");
+		return 1;
+	}
+
+	if(h->offset > fileSize) {
+		d_printf("ERROR: BMP image data starts beyond the end of the file.\n");
+		return 1;
 	}
 
+	u64 minRowSize = (u64)h->width * (h->bpp / 8);
 	u32 rowSize = h->imageDataSize / (u32)h->height;
-	if(rowSize < ((u32)h->width * 2)) {		
+	if(rowSize < minRowSize) {		
 		// we'll have to calculate it ourselves! size of file is in b->bytes, subtract h->offset.
-		h->imageDataSize = (u32)bytes->size - h->offset;
+		h->imageDataSize = (u32)(fileSize - h->offset);
 		rowSize = h->imageDataSize / (u32)h->height;
-		if(rowSize < ((u32)h->width * 2)) {
-			printf("ERROR: BMP imageDataSize (%u) doesn't make sense!\n", h->imageDataSize);
-			deleteBytes(bytes);
-			return NULL;
+		if(rowSize < minRowSize) {
+			d_printf("ERROR: BMP imageDataSize (%u) doesn't make sense!\n", h->imageDataSize);
+			return 1;
 		}
 	}
 
-	if(h->offset + h->imageDataSize < bytes->size) {
-		printf("ERROR: BMP file is too short to contain supposed data.\n");
-		deleteBytes(bytes);
+	if((u64)h->offset + h->imageDataSize > fileSize) {
+		d_printf("ERROR: BMP file is too short to contain supposed data.\n");
+		return 1;
+	}
+
+	// check bitfields are what we expect
+	if(h->bpp == 16) { // RGB565
+		if(fileSize < sizeof(BMPHeaderClassic)) {
+			d_printf("ERROR: BMP file is too short to contain bitfields.\n");
+			return 1;
+		}
+		if(h->bmiColors[0] != 0xF800 || h->bmiColors[1] != 0x07E0 || h->bmiColors[2] != 0x001F) {
+			d_printf("ERROR: BMP bitfields are not what we expect (RGB565).\n");
+			return 1;
+		}
+	} else if (h->bpp == 32 && r->backgroundImg != NULL && h->dibHeaderSize > 40) { 	// ARGB8888 to be blended against backgroundImg
+		BMPHeaderV4 * h4 = &r->header;
+		// check bitfields (if they exist) are what we expect. pixels are stored as B, G, R, A bytes.
+		if(h->compressionType == 3) {
+			if(h4->RGBAmasks[0] != 0x00FF0000 || h4->RGBAmasks[1] != 0x0000FF00 || h4->RGBAmasks[2] != 0x000000FF || h4->RGBAmasks[3] != 0xFF000000) {
+				d_printf("ERROR: BMP bitfields are not what we expect for 32-bit image (ARGB8888).\n");
+				return 1;
+			}
+		}
+		r->blend = true;
+	} else { // RGB888 (or ARGB8888 with no background to blend against)
+		if(h->compressionType == 3) {
+			if(h->bmiColors[0] != 0xFF0000 || h->bmiColors[1] != 0x00FF00 || h->bmiColors[2] != 0x0000FF) {
+				d_printf("ERROR: BMP bitfields are not what we expect (RGB888).\n");
+				return 1;
+			}
+		}
+	}
+
+	r->w = (u32)h->width;
+	r->h = (u32)h->height;
+	r->rowSize = rowSize;
+	return 0;
+}
+
+// Allocate a BMPReader to read the rows of bmp file data, which must outlive it. Returns NULL for failure.
+// If bmp file has alpha, and backgroundImg != NULL, use the alpha channel to blend.
+BMPReader * newBMPReaderFromBytes(const Bytes * bytes, Img * backgroundImg, u32 bpx, u32 bpy) {
+	BMPReader * r = malloc(sizeof(BMPReader));
+	if(r == NULL) {
+		d_printf("ERROR: Out of memory.\n");
 		return NULL;
 	}
+	*r = (BMPReader){ .backgroundImg = backgroundImg, .bpx = bpx, .bpy = bpy, .data = bytes->data };
+	if(initBMPReader(r, bytes->data, bytes->size, bytes->size) != 0) {
+		return deleteBMPReader(r);
+	}
+	return r;
+}
 
-	// Allocate memory to store ImageData and data
-	Img * img = malloc(sizeof(Img));
-	if(img == NULL) {
-		printf("ERROR: Out of memory.\n");
-		deleteBytes(bytes);
+// Allocate a BMPReader to read the rows of a bmp file, one at a time. Only one row of the file is kept in memory.
+// Returns NULL for failure. If bmp file has alpha, and backgroundImg != NULL, use the alpha channel to blend.
+BMPReader * newBMPReaderFromFile(char * filename, Img * backgroundImg, u32 bpx, u32 bpy) {
+	FILE * f = fopen(filename, "rb");
+	if(f == NULL) {
 		return NULL;
 	}
-	img->w = (u32)h->width;
-	img->h = (u32)h->height;
-	img->compression = 0;			// No compression
-	img->size = img->w * img->h * 2;	// Size is simple to calculate when no compression
-	img->data = malloc(img->size);
-	if(img->data == NULL) {
-		printf("ERROR: Out of memory.\n");
-		deleteBytes(bytes);
-		deleteImg(img);
+	BMPReader * r = malloc(sizeof(BMPReader));
+	if(r == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		fclose(f);
 		return NULL;
 	}
+	*r = (BMPReader){ .backgroundImg = backgroundImg, .bpx = bpx, .bpy = bpy, .f = f };
 
-	// Reading the file data depends on bpp
-	if(h->bpp == 16) { // RGB565
-		// check bitfields are what we expect
-		if(bytes->size < sizeof(BMPHeaderClassic)) {
-			printf("ERROR: BMP file is too short to contain bitfields.\n");
-			deleteBytes(bytes);
-			deleteImg(img);
-			return NULL;
-		}
-		if(h->bmiColors[0] != 0xF800 || h->bmiColors[1] != 0x07E0 || h->bmiColors[2] != 0x001F) {
-			printf("ERROR: BMP bitfields are not what we expect (RGB565).\n");
-			deleteBytes(bytes);
-			deleteImg(img);
-			return NULL;
-		}
+	// get file size, and read the header
+	u8 headerData[sizeof(BMPHeaderV4)];
+	fseek(f, 0, SEEK_END);
+	long fileSize = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if(fileSize < 0) {
+		return deleteBMPReader(r);
+	}
+	size_t headerSize = fread(headerData, 1, sizeof(headerData), f);
+	if(initBMPReader(r, headerData, headerSize, (size_t)fileSize) != 0) {
+		return deleteBMPReader(r);
+	}
 
-		// read in data, row by row
-		for(u32 y = 0; y < img->h; y++) {
-			u32 row = topDown ? y : (img->h - y - 1);	// row is line in BMP file, y is line in our img
-			size_t bmpOffset = h->offset + row * rowSize;
-			memcpy(&img->data[y * img->w * 2], &bytes->data[bmpOffset], img->w * 2);
-			// swap byte order
-			for(u32 j=0; j<(img->w*2); j+=2) {
-				u8 * a = &img->data[y*img->w*2 + j];
-				u8 * b = &img->data[y*img->w*2 + j + 1];
-				u8 temp = *a;
-				*a = *b;
-				*b = temp;
-			}
+	r->rowBuf = malloc(r->w * (r->header.bpp / 8));
+	if(r->rowBuf == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		return deleteBMPReader(r);
+	}
+	return r;
+}
+
+// Delete a BMPReader. Safe to use on already deleted BMPReader.
+BMPReader * deleteBMPReader(BMPReader * r) {
+	if(r != NULL) {
+		if(r->f != NULL) {
+			fclose(r->f);
 		}
+		free(r->rowBuf);
+		free(r);
+	}
+	return NULL;
+}
 
-		// done!
-	} else if (h->bpp == 32 && backgroundImg != NULL && h->dibHeaderSize > 40) { 	// ARGB8888 to be blended against backgroundImg
-		BMPHeaderV4 * h4 = (BMPHeaderV4 *)&h;
-		// check bitfields (if they exist) are what we expect
-		if(h->compressionType == 3) {
-			if(h4->RGBAmasks[0] != 0xFF000000 || h4->RGBAmasks[1] != 0x00FF0000 || h4->RGBAmasks[2] != 0x0000FF00 || h4->RGBAmasks[3] != 0x000000FF) {
-				printf("ERROR: BMP bitfields are not what we expect for 32-bit image (ARGB8888).\n");
-				deleteBytes(bytes);
-				deleteImg(img);
-				return NULL;
-			}
+// Cut the w*h area at x,y (from the top left) out of the bmp file in bytes, as a bmp file of its own in *out. The new file
+// has the same header, pixel format and row order. Returns 0 for success. Delete *out with deleteBytes.
+int newBMPCellFromBytes(const Bytes * bytes, u32 x, u32 y, u32 w, u32 h, Bytes ** out) {
+	BMPReader * r = newBMPReaderFromBytes(bytes, NULL, 0, 0);
+	if(r == NULL) {
+		return 1;
+	}
+	if(w < 1 || h < 1 || x > r->w || w > r->w - x || y > r->h || h > r->h - y) {		// written so it can't wrap
+		d_printf("ERROR: Cell %ux%u at %u,%u is outside the %ux%u bitmap.\n", w, h, x, y, r->w, r->h);
+		deleteBMPReader(r);
+		return 2;
+	}
+
+	u32 bytesPerPixel = r->header.bpp / 8;
+	u32 offset = r->header.offset;
+	if((size_t)offset + (size_t)r->rowSize * r->h > bytes->size) {
+		d_printf("ERROR: BMP file is too short to contain supposed data.\n");
+		deleteBMPReader(r);
+		return 1;
+	}
+	size_t rowSize = ((size_t)w * bytesPerPixel + 3) & ~(size_t)3;
+	size_t fileSize = offset + rowSize * h;
+	Bytes * b = malloc(sizeof(Bytes) + fileSize);
+	if(b == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		deleteBMPReader(r);
+		return 3;
+	}
+	b->size = fileSize;
+
+	// everything up to the image data is copied as-is (including masks), then the dimensions are changed
+	memcpy(b->data, bytes->data, offset);
+	BMPHeaderClassic * hdr = (BMPHeaderClassic *)b->data;
+	hdr->fileSize = (u32)fileSize;
+	hdr->width = (i32)w;
+	hdr->height = r->topDown ? -(i32)h : (i32)h;
+	hdr->imageDataSize = (u32)(rowSize * h);
+
+	for(u32 row=0; row<h; row++) {
+		u32 srcRow = r->topDown ? (y + row) : (r->h - 1 - (y + row));
+		u32 dstRow = r->topDown ? row : (h - 1 - row);
+		u8 * dst = &b->data[offset + dstRow * rowSize];
+		memcpy(dst, &bytes->data[offset + (size_t)srcRow * r->rowSize + (size_t)x * bytesPerPixel], (size_t)w * bytesPerPixel);
+		memset(&dst[w * bytesPerPixel], 0, rowSize - (size_t)w * bytesPerPixel);
+	}
+
+	deleteBMPReader(r);
+	*out = b;
+	return 0; // SUCCESS
+}
+
+
+// Read row y (from the top) of the bmp into dst, as r->w big-endian RGB565 pixels. Returns 0 for success.
+int readBMPRow(BMPReader * r, u32 y, u8 * dst) {
+	const BMPHeaderV4 * h = &r->header;
+	u32 row = r->topDown ? y : (r->h - y - 1);	// row is line in BMP file, y is line in our img
+	size_t bmpOffset = h->offset + (size_t)row * r->rowSize;
+	const u8 * src;
+	if(r->data != NULL) {
+		src = &r->data[bmpOffset];
+	} else {
+		size_t size = r->w * (h->bpp / 8);
+		if(fseek(r->f, (long)bmpOffset, SEEK_SET) != 0 || fread(r->rowBuf, 1, size, r->f) != size) {
+			d_printf("ERROR: BMP file is too short to contain supposed data.\n");
+			return 1;
 		}
+		src = r->rowBuf;
+	}
 
-	    // read in data, row by row, pixel by pixel
-		for(u32 y=0; y < img->h; y++) {
-			u32 row = topDown ? y : (img->h - y - 1);
-			size_t bmpOffset = h->offset + row * rowSize;
-			for(u32 x=0; x < img->w; x++) {
-				// get partner pixel from backgroundImg
-				u16 pixelIn = get_u16(&backgroundImg->data[2 * backgroundImg->w * (bpy+y) + 2 * (bpx+x)]);
-				RGBTrip bgPixel = RGB565to888(pixelIn);
-
-				// get bmp pixel
-				u8 b = bytes->data[bmpOffset + x * 4];
-				u8 g = bytes->data[bmpOffset + x * 4 + 1];
-				u8 r = bytes->data[bmpOffset + x * 4 + 2];
-				u8 a = bytes->data[bmpOffset + x * 4 + 3];
-
-				bgPixel.r = (u8)(((u32)(255 - a) * (u32)bgPixel.r + (u32)a * (u32)r) / 255);
-				bgPixel.g = (u8)(((u32)(255 - a) * (u32)bgPixel.g + (u32)a * (u32)g) / 255);
-				bgPixel.b = (u8)(((u32)(255 - a) * (u32)bgPixel.b + (u32)a * (u32)b) / 255);
-
-				u16 pixelOut = RGBTripTo565(&bgPixel);
-				img->data[y * img->w * 2 + 2 * x]     = pixelOut >> 8;
-				img->data[y * img->w * 2 + 2 * x + 1] = pixelOut & 0xFF;
-			}
+	// Reading the file data depends on bpp
+	if(h->bpp == 16) { // RGB565
+		// swap byte order
+		for(u32 j=0; j<(r->w*2); j+=2) {
+			dst[j] = src[j+1];
+			dst[j+1] = src[j];
+		}
+	} else if(r->blend) { // ARGB8888 to be blended against backgroundImg
+		const Img * bg = r->backgroundImg;
+		for(u32 x=0; x < r->w; x++) {
+			// get partner pixel from backgroundImg
+			u16 pixelIn = get_u16(&bg->data[2 * bg->w * (r->bpy+y) + 2 * (r->bpx+x)]);
+			RGBTrip bgPixel = RGB565to888(pixelIn);
+
+			// get bmp pixel
+			u8 b = src[x * 4];
+			u8 g = src[x * 4 + 1];
+			u8 rd = src[x * 4 + 2];
+			u8 a = src[x * 4 + 3];
+
+			bgPixel.r = (u8)(((u32)(255 - a) * (u32)bgPixel.r + (u32)a * (u32)rd) / 255);
+			bgPixel.g = (u8)(((u32)(255 - a) * (u32)bgPixel.g + (u32)a * (u32)g) / 255);
+			bgPixel.b = (u8)(((u32)(255 - a) * (u32)bgPixel.b + (u32)a * (u32)b) / 255);
+
+			u16 pixelOut = RGBTripTo565(&bgPixel);
+			dst[2 * x]     = pixelOut >> 8;
+			dst[2 * x + 1] = pixelOut & 0xFF;
 		}
 	} else { // RGB888 (or ARGB8888 with no background to blend against)
-		// check bitfields (if they exist) are what we expect
-		if(h->compressionType == 3) {
-			if(h->bmiColors[0] != 0xFF0000 || h->bmiColors[1] != 0x00FF00 || h->bmiColors[2] != 0x0000FF) {
-				printf("ERROR: BMP bitfields are not what we expect (RGB888).\n");
-				deleteBytes(bytes);
-				deleteImg(img);
-				return NULL;
-			}
+		u32 bytesPerPixel = h->bpp / 8;
+		for(u32 x=0; x < r->w; x++) {
+			u16 pixel = RGB888to565(&src[x * bytesPerPixel]); // ignore alpha channel
+			dst[2 * x]     = pixel >> 8;
+			dst[2 * x + 1] = pixel & 0xFF;
 		}
+	}
+	return 0;
+}
 
-	    // read in data, row by row, pixel by pixel
-		for(u32 y=0; y < img->h; y++) {
-			u32 row = topDown ? y : (img->h - y - 1);
-			size_t bmpOffset = h->offset + row * rowSize;
-			for(u32 x=0; x < img->w; x++) {
-				u16 pixel;
-				if(h->bpp == 24) {
-					pixel = RGB888to565(&bytes->data[bmpOffset + x * 3]);
-				} else { // h->bpp == 32
-					pixel = RGB888to565(&bytes->data[bmpOffset + x * 4]); // ignore alpha channel
-				}
-				img->data[y * img->w * 2 + 2 * x]     = pixel >> 8;
-				img->data[y * img->w * 2 + 2 * x + 1] = pixel & 0xFF;
-			}
-		}
+// If bytes is image file data in another format (png, qoi or jpeg), convert it to a bmp file in *out. A jpeg is
+// fitted to fitWidth x fitHeight, if they aren't 0. Returns 0 for success, including when it is already a bmp, and
+// *out is left NULL.
+static int convertImageToBMP(const Bytes * bytes, u32 fitWidth, u32 fitHeight, Bytes ** out) {
+	*out = NULL;
+	if(isPNG(bytes)) {
+		return newBMPFromPNG(bytes, out);
+	}
+	if(isQOI(bytes)) {
+		return newBMPFromQOI(bytes, out);
 	}
+	if(isJPEG(bytes)) {
+		return newBMPFromJPEG(bytes, fitWidth, fitHeight, out);
+	}
+	return 0;
+}
 
-	// Free filedata
+// Convert image file data in any format we can import (bmp, png, qoi or jpeg) to a bmp file. Takes ownership of
+// bytes, and returns it as-is if it is already a bmp. A jpeg (usually a photo) is scaled and cropped to fitWidth x
+// fitHeight, unless they are 0. Returns NULL for failure.
+Bytes * newBMPFromImageBytes(Bytes * bytes, u32 fitWidth, u32 fitHeight) {
+	Bytes * bmp = NULL;
+	if(bytes == NULL || convertImageToBMP(bytes, fitWidth, fitHeight, &bmp) != 0) {
+		return deleteBytes(bytes);
+	}
+	if(bmp == NULL) {
+		return bytes;
+	}
 	deleteBytes(bytes);
+	return bmp;
+}
+
+// Allocate Img and fill it with pixels from bmp (or png, qoi or jpeg) file data. Returns NULL for failure. Delete with
+// deleteImg. If bmp file has alpha, and backgroundImg != NULL, use the alpha channel to blend.
+Img * newImgFromBytes(const Bytes * bytes, Img * backgroundImg, u32 bpx, u32 bpy) {
+	Bytes * converted = NULL;
+	if(convertImageToBMP(bytes, 0, 0, &converted) != 0) {
+		return NULL;
+	}
+	if(converted != NULL) {
+		bytes = converted;
+	}
+	BMPReader * r = newBMPReaderFromBytes(bytes, backgroundImg, bpx, bpy);
+	if(r == NULL) {
+		deleteBytes(converted);
+		return NULL;
+	}
+
+	// Allocate memory to store ImageData and data
+	Img * img = malloc(sizeof(Img));
+	if(img == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		deleteBMPReader(r);
+		deleteBytes(converted);
+		return NULL;
+	}
+	img->w = r->w;
+	img->h = r->h;
+	img->compression = 0;			// No compression
+	img->size = img->w * img->h * 2;	// Size is simple to calculate when no compression
+	img->data = malloc(img->size);
+	if(img->data == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		deleteBMPReader(r);
+		deleteBytes(converted);
+		deleteImg(img);
+		return NULL;
+	}
+
+	// read in data, row by row
+	for(u32 y = 0; y < img->h; y++) {
+		readBMPRow(r, y, &img->data[y * img->w * 2]);
+	}
 
 	// Return Img
+	deleteBMPReader(r);
+	deleteBytes(converted);
+	return img;
+}
+
+// Allocate Img and fill it with pixels from a bmp (or png or qoi) file. Returns NULL for failure. Delete with deleteImg.
+// If bmp file has alpha, and backgroundImg != NULL, use the alpha channel to blend.
+Img * newImgFromFile(char * filename, Img * backgroundImg, u32 bpx, u32 bpy) {
+    // read in the whole file
+	Bytes * bytes = newBytesFromFile(filename);
+	if(bytes==NULL) {
+		d_printf("ERROR: Unable to read file.\n");
+		return NULL;
+	}
+	Img * img = newImgFromBytes(bytes, backgroundImg, bpx, bpy);
+	deleteBytes(bytes);
 	return img;
 }
 
@@ -529,7 +791,7 @@ Img * cloneImg(Img * i) {
 	// Allocate memory to store ImageData and data
 	Img * img = malloc(sizeof(Img));
 	if(img == NULL) {
-		printf("ERROR: Out of memory.\n");
+		d_printf("ERROR: Out of memory.\n");
 		return NULL;
 	}	
 	img->w = i->w;
@@ -538,7 +800,7 @@ Img * cloneImg(Img * i) {
 	img->size = i->size;
 	img->data = malloc(img->size);
 	if(img->data == NULL) {
-		printf("ERROR: Out of memory.\n");
+		d_printf("ERROR: Out of memory.\n");
 		deleteImg(img);
 		return NULL;
 	}
@@ -551,6 +813,80 @@ Img * cloneImg(Img * i) {
 //  COMPRESS IMG - Compress using (RLE_LINE) if it shrinks the size
 //----------------------------------------------------------------------------
  
+// RLE_LINE encode one row of w big-endian RGB565 pixels into dst. Returns the encoded size, or 0 if it doesn't fit
+// in dstSize bytes. (w + 1) * 3 bytes is always enough.
+size_t encodeRLERow(const u8 * line, u32 w, u8 * dst, size_t dstSize) {
+	size_t offset = 0;
+
+	#define putRun(p, n) { if(offset + 3 > dstSize) return 0; dst[offset] = (p)[0]; dst[offset+1] = (p)[1]; dst[offset+2] = (n); offset += 3; }
+
+	u8 prev[2] = { 0 };
+	u8 runLength = 0;
+	for(u32 x=0; x<w; x++) {
+		const u8 * curr = &line[x*2];
+		if(x==0) {
+			prev[0] = curr[0];
+			prev[1] = curr[1];
+			runLength = 1;
+			continue;
+		} 
+		if(curr[0] != prev[0] || curr[1] != prev[1]) {
+			// end the run and start a new one
+			putRun(prev, runLength);
+			prev[0] = curr[0];
+			prev[1] = curr[1];
+			runLength = 1;
+		} else {
+			// increase the run
+			runLength ++;
+			if(runLength==255) {
+				// save and restart the run
+				putRun(prev, runLength);
+				runLength = 0;
+			}
+		}
+	}
+	// save remaining run, if anything
+	if(runLength > 0) {
+		putRun(prev, runLength);
+	}
+
+	#undef putRun
+
+	return offset;
+}
+
+// RLE_LINE encode w*h big-endian RGB565 pixels into dst. Returns the encoded size, or 0 if it doesn't fit
+// in dstSize bytes or needs offsets larger than 16 bits.
+size_t encodeRLELine(const u8 * pixels, u32 w, u32 h, u8 * dst, size_t dstSize) {
+	if(dstSize < 2 + 2 * (size_t)h) {
+		return 0;
+	}
+
+	// Set identifier as RLE image
+	dst[0] = 0x08;
+	dst[1] = 0x21;
+
+	// Calculate offset
+	size_t offset = 2 + 2 * (size_t)h;	// id is 2 bytes, offsets are u16 and are of the end of line / running offset
+
+	// For each line
+	for(u32 y=0; y<h; y++) {
+		size_t size = encodeRLERow(&pixels[(size_t)y * w * 2], w, &dst[offset], dstSize - offset);
+		if(size == 0) {
+			return 0;
+		}
+		offset += size;
+		// save offset
+		if(offset > 65535) {	// Image exceeded RLE_LINE capabilities. We can't store offsets greater than 16-bits!
+			return 0;
+		}
+		set_u16(&dst[2+y*2], (u16)offset);
+	}
+
+	return offset;
+}
+
 int compressImg(Img * img) {
 	// Check it is a raw img we got
 	if(img == NULL || img->compression != 0) {
@@ -562,7 +898,7 @@ int compressImg(Img * img) {
 	size_t minSize = (2 + img->h * 2) + (img->w + 255) / 255 * 3 * img->h;
 
 	if(minSize > 65535) { // we can't store 16-bit offsets in a bigger file
-		printf("Note: Image too large to be RLE_LINE encoded.\n");
+		d_printf("Note: Image too large to be RLE_LINE encoded.\n");
 		return 101;
 	}
 
@@ -571,85 +907,28 @@ int compressImg(Img * img) {
 	// Allocate a stack of RAM to keep the image in
 	u8 * buf = malloc(maxSize);
 	if(buf==NULL) {
-		printf("ERROR: Out of memory (allocating %zu bytes).\n", maxSize);
+		d_printf("ERROR: Out of memory (allocating %zu bytes).\n", maxSize);
 		return 102;
 	}
 
-	// Set identifier as RLE image
-	buf[0] = 0x08;
-	buf[1] = 0x21;
-
-	// Calculate offset
-	u32 offset = 2 + 2 * img->h;	// id is 2 bytes, offsets are u16 and are of the end of line / running offset
-
-	// For each line
-	for(u32 y=0; y<img->h; y++) {
-		u8 prev[2] = { 0 };
-		u8 runLength = 0;
-		for(u32 x=0; x<img->w; x++) {
-			u8 curr[2];
-			curr[0] = img->data[y*img->w*2 + x*2];
-			curr[1] = img->data[y*img->w*2 + x*2 + 1];
-			if(x==0) {
-				prev[0] = curr[0];
-				prev[1] = curr[1];
-				runLength = 1;
-				continue;
-			} 
-			if(curr[0] != prev[0] || curr[1] != prev[1]) {
-				// end the run and start a new one
-				buf[offset]   = prev[0];
-				buf[offset+1] = prev[1];
-				buf[offset+2] = runLength;
-				offset += 3;
-				prev[0] = curr[0];
-				prev[1] = curr[1];
-				runLength = 1;
-			} else {
-				// increase the run
-				runLength ++;
-				if(runLength==255) {
-					// save and restart the run
-					buf[offset]   = prev[0];
-					buf[offset+1] = prev[1];
-					buf[offset+2] = runLength;
-					offset += 3;
-					runLength = 0;
-				}
-			}
-		}
-		// save remaining run, if anything
-		if(runLength > 0) {
-			buf[offset]   = prev[0];
-			buf[offset+1] = prev[1];
-			buf[offset+2] = runLength;
-			offset += 3;
-		}
-		// save offset
-		if(offset > 65535) {	// Image exceeded RLE_LINE capabilities. We can't store offsets greater than 16-bits!
-			free(buf);
-			return 0; // success, but not compressed
-		}
-		set_u16(&buf[2+y*2], (u16)offset);
-	}
+	size_t size = encodeRLELine(img->data, img->w, img->h, buf, maxSize);
 
 	// Check if the size is better
-	if(offset >= img->size) {
+	if(size == 0 || size >= img->size) {
 		free(buf);
 		return 0; // success, but not compressed
 	}
 
 	// Free the original data and store the new data
-	buf = realloc(buf, offset);	// remove any excess memory allocation
+	buf = realloc(buf, size);	// remove any excess memory allocation
 	if(buf == NULL) {
-		printf("ERROR: realloc() failure.\n");
+		d_printf("ERROR: realloc() failure.\n");
 		return 5;
 	}
 	
 	free(img->data);
 	img->data = buf;
-	img->size = offset;
+	img->size = (u32)size;
 	img->compression = RLE_LINE;
 	return 0;
 }
-
@@ -70,7 +70,12 @@ typedef struct _RGBTrip {
 
 void setBMPHeaderClassic(BMPHeaderClassic * dest, u32 width, u32 height, u8 bpp);
 void setBMPHeaderV4(BMPHeaderV4 * dest, u32 width, u32 height, u8 bpp);
+int newBMP16FromData(const u8 * srcData, size_t srcDataSize, u32 imgWidth, u32 imgHeight, bool basicRLE, Bytes ** out);
+int newBMP16FromPixels(const u8 * pixels, u32 imgWidth, u32 imgHeight, Bytes ** out);
 int dumpBMP16(char * filename, u8 * srcData, size_t srcDataSize, u32 imgWidth, u32 imgHeight, bool basicRLE);
+bool imgFitsData(size_t srcDataSize, u32 imgWidth, u32 imgHeight, u32 compression);
+int decodeImgSpan(const u8 * srcData, size_t srcDataSize, u32 imgWidth, u32 imgHeight, u32 compression, u32 spanX, u32 spanY, u32 spanWidth, u32 spanHeight, u8 * dst, size_t dstStride);
+int decodeImgData(const u8 * srcData, size_t srcDataSize, u32 imgWidth, u32 imgHeight, u32 compression, u8 * dst, size_t dstSize);
 
 
 //----------------------------------------------------------------------------
@@ -95,7 +100,34 @@ typedef enum _ImgCompression {
 
 extern const char * ImgCompressionStr[8];
 
+// BMPReader reads the rows of a bmp file one at a time, converting them to big-endian RGB565
+typedef struct _BMPReader {
+	u32 w;					// width in pixels
+	u32 h;					// height in pixels
+	BMPHeaderV4 header;		// normalised copy of the header, with a positive height
+	bool topDown;
+	bool blend;				// blend ARGB8888 pixels against backgroundImg
+	u32 rowSize;			// size of each row in the file, in bytes
+	Img * backgroundImg;
+	u32 bpx;				// position of the bmp on backgroundImg
+	u32 bpy;
+	const u8 * data;		// whole file, if reading from memory
+	FILE * f;				// otherwise, the file to read rows from
+	u8 * rowBuf;			// one row of the file
+} BMPReader;
+
+BMPReader * newBMPReaderFromBytes(const Bytes * bytes, Img * backgroundImg, u32 bpx, u32 bpy);
+BMPReader * newBMPReaderFromFile(char * filename, Img * backgroundImg, u32 bpx, u32 bpy);
+BMPReader * deleteBMPReader(BMPReader * r);
+int readBMPRow(BMPReader * r, u32 y, u8 * dst);
+int newBMPCellFromBytes(const Bytes * bytes, u32 x, u32 y, u32 w, u32 h, Bytes ** out);
+
+bool bmpNeedsBackground(const Bytes * bytes);
+Bytes * newBMPFromImageBytes(Bytes * bytes, u32 fitWidth, u32 fitHeight);
+Img * newImgFromBytes(const Bytes * bytes, Img * backgroundImg, u32 bpx, u32 bpy);
 Img * newImgFromFile(char * filename, Img * backgroundImg, u32 bpx, u32 bpy);
 Img * deleteImg(Img * i);
 Img * cloneImg(Img * i);
 int compressImg(Img * img);
+size_t encodeRLERow(const u8 * line, u32 w, u8 * dst, size_t dstSize);
+size_t encodeRLELine(const u8 * pixels, u32 w, u32 h, u8 * dst, size_t dstSize);
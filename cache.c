@@ -0,0 +1,442 @@
+/*  cache.c - hashing and caches for create
+
+	Da Watch Face Tool (dawft)
+	dawft: Watch Face Tool for MO YOUNG / DA FIT binary watch face files.
+
+	Copyright 2022 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/stat.h>		// for mkdir()
+
+#ifndef WINDOWS
+#include <pthread.h>
+#endif
+
+#include "dawft.h"
+#include "bmp.h"
+#include "cache.h"
+
+
+//----------------------------------------------------------------------------
+//  HASHING
+//----------------------------------------------------------------------------
+
+// FNV-1a 64-bit. Pass HASH_SEED as the seed, or a previous hash to continue it.
+u64 hashBytes(const u8 * data, size_t size, u64 seed) {
+	u64 hash = seed;
+	for(size_t i=0; i<size; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+
+//----------------------------------------------------------------------------
+//  MANIFEST - compiled watchface.txt, keyed by mtime and hash of the text
+//----------------------------------------------------------------------------
+
+/* Manifest file layout (little-endian, no padding):
+	char magic[8]				"DAWFTMF2"
+	i64 textMTime				mtime of watchface.txt when compiled
+	u64 textHash				hashBytes() of watchface.txt
+	u64 textSize				size of watchface.txt
+	FaceHeader h
+	ExtraFileInfo efi
+	u8 blobCompression[250]
+	signed char blobFaceData[250]
+	u8 blobAtlas[250]
+	u8 nameCount				number of non-empty blobFileNames
+	nameCount * { u8 idx, u8 length, char name[length] }
+*/
+
+static const char manifestMagic[8] = { 'D','A','W','F','T','M','F','2' };
+
+// Load a manifest if it exists and matches the text it was compiled from.
+// Returns 0 if spec was filled in, non-zero if the manifest is missing, stale or damaged.
+int loadManifest(char * fileName, FaceSpec * spec, i64 textMTime, u64 textHash, u64 textSize) {
+	FILE * f = fopen(fileName, "rb");
+	if(f == NULL) {
+		return 1;	// no manifest yet, not an error
+	}
+
+	u8 buf[8 + 8 + 8 + 8 + sizeof(FaceHeader) + sizeof(ExtraFileInfo) + 250 + 250 + 250 + 1];
+	if(fread(buf, 1, sizeof(buf), f) != sizeof(buf)) {
+		fclose(f);
+		return 2;
+	}
+
+	i64 mtime;
+	u64 hash, size;
+	memcpy(&mtime, &buf[8], 8);
+	memcpy(&hash, &buf[16], 8);
+	memcpy(&size, &buf[24], 8);
+	if(memcmp(buf, manifestMagic, 8) != 0 || mtime != textMTime || hash != textHash || size != textSize) {
+		fclose(f);
+		return 3;	// stale
+	}
+
+	*spec = (FaceSpec){ 0 };
+	size_t idx = 32;
+	memcpy(&spec->h, &buf[idx], sizeof(FaceHeader));
+	idx += sizeof(FaceHeader);
+	memcpy(&spec->efi, &buf[idx], sizeof(ExtraFileInfo));
+	idx += sizeof(ExtraFileInfo);
+	memcpy(spec->blobCompression, &buf[idx], 250);
+	idx += 250;
+	memcpy(spec->blobFaceData, &buf[idx], 250);
+	idx += 250;
+	memcpy(spec->blobAtlas, &buf[idx], 250);
+	idx += 250;
+	u8 nameCount = buf[idx];
+
+	for(u32 i=0; i<nameCount; i++) {
+		u8 entry[2];
+		if(fread(entry, 1, 2, f) != 2 || entry[0] >= 250 || fread(spec->blobFileNames[entry[0]], 1, entry[1], f) != entry[1]) {
+			fclose(f);
+			return 4;
+		}
+	}
+
+	fclose(f);
+	return 0; // SUCCESS
+}
+
+// Save a compiled watchface.txt. Returns 0 for success.
+int saveManifest(char * fileName, FaceSpec * spec, i64 textMTime, u64 textHash, u64 textSize) {
+	// write to a temporary file first, so a partial manifest is never picked up
+	char tempName[1100];
+	snprintf(tempName, sizeof(tempName), "%s.tmp", fileName);
+	FILE * f = fopen(tempName, "wb");
+	if(f == NULL) {
+		return 1;
+	}
+
+	u8 nameCount = 0;
+	for(u32 i=0; i<250; i++) {
+		if(spec->blobFileNames[i][0] != 0) nameCount++;
+	}
+
+	bool ok = true;
+	ok = ok && fwrite(manifestMagic, 1, 8, f) == 8;
+	ok = ok && fwrite(&textMTime, 1, 8, f) == 8;
+	ok = ok && fwrite(&textHash, 1, 8, f) == 8;
+	ok = ok && fwrite(&textSize, 1, 8, f) == 8;
+	ok = ok && fwrite(&spec->h, 1, sizeof(FaceHeader), f) == sizeof(FaceHeader);
+	ok = ok && fwrite(&spec->efi, 1, sizeof(ExtraFileInfo), f) == sizeof(ExtraFileInfo);
+	ok = ok && fwrite(spec->blobCompression, 1, 250, f) == 250;
+	ok = ok && fwrite(spec->blobFaceData, 1, 250, f) == 250;
+	ok = ok && fwrite(spec->blobAtlas, 1, 250, f) == 250;
+	ok = ok && fwrite(&nameCount, 1, 1, f) == 1;
+	for(u32 i=0; ok && i<250; i++) {
+		size_t len = strlen(spec->blobFileNames[i]);
+		if(len == 0) continue;
+		u8 entry[2] = { (u8)i, (u8)len };
+		ok = ok && fwrite(entry, 1, 2, f) == 2;
+		ok = ok && fwrite(spec->blobFileNames[i], 1, len, f) == len;
+	}
+
+	fclose(f);
+	if(!ok) {
+		remove(tempName);
+		return 2;
+	}
+	remove(fileName);		// rename() won't replace an existing file on Windows
+	if(rename(tempName, fileName) != 0) {
+		remove(tempName);
+		return 3;
+	}
+	return 0; // SUCCESS
+}
+
+
+//----------------------------------------------------------------------------
+//  BLOB CACHE - encoded blob payloads, keyed by their inputs
+//----------------------------------------------------------------------------
+
+// Bump this when the encoder output changes, so old payloads are not reused.
+#define BLOB_CACHE_VERSION 2
+
+// Stands in for the compression type in the key of the flag saying whether a source needs blending
+#define BLOB_CACHE_BLEND_FLAG 0xFF
+
+// The in-memory part of the cache may be shared between threads (see daemon mode).
+#ifndef WINDOWS
+#define lockBlobCache(c) pthread_mutex_lock((pthread_mutex_t *)(c)->lock)
+#define unlockBlobCache(c) pthread_mutex_unlock((pthread_mutex_t *)(c)->lock)
+#else
+#define lockBlobCache(c)
+#define unlockBlobCache(c)
+#endif
+
+// Allocate a BlobCache. dir is the folder to store payloads in (created if needed), or "" for none.
+// If inMemory is true, payloads and the decoded background are also kept in memory between creates.
+// Delete with deleteBlobCache.
+BlobCache * newBlobCache(char * dir, bool inMemory) {
+	BlobCache * c = malloc(sizeof(BlobCache));
+	if(c == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		return NULL;
+	}
+	*c = (BlobCache){ 0 };
+	snprintf(c->dir, sizeof(c->dir), "%s", dir);
+	c->inMemory = inMemory;
+#ifndef WINDOWS
+	c->lock = malloc(sizeof(pthread_mutex_t));
+	if(c->lock == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		free(c);
+		return NULL;
+	}
+	pthread_mutex_init((pthread_mutex_t *)c->lock, NULL);
+#endif
+	if(c->dir[0] != 0) {
+		d_mkdir(c->dir, S_IRWXU);
+	}
+	return c;
+}
+
+BlobCache * deleteBlobCache(BlobCache * c) {
+	if(c != NULL) {
+		for(u32 i=0; i<c->count; i++) {
+			deleteBytes(c->entries[i].payload);
+		}
+		free(c->entries);
+		deleteImg(c->backgroundImg);
+#ifndef WINDOWS
+		pthread_mutex_destroy((pthread_mutex_t *)c->lock);
+		free(c->lock);
+#endif
+		free(c);
+		c = NULL;
+	}
+	return c;
+}
+
+// Start a new create.
+void beginBlobCache(BlobCache * c) {
+	lockBlobCache(c);
+	c->generation++;
+	unlockBlobCache(c);
+}
+
+// Forget in-memory payloads that weren't used by the latest create.
+void pruneBlobCache(BlobCache * c) {
+	lockBlobCache(c);
+	u32 j = 0;
+	for(u32 i=0; i<c->count; i++) {
+		if(c->entries[i].lastUsed == c->generation) {
+			c->entries[j++] = c->entries[i];
+		} else {
+			deleteBytes(c->entries[i].payload);
+		}
+	}
+	c->count = j;
+	unlockBlobCache(c);
+}
+
+// Key for an encoded blob. bgHash, bpx and bpy should be 0 when the source isn't blended against the background.
+u64 blobCacheKey(u64 srcHash, u8 compression, u64 bgHash, u32 bpx, u32 bpy) {
+	u8 buf[8 + 1 + 8 + 4 + 4 + 1];
+	memcpy(&buf[0], &srcHash, 8);
+	buf[8] = compression;
+	memcpy(&buf[9], &bgHash, 8);
+	memcpy(&buf[17], &bpx, 4);
+	memcpy(&buf[21], &bpy, 4);
+	buf[25] = BLOB_CACHE_VERSION;
+	return hashBytes(buf, sizeof(buf), HASH_SEED);
+}
+
+static void blobCacheFileName(BlobCache * c, u64 key, char * dst, size_t dstSize) {
+	snprintf(dst, dstSize, "%s%s%08x%08x.blob", c->dir, DIR_SEPERATOR, (u32)(key >> 32), (u32)key);
+}
+
+static Bytes * newBytesCopy(const u8 * data, size_t size) {
+	Bytes * b = malloc(sizeof(Bytes) + size);
+	if(b == NULL) {
+		return NULL;
+	}
+	b->size = size;
+	memcpy(b->data, data, size);
+	return b;
+}
+
+// Keep a copy of a payload in memory. Call with the cache locked.
+static void addToMemory(BlobCache * c, u64 key, const u8 * data, size_t size) {
+	for(u32 i=0; i<c->count; i++) {
+		if(c->entries[i].key == key) {
+			return;		// another thread got here first
+		}
+	}
+	if(c->maxEntries != 0 && c->count >= c->maxEntries) {
+		// evict the least recently used payload
+		u32 lru = 0;
+		for(u32 i=1; i<c->count; i++) {
+			if(c->entries[i].lastUsed < c->entries[lru].lastUsed) {
+				lru = i;
+			}
+		}
+		deleteBytes(c->entries[lru].payload);
+		c->entries[lru] = c->entries[--c->count];
+	}
+	if(c->count == c->capacity) {
+		u32 capacity = c->capacity ? c->capacity * 2 : 64;
+		BlobCacheEntry * entries = realloc(c->entries, capacity * sizeof(BlobCacheEntry));
+		if(entries == NULL) {
+			return;		// it's only a cache
+		}
+		c->entries = entries;
+		c->capacity = capacity;
+	}
+	Bytes * payload = newBytesCopy(data, size);
+	if(payload == NULL) {
+		return;
+	}
+	c->entries[c->count++] = (BlobCacheEntry){ .key = key, .lastUsed = c->generation, .payload = payload };
+}
+
+static Bytes * newBytesFromCacheFile(BlobCache * c, u64 key) {
+	char fileName[1100];
+	blobCacheFileName(c, key, fileName, sizeof(fileName));
+
+	FILE * f = fopen(fileName, "rb");
+	if(f == NULL) {
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	long ftr = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if(ftr <= 0) {
+		fclose(f);
+		return NULL;
+	}
+
+	Bytes * b = malloc(sizeof(Bytes) + (size_t)ftr);
+	if(b == NULL) {
+		fclose(f);
+		return NULL;
+	}
+	b->size = (size_t)ftr;
+	if(fread(b->data, 1, b->size, f) != b->size) {
+		fclose(f);
+		free(b);
+		return NULL;
+	}
+	fclose(f);
+	return b;
+}
+
+// Get a cached payload. Returns NULL (quietly) if it isn't cached. Delete with deleteBytes.
+Bytes * newBytesFromBlobCache(BlobCache * c, u64 key) {
+	// try memory first
+	lockBlobCache(c);
+	for(u32 i=0; i<c->count; i++) {
+		if(c->entries[i].key == key) {
+			c->entries[i].lastUsed = c->generation;
+			Bytes * b = newBytesCopy(c->entries[i].payload->data, c->entries[i].payload->size);
+			unlockBlobCache(c);
+			return b;
+		}
+	}
+	unlockBlobCache(c);
+
+	Bytes * b = NULL;
+	if(c->dir[0] != 0) {
+		b = newBytesFromCacheFile(c, key);
+	}
+
+	if(b != NULL && c->inMemory) {
+		lockBlobCache(c);
+		addToMemory(c, key, b->data, b->size);
+		unlockBlobCache(c);
+	}
+	return b;
+}
+
+// Store a payload. Returns 0 for success.
+int saveToBlobCache(BlobCache * c, u64 key, const u8 * data, size_t size) {
+	if(c->inMemory) {
+		lockBlobCache(c);
+		addToMemory(c, key, data, size);
+		unlockBlobCache(c);
+	}
+	if(c->dir[0] == 0) {
+		return 0;
+	}
+
+	char fileName[1100];
+	char tempName[1120];
+	blobCacheFileName(c, key, fileName, sizeof(fileName));
+	lockBlobCache(c);
+	u32 tempNumber = c->tempCount++;
+	unlockBlobCache(c);
+	snprintf(tempName, sizeof(tempName), "%s.%u.tmp", fileName, tempNumber);
+
+	// write to a temporary file first, so a partial payload is never picked up. each save has its own, as
+	// creates running at once may save the same payload.
+	FILE * f = fopen(tempName, "wb");
+	if(f == NULL) {
+		return 1;
+	}
+	size_t r = fwrite(data, 1, size, f);
+	fclose(f);
+	if(r != size) {
+		remove(tempName);
+		return 2;
+	}
+	remove(fileName);		// rename() won't replace an existing file on Windows
+	if(rename(tempName, fileName) != 0) {
+		remove(tempName);
+		return 3;
+	}
+	return 0; // SUCCESS
+}
+
+// Whether the bitmap from the source with srcHash has transparent pixels to blend onto a background, as saved by
+// saveNeedsBackgroundToBlobCache(). Returns 1 or 0, or -1 if it isn't known.
+int needsBackgroundFromBlobCache(BlobCache * c, u64 srcHash) {
+	Bytes * b = newBytesFromBlobCache(c, blobCacheKey(srcHash, BLOB_CACHE_BLEND_FLAG, 0, 0, 0));
+	int r = (b != NULL && b->size == 1) ? b->data[0] : -1;
+	deleteBytes(b);
+	return r;
+}
+
+// Remember whether the bitmap from the source with srcHash needs blending, so the key of its payload is known before
+// it is decoded. Returns 0 for success.
+int saveNeedsBackgroundToBlobCache(BlobCache * c, u64 srcHash, bool needsBackground) {
+	u8 flag = needsBackground ? 1 : 0;
+	return saveToBlobCache(c, blobCacheKey(srcHash, BLOB_CACHE_BLEND_FLAG, 0, 0, 0), &flag, 1);
+}
+
+// Get a copy of the decoded background with the given source hash, or NULL. Delete with deleteImg.
+Img * newImgFromBlobCache(BlobCache * c, u64 bgHash) {
+	Img * img = NULL;
+	lockBlobCache(c);
+	if(c->backgroundImg != NULL && c->backgroundHash == bgHash) {
+		img = cloneImg(c->backgroundImg);
+	}
+	unlockBlobCache(c);
+	return img;
+}
+
+// Keep a copy of the decoded background in memory, if the cache is in memory.
+void saveImgToBlobCache(BlobCache * c, u64 bgHash, Img * img) {
+	if(!c->inMemory) {
+		return;
+	}
+	lockBlobCache(c);
+	if(c->backgroundImg == NULL || c->backgroundHash != bgHash) {
+		c->backgroundImg = deleteImg(c->backgroundImg);
+		c->backgroundImg = cloneImg(img);
+		c->backgroundHash = bgHash;
+	}
+	unlockBlobCache(c);
+}
@@ -0,0 +1,57 @@
+// cache.h
+
+
+//----------------------------------------------------------------------------
+//  HASHING
+//----------------------------------------------------------------------------
+
+#define HASH_SEED 0xcbf29ce484222325ULL		// FNV-1a 64-bit offset basis
+
+u64 hashBytes(const u8 * data, size_t size, u64 seed);
+
+
+//----------------------------------------------------------------------------
+//  MANIFEST - compiled watchface.txt, keyed by mtime and hash of the text
+//----------------------------------------------------------------------------
+
+#define MANIFEST_FILENAME "watchface.man"
+
+int loadManifest(char * fileName, FaceSpec * spec, i64 textMTime, u64 textHash, u64 textSize);
+int saveManifest(char * fileName, FaceSpec * spec, i64 textMTime, u64 textHash, u64 textSize);
+
+
+//----------------------------------------------------------------------------
+//  BLOB CACHE - encoded blob payloads, keyed by their inputs
+//----------------------------------------------------------------------------
+
+typedef struct _BlobCacheEntry {
+	u64 key;
+	u32 lastUsed;			// generation of the last create that used it
+	Bytes * payload;
+} BlobCacheEntry;
+
+typedef struct _BlobCache {
+	char dir[1024];			// folder the payloads are stored in, or empty
+	bool inMemory;			// keep payloads and the decoded background in memory too
+	u32 generation;			// incremented for each create
+	u32 tempCount;			// numbers the temporary files payloads are written to
+	u32 count;				// in-memory payloads
+	u32 capacity;
+	u32 maxEntries;			// least recently used payloads are evicted beyond this. 0 for no limit.
+	BlobCacheEntry * entries;
+	u64 backgroundHash;		// in-memory decoded background
+	Img * backgroundImg;
+	void * lock;			// pthread_mutex_t guarding the in-memory data, except on Windows
+} BlobCache;
+
+BlobCache * newBlobCache(char * dir, bool inMemory);
+BlobCache * deleteBlobCache(BlobCache * c);
+void beginBlobCache(BlobCache * c);
+void pruneBlobCache(BlobCache * c);
+u64 blobCacheKey(u64 srcHash, u8 compression, u64 bgHash, u32 bpx, u32 bpy);
+Bytes * newBytesFromBlobCache(BlobCache * c, u64 key);
+int saveToBlobCache(BlobCache * c, u64 key, const u8 * data, size_t size);
+int needsBackgroundFromBlobCache(BlobCache * c, u64 srcHash);
+int saveNeedsBackgroundToBlobCache(BlobCache * c, u64 srcHash, bool needsBackground);
+Img * newImgFromBlobCache(BlobCache * c, u64 bgHash);
+void saveImgToBlobCache(BlobCache * c, u64 bgHash, Img * img);
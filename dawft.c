@@ -16,6 +16,10 @@
 
 */
 
+#ifndef WINDOWS
+#define _DEFAULT_SOURCE		// for inotify, sockets, poll() and clock_gettime() under -std=c99
+#endif
+
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -24,8 +28,38 @@
 #include <sys/stat.h>		// for mkdir()
 #include <assert.h>
 
+#ifndef WINDOWS
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#endif
+
+#ifdef WINDOWS
+#include <io.h>				// for _dup() and _setmode()
+#include <fcntl.h>
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <dirent.h>
+#endif
+
 #include "dawft.h"
 #include "bmp.h"
+#include "cache.h"
+#include "libdawft.h"
+#include "render.h"
+#include "dumpio.h"
+#include "tar.h"
+#include "qoi.h"
+#include "jpeg.h"
+#include "gif.h"
 
 #include "strutil.h"
 
@@ -39,267 +73,31 @@ static int systemIsLittleEndian() {				// return 0 for big endian, 1 for little
     return (*((volatile uint8_t*)(&i))) == 0x67;
 }
 
-inline void set_u16(u8 * p, u16 v) {
-    p[0] = v&0xFF;
-    p[1] = v>>8;
-}
-
-
-//----------------------------------------------------------------------------
-//  BINARY FILE STRUCTURE
-//----------------------------------------------------------------------------
-
-/***
-
-fileType	FaceData size	Offset table start		Compression method				Different resolutions?
-TYPE A 		6				200						NONE/RLE_BASIC					No - always 240x240
-TYPE B		10				400						LZO of all data (not header)	Yes
-TYPE C 		10				400						NONE/RLE_LINE					Yes
-
-
-For reference:
-
-typedef struct _FaceDataA {
-	u8 type;				// type of object we are giving dimensions e.g. hours, day, steps etc.
-	u8 x;			
-	u8 y;
-	u8 w;
-	u8 h;
-	u8 idx;					// index into offset table
-} FaceDataA; 				// size is 6 bytes
-
-typedef struct _FaceHeaderA {
-	u8 fileID;	
-	u8 dataCount;
-	u8 blobCount;	
-	u16 faceNumber;	
-	FaceDataA faceData[32];	// sizeof(FaceDataA) = 6 bytes
-	u8 padding[3];	
-	u32 offsets[250];		// offsets of bitmap data for the face. Table starts at 200. Offsets start from end of header data i.e. at 1700.
-	u16 sizes[250];			// sizes of the bitmap data, in bytes. Unreliable. at 1600 is stored the animationFrame count. i.e. sizes[200]
-} FaceHeaderA;				// size is 1700 bytes
-
-***/
-
-#pragma pack (push)
-#pragma pack (1)
-
-typedef struct _FaceData {
-	u8 type;				// type of object we are giving dimensions e.g. hours, day, steps etc.
-	u8 idx;					// index into offset table
-	u16 x;
-	u16 y;
-	u16 w;
-	u16 h;
-} FaceData; 				// size is 10 bytes
-
-typedef struct _FaceHeader {
-	u8 fileID;				// 0x81 or 0x04 or 0x84
-	u8 dataCount;			// how many data objects
-	u8 blobCount;			// how many blob (bitmap) objects
-	u16 faceNumber;			// design number of this face, in this case 0x1E38 or 7736
-	FaceData faceData[39];	// sizeof(FaceData) = 10 bytes
-	u8 padding[5];
-	u32 offsets[250];		// offsets of bitmap data for the face. Table starts at 400. Offsets start from end of header data i.e. at 1900.
-	u16 sizes[250];			// sizes of the bitmap data, in bytes. For Type B, sizes are the uncompressed sizes. Unreliable. Table starts at 1400. Animation frame count is at sizes[0].
-} FaceHeader;				// size is 1900 bytes
-
-#pragma pack (pop)
-
-// Extra info about a binary file, which is not easy to access from binary file header
-typedef struct _ExtraFileInfo {
-	char fileType;
-	char padding;
-	u16 animationFrames;
-} ExtraFileInfo;
-
-static void setHeader(FaceHeader * h, const u8 * buf, char fileType) {
-	if(fileType != 'A' && fileType != 'B' && fileType != 'C') {
-		printf("ERROR: Invalid fileType in setHeader!\n");
-		return;
-	}
-	
-	*h = (FaceHeader){ 0 };
-
-	h->fileID = buf[0];
-	h->dataCount = buf[1];
-	h->blobCount = buf[2];
-	h->faceNumber = get_u16(&buf[3]);
-
-	u32 idx = 5;
-	
-	// load faceData
-	if(fileType != 'A') {
-		for(int i=0; i<39; i++) {
-			h->faceData[i].type = buf[idx];
-			h->faceData[i].idx = buf[idx+1];
-			h->faceData[i].x = get_u16(&buf[idx+2]);
-			h->faceData[i].y = get_u16(&buf[idx+4]);
-			h->faceData[i].w = get_u16(&buf[idx+6]);
-			h->faceData[i].h = get_u16(&buf[idx+8]);
-			idx += 10;
-		}
-		memcpy(h->padding, &buf[idx], 5);
-		idx += 5;
-	} else { // fileType == 'A'
-		for(int i=0; i<32; i++) {
-			h->faceData[i].type = buf[idx];
-			h->faceData[i].idx = buf[idx+5];
-			h->faceData[i].x = buf[idx+1];
-			h->faceData[i].y = buf[idx+2];
-			h->faceData[i].w = buf[idx+3];
-			h->faceData[i].h = buf[idx+4];
-			idx += 6;
-		}
-		memcpy(h->padding, &buf[idx], 3);
-		idx += 3;
-	}
-	
-	// load offsets
-	for(int i=0; i<250; i++) {
-		h->offsets[i] = get_u32(&buf[idx]);
-		idx += 4;
-	}
-
-	// load sizes
-	for(int i=0; i<250; i++) {
-		h->sizes[i] = get_u16(&buf[idx]);
-		idx += 2;
+// Load fileName, or all of stdin if fileName is "-". Returns NULL on failure.
+static Bytes * newBytesFromInput(char * fileName) {
+	if(streq(fileName, "-")) {
+#ifdef WINDOWS
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
+		return newBytesFromStream(stdin);
 	}
-
-	// Note: if fileType == 'B', offsets are into the *decompressed* data. 
+	return newBytesFromFile(fileName);
 }
 
-
-//----------------------------------------------------------------------------
-//  DATA TYPES
-//----------------------------------------------------------------------------
-
-typedef struct _DataType {
-	u8 type;
-	const char str[16];
-	u8 count;	
-	const char * description;
-} DataType;
-
-// digits: only w, h of first digit. 0-9.
-static const DataType dataTypes[] = {	
-	{ 0x00, "BACKGROUNDS", 		10, "Background (10 parts of 240x24). May contain example time (will be overwritten). Seen in Type A faces." },
-	{ 0x01, "BACKGROUND", 		1, 	"Background image, usually width and height of screen. Seen in Type B & C faces." },
-	{ 0x10, "MONTH_NAME", 		12, "JAN, FEB, MAR, APR, MAY, JUN, JUL, AUG, SEP, OCT, NOV, DEC." },
-	{ 0x11, "MONTH_NUM", 		10, "Month, digits." },
-	{ 0x12, "YEAR", 			10, "Year, 2 digits, left aligned." },
-	{ 0x30, "DAY_NUM", 			10, "Day number of the month, digits." },
-	{ 0x40, "TIME_H1", 			10, "Hh:mm" },
-	{ 0x41, "TIME_H2", 			10, "hH:mm" },
-	{ 0x43, "TIME_M1", 			10, "hh:Mm" },
-	{ 0x44, "TIME_M2", 			10, "hh:mM" },
-	{ 0x45, "TIME_AM", 			1,	"'AM'." },
-	{ 0x46, "TIME_PM", 			1,	"'PM'." },
-	{ 0x60, "DAY_NAME", 		7,	"SUN, MON, TUE, WED, THU, FRI, SAT." },
-	{ 0x61, "DAY_NAME_CN", 		7,	"SUN, MON, TUE, WED, THU, FRI, SAT, chinese symbol option." },
-	{ 0x62, "STEPS", 			10,	"Step count, left aligned, digits." },
-	{ 0x63, "STEPS_CA", 		10,	"Step count, centre aligned, digits." },
-	{ 0x64, "STEPS_RA", 		10,	"Step count, right aligned, digits." }, 
-	{ 0x65, "HR", 				10, "Heart rate, left aligned, digits. (Assumed)." },
-	{ 0x66, "HR_CA", 			10, "Heart rate, centre aligned, digits. (Assumed)." },
-	{ 0x67, "HR_RA", 			10, "Heart rate, right aligned, digits." }, 
-	{ 0x68, "KCAL", 			10, "kCals, left aligned, digits." },
-	{ 0x6b, "MONTH_NUM_B", 		10,	"Month, digits, alternate." },
-	{ 0x6c, "DAY_NUM_B", 		10,	"Day number of the month, digits, alternate." },
-	{ 0x70, "STEPS_PROGBAR",	11, "Steps progess bar 0,10,20...100%. 11 frames." },
-	{ 0x71, "STEPS_LOGO", 		1,	"Step count, static logo." },
-	{ 0x72, "STEPS_B", 			10, "Step count, left aligned, digits, alternate." },
-	{ 0x73, "STEPS_B_CA", 		10, "Step count, centre aligned, digits, alternate." },
-	{ 0x74, "STEPS_B_RA", 		10, "Step count, right aligned, digits, alternate." },
-	{ 0x76, "STEPS_GOAL", 		10, "Step goal, left aligned, digits." },
-	{ 0x80, "HR_PROGBAR", 		11, "Heart rate, progress bar 0,10,20...100%. 11 frames." },
-	{ 0x81, "HR_LOGO", 			1,  "Heart rate, static logo." },
-	{ 0x82, "HR_B", 			10,	"Heart rate, left aligned, digits, alternate." },
-	{ 0x83, "HR_B_CA", 			10, "Heart rate, centre aligned, digits, alternate." },
-	{ 0x84, "HR_B_RA", 			10, "Heart rate, right aligned, digits, alternate." },
-	{ 0x90, "KCAL_PROGBAR", 	11, "kCals progress bar 0,10,20...100%. 11 frames." },
-	{ 0x91, "KCAL_LOGO", 		1,  "kCals, static logo." },
-	{ 0x92, "KCAL_B", 			10, "kCals, left aligned, digits." },
-	{ 0x93, "KCAL_B_CA", 		10, "kCals, centre aligned, digits." },
-	{ 0x94, "KCAL_B_RA", 		10, "kCals, right aligned, digits." },
-	{ 0xA0, "DIST_PROGBAR", 	11, "Distance progress bar 0,10,20...100%. 11 frames." },
-	{ 0xA1, "DIST_LOGO", 		1, 	"Distance, static logo." },
-	{ 0xA2, "DIST", 			10, "Distance, left aligned, digits." },		// Has a decimal point - how wide?
-	{ 0xA3, "DIST_CA", 			10, "Distance, centre aligned, digits." },
-	{ 0xA4, "DIST_RA", 			10, "Distance, right aligned, digits." },
-	{ 0xA5, "DIST_KM", 			1,  "Distance unit 'KM'." },
-	{ 0xA6, "DIST_MI", 			1,  "Distance unit 'MI'." },
-	{ 0xC0, "BTLINK_UP", 		1,  "Bluetooth link up / connected." },
-	{ 0xC1, "BTLINK_DOWN", 		1,	"Bluetooth link down / not connected." },
-	{ 0xCE, "BATT_IMG", 		1,	"Battery level image." },
-	{ 0xD0, "BATT_IMG_B", 		1,	"Battery level image, alternate." },
-	{ 0xD1, "BATT_IMG_C", 		1,  "Battery level image, alternate." },
-	{ 0xD2, "BATT", 			10, "Battery level, left aligned, digits. (Assumed)." },
-	{ 0xD3, "BATT_CA", 			10, "Battery level, centre aligned, digits." },
-	{ 0xD4, "BATT_RA", 			10, "Battery level, right aligned, digits." },
-	{ 0xDA, "BATT_IMG_D", 		1,  "Battery level image, alternate." },
-	{ 0xD7, "WEATHER_TEMP", 	13, "Weather temperature, left aligned, 11 digits (0-9 and -) and a special 12 & 13th double-width characters for deg. C and deg. F." },
-	{ 0xD8, "WEATHER_TEMP_CA", 	13, "Weather temperature, centre aligned, 11 digits (0-9 and -) and a special 12 & 13th double-width characters for deg. C and deg. F." },
-	{ 0xD9, "WEATHER_TEMP_RA", 	13, "Weather temperature, right aligned, 11 digits (0-9 and -) and a special 12 & 13th double-width characters for deg. C and deg. F." },
-	{ 0xF0, "SEPERATOR", 		1,	"Static image used as date or time seperator e.g. / or :." },
-	{ 0xF1, "HAND_HOUR", 		1,	"Analog time hour hand, at 1200 position." },
-	{ 0xF2, "HAND_MINUTE", 		1,  "Analog time minute hand, at 1200 position." },
-	{ 0xF3, "HAND_SEC", 		1,	"Analog time second hand, at 1200 position." },
-	{ 0xF4, "HAND_PIN_UPPER", 	1,  "Top half of analog time centre pin." },
-	{ 0xF5, "HAND_PIN_LOWER", 	1,  "Bottom half of analog time centre pin." },
-	{ 0xF6, "TAP_TO_CHANGE", 	1,  "Series of images. Tap to change. Count is specified by animationFrames." },		// On #3156, #5315. #3135 has it as 3 images. Frame count at 1400 (Type C) or 1600 (Type A).
-	{ 0xF7, "ANIMATION",	 	1,  "Animation. Count is specified by animationFrames." }, 							// #3145, #163.  #3087, #3088 has it as a 7-frame animation. #3163 has it as a 36 frame animation. Frame count at 1400 (Type C) or 1600 (Type A)..
-	{ 0xF8, "ANIMATION_F8",   	1,  "Animation. Count is specified by animationFrames." }, 				// #3085, #3086. #3112 has it as a 14-frame animation. #3248 has it as a 10-frame animation. Frame count at 1400 (Type C) or 1600 (Type A).
-};		
-								
-static const char dataTypeStrUnknown[12] = "UNKNOWN";
-
-static int getDataTypeIdxFromStr(const char * s) {
-	int length = sizeof(dataTypes) / sizeof(DataType);
-	for(int i=0; i<length; i++) {
-		if(strcmp(dataTypes[i].str, s)==0 ) {
-			return i;
-		}
-	}
-	return -1; // failed to find
-}
-
-static u8 getDataTypeTypeFromStr(const char * s) {
-	int r = getDataTypeIdxFromStr(s);
-	if(r == -1) {
-		printf("ERROR: Failed to recognise Data Type String '%s'\n", s);
-		exit(EXIT_FAILURE);
-	}
-	return dataTypes[r].type;
-}
-
-static const char * getDataTypeStr(u8 type) {
-	int length = sizeof(dataTypes) / sizeof(DataType);
-	for(int i=0; i<length; i++) {
-		if(dataTypes[i].type == type) {
-			return dataTypes[i].str;
-		}
-	}
-	return dataTypeStrUnknown;
-}
-
-static int getDataTypeIdx(u8 type) {
-	int length = sizeof(dataTypes) / sizeof(DataType);
-	for(int i=0; i<length; i++) {
-		if(dataTypes[i].type == type) {
-			return i;
-		}
-	}
-	return -1; // failed to find
+// Write all of b to f, which may be a pipe. Returns 0 for success.
+static int writeBytesToStream(FILE * f, Bytes * b) {
+	if(fwrite(b->data, 1, b->size, f) != b->size || fflush(f) != 0) {
+		printf("ERROR: Unable to write to output file.\n");
+		return 1;
+	}
+	return 0;
 }
 
 static int printTypes() {
 	printf("DATA TYPES FOR BINARY WATCH FACE FILES\n");
 	printf("Note: Width and height of digits is of a single digit (bitmap). Digits will be printed with 2px spacing.\n");
 	printf("\nCode  Name              Count  Description\n");	
-	u32 typeCount = sizeof(dataTypes)/sizeof(DataType);
-	for(u32 i=0; i<typeCount; i++) {
+	for(u32 i=0; i<dataTypeCount; i++) {
 		printf("0x%02x  %-16s  %2u     %s\n", dataTypes[i].type, dataTypes[i].str, dataTypes[i].count, dataTypes[i].description);	
 	}
 	printf("\n");
@@ -307,382 +105,484 @@ static int printTypes() {
 }
 
 
-// Find the faceData index given an offset index. Returns -1 for failure, index for success.
-static int getFaceDataIndexFromOffsetIndex(int offsetIndex, FaceHeader * h, ExtraFileInfo * xfi) {
-	int matchIdx = -1;
-	for(int fdi=0; fdi < h->dataCount; fdi++) {
-		int count = 1;
-		u8 type = h->faceData[fdi].type;			// we only care about type because it affects count
-		int typeIdx = getDataTypeIdx(type);
-		if(typeIdx >= 0) {
-			if(type >= 0xF6 && type <= 0xF8) {
-				count = xfi->animationFrames;
-			} else {
-				count = dataTypes[typeIdx].count;
-			}
-		}
-		if(offsetIndex >= h->faceData[fdi].idx && offsetIndex < (h->faceData[fdi].idx + count)) {
-			matchIdx = fdi; // we found a match
-			break;
-		}
-	}
-	return matchIdx; // -1 for failure, index for success
-}
-
 //----------------------------------------------------------------------------
-//  NEWBYTESFROMFILE - read entire file into memory
+//  CREATEBIN - Read a watchface.txt file and associated bitmaps and save to bin.
 //----------------------------------------------------------------------------
 
-// Read file into struct Bytes. Delete with deleteBytes. 0123456sss
-Bytes * newBytesFromFile(char * fileName) {
-	// Open the binary input file
-    FILE * f = fopen(fileName, "rb");
-    if(f==NULL) {
-		printf("ERROR: Failed to open input file: '%s'\n", fileName);
-		return NULL;
-    }
-
-	// Check file size
-    fseek(f,0,SEEK_END);
-	long ftr = ftell(f);
-	fseek(f,0,SEEK_SET);
-	size_t fileSize = (size_t)ftr;
-
-	// Allocate buffer
-	Bytes * b = (Bytes *)malloc(sizeof(Bytes)+fileSize);
-	if(b == NULL) {
-		printf("ERROR: Unable to allocate enough memory to open file.\n");
-		fclose(f);
+// Load the file called name from srcFolder, or from archive if it isn't NULL. The path is put in fileName, for messages.
+// Returns NULL on failure.
+static Bytes * newBytesFromSource(char * srcFolder, Archive * archive, const char * name, char * fileName, size_t fileNameSize) {
+	int n = snprintf(fileName, fileNameSize, "%s%s%s", srcFolder, DIR_SEPERATOR, name);
+	if(n < 0 || (size_t)n >= fileNameSize) {
+		printf("ERROR: Path '%s%s%s' is too long\n", srcFolder, DIR_SEPERATOR, name);
 		return NULL;
 	}
+	if(archive != NULL) {
+		return newBytesFromArchive(archive, name);
+	}
+	return newBytesFromFile(fileName);
+}
 
-	b->size = fileSize;	
- 	// Read whole file
-	if(fread(b->data, 1, fileSize, f) != fileSize) {
-		printf("ERROR: Read failed.\n");
-		fclose(f);
-		free(b);
-		return NULL;
+// Load srcFolder/watchface.txt into spec. Uses the compiled manifest beside it if it is up to date,
+// otherwise parses the text and saves a new manifest. If archive isn't NULL, watchface.txt is read from it
+// instead, and there is no manifest. Returns 0 for success.
+static int loadFaceSpec(char * srcFolder, Archive * archive, FaceSpec * spec) {
+	char textFileName[1024];
+	char manifestFileName[1024];
+	snprintf(textFileName, sizeof(textFileName), "%s%swatchface.txt", srcFolder, DIR_SEPERATOR);
+	snprintf(manifestFileName, sizeof(manifestFileName), "%s%s%s", srcFolder, DIR_SEPERATOR, MANIFEST_FILENAME);
+
+	if(archive != NULL) {
+		Bytes * text = newBytesFromArchive(archive, "watchface.txt");
+		if(text == NULL) {
+			printf("ERROR: Failed to find watchface.txt in '%s'\n", srcFolder);
+			return 1;
+		}
+		int r = parseWatchFaceTxt(spec, text);
+		deleteBytes(text);
+		return r;
 	}
 
-	// Now file is loaded, close the file
-	fclose(f);
+	// load watchface.txt
+	struct stat st;
+	Bytes * text = NULL;
+	if(stat(textFileName, &st) != 0 || (text = newBytesFromFile(textFileName)) == NULL) {
+		printf("ERROR: Failed to open '%s' for reading\n", textFileName);
+		return 1;
+	}
+	i64 mtime = (i64)st.st_mtime;
+	u64 hash = hashBytes(text->data, text->size, HASH_SEED);
+	u64 size = text->size;
+
+	// use the manifest, if it matches
+	if(loadManifest(manifestFileName, spec, mtime, hash, size) == 0) {
+		printf("Using compiled manifest '%s'.\n", manifestFileName);
+		deleteBytes(text);
+		return 0;
+	}
 
-	// Return the allocated memory filled with the file data
-	return b;
-}
+	int r = parseWatchFaceTxt(spec, text);
+	deleteBytes(text);
+	if(r != 0) {
+		return r;
+	}
 
-Bytes * deleteBytes(Bytes * b) {
-	if(b != NULL) {
-		free(b);
-		b = NULL;
+	if(saveManifest(manifestFileName, spec, mtime, hash, size) != 0) {
+		printf("WARNING: Unable to save manifest '%s'.\n", manifestFileName);
 	}
-	return b;
+	return 0;
 }
 
-//----------------------------------------------------------------------------
-//  DUMPBLOB - dump binary data to file
-//----------------------------------------------------------------------------
-
-static int dumpBlob(char * fileName, u8 * srcData, size_t length) {
-	// open the dump file
-	FILE * dumpFile = fopen(fileName,"wb");
-	if(dumpFile==NULL) {
-		return 1;
-	}
-	int idx = 0;
+// One bitmap cut from an atlas
+typedef struct _AtlasCell {
+	u32 blob;
+	u32 x;
+	u32 y;
+	u32 w;
+	u32 h;
+} AtlasCell;
+
+// An atlas bitmap and its cells, kept loaded for all the blobs cut from it
+typedef struct _Atlas {
+	char name[256];				// as given in watchface.txt, or empty if nothing is loaded
+	Bytes * file;				// the image file, until it is converted to bmp
+	u64 fileHash;
+	Bytes * bmp;
+	u32 cellCount;
+	AtlasCell cells[250];
+} Atlas;
+
+static void clearAtlas(Atlas * atlas) {
+	atlas->file = deleteBytes(atlas->file);
+	atlas->bmp = deleteBytes(atlas->bmp);
+	atlas->name[0] = 0;
+	atlas->cellCount = 0;
+}
 
-	// write the data to the dump file
-	while(length > 0) {
-		size_t bytesToWrite = 4096;
-		if(length < bytesToWrite) {
-			bytesToWrite = length;
+// Read the cells of an atlas from the .txt file beside it. Each line is "cell BLOB X Y W H". Returns 0 for success.
+static int parseAtlasTxt(Atlas * atlas, const Bytes * text) {
+	char lineBuf[1024];
+	size_t textPos = 0;
+	atlas->cellCount = 0;
+	while(d_sgets(lineBuf, sizeof(lineBuf), (const char *)text->data, text->size, &textPos) != NULL) {
+		if(lineBuf[0] == '#') continue;
+		TokensIdx tok;
+		getTokensIdx(lineBuf, &tok);
+		if(tok.count < 6 || !streqn(tok.ptr[0], "cell", 4)) continue;
+		if(atlas->cellCount == 250) {
+			printf("ERROR: Too many cells in atlas '%s'.\n", atlas->name);
+			return 1;
 		}
+		AtlasCell * c = &atlas->cells[atlas->cellCount++];
+		*c = (AtlasCell){ .blob = readNum(tok.ptr[1]), .x = readNum(tok.ptr[2]), .y = readNum(tok.ptr[3]), .w = readNum(tok.ptr[4]), .h = readNum(tok.ptr[5]) };
+	}
+	return 0;
+}
 
-		size_t rval = fwrite(&srcData[idx],1,bytesToWrite,dumpFile);
-		if(rval != bytesToWrite) {
-			fclose(dumpFile);
-			remove(fileName);
-			return 2;
+// Image files for blobs without a file name in watchface.txt are looked for with these extensions, in order
+static const char * imageExtensions[] = { "bmp", "png", "qoi", "jpg" };
+
+// Put the file name of blob i, when watchface.txt doesn't give one, in name: the first of NNN.bmp, NNN.png... that
+// is in srcFolder (or archive, if it isn't NULL), or NNN.bmp if none of them are.
+static void getDefaultBlobName(char * srcFolder, Archive * archive, u32 i, char * name, size_t nameSize) {
+	for(size_t e=0; e<sizeof(imageExtensions)/sizeof(imageExtensions[0]); e++) {
+		snprintf(name, nameSize, "%03u.%s", i, imageExtensions[e]);
+		char path[1024];
+		snprintf(path, sizeof(path), "%s%s%s", srcFolder, DIR_SEPERATOR, name);
+		struct stat st;
+		if((archive != NULL) ? (findArchiveEntry(archive, name) != NULL) : (stat(path, &st) == 0)) {
+			return;
 		}
-		idx += bytesToWrite;
-		length -= bytesToWrite;
 	}
+	snprintf(name, nameSize, "%03u.%s", i, imageExtensions[0]);
+}
 
-	// close the dump file
-	fclose(dumpFile);
-
-	return 0; // SUCCESS
+// The name of the .txt file listing the cells of the atlas atlasName: the same name, with .txt for its extension.
+static void getAtlasTextName(const char * atlasName, char * name, size_t nameSize) {
+	snprintf(name, nameSize, "%s", atlasName);
+	char * ext = strrchr(name, '.');
+	size_t len = (ext != NULL && strchr(ext, '/') == NULL) ? (size_t)(ext - name) : strlen(name);
+	snprintf(&name[len], nameSize - len, ".txt");
 }
 
+// Hash file, which was read from the file called name. If it came from archive, the entry may already know its hash.
+static u64 hashSourceFile(Archive * archive, const char * name, const Bytes * file) {
+	const TarEntry * e = (archive != NULL) ? findArchiveEntry(archive, name) : NULL;
+	if(e != NULL && e->hash != 0 && e->size == file->size) {
+		return e->hash;
+	}
+	return hashBytes(file->data, file->size, HASH_SEED);
+}
 
-//----------------------------------------------------------------------------
-//  AUTODETECT FILE TYPE
-//----------------------------------------------------------------------------
+// The source of a blob's bitmap, read but not yet converted to bmp, so the cache can be checked before decoding it
+typedef struct _BlobSource {
+	Bytes * file;				// the image file, or NULL for a cell of the atlas
+	u32 fitWidth;				// the size a jpeg is fitted to
+	u32 fitHeight;
+	AtlasCell * cell;			// the cell of the atlas, or NULL
+	u64 hash;					// of everything the bmp depends on: the file and fitted size, or the atlas file and cell
+} BlobSource;
+
+static void clearBlobSource(BlobSource * src) {
+	src->file = deleteBytes(src->file);
+	src->cell = NULL;
+}
 
-static char autodetectFileType(u8 * fileData, size_t fileSize) {		// Auto-detect file type.
-	u8 blobCount = fileData[2];
-	int typeACount = 1;
-	u8 typeARunning = 1;
-	int typeBCount = 1;
-	u8 typeBRunning = 1;
-	u32 typeBMax = 0;
-	char fileType = 0;
+// Read the source of blob i of spec into src: its own file, or a cell of an atlas, which stays loaded in atlas for the
+// following blobs. The path is put in fileName, for messages. Returns 0 for success.
+static int loadBlobSource(char * srcFolder, Archive * archive, FaceSpec * spec, u32 i, Atlas * atlas, BlobSource * src, char * fileName, size_t fileNameSize) {
+	char name[300];
+	*src = (BlobSource){ 0 };
+	if(!spec->blobAtlas[i]) {
+		if(spec->blobFileNames[i][0] != 0) {
+			snprintf(name, sizeof(name), "%s", spec->blobFileNames[i]);
+		} else {
+			getDefaultBlobName(srcFolder, archive, i, name, sizeof(name));
+		}
+		int fdi = spec->blobFaceData[i];
+		src->fitWidth = (fdi != -1) ? spec->h.faceData[fdi].w : 0;
+		src->fitHeight = (fdi != -1) ? spec->h.faceData[fdi].h : 0;
+		src->file = newBytesFromSource(srcFolder, archive, name, fileName, fileNameSize);
+		if(src->file == NULL) {
+			return 1;
+		}
+		u32 fit[2] = { src->fitWidth, src->fitHeight };
+		src->hash = hashBytes((const u8 *)fit, sizeof(fit), hashSourceFile(archive, name, src->file));
+		return 0;
+	}
 
-	// Count the offsets and compare to blobCount. Type A offset table starts at 200. Type B/C offset table starts at 400.
-	for(u32 i=1; i<250; i++) {
-		if(typeARunning) {
-			if(get_u32(&fileData[200+(i*4)]) != 0) {
-				typeACount += 1;
-			} else {
-				typeARunning = 0;
-			}
+	// load the atlas, and its cells, if it isn't the one we already have. it is only converted when a cell is needed.
+	if(!streq(atlas->name, spec->blobFileNames[i])) {
+		clearAtlas(atlas);
+		atlas->file = newBytesFromSource(srcFolder, archive, spec->blobFileNames[i], fileName, fileNameSize);
+		if(atlas->file == NULL) {
+			return 1;
 		}
-		if(typeBRunning) {
-			u32 offset = get_u32(&fileData[400+(i*4)]);
-			if(offset != 0) {
-				typeBCount += 1;
-				typeBMax = offset;
-			} else {
-				typeBRunning = 0;
-			}
+		atlas->fileHash = hashSourceFile(archive, spec->blobFileNames[i], atlas->file);
+		getAtlasTextName(spec->blobFileNames[i], name, sizeof(name));
+		Bytes * text = newBytesFromSource(srcFolder, archive, name, fileName, fileNameSize);
+		int r = (text != NULL) ? parseAtlasTxt(atlas, text) : 1;
+		deleteBytes(text);
+		if(r != 0) {
+			printf("ERROR: Unable to read the cells of atlas '%s' from '%s'.\n", spec->blobFileNames[i], fileName);
+			clearAtlas(atlas);
+			return 1;
 		}
-	}		
-
-	if(typeACount == blobCount) {
-		printf("Autodetected fileType A\n");
-		fileType = 'A';			
-	} else if(typeBCount == blobCount) {
-		typeBMax += 1900; // add header size
-		// Type B will have offsets larger than the file size (as they are into the uncompressed data). Type C should be smaller than the file size.
-		if(typeBMax > fileSize) {
-			printf("Autodetected fileType B\n");
-			// (offset %u is greater than fileSize %zu)\n", typeBMax, fileSize);
-			fileType = 'B';
-		} else {
-			printf("Autodetected fileType C\n");
-			// (offset %u is less than fileSize %zu)\n", typeBMax, fileSize);
-			fileType = 'C';
+		snprintf(atlas->name, sizeof(atlas->name), "%s", spec->blobFileNames[i]);
+	}
+
+	snprintf(fileName, fileNameSize, "%s%s%s(%03u)", srcFolder, DIR_SEPERATOR, atlas->name, i);
+	for(u32 j=0; j<atlas->cellCount; j++) {
+		AtlasCell * c = &atlas->cells[j];
+		if(c->blob == i) {
+			u32 rect[4] = { c->x, c->y, c->w, c->h };
+			src->cell = c;
+			src->hash = hashBytes((const u8 *)rect, sizeof(rect), atlas->fileHash);
+			return 0;
 		}
-	} else {
-		printf("WARNING: Unable to autodetect fileType. Defaulting to type A.\n");
-		fileType = 'A';
 	}
-	return fileType;
+	printf("ERROR: Atlas '%s' has no cell for blob %03u.\n", atlas->name, i);
+	return 1;
 }
 
-
-//----------------------------------------------------------------------------
-//  CREATEBIN - Read a watchface.txt file and associated bitmaps and save to bin.
-//----------------------------------------------------------------------------
-
-static int createBin(char * srcFolder, char * outputFileName) {
-	printf("Creating '%s' from folder '%s'.\n", outputFileName, srcFolder);
-
-	char fileNameBuf[1024];
-	snprintf(fileNameBuf, sizeof(fileNameBuf), "%s%swatchface.txt", srcFolder, DIR_SEPERATOR);
-	
-	// load watchface.txt
-	FILE * textFile = fopen(fileNameBuf,"rb");
-	if(textFile == NULL) {
-		printf("ERROR: Failed to open '%s' for reading\n", fileNameBuf);
-		return 1;
+// Convert src, from loadBlobSource() with the same atlas, to a bmp file (a jpeg is fitted to the size of its faceData),
+// or cut it from the atlas. Takes the file from src. Returns NULL on failure.
+static Bytes * newBlobBytesFromBlobSource(BlobSource * src, Atlas * atlas) {
+	if(src->cell == NULL) {
+		Bytes * bmp = newBMPFromImageBytes(src->file, src->fitWidth, src->fitHeight);
+		src->file = NULL;
+		return bmp;
 	}
+	if(atlas->bmp == NULL) {
+		atlas->bmp = newBMPFromImageBytes(atlas->file, 0, 0);
+		atlas->file = NULL;
+		if(atlas->bmp == NULL) {
+			return NULL;
+		}
+	}
+	Bytes * cell = NULL;
+	AtlasCell * c = src->cell;
+	if(newBMPCellFromBytes(atlas->bmp, c->x, c->y, c->w, c->h, &cell) != 0) {
+		return NULL;
+	}
+	return cell;
+}
 
-	FaceHeader h = { 0 };
-	ExtraFileInfo efi = { 0 };
-
-	char lineBuf[1024];
-	char * ptr = NULL;
-	u32 lineNumber = 1;
-	ImgCompression blobCompression[250] = { TRY_RLE };
-	char blobFileNames[250][256] = { 0 };
-
-	#define printWarning(s) printf("WARNING: in watchface.txt line %u: %s.\n", lineNumber, s)
-	#define printError(s) printf("ERROR: in watchface.txt line %u: %s.\n", lineNumber, s)
-
-	while(1) {
-		ptr = fgets(lineBuf, sizeof(lineBuf), textFile);
-		if(ptr == NULL) break;				// stop if there's no more data to read
-		if(strlen(lineBuf)==0) continue;	// check for empty lines
-		if(lineBuf[0]=='#') continue;		// ignore comments
+// Load blob i of spec as a bmp file: from its own file (converted from png, qoi or jpeg, if it is one), or cut from
+// an atlas, which stays loaded in atlas for the following blobs. A jpeg is fitted to the size of its faceData. The
+// path is put in fileName, for messages. Returns NULL on failure.
+static Bytes * newBlobBytesFromSource(char * srcFolder, Archive * archive, FaceSpec * spec, u32 i, Atlas * atlas, char * fileName, size_t fileNameSize) {
+	BlobSource src;
+	if(loadBlobSource(srcFolder, archive, spec, i, atlas, &src, fileName, fileNameSize) != 0) {
+		return NULL;
+	}
+	Bytes * bmp = newBlobBytesFromBlobSource(&src, atlas);
+	clearBlobSource(&src);
+	return bmp;
+}
 
-		TokensIdx tok;
-		getTokensIdx(lineBuf, &tok);
-		if(tok.count < 2) {	// we don't have any single-token commands
-			continue;
-		}
-		if(streqn(tok.ptr[0], "fileType", 8)) {
-			efi.fileType = tok.ptr[1][0];
-		} else if(streqn(tok.ptr[0], "fileID", 6)) {
-			h.fileID = (u8)readNum(tok.ptr[1]);
-		} else if(streqn(tok.ptr[0], "faceNumber", 10)) {
-			h.faceNumber = (u16)readNum(tok.ptr[1]);
-		} else if(streqn(tok.ptr[0], "dataCount", 9)) {
-			// We'll calculate this ourselves
-		} else if(streqn(tok.ptr[0], "blobCount", 9)) {
-			h.blobCount = (u8)readNum(tok.ptr[1]);
-		} else if(streqn(tok.ptr[0], "animationFrames", 15)) {
-			efi.animationFrames = (u16)readNum(tok.ptr[1]);
-		} else if(streqn(tok.ptr[0], "blobCompression", 15)) {
-			if(tok.count >= 3) {
-				u8 blobIdx = (u8)readNum(tok.ptr[1]);
-				if(streqn(tok.ptr[2], "NONE", 4)) {
-					blobCompression[blobIdx] = NONE;
-				} else if(streqn(tok.ptr[2], "RLE_LINE", 8)) {
-					blobCompression[blobIdx] = RLE_LINE;
-				} else if(streqn(tok.ptr[2], "RLE_BASIC", 9)) {
-					blobCompression[blobIdx] = RLE_BASIC;
-				} else if(streqn(tok.ptr[2], "TRY_RLE", 7)) {
-					blobCompression[blobIdx] = TRY_RLE;
-				} else {
-					printWarning("Unsupported requested blobCompression");
-					continue;
-				}
-			}
-		} else if(streqn(tok.ptr[0], "faceData", 8)) {
-			// check enough tokens
-			if(tok.count < 7) {
-				printWarning("Insufficient tokens for faceData");
-				continue;
-			}
-			FaceData * fd = &h.faceData[h.dataCount];
-			// type could be a string:
-			if(isNum(tok.ptr[1])) {
-				fd->type = (u8)readNum(tok.ptr[1]);					// read the data type
-			} else {
-				fd->type = (u8)getDataTypeTypeFromStr(tok.ptr[1]);	// look up string to find the data type
-			}
-			fd->idx = (u8)readNum(tok.ptr[2]);
-			fd->x = (u16)readNum(tok.ptr[3]);
-			fd->y = (u16)readNum(tok.ptr[4]);
-			fd->w = (u16)readNum(tok.ptr[5]);
-			fd->h = (u16)readNum(tok.ptr[6]);
-	
-			// handle a filename, if we're given one. it could also be a comment.
-			if(tok.count >= 8) {
-				if(tok.length[7] > 0 && tok.ptr[7][0] != '#' && tok.length[7] < 256) {
-					// get the filename
-					char buf[256] = { 0 };
-					memcpy(&buf[0], tok.ptr[7], tok.length[7]);
-					// see if it makes sense
-					// we assume the last 7 characters are [0-9][0-9][0-9].bmp
-					if(strlen(buf) < 7) {
-						// don't bother with this one
-						printf("blobFileName specified isn't in the required prefix[0-9][0-9][0-9].bmp format\n");
-					} else {
-						// save it to all the following blob file names
-						u32 offset = (u32)strlen(buf) - 7;
-						u32 num = readNum(&buf[offset]);
-						u32 count = 1;
-						int dti = getDataTypeIdx(fd->type);
-						if(dti != -1) {
-							count = dataTypes[dti].count;
-						}
-						// TODO: Make sure ANIMATIONS have the correct count (and weather, etc.)
-						for(u32 j=0; j<count; j++) {
-							sprintf(&buf[offset], "%03u.bmp", num+j);
-							//printf("Determined file name for blob %03u would be: '%s'\n", fd->idx + j, buf);
-							strcpy(blobFileNames[fd->idx + j], buf);
-						}
-					}
-				}
-			}
+// The encoded blobs of a bin file, waiting to be assembled
+typedef struct _EncodedBlobs {
+	u32 count;
+	Bytes * bytes[250];		// blob from the cache or a .raw file, or
+	Img * imgs[250];		// newly encoded blob
+	u8 previewCompression;	// for the preview left out by encodeBin()
+} EncodedBlobs;
+
+// A preview image to draw, instead of loading it from a file
+typedef struct _FacePreview {
+	u32 w;
+	u32 h;
+	FaceState state;		// what the face shows in it
+} FacePreview;
+
+static void deleteEncodedBlobs(EncodedBlobs * e) {
+	for(u32 i=0; i<e->count; i++) {
+		e->bytes[i] = deleteBytes(e->bytes[i]);
+		e->imgs[i] = deleteImg(e->imgs[i]);
+	}
+	free(e);
+}
 
-			h.dataCount ++;
-		} else {
-			printWarning("Unrecognised token");
+// Get pointers to the data and sizes of the blobs. Missing blobs have a size of 0.
+static void getEncodedBlobData(EncodedBlobs * e, const u8 * blobData[250], size_t blobSizes[250]) {
+	for(u32 i=0; i<250; i++) {
+		blobData[i] = NULL;
+		blobSizes[i] = 0;
+		if(i < e->count && e->bytes[i] != NULL) {
+			blobData[i] = e->bytes[i]->data;
+			blobSizes[i] = e->bytes[i]->size;
+		} else if(i < e->count && e->imgs[i] != NULL) {
+			blobData[i] = e->imgs[i]->data;
+			blobSizes[i] = e->imgs[i]->size;
 		}
-
-		lineNumber ++;
 	}
+}
 
-	// Do some sanity checks
-	if(efi.fileType != 'C') {
-		printError("fileType is not (yet) supported");
+// Assemble h and the blobs into one buffer of exactly the right size. The offsets in h are filled in.
+// Returns 0 for success, with the file data in *out.
+static int assembleBin(FaceHeader * h, EncodedBlobs * e, Bytes ** out) {
+	const u8 * blobData[250];
+	size_t blobSizes[250];
+	getEncodedBlobData(e, blobData, blobSizes);
+
+	size_t size = 0;
+	dawftAssembleBin(h, blobData, blobSizes, NULL, 0, &size);
+	Bytes * bin = malloc(sizeof(Bytes) + size);
+	if(bin == NULL) {
+		printf("ERROR: Out of memory.\n");
 		return 1;
 	}
-	if(h.dataCount < 1) {
-		printError("No faceData lines founds");
+	if(dawftAssembleBin(h, blobData, blobSizes, bin->data, size, &bin->size) != DAWFT_OK) {
+		deleteBytes(bin);
 		return 1;
 	}
+	*out = bin;
+	return 0;
+}
+
+// Encode all the blobs of the bin file from srcFolder, or from archive if it isn't NULL. If cache is not NULL, encoded blobs
+// are reused from (and saved to) it. If skipPreview is true, the preview image isn't loaded, and its blob (the last one,
+// added if the last bitmap is part of a faceData) is left empty for addPreview(). Returns 0 for success, with the header
+// (offsets not filled in) in *hOut and the blobs in *out. Delete them with deleteEncodedBlobs.
+static int encodeBin(char * srcFolder, Archive * archive, BlobCache * cache, bool skipPreview, FaceHeader * hOut, EncodedBlobs ** out) {
+	char fileNameBuf[1024];
+	char name[1024];
+	Atlas atlas = { 0 };
 
-	if(h.blobCount < 1) {
-		printError("blobCount must be at least 1");
+	// load watchface.txt
+	FaceSpec spec;
+	if(loadFaceSpec(srcFolder, archive, &spec) != 0) {
 		return 1;
 	}
 
-	// Save animation frames
-	if(efi.fileType == 'A') {
-		h.sizes[200] = efi.animationFrames;
-	} else {
-		h.sizes[0] = efi.animationFrames;
+	FaceHeader h = spec.h;
+	if(skipPreview && h.blobCount > 0 && spec.blobFaceData[h.blobCount - 1] != -1) {
+		if(h.blobCount >= 250) {
+			printf("ERROR: No room for a preview image, there are already 250 bitmaps.\n");
+			return 1;
+		}
+		h.blobCount++;
 	}
 
-	// create output file
-	
-	FILE * binFile = fopen(outputFileName, "wb");
-	if(binFile == NULL) {
-		printf("ERROR: Failed to open '%s' for writing\n", outputFileName);
+	EncodedBlobs * enc = calloc(1, sizeof(EncodedBlobs));
+	if(enc == NULL) {
+		printf("ERROR: Out of memory.\n");
 		return 1;
 	}
+	enc->count = h.blobCount;
+	enc->previewCompression = spec.blobCompression[h.blobCount - 1];
 
-	// start at the appropriate offset
-	fseek(binFile, sizeof(FaceHeader), SEEK_SET);
-
-	// if we find the background image, save it for alpha blending
+	// if we find the background image, save it for alpha blending. it is only converted and decoded when needed.
 	Img * backgroundImg = NULL;
+	Bytes * backgroundBytes = NULL;
+	BlobSource backgroundSrc = { 0 };
+	u64 backgroundHash = 0;
+	bool haveBackground = false;
+	int fail = 0;
+	u32 reused = 0;				// counted here, as the cache may be shared by several creates at once
+	u32 encoded = 0;
+
+	if(cache != NULL) {
+		beginBlobCache(cache);
+	}
+
+	// read and encode bitmaps
+	for(int i=0; i<h.blobCount && !fail; i++) {
+		if(skipPreview && i == h.blobCount - 1) {
+			break;
+		}
 
-	u32 offset = 0;
-	// read and dump bitmaps
-	for(int i=0; i<h.blobCount; i++) {
 		// get faceData for this blob, if it exists
-		int fdi = getFaceDataIndexFromOffsetIndex(i, &h, &efi);
+		int fdi = spec.blobFaceData[i];
 		FaceData * fd = NULL;
 		if(fdi != -1) {
 			fd = &h.faceData[fdi];
 		}
 
-		// Try and load the image from the file
-		snprintf(fileNameBuf, sizeof(fileNameBuf), "%s%s%03u.bmp", srcFolder, DIR_SEPERATOR, i);
-		if(blobFileNames[i][0] != 0) {			
-			snprintf(fileNameBuf, sizeof(fileNameBuf), "%s%s%s", srcFolder, DIR_SEPERATOR, blobFileNames[i]);
+		// Read the image file, or find its atlas cell. It isn't decoded unless it has to be encoded.
+		BlobSource src;
+		if(loadBlobSource(srcFolder, archive, &spec, (u32)i, &atlas, &src, fileNameBuf, sizeof(fileNameBuf)) != 0) {
+			printf("ERROR: Unable to read file.\n");
 		}
+		bool loaded = (src.file != NULL || src.cell != NULL);
+
 		Img * img = NULL;
-		if(fd != NULL) {			
-			img = newImgFromFile(fileNameBuf, backgroundImg, fd->x, fd->y);
-		} else {
-			img = newImgFromFile(fileNameBuf, NULL, 0, 0);
+		Bytes * payload = NULL;		// encoded blob, if it was cached
+		bool isBackground = (fd != NULL && fd->type == 0x01 && fd->x == 0 && fd->y == 0 && !haveBackground);
+		bool canBlend = (fd != NULL && haveBackground);
+		u64 plainKey = 0;
+		u64 blendKey = 0;
+		int needsBackground = -1;
+
+		// look for the encoded blob in the cache, keyed by the source, so a hit needs no decoding. whether it is
+		// blended (and so keyed by the background too) is remembered from when it was last decoded.
+		if(loaded && cache != NULL) {
+			plainKey = blobCacheKey(src.hash, spec.blobCompression[i], 0, 0, 0);
+			blendKey = canBlend ? blobCacheKey(src.hash, spec.blobCompression[i], backgroundHash, fd->x, fd->y) : plainKey;
+			needsBackground = canBlend ? needsBackgroundFromBlobCache(cache, src.hash) : 0;
+			if(needsBackground >= 0) {
+				payload = newBytesFromBlobCache(cache, needsBackground ? blendKey : plainKey);
+			}
+		}
+
+		u64 key = plainKey;
+		if(loaded && payload == NULL) {
+			Bytes * srcBytes = newBlobBytesFromBlobSource(&src, &atlas);
+			if(srcBytes == NULL) {
+				printf("ERROR: Unable to read file.\n");
+			} else {
+				bool blend = (canBlend && bmpNeedsBackground(srcBytes));
+				if(cache != NULL && needsBackground < 0) {
+					saveNeedsBackgroundToBlobCache(cache, src.hash, blend);
+				}
+				if(blend) {
+					key = blendKey;
+				}
+				if(blend && backgroundImg == NULL && cache != NULL) {
+					backgroundImg = newImgFromBlobCache(cache, backgroundHash);
+				}
+				if(blend && backgroundImg == NULL) {
+					if(backgroundBytes == NULL) {
+						backgroundBytes = newBlobBytesFromBlobSource(&backgroundSrc, &atlas);
+					}
+					backgroundImg = (backgroundBytes != NULL) ? newImgFromBytes(backgroundBytes, NULL, 0, 0) : NULL;
+					if(backgroundImg != NULL && cache != NULL) {
+						saveImgToBlobCache(cache, backgroundHash, backgroundImg);
+					}
+				}
+				if(fd != NULL) {
+					img = newImgFromBytes(srcBytes, backgroundImg, fd->x, fd->y);
+				} else {
+					img = newImgFromBytes(srcBytes, NULL, 0, 0);
+				}
+			}
+
+			// if it's a background, in top left corner, let's save it for possible alpha blending
+			if(isBackground && img != NULL) {
+				backgroundBytes = srcBytes;
+				srcBytes = NULL;
+				backgroundImg = cloneImg(img);
+				if(backgroundImg != NULL && cache != NULL) {
+					saveImgToBlobCache(cache, src.hash, backgroundImg);
+				}
+			}
+			deleteBytes(srcBytes);
+		}
+
+		// a cached background is kept as its source, and only converted if something is blended onto it. a cell is
+		// converted now, as the atlas it is cut from may not be loaded by then.
+		if(isBackground && (payload != NULL || img != NULL)) {
+			haveBackground = true;
+			backgroundHash = src.hash;
+			if(payload != NULL && src.cell != NULL) {
+				backgroundBytes = newBlobBytesFromBlobSource(&src, &atlas);
+			} else if(payload != NULL) {
+				backgroundSrc = src;
+				src.file = NULL;
+			}
 		}
+		clearBlobSource(&src);
 		
-		if(img == NULL) {
+		if(img == NULL && payload == NULL) {
 			// Couldn't load the image. Try loading a raw blob instead.
 			printf("WARNING: Unable to load image from file '%s', looking for .raw file...\n", fileNameBuf);
-			snprintf(fileNameBuf, sizeof(fileNameBuf), "%s%s%03u.raw", srcFolder, DIR_SEPERATOR, i);
-			Bytes * rawBytes = newBytesFromFile(fileNameBuf);
+			snprintf(name, sizeof(name), "%03u.raw", i);
+			Bytes * rawBytes = newBytesFromSource(srcFolder, archive, name, fileNameBuf, sizeof(fileNameBuf));
 			if(rawBytes == NULL) {
 				printf("ERROR: Unable to load raw file '%s'. Giving up on this image.\n", fileNameBuf);
-				h.offsets[i] = offset; // save something in the offset table...
 				continue;
 			}
-
-			// save the data offset to appropriate place in offset table
-			h.offsets[i] = offset;
-			offset += rawBytes->size;
-
-			// save the raw data to the binfile
-			size_t r1 = fwrite(rawBytes->data, 1, rawBytes->size, binFile);
-			if(r1 != rawBytes->size) {
-				printf("ERROR: Unable to write raw data to output file.\n");
-				deleteBytes(rawBytes);
-				fclose(binFile);
-				remove(outputFileName);
-				deleteImg(img);
-				return 1;
-			}
-			
+			enc->bytes[i] = rawBytes;
 			printf("'%s' loaded. Size %7zu.\n", fileNameBuf, rawBytes->size);
-			deleteBytes(rawBytes);
+			continue;
+		}
+
+		if(payload != NULL) {
+			// Use the cached blob as-is
+			enc->bytes[i] = payload;
+			reused++;
+			printf("'%s' cached. Size %7zu.\n", fileNameBuf, payload->size);
 			continue;
 		}
 
@@ -695,109 +595,2765 @@ static int createBin(char * srcFolder, char * outputFileName) {
 					printf("WARNING: Width/Height mismatch for bitmap %03u. File: %ux%u, faceData(type 0x%02X): %ux%u\n", i, img->w, img->h, fd->type, fd->w, fd->h);
 				}
 			}
-
-			// if it's a background, in top left corner, let's save it for possible alpha blending
-			if(fd->type == 0x01 && fd->x == 0 && fd->y == 0 && backgroundImg == NULL) {
-				backgroundImg = cloneImg(img);
-			}
 		}
 
 		// compress the image, if it saves space and aren't told otherwise
-		if(blobCompression[i] != NONE) {
+		if(spec.blobCompression[i] != NONE) {
 			int r = compressImg(img);
 			if(r != 0) {
 				printf("ERROR: compressImg() failed with error code %d\n", r);
-				fclose(binFile);
-				remove(outputFileName);
 				deleteImg(img);
-				return 1;
+				fail = 1;
+				break;
 			}
 		}
 
-		// save the data offset to appropriate place in offset table
-		h.offsets[i] = offset;
-		offset += img->size;
-
-		// save the image data to the binfile
-		size_t r1 = fwrite(img->data, 1, img->size, binFile);
-		if(r1 != img->size) {
-			printf("ERROR: Unable to write image to output file.\n");
-			fclose(binFile);
-			remove(outputFileName);
-			deleteImg(img);
-			return 1;
+		// save the encoded blob for next time
+		if(cache != NULL) {
+			encoded++;
+			if(saveToBlobCache(cache, key, img->data, img->size) != 0) {
+				printf("WARNING: Unable to save blob %03u to cache.\n", i);
+			}
 		}
-		
+
+		enc->imgs[i] = img;
 		printf("'%s' loaded. Size %7u.\n", fileNameBuf, img->size);
-		deleteImg(img);
 	}
 
 	// dispose of background image, if we used it
 	backgroundImg = deleteImg(backgroundImg);
+	backgroundBytes = deleteBytes(backgroundBytes);
+	clearBlobSource(&backgroundSrc);
+	clearAtlas(&atlas);
 
-	// dump header
-	fseek(binFile, 0, SEEK_SET);
-	size_t r = fwrite((u8 *)&h, 1, sizeof(FaceHeader), binFile);
-	if(r != sizeof(FaceHeader)) {
-		printf("ERROR: Unable to write header to output file.\n");
-		fclose(binFile);
-		remove(outputFileName);
+	if(fail) {
+		deleteEncodedBlobs(enc);
 		return 1;
 	}
 
-	fclose(binFile);
-	printf("Done. Size %zu.\n", offset + sizeof(FaceHeader));
+	if(cache != NULL) {
+		printf("Blob cache: %u reused, %u encoded.\n", reused, encoded);
+	}
+	*hOut = h;
+	*out = enc;
 	return 0; // SUCCESS
 }
 
+// Build a bin file in memory from srcFolder, or from archive if it isn't NULL. If cache is not NULL, encoded blobs are
+// reused from (and saved to) it. All the blobs are encoded first, so the file can be assembled in a buffer of exactly
+// the right size. Returns 0 for success, with the file data in *out. Delete it with deleteBytes.
+static int buildBin(char * srcFolder, Archive * archive, BlobCache * cache, Bytes ** out) {
+	FaceHeader h;
+	EncodedBlobs * enc = NULL;
+	if(encodeBin(srcFolder, archive, cache, false, &h, &enc) != 0) {
+		return 1;
+	}
+	int r = assembleBin(&h, enc, out);
+	deleteEncodedBlobs(enc);
+	return r;
+}
 
-//----------------------------------------------------------------------------
-//  MAIN
-//----------------------------------------------------------------------------
+// Write all of b to fileName, via a temporary file and rename(), so fileName is replaced atomically
+// and a failure never leaves a partly written file. Returns 0 for success.
+static int saveBytesToFile(char * fileName, Bytes * b) {
+	char tempFileName[1100];
+	snprintf(tempFileName, sizeof(tempFileName), "%s.tmp", fileName);
 
-int main(int argc, char * argv[]) {
-	char * fileName = "";
-	char * folderName = "";
-	enum _MODE {
-		HELP,
-		INFO,
-		DUMP,
-		CREATE,
-		PRINT_TYPES,
-	} mode = HELP;
-	bool raw = false;
-	char fileType = 0;
+	FILE * f = fopen(tempFileName, "wb");
+	if(f == NULL) {
+		printf("ERROR: Failed to open '%s' for writing\n", tempFileName);
+		return 1;
+	}
 
-	// display basic program header
-    printf("\n%s\n\n","dawft: Watch Face Tool for MO YOUNG / DA FIT binary watch face files.");
-    
-	// check byte order
-	if(!systemIsLittleEndian()) {
-		printf("Sorry, this system is big-endian, and this program has only been designed for little-endian systems.\n");
+	size_t r = fwrite(b->data, 1, b->size, f);
+	if(fclose(f) != 0 || r != b->size) {
+		printf("ERROR: Unable to write to output file.\n");
+		remove(tempFileName);
 		return 1;
 	}
 
-	// find executable name
-	char * basename = "mywft";
-	if(argc>0) {
-		// find the name of the executable. not perfect but it's only used for display and no messy ifdefs.
-		char * b = strrchr(argv[0],'\\');
-		if(!b) {
-			b = strrchr(argv[0],'/');
-		}
-		basename = b ? b+1 : argv[0];
+#ifdef WINDOWS
+	remove(fileName);		// rename() won't replace an existing file
+#endif
+	if(rename(tempFileName, fileName) != 0) {
+		printf("ERROR: Failed to rename '%s' to '%s'\n", tempFileName, fileName);
+		remove(tempFileName);
+		return 1;
 	}
-  
-	// read mode argument
-	if(argc >= 2) {
-		if(streq(argv[1], "dump")) {
-			mode = DUMP;
-		} else if(streq(argv[1], "create")) {
-			mode = CREATE;
-		} else if(streq(argv[1], "info")) {
-			mode = INFO;
-		} else if(streq(argv[1], "print_types")) {
-			mode = PRINT_TYPES;
+	return 0;
+}
+
+#ifndef WINDOWS
+
+// Shared by the threads of writeBinParallel()
+typedef struct _BlobWriter {
+	int fd;
+	const u8 ** blobData;
+	size_t * blobSizes;
+	const FaceHeader * h;
+	u32 next;				// next blob to write
+	bool failed;
+	pthread_mutex_t lock;
+} BlobWriter;
+
+// pwrite() all of size bytes of data at offset. Returns true for success.
+static bool pwriteFull(int fd, const u8 * data, size_t size, off_t offset) {
+	while(size > 0) {
+		ssize_t n = pwrite(fd, data, size, offset);
+		if(n <= 0) {
+			return false;
+		}
+		data += n;
+		size -= (size_t)n;
+		offset += n;
+	}
+	return true;
+}
+
+static void * blobWriterThread(void * arg) {
+	BlobWriter * w = arg;
+	while(1) {
+		pthread_mutex_lock(&w->lock);
+		u32 i = w->next++;
+		pthread_mutex_unlock(&w->lock);
+		if(i >= w->h->blobCount || i >= 250) {
+			break;
+		}
+		off_t offset = (off_t)sizeof(FaceHeader) + w->h->offsets[i];
+		if(w->blobSizes[i] > 0 && !pwriteFull(w->fd, w->blobData[i], w->blobSizes[i], offset)) {
+			pthread_mutex_lock(&w->lock);
+			w->failed = true;
+			pthread_mutex_unlock(&w->lock);
+		}
+	}
+	return NULL;
+}
+
+// Write h and the blobs to fileName, via a temporary file and rename(). The file is allocated at its final size, and
+// threadCount threads pwrite() the blobs at their final offsets at the same time. The header is written last.
+// The offsets in h are filled in. Returns 0 for success, with the file size in *size.
+static int writeBinParallel(char * fileName, FaceHeader * h, EncodedBlobs * e, u32 threadCount, size_t * size) {
+	const u8 * blobData[250];
+	size_t blobSizes[250];
+	getEncodedBlobData(e, blobData, blobSizes);
+	if(dawftAssembleBin(h, blobData, blobSizes, NULL, 0, size) != DAWFT_ERR_BUFFER) {	// fills in the offsets and gets the size
+		printf("ERROR: Failed to assemble '%s'\n", fileName);
+		return 1;
+	}
+
+	char tempFileName[1100];
+	snprintf(tempFileName, sizeof(tempFileName), "%s.tmp", fileName);
+	int fd = open(tempFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		printf("ERROR: Failed to open '%s' for writing\n", tempFileName);
+		return 1;
+	}
+
+#ifdef __linux__
+	bool allocated = (posix_fallocate(fd, 0, (off_t)*size) == 0);
+#else
+	bool allocated = false;
+#endif
+	if(!allocated && ftruncate(fd, (off_t)*size) != 0) {
+		printf("ERROR: Unable to write to output file.\n");
+		close(fd);
+		remove(tempFileName);
+		return 1;
+	}
+
+	BlobWriter w = { .fd = fd, .blobData = blobData, .blobSizes = blobSizes, .h = h };
+	pthread_mutex_init(&w.lock, NULL);
+	if(threadCount > h->blobCount) {
+		threadCount = h->blobCount;
+	}
+	pthread_t threads[256];
+	u32 started = 0;
+	for(; started < threadCount && started < 256; started++) {
+		if(pthread_create(&threads[started], NULL, blobWriterThread, &w) != 0) {
+			break;
+		}
+	}
+	blobWriterThread(&w);		// help out, and make sure it gets done even if no threads started
+	for(u32 i=0; i<started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&w.lock);
+
+	bool ok = !w.failed && pwriteFull(fd, (const u8 *)h, sizeof(FaceHeader), 0);
+	if(close(fd) != 0 || !ok) {
+		printf("ERROR: Unable to write to output file.\n");
+		remove(tempFileName);
+		return 1;
+	}
+
+	if(rename(tempFileName, fileName) != 0) {
+		printf("ERROR: Failed to rename '%s' to '%s'\n", tempFileName, fileName);
+		remove(tempFileName);
+		return 1;
+	}
+	return 0;
+}
+
+#endif
+
+// Draw the preview image into the last blob of e, which encodeBin() left empty, by drawing the rest of the face and
+// shrinking it. Returns 0 for success.
+static int addPreview(FaceHeader * h, EncodedBlobs * e, const FacePreview * preview) {
+	// the face is drawn from a bin file without the preview
+	FaceHeader noPreview = *h;
+	noPreview.blobCount--;
+	Bytes * bin = NULL;
+	if(assembleBin(&noPreview, e, &bin) != 0) {
+		return 1;
+	}
+	FaceRenderer * r = newFaceRenderer(bin->data, bin->size, 'C');
+	deleteBytes(bin);
+	if(r == NULL) {
+		printf("ERROR: Unable to draw the face for the preview image.\n");
+		return 1;
+	}
+	if(preview->w > r->width || preview->h > r->height) {
+		printf("ERROR: The preview image can't be bigger than the screen (%ux%u).\n", r->width, r->height);
+		deleteFaceRenderer(r);
+		return 1;
+	}
+
+	Img * img = malloc(sizeof(Img));
+	u8 * pixels = malloc((size_t)preview->w * preview->h * 2);
+	if(img == NULL || pixels == NULL) {
+		printf("ERROR: Out of memory.\n");
+		free(img);
+		free(pixels);
+		deleteFaceRenderer(r);
+		return 1;
+	}
+	*img = (Img){ .w = preview->w, .h = preview->h, .compression = NONE, .size = preview->w * preview->h * 2, .data = pixels };
+	int er = renderPreview(r, &preview->state, preview->w, preview->h, pixels);
+	deleteFaceRenderer(r);
+	if(er != DAWFT_OK) {
+		printf("ERROR: Unable to draw the preview image.\n");
+		deleteImg(img);
+		return 1;
+	}
+	if(e->previewCompression != NONE) {
+		er = compressImg(img);
+		if(er != 0) {
+			printf("ERROR: compressImg() failed with error code %d\n", er);
+			deleteImg(img);
+			return 1;
+		}
+	}
+	e->imgs[e->count - 1] = img;
+	printf("Preview %03u drawn. Size %7u.\n", e->count - 1, img->size);
+	return 0;
+}
+
+// Create a bin file from srcFolder, or from archive if it isn't NULL. If cache is not NULL, encoded blobs are reused from
+// (and saved to) it. If preview isn't NULL, the preview image is drawn from the face instead of loaded. Once every blob is
+// encoded, threadCount threads write them to the file (except on Windows). If out isn't NULL, the bin file is written to
+// it, in one go, instead of to outputFileName.
+static int createBin(char * srcFolder, Archive * archive, char * outputFileName, FILE * out, BlobCache * cache,
+		const FacePreview * preview, u32 threadCount) {
+	printf("Creating '%s' from %s '%s'.\n", outputFileName, (archive != NULL && archive->bytes != NULL) ? "archive" : "folder", srcFolder);
+
+	FaceHeader h;
+	EncodedBlobs * enc = NULL;
+	if(encodeBin(srcFolder, archive, cache, preview != NULL, &h, &enc) != 0) {
+		return 1;
+	}
+	if(preview != NULL && addPreview(&h, enc, preview) != 0) {
+		deleteEncodedBlobs(enc);
+		return 1;
+	}
+
+	size_t size = 0;
+	int r = 0;
+#ifndef WINDOWS
+	if(out == NULL) {
+		r = writeBinParallel(outputFileName, &h, enc, threadCount, &size);
+	} else
+#else
+	(void)threadCount;
+#endif
+	{
+		Bytes * bin = NULL;
+		r = assembleBin(&h, enc, &bin);
+		if(r == 0) {
+			size = bin->size;
+			r = (out != NULL) ? writeBytesToStream(out, bin) : saveBytesToFile(outputFileName, bin);
+		}
+		deleteBytes(bin);
+	}
+	deleteEncodedBlobs(enc);
+	if(r == 0) {
+		printf("Done. Size %zu.\n", size);
+	}
+	return r;
+}
+
+
+//----------------------------------------------------------------------------
+//  CREATEBINSTREAMING - Create a bin file a row at a time, to bound memory use
+//----------------------------------------------------------------------------
+
+// Write the bmp being read by r to f, a row at a time. Unless compression is NONE, RLE_LINE is tried first, and kept if
+// it is smaller. Each row is also copied to bg, if it isn't NULL. Returns the size written, or 0 for failure.
+static size_t streamBlob(FILE * f, BMPReader * r, u8 compression, Img * bg) {
+	size_t rawSize = (size_t)r->w * r->h * 2;
+	size_t tableSize = 2 + 2 * (size_t)r->h;		// RLE_LINE identifier and line end offsets
+	size_t rleRowSize = ((size_t)r->w + 1) * 3;
+	long start = ftell(f);
+
+	u8 * row = malloc(r->w * 2);
+	u8 * rleRow = malloc(rleRowSize);
+	u8 * table = calloc(1, tableSize);
+	if(row == NULL || rleRow == NULL || table == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		free(row);
+		free(rleRow);
+		free(table);
+		return 0;
+	}
+
+	size_t offset = 0;
+	bool compressed = false;
+	if(compression != NONE) {
+		// same limit as compressImg()
+		size_t minSize = tableSize + (r->w + 255) / 255 * 3 * r->h;
+		if(minSize > 65535) {
+			printf("Note: Image too large to be RLE_LINE encoded.\n");
+			goto done;
+		}
+		table[0] = 0x08;
+		table[1] = 0x21;
+		offset = tableSize;
+		compressed = (tableSize < rawSize && fwrite(table, 1, tableSize, f) == tableSize);
+		for(u32 y=0; compressed && y<r->h; y++) {
+			if(readBMPRow(r, y, row) != 0) {
+				offset = 0;
+				goto done;
+			}
+			if(bg != NULL) {
+				memcpy(&bg->data[y * bg->w * 2], row, r->w * 2);
+			}
+			size_t size = encodeRLERow(row, r->w, rleRow, rleRowSize);
+			if(offset + size >= rawSize || offset + size > 65535) {
+				compressed = false;		// not worth it, or can't store 16-bit offsets
+				break;
+			}
+			if(fwrite(rleRow, 1, size, f) != size) {
+				offset = 0;
+				goto done;
+			}
+			offset += size;
+			set_u16(&table[2+y*2], (u16)offset);
+		}
+		if(compressed) {
+			// go back and fill in the line end offsets
+			if(fseek(f, start, SEEK_SET) != 0 || fwrite(table, 1, tableSize, f) != tableSize || fseek(f, start + (long)offset, SEEK_SET) != 0) {
+				offset = 0;
+			}
+			goto done;
+		}
+	}
+
+	// store it uncompressed
+	offset = 0;
+	if(fseek(f, start, SEEK_SET) != 0) {
+		goto done;
+	}
+	for(u32 y=0; y<r->h; y++) {
+		if(readBMPRow(r, y, row) != 0 || fwrite(row, 1, r->w * 2, f) != r->w * 2) {
+			goto done;
+		}
+		if(bg != NULL) {
+			memcpy(&bg->data[y * bg->w * 2], row, r->w * 2);
+		}
+	}
+	offset = rawSize;
+
+done:
+	free(row);
+	free(rleRow);
+	free(table);
+	return offset;
+}
+
+// Copy the file fileName to the end of f. Returns the size written, or 0 for failure.
+static size_t streamRawBlob(FILE * f, char * fileName) {
+	FILE * src = fopen(fileName, "rb");
+	if(src == NULL) {
+		return 0;
+	}
+	u8 buf[65536];
+	size_t total = 0;
+	size_t n;
+	while((n = fread(buf, 1, sizeof(buf), src)) > 0) {
+		if(fwrite(buf, 1, n, f) != n) {
+			total = 0;
+			break;
+		}
+		total += n;
+	}
+	fclose(src);
+	return total;
+}
+
+// Create a bin file from srcFolder, like createBin(), but reading, converting, blending and encoding each bitmap a row
+// at a time, straight to the output file. Only a few rows of each bitmap, and the background, are kept in memory.
+static int createBinStreaming(char * srcFolder, char * outputFileName) {
+	printf("Creating '%s' from folder '%s', a row at a time.\n", outputFileName, srcFolder);
+
+	// load watchface.txt
+	FaceSpec * spec = malloc(sizeof(FaceSpec));
+	if(spec == NULL) {
+		printf("ERROR: Out of memory.\n");
+		return 1;
+	}
+	if(loadFaceSpec(srcFolder, NULL, spec) != 0) {
+		free(spec);
+		return 1;
+	}
+	FaceHeader * h = &spec->h;
+
+	// create a temporary output file, with room for the header, which is filled in at the end
+	char tempFileName[1100];
+	snprintf(tempFileName, sizeof(tempFileName), "%s.tmp", outputFileName);
+	FILE * binFile = fopen(tempFileName, "wb");
+	if(binFile == NULL) {
+		printf("ERROR: Failed to open '%s' for writing\n", tempFileName);
+		free(spec);
+		return 1;
+	}
+	if(fwrite(h, 1, sizeof(FaceHeader), binFile) != sizeof(FaceHeader)) {
+		printf("ERROR: Unable to write to output file.\n");
+		fclose(binFile);
+		remove(tempFileName);
+		free(spec);
+		return 1;
+	}
+
+	// if we find the background image, keep it for alpha blending
+	Img * backgroundImg = NULL;
+	Atlas atlas = { 0 };
+	u32 offset = 0;
+	int fail = 0;
+
+	for(int i=0; i<h->blobCount && !fail; i++) {
+		// get faceData for this blob, if it exists
+		int fdi = spec->blobFaceData[i];
+		FaceData * fd = NULL;
+		if(fdi != -1) {
+			fd = &h->faceData[fdi];
+		}
+
+		char name[300];
+		char fileNameBuf[1024];
+		if(spec->blobFileNames[i][0] != 0) {
+			snprintf(name, sizeof(name), "%s", spec->blobFileNames[i]);
+		} else {
+			getDefaultBlobName(srcFolder, NULL, (u32)i, name, sizeof(name));
+		}
+		snprintf(fileNameBuf, sizeof(fileNameBuf), "%s%s%s", srcFolder, DIR_SEPERATOR, name);
+
+		// bmp files are read a row at a time. Cells of an atlas are cut out in memory, and other formats are
+		// converted to bmp in memory.
+		Img * blendImg = (fd != NULL) ? backgroundImg : NULL;
+		u32 bpx = (fd != NULL) ? fd->x : 0;
+		u32 bpy = (fd != NULL) ? fd->y : 0;
+		Bytes * cellBytes = NULL;
+		BMPReader * r = NULL;
+		size_t nameLen = strlen(name);
+		if(!spec->blobAtlas[i] && nameLen >= 4 && streq(&name[nameLen-4], ".bmp")) {
+			r = newBMPReaderFromFile(fileNameBuf, blendImg, bpx, bpy);
+		} else {
+			cellBytes = newBlobBytesFromSource(srcFolder, NULL, spec, (u32)i, &atlas, fileNameBuf, sizeof(fileNameBuf));
+			if(cellBytes != NULL) {
+				r = newBMPReaderFromBytes(cellBytes, blendImg, bpx, bpy);
+			}
+		}
+
+		h->offsets[i] = offset;
+
+		if(r == NULL) {
+			// Couldn't load the image. Try loading a raw blob instead.
+			cellBytes = deleteBytes(cellBytes);
+			printf("WARNING: Unable to load image from file '%s', looking for .raw file...\n", fileNameBuf);
+			snprintf(fileNameBuf, sizeof(fileNameBuf), "%s%s%03u.raw", srcFolder, DIR_SEPERATOR, i);
+			size_t size = streamRawBlob(binFile, fileNameBuf);
+			if(size == 0) {
+				printf("ERROR: Unable to load raw file '%s'. Giving up on this image.\n", fileNameBuf);
+				continue;
+			}
+			offset += (u32)size;
+			printf("'%s' loaded. Size %7zu.\n", fileNameBuf, size);
+			continue;
+		}
+
+		// check the image makes sense when compared to the faceData item
+		if(fd != NULL && (fd->w != r->w || fd->h != r->h) && !(fd->type >= 0xD7 && fd->type <= 0xD9)) {
+			printf("WARNING: Width/Height mismatch for bitmap %03u. File: %ux%u, faceData(type 0x%02X): %ux%u\n", i, r->w, r->h, fd->type, fd->w, fd->h);
+		}
+
+		// if it's a background, in top left corner, let's keep it for possible alpha blending
+		Img * bg = NULL;
+		if(fd != NULL && fd->type == 0x01 && fd->x == 0 && fd->y == 0 && backgroundImg == NULL) {
+			bg = malloc(sizeof(Img));
+			if(bg != NULL) {
+				*bg = (Img){ .w = r->w, .h = r->h, .compression = NONE, .size = r->w * r->h * 2 };
+				bg->data = malloc(bg->size);
+			}
+			if(bg == NULL || bg->data == NULL) {
+				printf("ERROR: Out of memory.\n");
+				deleteImg(bg);
+				deleteBMPReader(r);
+				deleteBytes(cellBytes);
+				fail = 1;
+				break;
+			}
+		}
+
+		size_t size = streamBlob(binFile, r, spec->blobCompression[i], bg);
+		deleteBMPReader(r);
+		deleteBytes(cellBytes);
+		if(size == 0) {
+			printf("ERROR: Unable to write '%s' to output file.\n", fileNameBuf);
+			deleteImg(bg);
+			fail = 1;
+			break;
+		}
+		if(bg != NULL) {
+			backgroundImg = bg;
+		}
+		offset += (u32)size;
+		printf("'%s' loaded. Size %7zu.\n", fileNameBuf, size);
+	}
+
+	backgroundImg = deleteImg(backgroundImg);
+	clearAtlas(&atlas);
+
+	// fill in the header
+	if(!fail && (fseek(binFile, 0, SEEK_SET) != 0 || fwrite(h, 1, sizeof(FaceHeader), binFile) != sizeof(FaceHeader))) {
+		printf("ERROR: Unable to write to output file.\n");
+		fail = 1;
+	}
+	free(spec);
+	if(fclose(binFile) != 0 || fail) {
+		remove(tempFileName);
+		return 1;
+	}
+
+	// replace the output file in one go
+#ifdef WINDOWS
+	remove(outputFileName);		// rename() won't replace an existing file
+#endif
+	if(rename(tempFileName, outputFileName) != 0) {
+		printf("ERROR: Failed to rename '%s' to '%s'\n", tempFileName, outputFileName);
+		remove(tempFileName);
+		return 1;
+	}
+
+	printf("Done. Size %zu.\n", sizeof(FaceHeader) + offset);
+	return 0; // SUCCESS
+}
+
+
+//----------------------------------------------------------------------------
+//  SWAPBIN - Replace the background of an existing bin file
+//----------------------------------------------------------------------------
+
+// Decode the new background bgBytes for bg, from the cache if it is there. Returns NULL for failure.
+static Img * newBackgroundImg(Bytes * bgBytes, FaceData * bg, u64 bgHash, BlobCache * cache) {
+	Img * img = (cache != NULL) ? newImgFromBlobCache(cache, bgHash) : NULL;
+	if(img != NULL) {
+		return img;
+	}
+
+	// a photo is scaled and cropped to fit the background
+	Bytes * fitted = NULL;
+	if(isJPEG(bgBytes) && newBMPFromJPEG(bgBytes, bg->w, bg->h, &fitted) != 0) {
+		return NULL;
+	}
+	img = newImgFromBytes((fitted != NULL) ? fitted : bgBytes, NULL, 0, 0);
+	deleteBytes(fitted);
+	if(img == NULL) {
+		return NULL;
+	}
+	if(img->w != bg->w || img->h != bg->h) {
+		printf("ERROR: Background is %ux%u, but must be %ux%u.\n", img->w, img->h, bg->w, bg->h);
+		return deleteImg(img);
+	}
+	if(cache != NULL) {
+		saveImgToBlobCache(cache, bgHash, img);
+	}
+	return img;
+}
+
+// Build a copy of the type C bin file in bin, with its background replaced by the bitmap in bgBytes. The other blobs
+// are copied as-is, except that bitmaps blended onto the background are blended again from srcFolder, if it is given,
+// or from archive, if it isn't NULL and holds a watchface.txt. If cache is not NULL, the blobs encoded again are reused
+// from (and saved to) it, keyed as create keys them, so nothing is decoded for a background that has been used before.
+// Returns 0 for success, with the file data in *out. Delete it with deleteBytes.
+static int swapBin(Bytes * bin, char fileType, Bytes * bgBytes, char * srcFolder, Archive * archive, BlobCache * cache, Bytes ** out) {
+	FaceHeader h;
+	ExtraFileInfo xfi;
+	DawftBlob blobs[250];
+	u32 blobCount = 0;
+
+	if(dawftParseHeader(bin->data, bin->size, fileType, &h, &xfi) != DAWFT_OK) {
+		return 1;
+	}
+	if(xfi.fileType != 'C') {
+		printf("ERROR: Swapping the background is only supported for fileType C\n");
+		return 1;
+	}
+	if(dawftListBlobs(bin->data, bin->size, &h, &xfi, blobs, &blobCount) != DAWFT_OK) {
+		return 1;
+	}
+
+	// find the background, in the top left corner
+	FaceData * bg = NULL;
+	for(u32 i=0; i<(sizeof(h.faceData)/sizeof(h.faceData[0])); i++) {
+		FaceData * fd = &h.faceData[i];
+		if(fd->type == 0x01 && fd->x == 0 && fd->y == 0 && fd->idx < blobCount) {
+			bg = fd;
+			break;
+		}
+	}
+	if(bg == NULL) {
+		printf("ERROR: No background found.\n");
+		return 1;
+	}
+
+	// the watchface.txt this bin was created from tells us which bitmaps need blending
+	FaceSpec spec;
+	bool haveSpec = (archive != NULL) ? (findArchiveEntry(archive, "watchface.txt") != NULL) : (srcFolder != NULL && srcFolder[0] != 0);
+	if(haveSpec) {
+		if(loadFaceSpec(srcFolder, archive, &spec) != 0) {
+			return 1;
+		}
+		if(spec.h.blobCount != blobCount) {
+			printf("ERROR: '%s' has %u blobs, but the bin file has %u.\n", srcFolder, spec.h.blobCount, blobCount);
+			return 1;
+		}
+	} else {
+		printf("Note: No folder given, bitmaps blended onto the old background are copied as-is.\n");
+	}
+
+	Img * imgs[250] = { NULL };		// blobs which have been encoded again
+	Bytes * payloads[250] = { NULL };	// or were found in the cache
+	u64 keys[250] = { 0 };
+	Atlas atlas = { 0 };
+	const u8 * blobData[250];
+	size_t blobSizes[250];
+	Img * bgImg = NULL;				// only decoded if something has to be encoded or blended
+	int r = 1;
+
+	// the new background is keyed as the source of a background is in create, so each reuses the other's blobs
+	u32 fit[2] = { bg->w, bg->h };
+	u64 bgHash = hashBytes((const u8 *)fit, sizeof(fit), hashBytes(bgBytes->data, bgBytes->size, HASH_SEED));
+	if(cache != NULL) {
+		beginBlobCache(cache);
+		u8 compression = haveSpec ? spec.blobCompression[bg->idx] : (u8)blobs[bg->idx].compression;
+		keys[bg->idx] = blobCacheKey(bgHash, compression, 0, 0, 0);
+		payloads[bg->idx] = newBytesFromBlobCache(cache, keys[bg->idx]);
+	}
+	if(payloads[bg->idx] == NULL) {
+		bgImg = newBackgroundImg(bgBytes, bg, bgHash, cache);
+		imgs[bg->idx] = (bgImg != NULL) ? cloneImg(bgImg) : NULL;
+		if(imgs[bg->idx] == NULL) {
+			goto done;
+		}
+	}
+
+	// blend again, against the new background. whether a bitmap blends is remembered in the cache, so bitmaps which
+	// don't are copied without being decoded.
+	for(u32 i=0; haveSpec && i<blobCount; i++) {
+		int fdi = spec.blobFaceData[i];
+		if(i == bg->idx || fdi == -1) {
+			continue;
+		}
+		char fileNameBuf[1024];
+		BlobSource src;
+		if(loadBlobSource(srcFolder, archive, &spec, i, &atlas, &src, fileNameBuf, sizeof(fileNameBuf)) != 0) {
+			continue;
+		}
+		FaceData * fd = &spec.h.faceData[fdi];
+		u64 srcHash = src.hash;
+		int needsBackground = (cache != NULL) ? needsBackgroundFromBlobCache(cache, srcHash) : -1;
+		if(cache != NULL) {
+			keys[i] = blobCacheKey(srcHash, spec.blobCompression[i], bgHash, fd->x, fd->y);
+		}
+		if(needsBackground == 1) {
+			payloads[i] = newBytesFromBlobCache(cache, keys[i]);
+		}
+		if(needsBackground == 0 || payloads[i] != NULL) {
+			clearBlobSource(&src);
+			continue;
+		}
+
+		Bytes * srcBytes = newBlobBytesFromBlobSource(&src, &atlas);
+		clearBlobSource(&src);
+		bool blend = (srcBytes != NULL && bmpNeedsBackground(srcBytes));
+		if(srcBytes != NULL && cache != NULL && needsBackground < 0) {
+			saveNeedsBackgroundToBlobCache(cache, srcHash, blend);
+		}
+		if(!blend) {
+			deleteBytes(srcBytes);
+			continue;
+		}
+		if(bgImg == NULL) {
+			bgImg = newBackgroundImg(bgBytes, bg, bgHash, cache);
+			if(bgImg == NULL) {
+				deleteBytes(srcBytes);
+				goto done;
+			}
+		}
+		imgs[i] = newImgFromBytes(srcBytes, bgImg, fd->x, fd->y);
+		deleteBytes(srcBytes);
+		if(imgs[i] == NULL) {
+			printf("ERROR: Unable to load image from file '%s'.\n", fileNameBuf);
+			goto done;
+		}
+		printf("'%s' blended with new background.\n", fileNameBuf);
+	}
+
+	// encode what we changed, and take everything else from the cache or the bin file
+	for(u32 i=0; i<blobCount; i++) {
+		if(payloads[i] != NULL) {
+			blobData[i] = payloads[i]->data;
+			blobSizes[i] = payloads[i]->size;
+			continue;
+		}
+		if(imgs[i] == NULL) {
+			blobData[i] = &bin->data[blobs[i].offset];
+			blobSizes[i] = blobs[i].size;
+			continue;
+		}
+		// without the watchface.txt, keep each bitmap as it was: compressed only if it was compressed before
+		u8 compression = haveSpec ? spec.blobCompression[i] : (u8)blobs[i].compression;
+		if(compression != NONE && compressImg(imgs[i]) != 0) {
+			printf("ERROR: compressImg() failed for blob %03u\n", i);
+			goto done;
+		}
+		if(cache != NULL && saveToBlobCache(cache, keys[i], imgs[i]->data, imgs[i]->size) != 0) {
+			printf("WARNING: Unable to save blob %03u to cache.\n", i);
+		}
+		blobData[i] = imgs[i]->data;
+		blobSizes[i] = imgs[i]->size;
+	}
+
+	size_t size = 0;
+	dawftAssembleBin(&h, blobData, blobSizes, NULL, 0, &size);
+	Bytes * b = malloc(sizeof(Bytes) + size);
+	if(b == NULL) {
+		printf("ERROR: Out of memory.\n");
+		goto done;
+	}
+	if(dawftAssembleBin(&h, blobData, blobSizes, b->data, size, &b->size) != DAWFT_OK) {
+		deleteBytes(b);
+		goto done;
+	}
+	*out = b;
+	r = 0;
+
+done:
+	for(u32 i=0; i<blobCount; i++) {
+		deleteImg(imgs[i]);
+		deleteBytes(payloads[i]);
+	}
+	deleteImg(bgImg);
+	clearAtlas(&atlas);
+	return r;
+}
+
+// Create outputFileName from the bin file binFileName, with the background replaced by bgFileName.
+// binFileName may be "-" for stdin. If out isn't NULL, the new bin file is written to it instead of outputFileName.
+// If cache is not NULL, blobs blended again are reused from (and saved to) it.
+static int swapBackground(char * binFileName, char fileType, char * bgFileName, char * srcFolder, char * outputFileName, FILE * out, BlobCache * cache) {
+	printf("Creating '%s' from '%s' with background '%s'.\n", outputFileName, binFileName, bgFileName);
+
+	Bytes * bin = newBytesFromInput(binFileName);
+	Bytes * bgBytes = newBytesFromFile(bgFileName);
+	Bytes * swapped = NULL;
+	int r = 1;
+	if(bin != NULL && bgBytes != NULL) {
+		r = swapBin(bin, fileType, bgBytes, srcFolder, NULL, cache, &swapped);
+	}
+	deleteBytes(bin);
+	deleteBytes(bgBytes);
+	if(r != 0) {
+		return r;
+	}
+
+	r = (out != NULL) ? writeBytesToStream(out, swapped) : saveBytesToFile(outputFileName, swapped);
+	if(r == 0) {
+		printf("Done. Size %zu.\n", swapped->size);
+	}
+	deleteBytes(swapped);
+	return r;
+}
+
+
+//----------------------------------------------------------------------------
+//  INFO / DUMP - Read a bin file, and dump its blobs and watchface.txt.
+//----------------------------------------------------------------------------
+
+// File format of the bitmaps written by dump
+typedef enum _DumpFormat {
+	DUMP_BMP = 0,
+	DUMP_QOI = 1,
+} DumpFormat;
+
+static const char * DumpFormatStr[2] = { "bmp", "qoi" };
+
+// Build a bitmap file in format from blob data, like newBMP16FromData(). Returns 0 for success.
+static int newDumpImgFromData(DumpFormat format, const u8 * srcData, size_t srcDataSize, u32 imgWidth, u32 imgHeight, bool basicRLE, Bytes ** out) {
+	if(format == DUMP_QOI) {
+		return newQOIFromData(srcData, srcDataSize, imgWidth, imgHeight, basicRLE, out);
+	}
+	return newBMP16FromData(srcData, srcDataSize, imgWidth, imgHeight, basicRLE, out);
+}
+
+// Build a bitmap file in format from big-endian RGB565 pixels, like newBMP16FromPixels(). Returns 0 for success.
+static int newDumpImgFromPixels(DumpFormat format, const u8 * pixels, u32 imgWidth, u32 imgHeight, Bytes ** out) {
+	if(format == DUMP_QOI) {
+		return newQOIFromPixels(pixels, imgWidth, imgHeight, out);
+	}
+	return newBMP16FromPixels(pixels, imgWidth, imgHeight, out);
+}
+
+// Everything discovered about a bin file by loadBinInfo()
+typedef struct _BinInfo {
+	FaceHeader h;
+	ExtraFileInfo xfi;
+	u32 headerSize;
+	int blobEstSize[250];
+	char watchFaceStr[32000];		// watchface.txt to recreate this bin file. have enough room for all the lines we need to store
+} BinInfo;
+
+// Read the header of a bin file into bi, and build the watchface.txt that would recreate it.
+// fileType is 'A', 'B', 'C', or 0 to autodetect. Returns 0 for success.
+static int loadBinInfo(Bytes * bytes, char fileType, BinInfo * bi) {
+	u8 * fileData = bytes->data;
+	size_t fileSize = bytes->size;
+	bi->watchFaceStr[0] = 0;
+
+	// Check file size	
+	if(fileSize < 1700) {
+		printf("ERROR: File is less than the minimum header size (1700 bytes)!\n");
+		return 1;
+	}
+
+	// Check first byte of file
+	if(fileData[0] != 0x81 && fileData[0] != 0x04 && fileData[0] != 0x84) {
+		printf("WARNING: Unknown fileID: 0x%02x\n", fileData[0]);
+	}
+
+	// Autodetect file type, if unspecified.
+	if(fileType==0) {
+		fileType = autodetectFileType(fileData, fileSize);
+	}
+
+	// Save important info to xfi struct
+	bi->xfi = (ExtraFileInfo){ .fileType = fileType, .animationFrames = 0 };
+
+	// determine header size
+	u32 headerSize = 1900;
+	if(fileType == 'A') {
+		headerSize = 1700;
+	}
+	bi->headerSize = headerSize;
+
+	// Check header size
+	if(fileSize < headerSize) {
+		printf("ERROR: File is less than the header size (%u bytes)!\n", headerSize);
+		return 1;
+	}
+
+	// store discovered data in string, for saving to file, so we can recreate this bin file
+	char lineBuf[128] = "";
+
+	snprintf(lineBuf, sizeof(lineBuf), "fileType        %c\n", fileType);
+	d_strlcat(bi->watchFaceStr, lineBuf, sizeof(bi->watchFaceStr));
+
+	snprintf(lineBuf, sizeof(lineBuf), "fileID          0x%02x\n", fileData[0]);
+	d_strlcat(bi->watchFaceStr, lineBuf, sizeof(bi->watchFaceStr));
+
+
+
+	// Load header struct from file
+	setHeader(&bi->h, fileData, bi->xfi.fileType);
+	FaceHeader * h = &bi->h;
+
+	// the header only has room for 39 faceData items and 250 blobs
+	if(h->dataCount > sizeof(h->faceData)/sizeof(h->faceData[0]) || h->blobCount > 250) {
+		printf("ERROR: dataCount %u or blobCount %u is too big for the header.\n", h->dataCount, h->blobCount);
+		return 1;
+	}
+
+	// Print header info
+	snprintf(lineBuf, sizeof(lineBuf), "dataCount       %u\n", h->dataCount);
+	d_strlcat(bi->watchFaceStr, lineBuf, sizeof(bi->watchFaceStr));
+	snprintf(lineBuf, sizeof(lineBuf), "blobCount       %u\n", h->blobCount);
+	d_strlcat(bi->watchFaceStr, lineBuf, sizeof(bi->watchFaceStr));
+	snprintf(lineBuf, sizeof(lineBuf), "faceNumber      %u\n", h->faceNumber);
+	d_strlcat(bi->watchFaceStr, lineBuf, sizeof(bi->watchFaceStr));
+	snprintf(lineBuf, sizeof(lineBuf), "\n%s\n", "#               TYPE  INDEX      X    Y    W    H");
+	d_strlcat(bi->watchFaceStr, lineBuf, sizeof(bi->watchFaceStr));
+
+	// Print faceData header info
+	FaceData * background = NULL;
+	FaceData * backgrounds = NULL;
+	int myDataCount = 0;
+	
+	for(u32 i=0; i<(sizeof(h->faceData)/sizeof(h->faceData[0])); i++) {
+		if(h->faceData[i].type != 0 || i==0) {		// some formats use type 0 in position 0 as background
+			FaceData * fd = &h->faceData[i];			
+			snprintf(lineBuf, sizeof(lineBuf), "faceData        0x%02x    %03u   %4u %4u %4u %4u          # %-15s\n",
+				fd->type, fd->idx, fd->x, fd->y, fd->w, fd->h, getDataTypeStr(fd->type)
+				);
+			d_strlcat(bi->watchFaceStr, lineBuf, sizeof(bi->watchFaceStr));
+			myDataCount++;
+			if(fd->type == 0x01 && background == NULL) {
+				background = &h->faceData[i];
+			}
+			if(fd->type == 0x00 && backgrounds == NULL) {
+				backgrounds = &h->faceData[i];
+			}
+			if(fd->type >= 0xF6 && fd->type <= 0xF8) {
+				if(fileType == 'A') {
+					bi->xfi.animationFrames = h->sizes[200];
+				} else {
+					bi->xfi.animationFrames = h->sizes[0];		// animation frame count is stored here for type C. TODO test assumption this is correct for Type B
+				}
+			}
+		}
+	}
+
+	if(bi->xfi.animationFrames != 0) {
+		snprintf(lineBuf, sizeof(lineBuf), "animationFrames %u\n", bi->xfi.animationFrames);
+		d_strlcat(bi->watchFaceStr, lineBuf, sizeof(bi->watchFaceStr));
+	}
+
+
+	if(background == NULL && backgrounds == NULL) {
+		printf("WARNING: No background found.\n");
+	}
+
+	int fail = 0;
+
+	if(myDataCount != h->dataCount) {
+		printf("myDataCount     %u\n", myDataCount);
+		if(myDataCount < h->dataCount) {
+			printf("WARNING: myDataCount < dataCount!\n");
+		}
+	}
+
+	// Count offsets to verify number of blobs. Estimate blob sizes.
+	int myBlobCount = 0;
+	u8 blobCompression[250] = { 0 };
+	memset(bi->blobEstSize, 0, sizeof(bi->blobEstSize));
+	snprintf(lineBuf, sizeof(lineBuf), "\n%s\n", "#             INDEX  CTYPE");
+	d_strlcat(bi->watchFaceStr, lineBuf, sizeof(bi->watchFaceStr));
+	for(u32 i=0; i<250; i++) {
+		if(h->offsets[i] != 0 || i == 0) {
+			myBlobCount += 1;
+			bool inFile = ((size_t)headerSize + h->offsets[i] + 2 <= fileSize);		// room for the RLE marker at least
+			if(!inFile && fileType != 'B' && !fail) {
+				printf("ERROR: Offset %u is greater than file size, cannot dump this file.\n", h->offsets[i]);	// Unknown file type
+				fail = 1;
+			} else if(inFile) {
+				int isRLE = (get_u16(&fileData[headerSize+h->offsets[i]]) == 0x2108);
+				ImgCompression ic = isRLE?(fileType=='C'?RLE_LINE:RLE_BASIC):NONE;				
+				// if(fileType=='B') it's actually a big LZO blob that needs to be split up.
+				blobCompression[i] = (u8)ic;
+				if(i<249 && h->offsets[i+1] != 0) {
+					bi->blobEstSize[i] = (int)(h->offsets[i+1] - h->offsets[i]);
+				} else {
+					bi->blobEstSize[i] = (int)fileSize - (int)headerSize - (int)h->offsets[i];
+				}
+				snprintf(lineBuf, sizeof(lineBuf), "blobCompression %03u  %-9s  %8u  %8i\n", i, ImgCompressionStr[ic], h->offsets[i], bi->blobEstSize[i]);
+				d_strlcat(bi->watchFaceStr, lineBuf, sizeof(bi->watchFaceStr));
+			}
+		} 
+	}
+
+	if(fail) {
+		return 1;
+	}
+
+	if(myBlobCount != h->blobCount) {
+		printf("myBlobCount     %u\n", myBlobCount);
+		if(myBlobCount < h->blobCount) {
+			printf("WARNING: myBlobCount < blobCount!\n");
+		}
+	}
+
+	return 0; // SUCCESS
+}
+
+// Add an atlas to list for each group of bitmaps (digits, names, animation frames...): one bitmap with the cells stacked
+// top to bottom, and a .txt file listing where each cell is. The bitmaps in an atlas are marked in inAtlas.
+// Returns 0 for success, with watchface.txt (including the atlas lines) in *text.
+static int addAtlasesToDumpList(DumpList * list, Bytes * bytes, BinInfo * bi, char * folderStr, DumpFormat format, bool inAtlas[250], Bytes ** text) {
+	const char * ext = DumpFormatStr[format];
+	DawftBlob blobs[250];
+	u32 blobCount = 0;
+	if(dawftListBlobs(bytes->data, bytes->size, &bi->h, &bi->xfi, blobs, &blobCount) != DAWFT_OK) {
+		return 1;
+	}
+
+	size_t textSize = strlen(bi->watchFaceStr);
+	size_t textCapacity = textSize + 250 * 64;
+	Bytes * t = malloc(sizeof(Bytes) + textCapacity);
+	if(t == NULL) {
+		printf("ERROR: Out of memory.\n");
+		return 1;
+	}
+	memcpy(t->data, bi->watchFaceStr, textSize);
+	textSize += (size_t)snprintf((char *)&t->data[textSize], textCapacity - textSize,
+		"# Groups of bitmaps in one atlas, with the cells listed in the .txt file of the same name\n"
+		"#              INDEX  COUNT     FILENAME\n");
+
+	char fileName[1024];
+	for(u32 i=0; i<blobCount; i++) {
+		// the group starting here is the biggest of the faceData items that start here
+		u32 count = 0;
+		for(u32 fdi=0; fdi<bi->h.dataCount; fdi++) {
+			const FaceData * fd = &bi->h.faceData[fdi];
+			int n = getFaceDataBlobCount(fd, &bi->xfi);
+			if(fd->idx == i && n > 0 && (u32)n > count) {
+				count = (u32)n;
+			}
+		}
+		if(count > blobCount - i) {
+			count = blobCount - i;
+		}
+		if(count < 2) {
+			continue;
+		}
+
+		// stack the cells top to bottom
+		u32 w = 0;
+		u32 h = 0;
+		bool fits = true;
+		for(u32 j=i; j<i+count; j++) {
+			w = (blobs[j].width > w) ? blobs[j].width : w;
+			h += blobs[j].height;
+			fits = fits && imgFitsData(bytes->size - blobs[j].offset, blobs[j].width, blobs[j].height, blobs[j].compression);
+		}
+		if(!fits) {
+			printf("WARNING: Bitmaps %03u-%03u don't fit their blobs, so they aren't dumped as an atlas.\n", i, i + count - 1);
+			continue;
+		}
+		u8 * pixels = calloc((size_t)w * h, 2);
+		u8 * cell = malloc((size_t)w * h * 2);
+		char cells[250 * 48];
+		size_t cellsSize = (size_t)snprintf(cells, sizeof(cells), "# Cells of atlas%03u.%s\n#      BLOB      X      Y      W      H\n", i, ext);
+		bool ok = (pixels != NULL && cell != NULL && w > 0);
+		u32 y = 0;
+		for(u32 j=i; ok && j<i+count; j++) {
+			DawftBlob * b = &blobs[j];
+			ok = (b->width > 0 && b->height > 0 && dawftDecodeBlob(&bytes->data[b->offset], bytes->size - b->offset, b->width, b->height, b->compression, cell, (size_t)w * h * 2) == DAWFT_OK);
+			for(u32 row=0; ok && row<b->height; row++) {
+				memcpy(&pixels[((size_t)(y + row) * w) * 2], &cell[(size_t)row * b->width * 2], (size_t)b->width * 2);
+			}
+			cellsSize += (size_t)snprintf(&cells[cellsSize], sizeof(cells) - cellsSize, "cell    %03u  %5u  %5u  %5u  %5u\n", j, 0, y, b->width, b->height);
+			y += b->height;
+		}
+		free(cell);
+
+		Bytes * bmp = NULL;
+		if(!ok || newDumpImgFromPixels(format, pixels, w, h, &bmp) != 0) {
+			printf("WARNING: Unable to make an atlas of bitmaps %03u-%03u, dumping them one at a time.\n", i, i + count - 1);
+			free(pixels);
+			continue;
+		}
+		free(pixels);
+
+		snprintf(fileName, sizeof(fileName), "%s%satlas%03u.%s", folderStr, DIR_SEPERATOR, i, ext);
+		printf("Dumping bitmaps %03u-%03u to atlas %s\n", i, i + count - 1, fileName);
+		if(addDumpBytes(list, fileName, bmp) != 0) {
+			deleteBytes(t);
+			return 1;
+		}
+		Bytes * cellsBytes = malloc(sizeof(Bytes) + cellsSize);
+		if(cellsBytes == NULL) {
+			printf("ERROR: Out of memory.\n");
+			deleteBytes(t);
+			return 1;
+		}
+		cellsBytes->size = cellsSize;
+		memcpy(cellsBytes->data, cells, cellsSize);
+		snprintf(fileName, sizeof(fileName), "%s%satlas%03u.txt", folderStr, DIR_SEPERATOR, i);
+		if(addDumpBytes(list, fileName, cellsBytes) != 0) {
+			deleteBytes(t);
+			return 1;
+		}
+
+		textSize += (size_t)snprintf((char *)&t->data[textSize], textCapacity - textSize, "atlas           %03u    %3u     atlas%03u.%s\n", i, count, i, ext);
+		for(u32 j=i; j<i+count; j++) {
+			inAtlas[j] = true;
+		}
+		i += count - 1;
+	}
+
+	t->size = textSize;
+	*text = t;
+	return 0;
+}
+
+// Dump the blobs of a bin file, and a watchface.txt to recreate it, to folderName.
+// If folderName is empty, the face number is used. If srcFd isn't -1, it is the open bin file, and raw blobs are
+// copied from it directly. If archive isn't NULL, the files are written to it as a tar archive, in the folder,
+// instead. If atlas is true, each group of bitmaps is dumped as one atlas. Bitmaps are written as format.
+// Returns 0 for success.
+static int dumpBin(Bytes * bytes, BinInfo * bi, char * folderName, bool raw, bool atlas, DumpFormat format, int srcFd, FILE * archive) {
+	u8 * fileData = bytes->data;
+	size_t fileSize = bytes->size;
+	char fileType = bi->xfi.fileType;
+	u32 headerSize = bi->headerSize;
+	FaceHeader * h = &bi->h;
+	int * blobEstSize = bi->blobEstSize;
+	char * watchFaceStr = bi->watchFaceStr;
+
+	if(fileType == 'B') {
+		// What compression method is used in type B files? LZO?
+		printf("Dumping from fileType B is not supported\n");
+		return 1;
+	}
+
+	char dumpFileName[1024];
+	char * folderStr;
+	char faceNumberStr[16];
+	snprintf(faceNumberStr, sizeof(faceNumberStr), "%d", h->faceNumber);
+	if(folderName[0]==0) {		// if empty string
+		folderStr = faceNumberStr;
+	} else {
+		folderStr = folderName;
+	}
+	
+	// create folder if it doesn't exist
+	if(archive == NULL) {
+		d_mkdir(folderStr, S_IRWXU);
+	}
+
+	// everything is decoded first, then all the files are written at once
+	DumpList * list = newDumpList();
+	if(list == NULL) {
+		return 1;
+	}
+	list->srcFd = srcFd;
+
+	// dump the atlases, if wanted
+	bool inAtlas[250] = { false };
+	Bytes * atlasText = NULL;
+	if(atlas && fileType != 'C') {
+		printf("WARNING: Atlases are only supported for fileType C\n");
+	} else if(atlas && addAtlasesToDumpList(list, bytes, bi, folderStr, format, inAtlas, &atlasText) != 0) {
+		deleteDumpList(list);
+		return 1;
+	}
+
+	// dump the watch face data
+	snprintf(dumpFileName, sizeof(dumpFileName), "%s%swatchface.txt", folderStr, DIR_SEPERATOR);
+	int added = (atlasText != NULL) ? addDumpBytes(list, dumpFileName, atlasText) : addDumpData(list, dumpFileName, (u8 *)watchFaceStr, strlen(watchFaceStr));
+	if(added != 0) {
+		deleteDumpList(list);
+		return 1;
+	}
+
+	// for each binary blob
+	for(int i=0; i<h->blobCount; i++) {
+		// determine file offset
+		if((size_t)headerSize + h->offsets[i] + 2 > fileSize) {
+			printf("WARNING: Offset %u of blob %03u is past the end of the file, not dumping it.\n", h->offsets[i], i);
+			continue;
+		}
+		u32 fileOffset = headerSize + h->offsets[i];
+		bool rawDumpThisOne = false;
+		
+		// get faceData index from offset index
+		int fdi = getFaceDataIndexFromOffsetIndex(i, h, &bi->xfi);
+
+		// is it RLE?
+		int isRLE = (get_u16(&fileData[fileOffset]) == 0x2108);
+		
+		// Dump the bitmaps
+		if(inAtlas[i]) {
+			// already in an atlas
+		} else if(fdi != -1) {
+			u32 width = h->faceData[fdi].w;
+			u32 height = h->faceData[fdi].h;
+			if(h->faceData[fdi].type == 0x00 && (fileType=='A') && (h->faceData[fdi].w != 240 || h->faceData[fdi].h != 24)) {
+				// override width and height
+				h->faceData[fdi].w = 240;
+				h->faceData[fdi].h = 24;
+				width = 240;
+				height = 24;
+				printf("WARNING: Overriding width and height with 240x24 for backgrounds of type 0x00\n");
+			}
+			if((h->faceData[fdi].type >= 0xD7 && h->faceData[fdi].type <= 0xD9) && i > (h->faceData[fdi].idx + 10)) {
+				// override width
+				width = width * 2;
+				printf("WARNING: Overriding width and height for double-width degC degF 0xD7-0xD9\n");
+			}
+			if(!imgFitsData(fileSize - fileOffset, width, height, isRLE ? ((fileType=='A') ? RLE_BASIC : RLE_LINE) : NONE)) {
+				printf("WARNING: Blob %03u can't be a %ux%u bitmap, dumping it raw instead.\n", i, width, height);
+				rawDumpThisOne = true;
+			} else {
+				snprintf(dumpFileName, sizeof(dumpFileName), "%s%s%03u.%s", folderStr, DIR_SEPERATOR, i, DumpFormatStr[format]);
+				printf("Dumping from %s img to %s file %s\n", (isRLE?"RLE":"unc"), (format == DUMP_QOI ? "QOI" : "BMP"), dumpFileName);
+				Bytes * bmp = NULL;
+				if(newDumpImgFromData(format, &fileData[fileOffset], fileSize-fileOffset, width, height, (fileType=='A'), &bmp) == 0) {
+					addDumpBytes(list, dumpFileName, bmp);
+				}
+			}
+		} else if(i == (h->blobCount - 1)) {
+			// this is a small preview image of 140x163, used when selecting backgrounds (for 240x280 images)
+			snprintf(dumpFileName, sizeof(dumpFileName), "%s%s%03u.%s", folderStr, DIR_SEPERATOR, i, DumpFormatStr[format]);
+			printf("Dumping from %s img to %s file %s\n", (isRLE?"RLE":"unc"), (format == DUMP_QOI ? "QOI" : "BMP"), dumpFileName);
+			Bytes * bmp = NULL;
+			if(newDumpImgFromData(format, &fileData[fileOffset], fileSize-fileOffset, 140, 163, (fileType=='A'), &bmp) == 0) {
+				addDumpBytes(list, dumpFileName, bmp);
+			}
+		} else {	// it's just rubbish data... but we should dump it for completeness
+			rawDumpThisOne = true;
+		}
+
+		// Dump the raw data
+		if(raw || rawDumpThisOne) {
+			// determine size of blob
+			size_t size = h->sizes[i]; // Sometimes, length is stored in file, but this is unreliable, and that section is used for other purposes
+			if(blobEstSize[i] >= 0) {
+				size = (size_t)blobEstSize[i];
+				if(h->sizes[i] > 0 && h->sizes[i] != size) {
+					printf("WARNING: Overriding unreliable zone size %u with estimated size %zu\n", h->sizes[i], size);
+				}
+			}
+
+			if(!isRLE) { 
+				// We can also estimate a size for uncompressed images
+				size_t estimatedSize = 0;
+				if(fdi != -1) {
+					estimatedSize = (size_t)h->faceData[fdi].w * h->faceData[fdi].h * 2;
+				}
+				if(size != estimatedSize && estimatedSize != 0) {
+					printf("WARNING: Size mismatch (file: %zu, estimated: %zu, zone: %u)\n", size, estimatedSize, h->sizes[i]);
+				}
+			}
+
+			if(size == 0) {
+				printf("WARNING: Unable to determine size for blob idx %03u, not dumping raw data.\n", i);
+			} else {
+				// check it won't go past EOF
+				if(fileOffset + size > fileSize) {
+					printf("WARNING: Unable to dump raw blob %u as it exceeds EOF (%zu>%zu)\n", i, fileOffset+size, fileSize);
+				} else {
+					// assemble file name to dump to
+					snprintf(dumpFileName, sizeof(dumpFileName), "%s%s%03u.raw", folderStr, DIR_SEPERATOR, i);
+					printf("Dumping raw blob size %6zu to file %s\n", size ,dumpFileName);
+
+					// dump it
+					addDumpRange(list, dumpFileName, &fileData[fileOffset], size, fileOffset);
+				}
+			}
+		}
+
+	}
+
+	// write all the files
+	int r = (archive != NULL) ? writeDumpListTar(list, archive) : writeDumpList(list);
+	deleteDumpList(list);
+	return r;
+}
+
+
+//----------------------------------------------------------------------------
+//  RENDER - Draw a frame of a bin file, for a given time and sensor readings
+//----------------------------------------------------------------------------
+
+// If arg is one of the render options (time=, date=, steps=...), set it in s. Returns 1 if it was one, 0 if it
+// wasn't, or -1 if it was invalid.
+static int parseFaceStateOption(FaceState * s, char * arg) {
+	if(streqn(arg, "time=", 5)) {
+		u32 h = 0, m = 0, sec = 0;
+		if(sscanf(&arg[5], "%u:%u:%u", &h, &m, &sec) < 2 || h > 23 || m > 59 || sec > 59) {
+			printf("ERROR: Invalid time=, use HH:MM or HH:MM:SS\n");
+			return -1;
+		}
+		s->hour = (u8)h;
+		s->minute = (u8)m;
+		s->second = (u8)sec;
+	} else if(streqn(arg, "date=", 5)) {
+		u32 y = 0, m = 0, d = 0;
+		if(sscanf(&arg[5], "%u-%u-%u", &y, &m, &d) != 3 || y < 1 || y > 9999 || m < 1 || m > 12 || d < 1 || d > 31) {
+			printf("ERROR: Invalid date=, use YYYY-MM-DD\n");
+			return -1;
+		}
+		s->year = (u16)y;
+		s->month = (u8)m;
+		s->day = (u8)d;
+		s->weekday = getWeekday(y, m, d);
+	} else if(streqn(arg, "steps=", 6)) {
+		s->steps = readNum(&arg[6]);
+	} else if(streqn(arg, "hr=", 3)) {
+		s->hr = readNum(&arg[3]);
+	} else if(streqn(arg, "kcal=", 5)) {
+		s->kcal = readNum(&arg[5]);
+	} else if(streqn(arg, "dist=", 5)) {
+		s->dist = readNum(&arg[5]);
+	} else if(streqn(arg, "battery=", 8)) {
+		s->battery = readNum(&arg[8]);
+	} else if(streqn(arg, "temp=", 5)) {
+		int n = 0;
+		if(sscanf(&arg[5], "%d%n", &s->temp, &n) != 1 || !(streq(&arg[5 + n], "") || streq(&arg[5 + n], "C") || streq(&arg[5 + n], "F"))) {
+			printf("ERROR: Invalid temp=, use e.g. 21 or 21C or 70F\n");
+			return -1;
+		}
+		s->fahrenheit = streq(&arg[5 + n], "F");
+	} else if(streq(arg, "clock=12") || streq(arg, "clock=24")) {
+		s->hour12 = streq(arg, "clock=12");
+	} else if(streq(arg, "units=km") || streq(arg, "units=mi")) {
+		s->miles = streq(arg, "units=mi");
+	} else if(streq(arg, "bt=true") || streq(arg, "bt=false")) {
+		s->btConnected = streq(arg, "bt=true");
+	} else if(streqn(arg, "frame=", 6)) {
+		s->frame = readNum(&arg[6]);
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+// Draw the bin file binFileName as the watch would show it in state s, and save it to outputFileName (or out, if it
+// isn't NULL). Returns 0 for success.
+static int renderBin(char * binFileName, char fileType, const FaceState * s, DumpFormat format, char * outputFileName, FILE * out) {
+	Bytes * bin = newBytesFromInput(binFileName);
+	if(bin == NULL) {
+		printf("ERROR: Failed to read file into memory.\n");
+		return 1;
+	}
+	FaceRenderer * fr = newFaceRenderer(bin->data, bin->size, fileType);
+	deleteBytes(bin);
+	if(fr == NULL) {
+		return 1;
+	}
+
+	int r = 1;
+	Bytes * img = NULL;
+	u8 * frame = malloc((size_t)fr->width * fr->height * 2);
+	if(frame == NULL) {
+		printf("ERROR: Out of memory.\n");
+	} else if(renderFace(fr, s, frame) == DAWFT_OK && newDumpImgFromPixels(format, frame, fr->width, fr->height, &img) == 0) {
+		r = (out != NULL) ? writeBytesToStream(out, img) : saveBytesToFile(outputFileName, img);
+	}
+	if(r == 0) {
+		printf("Rendered %ux%u frame of '%s' at %02u:%02u:%02u on %04u-%02u-%02u to '%s'.\n", fr->width, fr->height, binFileName,
+			s->hour, s->minute, s->second, s->year, s->month, s->day, outputFileName);
+	}
+	deleteBytes(img);
+	free(frame);
+	deleteFaceRenderer(fr);
+	return r;
+}
+
+// Run the bin file binFileName for tickCount seconds from state s, drawing again only what changes each second,
+// and print how much is drawn and decoded per tick. Returns 0 for success.
+static int simulateBin(char * binFileName, char fileType, const FaceState * s, u32 tickCount) {
+	Bytes * bin = newBytesFromInput(binFileName);
+	if(bin == NULL) {
+		printf("ERROR: Failed to read file into memory.\n");
+		return 1;
+	}
+	FaceRenderer * fr = newFaceRenderer(bin->data, bin->size, fileType);
+	deleteBytes(bin);
+	if(fr == NULL) {
+		return 1;
+	}
+	u8 * frame = malloc((size_t)fr->width * fr->height * 2);
+	if(frame == NULL) {
+		printf("ERROR: Out of memory.\n");
+		deleteFaceRenderer(fr);
+		return 1;
+	}
+
+	FaceState prev = *s;
+	FaceState state = *s;
+	renderFace(fr, &state, frame);
+	u64 totalPixels = 0, totalBytes = 0, maxPixels = 0, maxBytes = 0;
+	u32 idleTicks = 0;
+	u32 dirtyTicks[39] = { 0 };
+	for(u32 t=0; t<tickCount; t++) {
+		FaceTick tick;
+		tickFaceState(&state);
+		renderFaceTick(fr, &prev, &state, frame, &tick);
+		prev = state;
+		totalPixels += tick.pixels;
+		totalBytes += tick.bytes;
+		maxPixels = (tick.pixels > maxPixels) ? tick.pixels : maxPixels;
+		maxBytes = (tick.bytes > maxBytes) ? tick.bytes : maxBytes;
+		idleTicks += (tick.rectCount == 0) ? 1 : 0;
+		for(u32 i=0; i<39; i++) {
+			dirtyTicks[i] += (tick.dirtyFaceData >> i) & 1;
+		}
+	}
+
+	u64 framePixels = (u64)fr->width * fr->height;
+	printf("Simulated %u ticks of '%s' from %02u:%02u:%02u on %04u-%02u-%02u.\n", tickCount, binFileName,
+		s->hour, s->minute, s->second, s->year, s->month, s->day);
+	printf("Full frame:      %8llu pixels (%ux%u)\n", (unsigned long long)framePixels, fr->width, fr->height);
+	printf("Pixels per tick: %8llu average, %8llu max, %10llu total\n", (unsigned long long)(tickCount ? totalPixels / tickCount : 0),
+		(unsigned long long)maxPixels, (unsigned long long)totalPixels);
+	printf("Bytes per tick:  %8llu average, %8llu max, %10llu total\n", (unsigned long long)(tickCount ? totalBytes / tickCount : 0),
+		(unsigned long long)maxBytes, (unsigned long long)totalBytes);
+	printf("Idle ticks:      %8u\n", idleTicks);
+	printf("\nfaceData  type  name              dirty ticks\n");
+	u32 maxFaceData = (fr->xfi.fileType == 'A') ? 32 : 39;
+	for(u32 i=0; i<fr->h.dataCount && i<maxFaceData; i++) {
+		int dti = getDataTypeIdx(fr->h.faceData[i].type);
+		printf("%8u  0x%02x  %-16s  %11u\n", i, fr->h.faceData[i].type, (dti >= 0) ? dataTypes[dti].str : "UNKNOWN", dirtyTicks[i]);
+	}
+
+	free(frame);
+	deleteFaceRenderer(fr);
+	return 0;
+}
+
+
+//----------------------------------------------------------------------------
+//  EXPORT ANIMATION - Draw every frame of an animation, as a GIF or raw frames
+//----------------------------------------------------------------------------
+
+// Shared by the threads of exportAnimation()
+typedef struct _FrameRenderer {
+	const FaceRenderer * fr;
+	const FaceState * s;
+	FaceRect rect;				// the part of the screen that is kept
+	u8 ** frames;
+	u32 frameCount;
+	u32 next;					// next frame to draw
+	bool failed;
+#ifndef WINDOWS
+	pthread_mutex_t lock;
+#endif
+} FrameRenderer;
+
+static void * frameRendererThread(void * arg) {
+	FrameRenderer * w = arg;
+	u8 * screen = malloc((size_t)w->fr->width * w->fr->height * 2);
+	while(1) {
+#ifndef WINDOWS
+		pthread_mutex_lock(&w->lock);
+#endif
+		u32 i = w->next++;
+#ifndef WINDOWS
+		pthread_mutex_unlock(&w->lock);
+#endif
+		if(i >= w->frameCount) {
+			break;
+		}
+		FaceState s = *w->s;
+		s.frame = i;
+		if(screen == NULL || renderFace(w->fr, &s, screen) != DAWFT_OK) {
+#ifndef WINDOWS
+			pthread_mutex_lock(&w->lock);
+#endif
+			w->failed = true;
+#ifndef WINDOWS
+			pthread_mutex_unlock(&w->lock);
+#endif
+			continue;
+		}
+		for(i32 y=0; y<w->rect.h; y++) {
+			memcpy(&w->frames[i][(size_t)y * w->rect.w * 2], &screen[((size_t)(w->rect.y + y) * w->fr->width + w->rect.x) * 2], (size_t)w->rect.w * 2);
+		}
+	}
+	free(screen);
+	return NULL;
+}
+
+// Draw every frame of the first animation (or tap to change images) of binFileName, in state s, cropped to the
+// animation's rectangle, using threadCount threads. Save them to outputFileName (or out, if it isn't NULL) as an
+// animated GIF showing each frame for delayMs, or if raw is true, as one big-endian RGB565 frame after another.
+// Returns 0 for success.
+static int exportAnimation(char * binFileName, char fileType, const FaceState * s, bool raw, u32 delayMs, u32 threadCount, char * outputFileName, FILE * out) {
+	Bytes * bin = newBytesFromInput(binFileName);
+	if(bin == NULL) {
+		printf("ERROR: Failed to read file into memory.\n");
+		return 1;
+	}
+	FaceRenderer * fr = newFaceRenderer(bin->data, bin->size, fileType);
+	deleteBytes(bin);
+	if(fr == NULL) {
+		return 1;
+	}
+
+	const FaceData * fd = NULL;
+	u32 maxFaceData = (fr->xfi.fileType == 'A') ? 32 : 39;
+	for(u32 i=0; i<fr->h.dataCount && i<maxFaceData && fd == NULL; i++) {
+		if(fr->h.faceData[i].type >= 0xF6 && fr->h.faceData[i].type <= 0xF8) {
+			fd = &fr->h.faceData[i];
+		}
+	}
+	FaceRect rect = { 0 };
+	if(fd != NULL) {
+		rect = (FaceRect){ .x = fd->x, .y = fd->y, .w = fd->w, .h = fd->h };
+		rect.w = (rect.x + rect.w > (i32)fr->width) ? (i32)fr->width - rect.x : rect.w;
+		rect.h = (rect.y + rect.h > (i32)fr->height) ? (i32)fr->height - rect.y : rect.h;
+	}
+	if(fd == NULL || fr->xfi.animationFrames == 0 || rect.w <= 0 || rect.h <= 0) {
+		printf("ERROR: '%s' has no animation.\n", binFileName);
+		deleteFaceRenderer(fr);
+		return 1;
+	}
+
+	// one block for all the frames, so raw output is ready to write
+	u32 frameCount = fr->xfi.animationFrames;
+	size_t frameSize = (size_t)rect.w * rect.h * 2;
+	Bytes * frameBytes = malloc(sizeof(Bytes) + frameSize * frameCount);
+	u8 ** frames = malloc(frameCount * sizeof(u8 *));
+	if(frameBytes == NULL || frames == NULL) {
+		printf("ERROR: Out of memory.\n");
+		free(frameBytes);
+		free(frames);
+		deleteFaceRenderer(fr);
+		return 1;
+	}
+	frameBytes->size = frameSize * frameCount;
+	for(u32 i=0; i<frameCount; i++) {
+		frames[i] = &frameBytes->data[frameSize * i];
+	}
+
+	FrameRenderer w = { .fr = fr, .s = s, .rect = rect, .frames = frames, .frameCount = frameCount };
+#ifndef WINDOWS
+	pthread_mutex_init(&w.lock, NULL);
+	pthread_t threads[256];
+	u32 started = 0;
+	for(; started + 1 < threadCount && started + 1 < frameCount && started < 256; started++) {
+		if(pthread_create(&threads[started], NULL, frameRendererThread, &w) != 0) {
+			break;
+		}
+	}
+	frameRendererThread(&w);		// help out, and make sure it gets done even if no threads started
+	for(u32 i=0; i<started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&w.lock);
+#else
+	frameRendererThread(&w);
+#endif
+
+	int r = 1;
+	Bytes * gif = NULL;
+	if(w.failed) {
+		printf("ERROR: Out of memory.\n");
+	} else if(raw) {
+		r = (out != NULL) ? writeBytesToStream(out, frameBytes) : saveBytesToFile(outputFileName, frameBytes);
+	} else if(newGIFFromFrames((const u8 * const *)frames, frameCount, (u32)rect.w, (u32)rect.h, delayMs, threadCount, &gif) == 0) {
+		r = (out != NULL) ? writeBytesToStream(out, gif) : saveBytesToFile(outputFileName, gif);
+	}
+	if(r == 0) {
+		printf("Exported %u frames of %ux%u from '%s' to '%s'%s.\n", frameCount, (u32)rect.w, (u32)rect.h, binFileName,
+			outputFileName, raw ? " as raw big-endian RGB565" : "");
+	}
+	deleteBytes(gif);
+	free(frameBytes);
+	free(frames);
+	deleteFaceRenderer(fr);
+	return r;
+}
+
+
+//----------------------------------------------------------------------------
+//  THUMBNAILS - Small pictures of many faces, tiled onto contact sheets or one file each
+//----------------------------------------------------------------------------
+
+// Shared by the threads of makeThumbnails()
+typedef struct _ThumbnailMaker {
+	char ** fileNames;
+	char fileType;
+	const FaceState * s;
+	u32 w;						// thumbnail size
+	u32 h;
+	u8 * sheet;					// if not NULL, the thumbnails are drawn onto it, instead of saved to folder
+	u32 sheetFirst;				// file in the top left tile
+	u32 columns;
+	char * folder;
+	char ** thumbNames;			// name to save each thumbnail as in folder, or NULL if an earlier file has the same name
+	DumpFormat format;
+	bool * made;				// whether each file's thumbnail was made. each thread only touches its own files
+	u32 next;					// next file to do
+	u32 end;
+	u32 previews;				// thumbnails made from the preview image
+	u32 failed;
+#ifndef WINDOWS
+	pthread_mutex_t lock;
+#endif
+} ThumbnailMaker;
+
+// Draw a w x h thumbnail of the face in fileName into pixels. Type C files with a big enough preview image only have
+// that decoded and shrunk. Anything else is drawn in state s, and shrunk. Returns 0 for success, with *fromPreview set
+// if the preview image was used.
+static int drawThumbnail(char * fileName, char fileType, const FaceState * s, u32 w, u32 h, u8 * pixels, bool * fromPreview) {
+	Bytes * bin = newBytesFromFile(fileName);
+	if(bin == NULL) {
+		return 1;
+	}
+	FaceHeader fh;
+	ExtraFileInfo xfi;
+	DawftBlob blobs[250];
+	u32 blobCount = 0;
+	int r = 1;
+	*fromPreview = false;
+	if(dawftParseHeader(bin->data, bin->size, fileType, &fh, &xfi) == DAWFT_OK &&
+			dawftListBlobs(bin->data, bin->size, &fh, &xfi, blobs, &blobCount) == DAWFT_OK && blobCount > 0) {
+		const DawftBlob * b = &blobs[blobCount - 1];
+		if(xfi.fileType == 'C' && b->faceDataIdx == -1 && b->width >= w && b->height >= h && imgFitsData(b->size, b->width, b->height, b->compression)) {
+			size_t previewSize = (size_t)b->width * b->height * 2;
+			u8 * preview = (b->width == w && b->height == h) ? pixels : malloc(previewSize);
+			if(preview != NULL && dawftDecodeBlob(&bin->data[b->offset], b->size, b->width, b->height, b->compression, preview, previewSize) == DAWFT_OK &&
+					(preview == pixels || shrinkPixels(preview, b->width, b->height, pixels, w, h) == DAWFT_OK)) {
+				r = 0;
+				*fromPreview = true;
+			}
+			if(preview != pixels) {
+				free(preview);
+			}
+		}
+		if(r != 0) {
+			FaceRenderer * fr = newFaceRenderer(bin->data, bin->size, xfi.fileType);
+			if(fr != NULL && renderPreview(fr, s, w, h, pixels) == DAWFT_OK) {
+				r = 0;
+			}
+			deleteFaceRenderer(fr);
+		}
+	}
+	deleteBytes(bin);
+	return r;
+}
+
+// One thumbnail's name, and which file it is for
+typedef struct _ThumbnailName {
+	char * name;
+	u32 idx;
+} ThumbnailName;
+
+static int compareThumbnailNames(const void * a, const void * b) {
+	const ThumbnailName * na = a;
+	const ThumbnailName * nb = b;
+	int c = strcmp(na->name, nb->name);
+	return (c != 0) ? c : ((na->idx > nb->idx) - (na->idx < nb->idx));
+}
+
+// Name each file's thumbnail after its path, without .bin, with the folder separators replaced by _. So a/face.bin
+// and b/face.bin become a_face and b_face. If two files still get the same name (the same file twice, or a_face.bin
+// and a/face.bin), only the first keeps it, and the other's entry is NULL. Returns NULL if out of memory.
+// Delete with deleteThumbnailNames.
+static char ** newThumbnailNames(char ** fileNames, u32 fileCount) {
+	char ** names = calloc(fileCount + 1, sizeof(char *));
+	ThumbnailName * sorted = malloc((fileCount + 1) * sizeof(ThumbnailName));
+	bool ok = (names != NULL && sorted != NULL);
+	for(u32 i=0; ok && i<fileCount; i++) {
+		const char * path = fileNames[i];
+		while(path[0] == '.' && (path[1] == '/' || path[1] == '\\')) {
+			path += 2;
+		}
+		while(path[0] == '/' || path[0] == '\\') {
+			path++;
+		}
+		size_t len = strlen(path);
+		if(len > 4 && streq(&path[len - 4], ".bin")) {
+			len -= 4;
+		}
+		names[i] = malloc(len + 1);
+		ok = (names[i] != NULL);
+		for(size_t c=0; ok && c<len; c++) {
+			names[i][c] = (path[c] == '/' || path[c] == '\\' || path[c] == ':') ? '_' : path[c];
+		}
+		if(ok) {
+			names[i][len] = 0;
+			sorted[i] = (ThumbnailName){ .name = names[i], .idx = i };
+		}
+	}
+	if(ok) {
+		qsort(sorted, fileCount, sizeof(ThumbnailName), compareThumbnailNames);
+		for(u32 i=1; i<fileCount; i++) {
+			if(streq(sorted[i].name, sorted[i - 1].name)) {
+				names[sorted[i].idx] = NULL;		// still pointed to by sorted, so freed below
+			}
+		}
+		for(u32 i=1; i<fileCount; i++) {
+			if(names[sorted[i].idx] == NULL) {
+				free(sorted[i].name);
+			}
+		}
+	} else if(names != NULL) {
+		for(u32 i=0; i<fileCount; i++) {
+			free(names[i]);
+		}
+		free(names);
+		names = NULL;
+	}
+	free(sorted);
+	return names;
+}
+
+static void deleteThumbnailNames(char ** names, u32 fileCount) {
+	if(names != NULL) {
+		for(u32 i=0; i<fileCount; i++) {
+			free(names[i]);
+		}
+		free(names);
+	}
+}
+
+// Save a thumbnail to t->folder as name. Returns 0 for success.
+static int saveThumbnail(ThumbnailMaker * t, char * name, const u8 * pixels) {
+	char thumbFileName[1100];
+	int n = snprintf(thumbFileName, sizeof(thumbFileName), "%s%s%s.%s", t->folder, DIR_SEPERATOR, name, DumpFormatStr[t->format]);
+	if(n < 0 || (size_t)n >= sizeof(thumbFileName)) {
+		return 1;
+	}
+	Bytes * img = NULL;
+	int r = 1;
+	if(newDumpImgFromPixels(t->format, pixels, t->w, t->h, &img) == 0) {
+		r = saveBytesToFile(thumbFileName, img);
+	}
+	deleteBytes(img);
+	return r;
+}
+
+static void * thumbnailThread(void * arg) {
+	ThumbnailMaker * t = arg;
+	u8 * pixels = malloc((size_t)t->w * t->h * 2);
+	while(1) {
+#ifndef WINDOWS
+		pthread_mutex_lock(&t->lock);
+#endif
+		u32 i = t->next++;
+#ifndef WINDOWS
+		pthread_mutex_unlock(&t->lock);
+#endif
+		if(i >= t->end) {
+			break;
+		}
+		bool fromPreview = false;
+		int r = 1;
+		if(t->sheet == NULL && t->thumbNames[i] == NULL) {
+			printf("WARNING: The thumbnail of '%s' would have the same name as another's.\n", t->fileNames[i]);
+			r = -1;
+		} else if(pixels != NULL) {
+			r = drawThumbnail(t->fileNames[i], t->fileType, t->s, t->w, t->h, pixels, &fromPreview);
+		}
+		if(r == 0 && t->sheet != NULL) {
+			// each tile has its own place on the sheet, so no lock is needed
+			u32 tile = i - t->sheetFirst;
+			size_t stride = (size_t)t->columns * t->w * 2;
+			u8 * dst = &t->sheet[(size_t)(tile / t->columns) * t->h * stride + (size_t)(tile % t->columns) * t->w * 2];
+			for(u32 y=0; y<t->h; y++) {
+				memcpy(&dst[y * stride], &pixels[(size_t)y * t->w * 2], (size_t)t->w * 2);
+			}
+		} else if(r == 0) {
+			r = saveThumbnail(t, t->thumbNames[i], pixels);
+		}
+		if(r > 0) {
+			printf("WARNING: Unable to make a thumbnail of '%s'.\n", t->fileNames[i]);
+		}
+		t->made[i] = (r == 0);
+#ifndef WINDOWS
+		pthread_mutex_lock(&t->lock);
+#endif
+		t->failed += (r != 0) ? 1 : 0;
+		t->previews += (r == 0 && fromPreview) ? 1 : 0;
+#ifndef WINDOWS
+		pthread_mutex_unlock(&t->lock);
+#endif
+	}
+	free(pixels);
+	return NULL;
+}
+
+// Make thumbnails of files t->next to t->end - 1, using threadCount threads.
+static void runThumbnailThreads(ThumbnailMaker * t, u32 threadCount) {
+#ifndef WINDOWS
+	pthread_t threads[256];
+	u32 started = 0;
+	u32 count = t->end - t->next;		// read before any thread starts taking files
+	for(; started + 1 < threadCount && started + 1 < count && started < 256; started++) {
+		if(pthread_create(&threads[started], NULL, thumbnailThread, t) != 0) {
+			break;
+		}
+	}
+	thumbnailThread(t);			// help out, and make sure it gets done even if no threads started
+	for(u32 i=0; i<started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+#else
+	(void)threadCount;
+	thumbnailThread(t);
+#endif
+}
+
+// The library's messages, which would say nothing about which file they are for
+static void ignoreDiagnostics(void * ctx, const char * msg) {
+	(void)ctx;
+	(void)msg;
+}
+
+// Make a w x h thumbnail of each of the fileCount bin files in fileNames, in state s, using threadCount threads.
+// If sheetName isn't NULL, they are tiled columns x rows onto contact sheets, sheetNameNNN.ext, listed in
+// sheetName.txt. Otherwise each is saved to folder, named after its bin file. Returns 0 if every thumbnail was made.
+static int makeThumbnails(char ** fileNames, u32 fileCount, char fileType, const FaceState * s, u32 w, u32 h,
+		char * sheetName, u32 columns, u32 rows, char * folder, DumpFormat format, u32 threadCount) {
+	ThumbnailMaker t = { .fileNames = fileNames, .fileType = fileType, .s = s, .w = w, .h = h, .columns = columns,
+		.folder = folder, .format = format };
+	t.made = calloc(fileCount + 1, sizeof(bool));
+	if(t.made == NULL) {
+		printf("ERROR: Out of memory.\n");
+		return 1;
+	}
+	FILE * index = NULL;
+	if(sheetName != NULL) {
+		char indexFileName[1100];
+		snprintf(indexFileName, sizeof(indexFileName), "%s.txt", sheetName);
+		index = fopen(indexFileName, "w");
+		t.sheet = malloc((size_t)columns * rows * w * h * 2);
+		if(index == NULL || t.sheet == NULL) {
+			printf("ERROR: %s\n", (index == NULL) ? "Unable to open the contact sheet index for writing." : "Out of memory.");
+			if(index != NULL) {
+				fclose(index);
+			}
+			free(t.sheet);
+			free(t.made);
+			return 1;
+		}
+	} else {
+		t.thumbNames = newThumbnailNames(fileNames, fileCount);
+		if(t.thumbNames == NULL) {
+			printf("ERROR: Out of memory.\n");
+			free(t.made);
+			return 1;
+		}
+		d_mkdir(folder, S_IRWXU);
+	}
+	dawftSetDiagnostics(ignoreDiagnostics, NULL);
+#ifndef WINDOWS
+	pthread_mutex_init(&t.lock, NULL);
+#endif
+
+	int r = 0;
+	u32 sheetCount = 0;
+	if(sheetName == NULL) {
+		t.end = fileCount;
+		runThumbnailThreads(&t, threadCount);
+	}
+	for(u32 first=0; sheetName != NULL && first<fileCount && r == 0; first += columns * rows) {
+		// the last sheet only has as many rows as it needs
+		u32 count = (fileCount - first < columns * rows) ? fileCount - first : columns * rows;
+		u32 sheetRows = (count + columns - 1) / columns;
+		memset(t.sheet, 0, (size_t)columns * sheetRows * w * h * 2);
+		t.sheetFirst = first;
+		t.next = first;
+		t.end = first + count;
+		runThumbnailThreads(&t, threadCount);
+
+		char sheetFileName[1100];
+		snprintf(sheetFileName, sizeof(sheetFileName), "%s%03u.%s", sheetName, sheetCount++, DumpFormatStr[format]);
+		Bytes * img = NULL;
+		r = newDumpImgFromPixels(format, t.sheet, columns * w, sheetRows * h, &img);
+		if(r == 0) {
+			r = saveBytesToFile(sheetFileName, img);
+		}
+		deleteBytes(img);
+		for(u32 i=0; i<count; i++) {
+			if(t.made[first + i]) {		// the tiles of files that failed are left black, and not listed
+				fprintf(index, "%s %u %u %u %u %s\n", sheetFileName, (i % columns) * w, (i / columns) * h, w, h, fileNames[first + i]);
+			}
+		}
+	}
+
+#ifndef WINDOWS
+	pthread_mutex_destroy(&t.lock);
+#endif
+	dawftSetDiagnostics(NULL, NULL);
+	if(index != NULL && fclose(index) != 0) {
+		printf("ERROR: Unable to write the contact sheet index.\n");
+		r = 1;
+	}
+	free(t.sheet);
+	free(t.made);
+	deleteThumbnailNames(t.thumbNames, fileCount);
+	if(r == 0) {
+		printf("Made %u thumbnails of %ux%u (%u from preview images, %u drawn)", fileCount - t.failed, w, h, t.previews,
+			fileCount - t.failed - t.previews);
+		if(sheetName != NULL) {
+			printf(" on %u contact sheets, listed in '%s.txt'.\n", sheetCount, sheetName);
+		} else {
+			printf(" in '%s'.\n", folder);
+		}
+		if(t.failed > 0) {
+			printf("%u files failed.\n", t.failed);
+		}
+	}
+	return (r == 0 && t.failed == 0) ? 0 : 1;
+}
+
+
+//----------------------------------------------------------------------------
+//  WATCHBIN - Recreate the bin file whenever the source folder changes
+//----------------------------------------------------------------------------
+
+#ifdef __linux__
+
+static double msSince(struct timespec * start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)(now.tv_sec - start->tv_sec) * 1000.0 + (double)(now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+// Returns true if the file called name in the watched folder affects the bin file. outputName is the name of the bin
+// file, if it is in the watched folder, or NULL.
+static bool watchedFileRelevant(const char * name, const char * outputName) {
+	size_t nameLen = strlen(name);
+	if(streq(name, MANIFEST_FILENAME)) return false;							// written by us
+	if(outputName != NULL && streq(name, outputName)) return false;			// the output file, whatever it is called
+	if(nameLen >= 4 && streq(&name[nameLen-4], ".tmp")) return false;			// temporary files
+	if(nameLen >= 4 && streq(&name[nameLen-4], ".bin")) return false;			// output files
+	return (name[0] != 0 && !streq(name, ".") && !streq(name, ".."));
+}
+
+// Read the file called name, in srcFolder, into snapshot, and hash it once here instead of on every rebuild. If it
+// isn't a file that can be read (it has been deleted, or is a folder), it is removed from snapshot.
+static void refreshSnapshotFile(Archive * snapshot, char * srcFolder, const char * name) {
+	char path[1024];
+	struct stat st;
+	snprintf(path, sizeof(path), "%s%s%s", srcFolder, DIR_SEPERATOR, name);
+	Bytes * b = (stat(path, &st) == 0 && S_ISREG(st.st_mode)) ? newBytesFromFile(path) : NULL;
+	if(b == NULL) {
+		removeArchiveEntry(snapshot, name);
+		return;
+	}
+	setArchiveEntry(snapshot, name, b, hashBytes(b->data, b->size, HASH_SEED));
+}
+
+// Read all the files in srcFolder that affect the bin file into a new snapshot, to build it from. Returns NULL on failure.
+static Archive * newFolderSnapshot(char * srcFolder, const char * outputName) {
+	DIR * dir = opendir(srcFolder);
+	if(dir == NULL) {
+		printf("ERROR: Unable to read folder '%s'.\n", srcFolder);
+		return NULL;
+	}
+	Archive * snapshot = newEmptyArchive();
+	struct dirent * de;
+	while(snapshot != NULL && (de = readdir(dir)) != NULL) {
+		if(watchedFileRelevant(de->d_name, outputName)) {
+			refreshSnapshotFile(snapshot, srcFolder, de->d_name);
+		}
+	}
+	closedir(dir);
+	return snapshot;
+}
+
+// Files watchface.txt names in other folders aren't watched, so read them again before every rebuild.
+static void refreshSnapshotOtherFolders(Archive * snapshot, char * srcFolder) {
+	Bytes * text = newBytesFromArchive(snapshot, "watchface.txt");
+	FaceSpec * spec = (text != NULL) ? malloc(sizeof(FaceSpec)) : NULL;
+	if(spec == NULL) {
+		deleteBytes(text);
+		return;
+	}
+	dawftSetDiagnostics(ignoreDiagnostics, NULL);		// the rebuild reports any problems with it
+	int r = parseWatchFaceTxt(spec, text);
+	dawftSetDiagnostics(NULL, NULL);
+	deleteBytes(text);
+	for(u32 i=0; r == 0 && i<spec->h.blobCount; i++) {
+		if(strchr(spec->blobFileNames[i], '/') != NULL) {
+			refreshSnapshotFile(snapshot, srcFolder, spec->blobFileNames[i]);
+			if(spec->blobAtlas[i]) {
+				char name[300];
+				getAtlasTextName(spec->blobFileNames[i], name, sizeof(name));
+				refreshSnapshotFile(snapshot, srcFolder, name);
+			}
+		}
+	}
+	free(spec);
+}
+
+// Bring snapshot up to date with the events in buf: files written or moved into the folder are read again, and files
+// deleted or moved out are forgotten. Other files aren't read again. Returns true if any of them affects the bin file.
+// If events were lost, *rescan is set, to read the whole folder again.
+static bool applyWatchEvents(Archive * snapshot, char * srcFolder, const char * buf, ssize_t len, const char * outputName, bool * rescan) {
+	bool relevant = false;
+	for(ssize_t i = 0; i < len; ) {
+		const struct inotify_event * ev = (const struct inotify_event *)&buf[i];
+		i += (ssize_t)sizeof(struct inotify_event) + ev->len;
+		if(ev->mask & IN_Q_OVERFLOW) {
+			*rescan = true;
+			relevant = true;
+			continue;
+		}
+		if(ev->len == 0 || !watchedFileRelevant(ev->name, outputName)) continue;
+		if(ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+			removeArchiveEntry(snapshot, ev->name);
+		} else {
+			refreshSnapshotFile(snapshot, srcFolder, ev->name);
+		}
+		relevant = true;
+	}
+	return relevant;
+}
+
+// Returns the name of outputFileName if it is in srcFolder, or NULL. Free it with free().
+static char * newOutputNameInFolder(const char * srcFolder, const char * outputFileName) {
+	const char * name = strrchr(outputFileName, '/');
+	char * dir = NULL;
+	if(name == NULL) {
+		name = outputFileName;
+		dir = realpath(".", NULL);
+	} else {
+		char * outputDir = strndup(outputFileName, (size_t)(name - outputFileName) + 1);
+		dir = (outputDir != NULL) ? realpath(outputDir, NULL) : NULL;
+		free(outputDir);
+		name++;
+	}
+	char * folder = realpath(srcFolder, NULL);
+	char * r = (dir != NULL && folder != NULL && streq(dir, folder)) ? strdup(name) : NULL;
+	free(dir);
+	free(folder);
+	return r;
+}
+
+// Recreate outputFileName each time a file in srcFolder is saved. The files, and their hashes, are kept in memory, and
+// only the ones named by inotify events are read and hashed again. Encoded blobs and the decoded background are kept
+// in memory too, so only changed bitmaps are decoded and compressed again.
+static int watchBin(char * srcFolder, char * outputFileName, BlobCache * cache, u32 threadCount) {
+	int ifd = inotify_init1(IN_CLOEXEC);
+	if(ifd < 0) {
+		printf("ERROR: inotify_init1() failed.\n");
+		return 1;
+	}
+	if(inotify_add_watch(ifd, srcFolder, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM) < 0) {
+		printf("ERROR: Unable to watch folder '%s'.\n", srcFolder);
+		close(ifd);
+		return 1;
+	}
+	char * outputName = newOutputNameInFolder(srcFolder, outputFileName);
+	Archive * snapshot = NULL;
+
+	char buf[16384] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	bool rebuild = true;
+	bool rescan = true;
+
+	while(1) {
+		if(rescan) {
+			deleteArchive(snapshot);
+			snapshot = newFolderSnapshot(srcFolder, outputName);
+			rescan = false;
+		}
+		if(snapshot == NULL) {
+			break;
+		}
+		if(rebuild) {
+			struct timespec start;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			refreshSnapshotOtherFolders(snapshot, srcFolder);
+			int r = createBin(srcFolder, snapshot, outputFileName, NULL, cache, NULL, threadCount);
+			pruneBlobCache(cache);
+			if(r == 0) {
+				printf("Rebuilt '%s' in %.1f ms. Watching '%s' for changes...\n", outputFileName, msSince(&start), srcFolder);
+			} else {
+				printf("Rebuild failed. Watching '%s' for changes...\n", srcFolder);
+			}
+			fflush(stdout);
+			rebuild = false;
+		}
+
+		// wait for a change
+		ssize_t len = read(ifd, buf, sizeof(buf));
+		if(len <= 0) {
+			printf("ERROR: Failed to read inotify events.\n");
+			break;
+		}
+		rebuild = applyWatchEvents(snapshot, srcFolder, buf, len, outputName, &rescan);
+
+		// an editor may save several files at once, so wait until things are quiet
+		struct pollfd pfd = { .fd = ifd, .events = POLLIN };
+		while(rebuild && poll(&pfd, 1, 20) > 0) {
+			len = read(ifd, buf, sizeof(buf));
+			if(len <= 0) break;
+			applyWatchEvents(snapshot, srcFolder, buf, len, outputName, &rescan);
+		}
+	}
+
+	deleteArchive(snapshot);
+	free(outputName);
+	close(ifd);
+	return 1;
+}
+
+#else
+
+static int watchBin(char * srcFolder, char * outputFileName, BlobCache * cache, u32 threadCount) {
+	(void)srcFolder;
+	(void)outputFileName;
+	(void)cache;
+	(void)threadCount;
+	printf("ERROR: watch mode is only supported on Linux.\n");
+	return 1;
+}
+
+#endif
+
+
+//----------------------------------------------------------------------------
+//  DAEMON - Serve create/info/dump/swap requests over a Unix domain socket
+//----------------------------------------------------------------------------
+
+/*	All integers are u32, little-endian.
+
+	Request:	magic "DAWF", command length, payload length, command, payload
+	Response:	status (0 for success), text length, payload length, text, payload
+
+	Commands take the same options as the command line, but no FILENAME. Every input comes in the request payload,
+	and every output goes back in the response payload, so the daemon never reads or writes files of its own:
+		create											request payload is a tar archive of the face's folder,
+														response payload is the bin file
+		info [fileType=C]								request payload is the bin file, response text is its watchface.txt
+		dump [folder=FOLDERNAME] [raw=true] [format=qoi] [fileType=C]	request payload is the bin file,
+														response payload is a tar archive of the folder
+		swap background=NAME [fileType=C]				request payload is a tar archive holding face.bin, the background
+														NAME and, to blend again, the face's watchface.txt and bitmaps.
+														response payload is the new bin file, and the text names the
+														template the archive is kept as
+		swap background=NAME template=KEY [fileType=C]	request payload is a tar archive holding only NAME. face.bin and
+														the rest come from the template KEY, if it is still kept
+
+	A connection may send any number of requests, one after the other. Between requests, it waits in the listening
+	thread, not in a worker, so idle connections don't hold up other clients.
+	Encoded blobs and the decoded background are shared between requests through an in-memory BlobCache, and the
+	archives of the last DAEMON_MAX_TEMPLATES faces swapped are kept as templates.
+*/
+
+#ifndef WINDOWS
+
+#define DAEMON_MAGIC 0x46574144			// "DAWF"
+#define DAEMON_MAX_COMMAND 1024
+#define DAEMON_MAX_PAYLOAD (64*1024*1024)
+#define DAEMON_QUEUE_SIZE 256
+#define DAEMON_MAX_CONNECTIONS 1024		// waiting for their next request
+#define DAEMON_TIMEOUT 10				// seconds a client has to send all of a request once started, or to read all of a response
+#define DAEMON_MAX_TEMPLATES 16			// faces kept for swap requests that give template= instead of sending the face again
+
+// The archive of a swap request, kept so later swaps of the same face only need to send the new background
+typedef struct _SwapTemplate {
+	u64 key;							// hash of the request payload, or 0 if the slot is empty
+	u32 lastUsed;
+	u32 users;							// requests using it now. it isn't replaced until they have finished.
+	Archive * archive;
+} SwapTemplate;
+
+typedef struct _SwapTemplates {
+	SwapTemplate slots[DAEMON_MAX_TEMPLATES];
+	u32 clock;
+	pthread_mutex_t lock;
+} SwapTemplates;
+
+typedef struct _DaemonQueue {
+	int fds[DAEMON_QUEUE_SIZE];			// connections with a request waiting for a worker
+	u32 head;
+	u32 count;
+	pthread_mutex_t lock;
+	pthread_cond_t notEmpty;
+	int handBack;						// workers write connections to this pipe, for their next request
+	BlobCache * cache;
+	SwapTemplates templates;
+} DaemonQueue;
+
+// The time, in milliseconds, DAEMON_TIMEOUT seconds from now.
+static int64_t daemonDeadline(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000 + DAEMON_TIMEOUT * 1000;
+}
+
+// Wait until fd is ready for events, or the deadline passes. Returns false if it passed.
+static bool waitUntil(int fd, short events, int64_t deadline) {
+	struct pollfd pfd = { .fd = fd, .events = events };
+	int r = -1;
+	while(r < 0) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		int64_t left = deadline - ((int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+		if(left <= 0) return false;
+		r = poll(&pfd, 1, (int)left);
+		if(r < 0 && errno != EINTR) return false;
+	}
+	return r > 0;
+}
+
+// The whole of buf must arrive before the deadline, however slowly it trickles in.
+static bool readFull(int fd, void * buf, size_t size, int64_t deadline) {
+	u8 * p = buf;
+	while(size > 0) {
+		if(!waitUntil(fd, POLLIN, deadline)) return false;
+		ssize_t r = recv(fd, p, size, MSG_DONTWAIT);
+		if(r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+		if(r <= 0) return false;
+		p += r;
+		size -= (size_t)r;
+	}
+	return true;
+}
+
+static bool writeFull(int fd, const void * buf, size_t size, int64_t deadline) {
+	const u8 * p = buf;
+	while(size > 0) {
+		if(!waitUntil(fd, POLLOUT, deadline)) return false;
+		ssize_t r = send(fd, p, size, MSG_DONTWAIT);
+		if(r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+		if(r <= 0) return false;
+		p += r;
+		size -= (size_t)r;
+	}
+	return true;
+}
+
+// The client has DAEMON_TIMEOUT seconds to read the whole response.
+static bool sendResponse(int fd, u32 status, const char * text, Bytes * payload) {
+	u32 head[3] = { status, (u32)strlen(text), payload ? (u32)payload->size : 0 };
+	int64_t deadline = daemonDeadline();
+	return writeFull(fd, head, sizeof(head), deadline)
+		&& writeFull(fd, text, head[1], deadline)
+		&& (payload == NULL || writeFull(fd, payload->data, payload->size, deadline));
+}
+
+// Take the tar archive in *payload. Returns NULL, with an error in text, if it isn't one.
+static Archive * newArchiveFromPayload(Bytes ** payload, const char * mode, char * text, size_t textSize) {
+	Archive * archive = NULL;
+	if(*payload != NULL) {
+		archive = newArchiveFromBytes(*payload);
+		*payload = NULL;
+	}
+	if(archive == NULL) {
+		snprintf(text, textSize, "ERROR: %s requires a tar archive payload.\n", mode);
+	}
+	return archive;
+}
+
+// Get the archive of the template with key, and hold on to it until releaseTemplate(). Returns NULL if it isn't kept.
+static Archive * useTemplate(SwapTemplates * t, u64 key) {
+	Archive * archive = NULL;
+	pthread_mutex_lock(&t->lock);
+	for(u32 i=0; i<DAEMON_MAX_TEMPLATES; i++) {
+		SwapTemplate * st = &t->slots[i];
+		if(st->key != 0 && st->key == key) {
+			st->lastUsed = ++t->clock;
+			st->users++;
+			archive = st->archive;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&t->lock);
+	return archive;
+}
+
+static void releaseTemplate(SwapTemplates * t, Archive * archive) {
+	pthread_mutex_lock(&t->lock);
+	for(u32 i=0; i<DAEMON_MAX_TEMPLATES; i++) {
+		if(t->slots[i].archive == archive && t->slots[i].users > 0) {
+			t->slots[i].users--;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&t->lock);
+}
+
+// Keep archive as the template with key, in place of the least recently used one that isn't in use. Takes archive,
+// deleting it if it is already kept, or there's no room. Returns true if the template is kept.
+static bool keepTemplate(SwapTemplates * t, u64 key, Archive * archive) {
+	SwapTemplate * slot = NULL;
+	pthread_mutex_lock(&t->lock);
+	for(u32 i=0; i<DAEMON_MAX_TEMPLATES; i++) {
+		SwapTemplate * st = &t->slots[i];
+		if(st->key != 0 && st->key == key) {
+			st->lastUsed = ++t->clock;
+			pthread_mutex_unlock(&t->lock);
+			deleteArchive(archive);
+			return true;
+		}
+		if(st->users == 0 && (slot == NULL || st->key == 0 || (slot->key != 0 && st->lastUsed < slot->lastUsed))) {
+			slot = st;
+		}
+	}
+	Archive * old = NULL;
+	if(slot != NULL) {
+		old = slot->archive;
+		*slot = (SwapTemplate){ .key = key, .lastUsed = ++t->clock, .archive = archive };
+		archive = NULL;
+	}
+	pthread_mutex_unlock(&t->lock);
+	deleteArchive(old);
+	deleteArchive(archive);
+	return (slot != NULL);
+}
+
+// Handle one request. The payload may be taken, setting *payload to NULL. Fills in text (of size textSize), and *out
+// if there is a payload to send back. Returns the status.
+static u32 handleRequest(char * command, Bytes ** payload, BlobCache * cache, SwapTemplates * templates, char * text, size_t textSize, Bytes ** out) {
+	char mode[16] = "";
+	u64 templateKey = 0;
+	char folderName[1024] = "";
+	char backgroundName[1024] = "";
+	char fileType = 0;
+	bool raw = false;
+	DumpFormat format = DUMP_BMP;
+
+	// read the command, like main() does
+	TokensIdx tok;
+	getTokensIdx(command, &tok);
+	for(u32 i=0; i<tok.count; i++) {
+		char arg[1024] = "";
+		memcpy(arg, tok.ptr[i], tok.length[i] < sizeof(arg) - 1 ? tok.length[i] : sizeof(arg) - 1);
+		if(i == 0) {
+			snprintf(mode, sizeof(mode), "%.15s", arg);
+		} else if(streqn(arg, "folder=", 7)) {
+			snprintf(folderName, sizeof(folderName), "%s", &arg[7]);
+		} else if(streqn(arg, "fileType=", 9)) {
+			fileType = arg[9];
+		} else if(streq(arg, "raw=true")) {
+			raw = true;
+		} else if(streq(arg, "format=qoi")) {
+			format = DUMP_QOI;
+		} else if(streqn(arg, "background=", 11)) {
+			snprintf(backgroundName, sizeof(backgroundName), "%s", &arg[11]);
+		} else if(streqn(arg, "template=", 9)) {
+			templateKey = strtoull(&arg[9], NULL, 16);
+		}
+	}
+
+	if(streq(mode, "create")) {
+		Archive * archive = newArchiveFromPayload(payload, mode, text, textSize);
+		if(archive == NULL) {
+			return 1;
+		}
+		int r = buildBin("payload", archive, cache, out);
+		deleteArchive(archive);
+		if(r != 0) {
+			snprintf(text, textSize, "ERROR: Failed to create bin file.\n");
+			return 1;
+		}
+		snprintf(text, textSize, "Done. Size %zu.\n", (*out)->size);
+		return 0;
+	}
+
+	if(streq(mode, "swap")) {
+		if(backgroundName[0] == 0) {
+			snprintf(text, textSize, "ERROR: swap requires background=\n");
+			return 1;
+		}
+		u64 payloadHash = (*payload != NULL) ? hashBytes((*payload)->data, (*payload)->size, HASH_SEED) : 0;
+		Archive * archive = newArchiveFromPayload(payload, mode, text, textSize);
+		if(archive == NULL) {
+			return 1;
+		}
+
+		// face.bin and the face's folder come from this request, or from a template kept from an earlier one
+		Archive * face = archive;
+		if(templateKey != 0) {
+			face = useTemplate(templates, templateKey);
+			if(face == NULL) {
+				snprintf(text, textSize, "ERROR: Template %08x%08x isn't kept, send face.bin again.\n", (u32)(templateKey >> 32), (u32)templateKey);
+				deleteArchive(archive);
+				return 1;
+			}
+		}
+		Bytes * bin = newBytesFromArchive(face, "face.bin");
+		Bytes * bgBytes = newBytesFromArchive(archive, backgroundName);
+		int r = 1;
+		if(bin == NULL || bgBytes == NULL) {
+			snprintf(text, textSize, "ERROR: swap requires face.bin and '%s' in the payload.\n", backgroundName);
+		} else if(swapBin(bin, fileType, bgBytes, "payload", face, cache, out) != 0) {
+			snprintf(text, textSize, "ERROR: Failed to swap background to '%s'.\n", backgroundName);
+		} else {
+			r = 0;
+		}
+		deleteBytes(bin);
+		deleteBytes(bgBytes);
+		if(face != archive) {
+			releaseTemplate(templates, face);
+		} else if(r == 0 && payloadHash != 0) {
+			if(keepTemplate(templates, payloadHash, archive)) {
+				templateKey = payloadHash;
+			}
+			archive = NULL;
+		}
+		deleteArchive(archive);
+		if(r == 0 && templateKey != 0) {
+			snprintf(text, textSize, "Done. Size %zu. Template %08x%08x.\n", (*out)->size, (u32)(templateKey >> 32), (u32)templateKey);
+		} else if(r == 0) {
+			snprintf(text, textSize, "Done. Size %zu.\n", (*out)->size);
+		}
+		return (u32)r;
+	}
+
+	if(streq(mode, "info") || streq(mode, "dump")) {
+		if(*payload == NULL) {
+			snprintf(text, textSize, "ERROR: %s requires a bin file payload.\n", mode);
+			return 1;
+		}
+		BinInfo * bi = malloc(sizeof(BinInfo));
+		if(bi == NULL) {
+			snprintf(text, textSize, "ERROR: Out of memory.\n");
+			return 1;
+		}
+		int r = loadBinInfo(*payload, fileType, bi);
+		if(r == 0 && streq(mode, "dump")) {
+			// the files go back to the client as a tar archive, never to the daemon's own filesystem
+			char * tar = NULL;
+			size_t tarSize = 0;
+			FILE * f = open_memstream(&tar, &tarSize);
+			r = (f != NULL) ? dumpBin(*payload, bi, folderName, raw, false, format, -1, f) : 1;
+			if(f != NULL && fclose(f) != 0) {
+				r = 1;
+			}
+			Bytes * b = (r == 0) ? malloc(sizeof(Bytes) + tarSize) : NULL;
+			if(b != NULL) {
+				b->size = tarSize;
+				memcpy(b->data, tar, tarSize);
+				*out = b;
+			} else {
+				r = 1;
+			}
+			free(tar);
+		}
+		snprintf(text, textSize, "%s", (r == 0) ? bi->watchFaceStr : "ERROR: Failed to read bin file.\n");
+		free(bi);
+		return (u32)r;
+	}
+
+	snprintf(text, textSize, "ERROR: Unknown command '%s'.\n", mode);
+	return 1;
+}
+
+// Serve one request on a connection. Returns false if the connection should be closed.
+static bool serveRequest(int fd, BlobCache * cache, SwapTemplates * templates, char * text, size_t textSize) {
+	char command[DAEMON_MAX_COMMAND + 1];
+	u32 head[3];
+	int64_t deadline = daemonDeadline();		// the request has started arriving, so all of it must arrive by then
+	if(!readFull(fd, head, sizeof(head), deadline)) {
+		return false;
+	}
+	if(head[0] != DAEMON_MAGIC || head[1] > DAEMON_MAX_COMMAND || head[2] > DAEMON_MAX_PAYLOAD) {
+		sendResponse(fd, 1, "ERROR: Bad request.\n", NULL);
+		return false;
+	}
+	if(!readFull(fd, command, head[1], deadline)) {
+		return false;
+	}
+	command[head[1]] = 0;
+
+	Bytes * payload = NULL;
+	if(head[2] > 0) {
+		payload = malloc(sizeof(Bytes) + head[2]);
+		if(payload == NULL) {
+			sendResponse(fd, 1, "ERROR: Out of memory.\n", NULL);
+			return false;
+		}
+		payload->size = head[2];
+		if(!readFull(fd, payload->data, payload->size, deadline)) {
+			deleteBytes(payload);
+			return false;
+		}
+	}
+
+	Bytes * out = NULL;
+	text[0] = 0;
+	u32 status = handleRequest(command, &payload, cache, templates, text, textSize, &out);
+	bool sent = sendResponse(fd, status, text, out);
+	deleteBytes(payload);
+	deleteBytes(out);
+	return sent;
+}
+
+static void * daemonWorker(void * arg) {
+	DaemonQueue * q = arg;
+	char * text = malloc(32000);
+	while(text != NULL) {
+		pthread_mutex_lock(&q->lock);
+		while(q->count == 0) {
+			pthread_cond_wait(&q->notEmpty, &q->lock);
+		}
+		int fd = q->fds[q->head];
+		q->head = (q->head + 1) % DAEMON_QUEUE_SIZE;
+		q->count--;
+		pthread_mutex_unlock(&q->lock);
+
+		// one request, then the connection goes back to the listening thread to wait for the next
+		if(!serveRequest(fd, q->cache, &q->templates, text, 32000) || write(q->handBack, &fd, sizeof(fd)) != sizeof(fd)) {
+			close(fd);
+		}
+	}
+	return NULL;
+}
+
+// Give the connection fd, which has a request (or has closed), to a worker.
+static void queueConnection(DaemonQueue * q, int fd) {
+	pthread_mutex_lock(&q->lock);
+	if(q->count == DAEMON_QUEUE_SIZE) {
+		pthread_mutex_unlock(&q->lock);
+		sendResponse(fd, 1, "ERROR: Too many requests.\n", NULL);
+		close(fd);
+		return;
+	}
+	q->fds[(q->head + q->count) % DAEMON_QUEUE_SIZE] = fd;
+	q->count++;
+	pthread_cond_signal(&q->notEmpty);
+	pthread_mutex_unlock(&q->lock);
+}
+
+// Listen on socketPath, which only this user may connect to, and serve requests with threadCount worker threads.
+// Only returns on failure.
+static int daemonBin(char * socketPath, u32 threadCount, BlobCache * cache) {
+	struct sockaddr_un addr = { 0 };
+	addr.sun_family = AF_UNIX;
+	if(strlen(socketPath) >= sizeof(addr.sun_path)) {
+		printf("ERROR: Socket path is too long.\n");
+		return 1;
+	}
+	strcpy(addr.sun_path, socketPath);
+
+	int sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	int pipeFds[2];
+	if(sfd < 0 || pipe(pipeFds) != 0) {
+		printf("ERROR: Unable to create socket.\n");
+		return 1;
+	}
+	unlink(socketPath);
+	mode_t oldMask = umask(0177);		// so there is never a moment when others could connect
+	int bound = bind(sfd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(oldMask);
+	if(bound != 0 || chmod(socketPath, 0600) != 0 || listen(sfd, 64) != 0) {
+		printf("ERROR: Unable to listen on '%s'.\n", socketPath);
+		close(sfd);
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);		// a client going away shouldn't stop the daemon
+
+	static DaemonQueue q;
+	q.cache = cache;
+	q.handBack = pipeFds[1];
+	pthread_mutex_init(&q.lock, NULL);
+	pthread_mutex_init(&q.templates.lock, NULL);
+	pthread_cond_init(&q.notEmpty, NULL);
+	for(u32 i=0; i<threadCount; i++) {
+		pthread_t t;
+		if(pthread_create(&t, NULL, daemonWorker, &q) != 0) {
+			printf("ERROR: Unable to start worker thread.\n");
+			close(sfd);
+			return 1;
+		}
+		pthread_detach(t);
+	}
+
+	printf("Listening on '%s' with %u threads.\n", socketPath, threadCount);
+	fflush(stdout);
+
+	// the workers' messages would be interleaved, and each request's result is in its response anyway
+	if(freopen("/dev/null", "w", stdout) == NULL) {
+		fprintf(stderr, "WARNING: Unable to silence worker messages.\n");
+	}
+
+	// wait for new connections, connections handed back by the workers, and requests on those
+	static struct pollfd pfds[2 + DAEMON_MAX_CONNECTIONS];
+	u32 waiting = 0;
+	pfds[0] = (struct pollfd){ .fd = sfd, .events = POLLIN };
+	pfds[1] = (struct pollfd){ .fd = pipeFds[0], .events = POLLIN };
+	while(1) {
+		if(poll(pfds, 2 + waiting, -1) < 0) {
+			continue;
+		}
+
+		// a connection with a request (or that has closed) goes to a worker
+		for(u32 i=0; i<waiting; ) {
+			if(pfds[2 + i].revents != 0) {
+				queueConnection(&q, pfds[2 + i].fd);
+				pfds[2 + i] = pfds[2 + --waiting];
+			} else {
+				i++;
+			}
+		}
+
+		int fds[64 + 1];
+		int count = 0;
+		if(pfds[1].revents & POLLIN) {
+			ssize_t r = read(pipeFds[0], fds, 64 * sizeof(int));
+			count = (r > 0) ? (int)(r / (ssize_t)sizeof(int)) : 0;
+		}
+		if(pfds[0].revents & POLLIN) {
+			int fd = accept(sfd, NULL, NULL);
+			if(fd >= 0) {
+				fds[count++] = fd;
+			}
+		}
+		for(int i=0; i<count; i++) {
+			if(waiting == DAEMON_MAX_CONNECTIONS) {
+				sendResponse(fds[i], 1, "ERROR: Too many connections.\n", NULL);
+				close(fds[i]);
+				continue;
+			}
+			pfds[2 + waiting++] = (struct pollfd){ .fd = fds[i], .events = POLLIN };
+		}
+	}
+}
+
+#else
+
+static int daemonBin(char * socketPath, u32 threadCount, BlobCache * cache) {
+	(void)socketPath;
+	(void)threadCount;
+	(void)cache;
+	printf("ERROR: daemon mode is not supported on Windows.\n");
+	return 1;
+}
+
+#endif
+
+
+//----------------------------------------------------------------------------
+//  MAIN
+//----------------------------------------------------------------------------
+
+// Move messages from stdout to stderr, so stdout can carry data. Returns a FILE for the data, or NULL on failure.
+static FILE * openDataStdout(void) {
+	fflush(stdout);
+#ifdef WINDOWS
+	int fd = _dup(_fileno(stdout));
+	if(fd < 0 || _dup2(_fileno(stderr), _fileno(stdout)) != 0) {
+		return NULL;
+	}
+	_setmode(fd, _O_BINARY);
+	return _fdopen(fd, "wb");
+#else
+	int fd = dup(STDOUT_FILENO);
+	if(fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+		return NULL;
+	}
+	return fdopen(fd, "wb");
+#endif
+}
+
+int main(int argc, char * argv[]) {
+	char * fileName = "";
+	char * folderName = "";
+	char * cacheFolderName = "";
+	char * socketName = "dawft.sock";
+	char * backgroundName = "";
+	char * outputName = "";
+	char * archiveName = "";
+	char * sheetName = "";
+	char * listName = "";
+	FILE * dataStdout = NULL;
+	u32 threadCount = 4;
+	enum _MODE {
+		HELP,
+		INFO,
+		DUMP,
+		CREATE,
+		SWAP,
+		WATCH,
+		DAEMON,
+		RENDER,
+		SIMULATE,
+		EXPORT_ANIMATION,
+		THUMBNAILS,
+		PRINT_TYPES,
+	} mode = HELP;
+	bool raw = false;
+	bool stream = false;
+	bool atlas = false;
+	DumpFormat format = DUMP_BMP;
+	char fileType = 0;
+	FaceState state;
+	setDefaultFaceState(&state);
+	u32 tickCount = 3600;
+	u32 delayMs = 100;
+	FacePreview preview = { 0 };
+	u32 thumbWidth = 140;
+	u32 thumbHeight = 163;
+	u32 columns = 10;
+	u32 rows = 10;
+
+	// if data is going to stdout (the output file of create or swap, or the archive of dump), messages go to stderr instead
+	bool hasOutput = (argc >= 2) && (streq(argv[1], "swap") || streq(argv[1], "render") || streq(argv[1], "export-animation"));
+	bool outputStdout = false;
+	bool archiveStdout = false;
+	u32 positional = 0;
+	for(int i=2; i<argc; i++) {
+		if(strchr(argv[i], '=') == NULL) {
+			// the file names are read the same way below: the last one for create, or any after the first for hasOutput
+			if(streq(argv[1], "create") || (hasOutput && positional > 0)) {
+				outputStdout = streq(argv[i], "-");
+			}
+			positional++;
+		} else if(streq(argv[i], "archive=-") && streq(argv[1], "dump")) {
+			archiveStdout = true;
+		}
+	}
+	if(outputStdout || archiveStdout) {
+		dataStdout = openDataStdout();
+		if(dataStdout == NULL) {
+			printf("ERROR: Unable to write to stdout.\n");
+			return 1;
+		}
+	}
+
+	// display basic program header
+    printf("\n%s\n\n","dawft: Watch Face Tool for MO YOUNG / DA FIT binary watch face files.");
+    
+	// check byte order
+	if(!systemIsLittleEndian()) {
+		printf("Sorry, this system is big-endian, and this program has only been designed for little-endian systems.\n");
+		return 1;
+	}
+
+	// find executable name
+	char * basename = "mywft";
+	if(argc>0) {
+		// find the name of the executable. not perfect but it's only used for display and no messy ifdefs.
+		char * b = strrchr(argv[0],'\\');
+		if(!b) {
+			b = strrchr(argv[0],'/');
+		}
+		basename = b ? b+1 : argv[0];
+	}
+  
+	// read mode argument
+	if(argc >= 2) {
+		if(streq(argv[1], "dump")) {
+			mode = DUMP;
+		} else if(streq(argv[1], "create")) {
+			mode = CREATE;
+		} else if(streq(argv[1], "swap")) {
+			mode = SWAP;
+		} else if(streq(argv[1], "watch")) {
+			mode = WATCH;
+		} else if(streq(argv[1], "daemon")) {
+			mode = DAEMON;
+		} else if(streq(argv[1], "render")) {
+			mode = RENDER;
+		} else if(streq(argv[1], "simulate")) {
+			mode = SIMULATE;
+		} else if(streq(argv[1], "export-animation")) {
+			mode = EXPORT_ANIMATION;
+		} else if(streq(argv[1], "thumbnails")) {
+			mode = THUMBNAILS;
+		} else if(streq(argv[1], "info")) {
+			mode = INFO;
+		} else if(streq(argv[1], "print_types")) {
+			mode = PRINT_TYPES;
 		}
 	}
 
@@ -807,29 +3363,84 @@ int main(int argc, char * argv[]) {
 	}
 
 	// display help
-    if(argc<3 || mode == HELP) {
+    if((argc<3 && mode != DAEMON) || mode == HELP) {
 		printf("Usage:   %s MODE [OPTIONS] [FILENAME]\n\n",basename);
 		printf("%s\n","  MODE:");
 		printf("%s\n","    info               Display info about binary file.");
 		printf("%s\n","    dump               Dump data from binary file to folder.");
 		printf("%s\n","    create             Create binary file from data in folder.");
+		printf("%s\n","    swap               Create binary file from another, with a new background.");
+		printf("%s\n","    watch              Create binary file, and recreate it whenever the folder changes.");
+		printf("%s\n","    daemon             Serve create/info/dump/swap requests on a Unix domain socket.");
+		printf("%s\n","    render             Draw the face from a binary file, as the watch would show it, to a bitmap.");
+		printf("%s\n","    simulate           Run the face a second at a time, and report how much is redrawn each second.");
+		printf("%s\n","    export-animation   Draw every frame of the animation in a binary file, to an animated GIF.");
+		printf("%s\n","    thumbnails         Make small pictures of many binary files, tiled onto contact sheets or one each.");
 		printf("%s\n","    print_types        Print the data type codes and description.");
 		printf("%s\n","  OPTIONS:");
 		printf("%s\n","    folder=FOLDERNAME  Folder to dump data to/read from. Defaults to the face design number.");
-		printf("%s\n","                       Required for create.");
-		printf("%s\n","    raw=true           When dumping, dump raw files. Default is false.");
+		printf("%s\n","                       Required for create and watch.");
+		printf("%s\n","    raw=true           When dumping, dump raw files. Default is false. For export-animation,");
+		printf("%s\n","                       write the frames one after another as big-endian RGB565, instead of a GIF.");
+		printf("%s\n","    atlas=true         When dumping, put each group of bitmaps (digits, names, frames) in one atlas.");
+		printf("%s\n","    format=qoi         When dumping, write bitmaps as QOI files instead of BMP (format=bmp).");
 		printf("%s\n","    fileType=C         Specify type of binary file (A, B or C). Default is to autodetect or type A.");
+		printf("%s\n","    cache=FOLDERNAME   When creating or swapping, reuse encoded bitmaps from (and save them to) this folder.");
+		printf("%s\n","    stream=true        When creating, work a row at a time to use less memory. Doesn't use cache=.");
+		printf("%s\n","    preview=auto       When creating, draw the 140x163 preview image (the last bitmap) from the face");
+		printf("%s\n","                       at time= and date=, instead of loading it. preview=WxH for other sizes.");
+		printf("%s\n","    archive=FILE       Dump to, or create from, a tar archive instead of a folder. - is stdout/stdin.");
+		printf("%s\n","    background=FILE    Bitmap for the new background, for swap. folder= is used to blend again");
+		printf("%s\n","                       any bitmaps that were blended onto the old background.");
+		printf("%s\n","    socket=PATH        Socket for daemon mode. Default is dawft.sock.");
+		printf("%s\n","    threads=4          Number of threads writing the binary file, or worker threads for daemon mode.");
+		printf("%s\n","    ticks=3600         Number of seconds to simulate.");
+		printf("%s\n","    delay=100          Milliseconds each frame is shown for, in an exported GIF.");
+		printf("%s\n","    size=140x163       Size of each thumbnail.");
+		printf("%s\n","    sheet=NAME         Tile the thumbnails onto contact sheets NAME000.bmp... listed in NAME.txt,");
+		printf("%s\n","                       columns=10 by rows=10. Otherwise they go one each into folder=thumbnails.");
+		printf("%s\n","    list=FILE          For thumbnails, a file listing binary files, one per line. - is stdin.");
+		printf("%s\n","    time=10:08:36      For render, simulate, thumbnails and preview=, the time and date to show,");
+		printf("%s\n","    date=2022-06-15      and the readings: steps=, hr=, kcal=, dist=, battery=, temp= (e.g. -5 or 70F),");
+		printf("%s\n","                         clock=12, units=mi, bt=false and frame= (of an animation).");
 		printf("%s\n","  FILENAME               Binary watch face file for input (or output). Required for info/dump/create.");
+		printf("%s\n","                         For swap, render and export-animation, give the input file and then");
+		printf("%s\n","                         the output file.");
+		printf("%s\n","                         For thumbnails, give any number of input files.");
+		printf("%s\n","                         Otherwise, if several are given, the last one is used.");
+		printf("%s\n","                         - is stdin for input, or stdout for output.");
 		printf("\n");
 		return 0;
     }
 		
 	// read command-line parameters
 	for(int i=2; i<argc; i++) {
+		int stateOption = (mode == CREATE || mode == RENDER || mode == SIMULATE || mode == EXPORT_ANIMATION || mode == THUMBNAILS) ?
+			parseFaceStateOption(&state, argv[i]) : 0;
+		if(stateOption < 0) {
+			return 1;
+		} else if(stateOption > 0) {
+			continue;
+		}
 		if(streq(argv[i], "raw=true")) {
 			raw = 1;
 		} else if(streq(argv[i], "raw=false")) {
 			raw = 0;
+		} else if(streq(argv[i], "atlas=true")) {
+			atlas = true;
+		} else if(streq(argv[i], "atlas=false")) {
+			atlas = false;
+		} else if(streq(argv[i], "format=bmp")) {
+			format = DUMP_BMP;
+		} else if(streq(argv[i], "format=qoi")) {
+			format = DUMP_QOI;
+		} else if(streqn(argv[i], "format=", 7)) {
+			printf("ERROR: Invalid format=\n");
+			return 1;
+		} else if(streq(argv[i], "stream=true")) {
+			stream = true;
+		} else if(streq(argv[i], "stream=false")) {
+			stream = false;
 		} else if(streqn(argv[i], "raw=", 4)) {
 			printf("ERROR: Invalid raw=\n");
 			return 1;
@@ -844,305 +3455,286 @@ int main(int argc, char * argv[]) {
 			return 1;
 		} else if(streqn(argv[i], "folder=", 7) && strlen(argv[i]) >= 8) {
 			folderName = &argv[i][7];
-		} else {
-			// must be fileName
+		} else if(streqn(argv[i], "cache=", 6) && strlen(argv[i]) >= 7) {
+			cacheFolderName = &argv[i][6];
+		} else if(streqn(argv[i], "background=", 11) && strlen(argv[i]) >= 12) {
+			backgroundName = &argv[i][11];
+		} else if(streqn(argv[i], "archive=", 8) && strlen(argv[i]) >= 9) {
+			archiveName = &argv[i][8];
+		} else if(streqn(argv[i], "socket=", 7) && strlen(argv[i]) >= 8) {
+			socketName = &argv[i][7];
+		} else if(streqn(argv[i], "ticks=", 6)) {
+			tickCount = readNum(&argv[i][6]);
+		} else if(streqn(argv[i], "delay=", 6)) {
+			delayMs = readNum(&argv[i][6]);
+		} else if(streqn(argv[i], "size=", 5)) {
+			if(sscanf(&argv[i][5], "%ux%u", &thumbWidth, &thumbHeight) != 2 || thumbWidth == 0 || thumbHeight == 0) {
+				printf("ERROR: Invalid size=, use WxH\n");
+				return 1;
+			}
+		} else if(streqn(argv[i], "columns=", 8)) {
+			columns = readNum(&argv[i][8]);
+			if(columns < 1 || columns > 100) {
+				printf("ERROR: Invalid columns=\n");
+				return 1;
+			}
+		} else if(streqn(argv[i], "rows=", 5)) {
+			rows = readNum(&argv[i][5]);
+			if(rows < 1 || rows > 100) {
+				printf("ERROR: Invalid rows=\n");
+				return 1;
+			}
+		} else if(streqn(argv[i], "sheet=", 6) && strlen(argv[i]) >= 7) {
+			sheetName = &argv[i][6];
+		} else if(streqn(argv[i], "list=", 5) && strlen(argv[i]) >= 6) {
+			listName = &argv[i][5];
+		} else if(streq(argv[i], "preview=auto")) {
+			preview.w = 140;
+			preview.h = 163;
+		} else if(streqn(argv[i], "preview=", 8)) {
+			if(sscanf(&argv[i][8], "%ux%u", &preview.w, &preview.h) != 2 || preview.w == 0 || preview.h == 0) {
+				printf("ERROR: Invalid preview=, use auto or WxH\n");
+				return 1;
+			}
+		} else if(streqn(argv[i], "threads=", 8)) {
+			threadCount = readNum(&argv[i][8]);
+			if(threadCount < 1 || threadCount > 256) {
+				printf("ERROR: Invalid threads=\n");
+				return 1;
+			}
+		} else if(fileName[0] == 0 || !hasOutput) {
+			// must be fileName. if there are several, the last one is used
 			fileName = argv[i];
+		} else {
+			// or the output fileName, for the modes that read one file and write another
+			outputName = argv[i];
 		}
 	}
 
 	// Check if we are in CREATE mode
-	if(mode==CREATE) {
-		return createBin(folderName, fileName);
-	}
-
-	// We are in INFO / DUMP mode
-
-	// Open the binary input file
-	Bytes * bytes = newBytesFromFile(fileName);
-	if(bytes == NULL) {
-		printf("ERROR: Failed to read file into memory.\n");
-		return 1;
+	preview.state = state;
+	if(mode==CREATE && stream) {
+		if(preview.w != 0) {
+			printf("ERROR: stream=true can't be used with preview=\n");
+			return 1;
+		}
+		if(archiveName[0] != 0) {
+			printf("ERROR: stream=true can't be used with archive=\n");
+			return 1;
+		}
+		if(dataStdout != NULL) {
+			printf("ERROR: stream=true can't write to stdout\n");
+			return 1;
+		}
+		return createBinStreaming(folderName, fileName);
 	}
-
-	u8 * fileData = bytes->data;
-	size_t fileSize = bytes->size;
-
-	// Check file size	
-	if(fileSize < 1700) {
-		printf("ERROR: File is less than the minimum header size (1700 bytes)!\n");
-		deleteBytes(bytes);
-		return 1;
+	if(mode==CREATE) {
+		Archive * archive = NULL;
+		if(archiveName[0] != 0) {
+			Bytes * archiveBytes = newBytesFromInput(archiveName);
+			if(archiveBytes == NULL) {
+				printf("ERROR: Failed to read archive '%s'.\n", archiveName);
+				return 1;
+			}
+			archive = newArchiveFromBytes(archiveBytes);
+			if(archive == NULL) {
+				return 1;
+			}
+		}
+		BlobCache * cache = NULL;
+		if(cacheFolderName[0] != 0) {
+			cache = newBlobCache(cacheFolderName, false);
+			if(cache == NULL) {
+				deleteArchive(archive);
+				return 1;
+			}
+		}
+		int r = createBin((archive != NULL) ? archiveName : folderName, archive, fileName, dataStdout, cache,
+			(preview.w != 0) ? &preview : NULL, threadCount);
+		deleteBlobCache(cache);
+		deleteArchive(archive);
+		return r;
 	}
 
-	// Check first byte of file
-	if(fileData[0] != 0x81 && fileData[0] != 0x04 && fileData[0] != 0x84) {
-		printf("WARNING: Unknown fileID: 0x%02x\n", fileData[0]);
+	// Check if we are in SWAP mode
+	if(mode==SWAP) {
+		if(backgroundName[0] == 0 || outputName[0] == 0) {
+			printf("ERROR: swap requires background= and an output file name\n");
+			return 1;
+		}
+		BlobCache * cache = NULL;
+		if(cacheFolderName[0] != 0) {
+			cache = newBlobCache(cacheFolderName, false);
+			if(cache == NULL) {
+				return 1;
+			}
+		}
+		int r = swapBackground(fileName, fileType, backgroundName, folderName, outputName, dataStdout, cache);
+		deleteBlobCache(cache);
+		return r;
 	}
 
-	// Autodetect file type, if unspecified.
-	if(fileType==0) {
-		fileType = autodetectFileType(fileData, fileSize);
+	// Check if we are in RENDER mode
+	if(mode==RENDER) {
+		if(outputName[0] == 0) {
+			printf("ERROR: render requires an output file name\n");
+			return 1;
+		}
+		return renderBin(fileName, fileType, &state, format, outputName, dataStdout);
 	}
 
-	// Save important info to xfi struct
-	ExtraFileInfo xfi = { .fileType = fileType, .animationFrames = 0 };
-
-	// determine header size
-	u32 headerSize = 1900;
-	if(fileType == 'A') {
-		headerSize = 1700;
+	// Check if we are in SIMULATE mode
+	if(mode==SIMULATE) {
+		return simulateBin(fileName, fileType, &state, tickCount);
 	}
 
-	// Check header size
-	if(fileSize < headerSize) {
-		printf("ERROR: File is less than the header size (%u bytes)!\n", headerSize);
-		deleteBytes(bytes);
-		return 1;
+	// Check if we are in EXPORT_ANIMATION mode
+	if(mode==EXPORT_ANIMATION) {
+		if(outputName[0] == 0) {
+			printf("ERROR: export-animation requires an output file name\n");
+			return 1;
+		}
+		return exportAnimation(fileName, fileType, &state, raw, delayMs, threadCount, outputName, dataStdout);
 	}
 
-	// store discovered data in string, for saving to file, so we can recreate this bin file
-	char watchFaceStr[32000] = "";		// have enough room for all the lines we need to store
-	char lineBuf[128] = "";
-
-	snprintf(lineBuf, sizeof(lineBuf), "fileType        %c\n", fileType);
-	d_strlcat(watchFaceStr, lineBuf, sizeof(watchFaceStr));
-
-	snprintf(lineBuf, sizeof(lineBuf), "fileID          0x%02x\n", fileData[0]);
-	d_strlcat(watchFaceStr, lineBuf, sizeof(watchFaceStr));
-
-
-
-	// Load header struct from file
-	FaceHeader header;
-	setHeader(&header, fileData, xfi.fileType);
-	FaceHeader * h = &header;
-
-	// Print header info
-	snprintf(lineBuf, sizeof(lineBuf), "dataCount       %u\n", h->dataCount);
-	d_strlcat(watchFaceStr, lineBuf, sizeof(watchFaceStr));
-	snprintf(lineBuf, sizeof(lineBuf), "blobCount       %u\n", h->blobCount);
-	d_strlcat(watchFaceStr, lineBuf, sizeof(watchFaceStr));
-	snprintf(lineBuf, sizeof(lineBuf), "faceNumber      %u\n", h->faceNumber);
-	d_strlcat(watchFaceStr, lineBuf, sizeof(watchFaceStr));
-	snprintf(lineBuf, sizeof(lineBuf), "\n%s\n", "#               TYPE  INDEX      X    Y    W    H");
-	d_strlcat(watchFaceStr, lineBuf, sizeof(watchFaceStr));
-
-	// Print faceData header info
-	FaceData * background = NULL;
-	FaceData * backgrounds = NULL;
-	int myDataCount = 0;
-	
-	for(u32 i=0; i<(sizeof(h->faceData)/sizeof(h->faceData[0])); i++) {
-		if(h->faceData[i].type != 0 || i==0) {		// some formats use type 0 in position 0 as background
-			FaceData * fd = &h->faceData[i];			
-			snprintf(lineBuf, sizeof(lineBuf), "faceData        0x%02x    %03u   %4u %4u %4u %4u          # %-15s\n",
-				fd->type, fd->idx, fd->x, fd->y, fd->w, fd->h, getDataTypeStr(fd->type)
-				);
-			d_strlcat(watchFaceStr, lineBuf, sizeof(watchFaceStr));
-			myDataCount++;
-			if(fd->type == 0x01 && background == NULL) {
-				background = &h->faceData[i];
+	// Check if we are in THUMBNAILS mode
+	if(mode==THUMBNAILS) {
+		// the bin files are given on the command line, and listed one per line in list=
+		char * list = NULL;
+		size_t listSize = 0;
+		if(listName[0] != 0) {
+			Bytes * listBytes = newBytesFromInput(listName);
+			list = (listBytes != NULL) ? malloc(listBytes->size + 1) : NULL;
+			if(list == NULL) {
+				printf("ERROR: Failed to read list '%s'.\n", listName);
+				deleteBytes(listBytes);
+				return 1;
 			}
-			if(fd->type == 0x00 && backgrounds == NULL) {
-				backgrounds = &h->faceData[i];
+			listSize = listBytes->size;
+			memcpy(list, listBytes->data, listSize);
+			list[listSize] = 0;
+			deleteBytes(listBytes);
+		}
+		u32 maxFiles = (u32)argc;
+		for(size_t i=0; i<listSize; i++) {
+			maxFiles += (list[i] == '\n') ? 1 : 0;
+		}
+		char ** files = malloc((maxFiles + 1) * sizeof(char *));
+		if(files == NULL) {
+			printf("ERROR: Out of memory.\n");
+			free(list);
+			return 1;
+		}
+		u32 fileCount = 0;
+		for(int i=2; i<argc; i++) {
+			if(strchr(argv[i], '=') == NULL) {
+				files[fileCount++] = argv[i];
 			}
-			if(fd->type >= 0xF6 && fd->type <= 0xF8) {
-				if(fileType == 'A') {
-					xfi.animationFrames = h->sizes[200];
-				} else {
-					xfi.animationFrames = h->sizes[0];		// animation frame count is stored here for type C. TODO test assumption this is correct for Type B
-				}
+		}
+		for(char * line = list; line != NULL && *line != 0; ) {
+			char * end = strchr(line, '\n');
+			char * next = (end != NULL) ? end + 1 : NULL;
+			end = (end != NULL) ? end : &line[strlen(line)];
+			while(end > line && (end[-1] == '\r' || end[-1] == ' ')) {
+				end--;
 			}
+			*end = 0;
+			if(*line != 0) {
+				files[fileCount++] = line;
+			}
+			line = next;
 		}
+		int r = 1;
+		if(fileCount == 0) {
+			printf("ERROR: thumbnails requires binary files, or list=\n");
+		} else {
+			r = makeThumbnails(files, fileCount, fileType, &state, thumbWidth, thumbHeight, (sheetName[0] != 0) ? sheetName : NULL,
+				columns, rows, (folderName[0] != 0) ? folderName : "thumbnails", format, threadCount);
+		}
+		free(files);
+		free(list);
+		return r;
 	}
 
-	if(xfi.animationFrames != 0) {
-		snprintf(lineBuf, sizeof(lineBuf), "animationFrames %u\n", xfi.animationFrames);
-		d_strlcat(watchFaceStr, lineBuf, sizeof(watchFaceStr));
-	}
-
-
-	if(background == NULL && backgrounds == NULL) {
-		printf("WARNING: No background found.\n");
-	}
-
-	int fail = 0;
-
-	if(myDataCount != h->dataCount) {
-		printf("myDataCount     %u\n", myDataCount);
-		if(myDataCount < h->dataCount) {
-			printf("WARNING: myDataCount < dataCount!\n");
+	// Check if we are in WATCH mode
+	if(mode==WATCH) {
+		BlobCache * cache = newBlobCache(cacheFolderName, true);
+		if(cache == NULL) {
+			return 1;
 		}
+		int r = watchBin(folderName, fileName, cache, threadCount);
+		deleteBlobCache(cache);
+		return r;
 	}
 
-	// Count offsets to verify number of blobs. Estimate blob sizes.
-	int myBlobCount = 0;
-	u8 blobCompression[250] = { 0 };
-	int blobEstSize[250] = { 0 };
-	snprintf(lineBuf, sizeof(lineBuf), "\n%s\n", "#             INDEX  CTYPE");
-	d_strlcat(watchFaceStr, lineBuf, sizeof(watchFaceStr));
-	for(u32 i=0; i<250; i++) {
-		if(h->offsets[i] != 0 || i == 0) {
-			myBlobCount += 1;
-			if(h->offsets[i] >= fileSize && fileType != 'B' && !fail) {
-				printf("ERROR: Offset %u is greater than file size, cannot dump this file.\n", h->offsets[i]);	// Unknown file type
-				fail = 1;
-			} else {
-				int isRLE = (get_u16(&fileData[headerSize+h->offsets[i]]) == 0x2108);
-				ImgCompression ic = isRLE?(fileType=='C'?RLE_LINE:RLE_BASIC):NONE;				
-				// if(fileType=='B') it's actually a big LZO blob that needs to be split up.
-				blobCompression[i] = (u8)ic;
-				if(i<249 && h->offsets[i+1] != 0) {
-					blobEstSize[i] = (int)(h->offsets[i+1] - h->offsets[i]);
-				} else {
-					blobEstSize[i] = (int)fileSize - (int)headerSize - (int)h->offsets[i];
-				}
-				snprintf(lineBuf, sizeof(lineBuf), "blobCompression %03u  %-9s  %8u  %8i\n", i, ImgCompressionStr[ic], h->offsets[i], blobEstSize[i]);
-				d_strlcat(watchFaceStr, lineBuf, sizeof(watchFaceStr));
-			}
-		} 
+	// Check if we are in DAEMON mode
+	if(mode==DAEMON) {
+		BlobCache * cache = newBlobCache(cacheFolderName, true);
+		if(cache == NULL) {
+			return 1;
+		}
+		cache->maxEntries = 4096;
+		int r = daemonBin(socketName, threadCount, cache);
+		deleteBlobCache(cache);
+		return r;
 	}
 
-	// display all the important data
-	printf("%s", watchFaceStr);		
+	// We are in INFO / DUMP mode
 
-	if(fail) {
-		deleteBytes(bytes);
+	// Open the binary input file
+	Bytes * bytes = newBytesFromInput(fileName);
+	if(bytes == NULL) {
+		printf("ERROR: Failed to read file into memory.\n");
 		return 1;
 	}
 
-	if(myBlobCount != h->blobCount) {
-		printf("myBlobCount     %u\n", myBlobCount);
-		if(myBlobCount < h->blobCount) {
-			printf("WARNING: myBlobCount < blobCount!\n");
-		}
+	// Check file size and header, print what we find
+	BinInfo * bi = malloc(sizeof(BinInfo));
+	if(bi == NULL) {
+		printf("ERROR: Out of memory.\n");
+		deleteBytes(bytes);
+		return 1;
 	}
-
-	// Check if we are in DUMP mode
-	if(mode==DUMP) {
-		if(fileType == 'B') {
-			// What compression method is used in type B files? LZO?
-			printf("Dumping from fileType B is not supported\n");
-			deleteBytes(bytes);
-			return 1;
+	int r = loadBinInfo(bytes, fileType, bi);
+	printf("%s", bi->watchFaceStr);
+	if(r == 0 && mode == DUMP) {
+		int srcFd = -1;
+#ifndef WINDOWS
+		// raw blobs can be copied straight from the file (even as stdin), if it hasn't changed size since it was read
+		struct stat st;
+		srcFd = streq(fileName, "-") ? dup(STDIN_FILENO) : open(fileName, O_RDONLY);
+		if(srcFd >= 0 && (fstat(srcFd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size != bytes->size)) {
+			close(srcFd);
+			srcFd = -1;
 		}
-
-		char dumpFileName[1024];
-		char * folderStr;
-		char faceNumberStr[16];
-		snprintf(faceNumberStr, sizeof(faceNumberStr), "%d", h->faceNumber);
-		if(folderName[0]==0) {		// if empty string
-			folderStr = faceNumberStr;
-		} else {
-			folderStr = folderName;
+#endif
+		FILE * archive = NULL;
+		if(dataStdout != NULL) {
+			archive = dataStdout;
+		} else if(archiveName[0] != 0) {
+			archive = fopen(archiveName, "wb");
+			if(archive == NULL) {
+				printf("ERROR: Failed to open '%s' for writing\n", archiveName);
+				r = 1;
+			}
 		}
-		
-		// create folder if it doesn't exist
-		d_mkdir(folderStr, S_IRWXU);
-
-		// dump the watch face data
-		snprintf(dumpFileName, sizeof(dumpFileName), "%s%swatchface.txt", folderStr, DIR_SEPERATOR);
-		FILE * fwf = fopen(dumpFileName,"wb");
-		if(fwf == NULL) {
-			printf("ERROR: Failed to open '%s' for writing\n", dumpFileName);
-			deleteBytes(bytes);
-			return 1;
+		if(r == 0) {
+			r = dumpBin(bytes, bi, folderName, raw, atlas, format, srcFd, archive);
 		}
-		size_t res = fwrite(watchFaceStr, 1, strlen(watchFaceStr), fwf);
-		if(res != strlen(watchFaceStr)) {
-			printf("ERROR: Failed when writing to '%s'\n", dumpFileName);
-			deleteBytes(bytes);
-			fclose(fwf);
-			remove(dumpFileName);
-			return 1;
+		if(archive != NULL && fclose(archive) != 0 && r == 0) {
+			printf("ERROR: Unable to write to the archive.\n");
+			r = 1;
 		}
-		fclose(fwf);
-
-		// for each binary blob
-		for(int i=0; i<h->blobCount; i++) {
-			// determine file offset
-			u32 fileOffset = headerSize + h->offsets[i];
-			bool rawDumpThisOne = false;
-			
-			// get faceData index from offset index
-			int fdi = getFaceDataIndexFromOffsetIndex(i, h, &xfi);
-
-			// is it RLE?
-			int isRLE = (get_u16(&fileData[fileOffset]) == 0x2108);
-			
-			// Dump the bitmaps
-			if(fdi != -1) {
-				u32 width = h->faceData[fdi].w;
-				u32 height = h->faceData[fdi].h;
-				if(h->faceData[fdi].type == 0x00 && (fileType=='A') && (h->faceData[fdi].w != 240 || h->faceData[fdi].h != 24)) {
-					// override width and height
-					h->faceData[fdi].w = 240;
-					h->faceData[fdi].h = 24;
-					width = 240;
-					height = 24;
-					printf("WARNING: Overriding width and height with 240x24 for backgrounds of type 0x00\n");
-				}
-				if((h->faceData[fdi].type >= 0xD7 && h->faceData[fdi].type <= 0xD9) && i > (h->faceData[fdi].idx + 10)) {
-					// override width
-					width = width * 2;
-					printf("WARNING: Overriding width and height for double-width degC degF 0xD7-0xD9\n");
-				}
-
-				snprintf(dumpFileName, sizeof(dumpFileName), "%s%s%03u.bmp", folderStr, DIR_SEPERATOR, i);
-				printf("Dumping from %s img to BMP file %s\n", (isRLE?"RLE":"unc"), dumpFileName);
-				dumpBMP16(dumpFileName, &fileData[fileOffset], fileSize-fileOffset, width, height, (fileType=='A'));
-			} else if(i == (h->blobCount - 1)) {
-				// this is a small preview image of 140x163, used when selecting backgrounds (for 240x280 images)
-				snprintf(dumpFileName, sizeof(dumpFileName), "%s%s%03u.bmp", folderStr, DIR_SEPERATOR, i);
-				printf("Dumping from %s img to BMP file %s\n", (isRLE?"RLE":"unc"), dumpFileName);
-				dumpBMP16(dumpFileName, &fileData[fileOffset], fileSize-fileOffset, 140, 163, (fileType=='A'));
-			} else {	// it's just rubbish data... but we should dump it for completeness
-				rawDumpThisOne = true;
-			}
-
-			// Dump the raw data
-			if(raw || rawDumpThisOne) {
-				// determine size of blob
-				size_t size = h->sizes[i]; // Sometimes, length is stored in file, but this is unreliable, and that section is used for other purposes
-				if(blobEstSize[i] >= 0) {
-					size = (size_t)blobEstSize[i];
-					if(h->sizes[i] > 0 && h->sizes[i] != size) {
-						printf("WARNING: Overriding unreliable zone size %u with estimated size %zu\n", h->sizes[i], size);
-					}
-				}
-
-				if(!isRLE) { 
-					// We can also estimate a size for uncompressed images
-					size_t estimatedSize = 0;
-					if(fdi != -1) {
-						estimatedSize = h->faceData[fdi].w * h->faceData[fdi].h * 2;
-					}
-					if(size != estimatedSize && estimatedSize != 0) {
-						printf("WARNING: Size mismatch (file: %zu, estimated: %zu, zone: %u)\n", size, estimatedSize, h->sizes[i]);
-					}
-				}
-
-				if(size == 0) {
-					printf("WARNING: Unable to determine size for blob idx %03u, not dumping raw data.\n", i);
-				} else {
-					// check it won't go past EOF
-					if(fileOffset + size > fileSize) {
-						printf("WARNING: Unable to dump raw blob %u as it exceeds EOF (%zu>%zu)\n", i, fileOffset+size, fileSize);
-					} else {
-						// assemble file name to dump to
-						snprintf(dumpFileName, sizeof(dumpFileName), "%s%s%03u.raw", folderStr, DIR_SEPERATOR, i);
-						printf("Dumping raw blob size %6zu to file %s\n", size ,dumpFileName);
-
-						// dump it
-						int rval = dumpBlob(dumpFileName, &fileData[fileOffset], size);
-						if(rval != 0) {
-							printf("Failed to write data to file: '%s'\n", dumpFileName);
-						}
-					}
-				}
-			}
-
+#ifndef WINDOWS
+		if(srcFd >= 0) {
+			close(srcFd);
 		}
+#endif
+	}
+	free(bi);
+	if(r != 0) {
+		deleteBytes(bytes);
+		return 1;
 	}
 
 	deleteBytes(bytes);
@@ -23,7 +23,9 @@
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
 typedef int32_t i32;
+typedef int64_t i64;
 
 
 //----------------------------------------------------------------------------
@@ -57,9 +59,53 @@ typedef struct _Bytes {
     u8 data[16];        // cover weird padding/align situations
 } Bytes;
 
+#pragma pack (push)
+#pragma pack (1)
+
+typedef struct _FaceData {
+	u8 type;				// type of object we are giving dimensions e.g. hours, day, steps etc.
+	u8 idx;					// index into offset table
+	u16 x;
+	u16 y;
+	u16 w;
+	u16 h;
+} FaceData; 				// size is 10 bytes
+
+typedef struct _FaceHeader {
+	u8 fileID;				// 0x81 or 0x04 or 0x84
+	u8 dataCount;			// how many data objects
+	u8 blobCount;			// how many blob (bitmap) objects
+	u16 faceNumber;			// design number of this face, in this case 0x1E38 or 7736
+	FaceData faceData[39];	// sizeof(FaceData) = 10 bytes
+	u8 padding[5];
+	u32 offsets[250];		// offsets of bitmap data for the face. Table starts at 400. Offsets start from end of header data i.e. at 1900.
+	u16 sizes[250];			// sizes of the bitmap data, in bytes. For Type B, sizes are the uncompressed sizes. Unreliable. Table starts at 1400. Animation frame count is at sizes[0].
+} FaceHeader;				// size is 1900 bytes
+
+#pragma pack (pop)
+
+// Extra info about a binary file, which is not easy to access from binary file header
+typedef struct _ExtraFileInfo {
+	char fileType;
+	char padding;
+	u16 animationFrames;
+} ExtraFileInfo;
+
+// Everything createBin() needs to know from watchface.txt
+typedef struct _FaceSpec {
+	FaceHeader h;						// offsets are not filled in
+	ExtraFileInfo efi;
+	u8 blobCompression[250];			// ImgCompression for each blob
+	signed char blobFaceData[250];		// faceData index for each blob, or -1
+	char blobFileNames[250][256];		// file name for each blob, or empty for the default NNN.bmp
+	u8 blobAtlas[250];					// 1 if the blob is a cell of the atlas named in blobFileNames
+} FaceSpec;
+
 //----------------------------------------------------------------------------
 //  EXPORTED FUNCTIONS
 //----------------------------------------------------------------------------
 
 Bytes * newBytesFromFile(char * filename);
+Bytes * newBytesFromStream(FILE * f);
 Bytes * deleteBytes(Bytes * b);
+void d_printf(const char * format, ...);
@@ -0,0 +1,482 @@
+/*  dumpio.c - writing the many files of a dump
+
+	Da Watch Face Tool (dawft)
+	dawft: Watch Face Tool for MO YOUNG / DA FIT binary watch face files.
+
+	Copyright 2022 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+
+*/
+
+#ifndef WINDOWS
+#define _DEFAULT_SOURCE		// for syscall() and mmap() under -std=c99
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define HAVE_IO_URING
+#endif
+#define HAVE_COPY_RANGE
+#endif
+
+#include "dawft.h"
+#include "dumpio.h"
+#include "tar.h"
+
+
+//----------------------------------------------------------------------------
+//  DUMPLIST
+//----------------------------------------------------------------------------
+
+DumpList * newDumpList(void) {
+	DumpList * list = calloc(1, sizeof(DumpList));
+	if(list == NULL) {
+		printf("ERROR: Out of memory.\n");
+		return NULL;
+	}
+	list->srcFd = -1;
+	return list;
+}
+
+// Delete a DumpList, and the data it owns. Safe to use on already deleted DumpList.
+DumpList * deleteDumpList(DumpList * list) {
+	if(list != NULL) {
+		for(u32 i=0; i<list->count; i++) {
+			deleteBytes(list->files[i].bytes);
+		}
+		free(list->files);
+		free(list);
+	}
+	return NULL;
+}
+
+static DumpFile * addDumpFile(DumpList * list, const char * name) {
+	if(list->count == list->capacity) {
+		u32 capacity = list->capacity ? list->capacity * 2 : 64;
+		DumpFile * files = realloc(list->files, capacity * sizeof(DumpFile));
+		if(files == NULL) {
+			printf("ERROR: Out of memory.\n");
+			return NULL;
+		}
+		list->files = files;
+		list->capacity = capacity;
+	}
+	DumpFile * f = &list->files[list->count++];
+	*f = (DumpFile){ .srcOffset = -1 };
+	snprintf(f->name, sizeof(f->name), "%s", name);
+	return f;
+}
+
+// Add a file to the list, with data in bytes. The list takes ownership of bytes, even on failure.
+int addDumpBytes(DumpList * list, const char * name, Bytes * bytes) {
+	DumpFile * f = addDumpFile(list, name);
+	if(f == NULL) {
+		deleteBytes(bytes);
+		return 1;
+	}
+	f->bytes = bytes;
+	f->data = bytes->data;
+	f->size = bytes->size;
+	return 0;
+}
+
+// Add a file to the list, with size bytes of data, which must outlive the list.
+int addDumpData(DumpList * list, const char * name, const u8 * data, size_t size) {
+	DumpFile * f = addDumpFile(list, name);
+	if(f == NULL) {
+		return 1;
+	}
+	f->data = data;
+	f->size = size;
+	return 0;
+}
+
+// Add a file to the list, like addDumpData(), where the same data is also at srcOffset in list->srcFd.
+int addDumpRange(DumpList * list, const char * name, const u8 * data, size_t size, long long srcOffset) {
+	if(addDumpData(list, name, data, size) != 0) {
+		return 1;
+	}
+	list->files[list->count - 1].srcOffset = srcOffset;
+	return 0;
+}
+
+
+//----------------------------------------------------------------------------
+//  STDIO - write the files one at a time
+//----------------------------------------------------------------------------
+
+static int writeDumpFileStdio(const DumpFile * f) {
+	FILE * file = fopen(f->name, "wb");
+	if(file == NULL) {
+		return 1;
+	}
+	size_t rval = fwrite(f->data, 1, f->size, file);
+	if(fclose(file) != 0 || rval != f->size) {
+		remove(f->name);
+		return 2;
+	}
+	return 0;
+}
+
+
+//----------------------------------------------------------------------------
+//  IO_URING - open, write and close a batch of files with a few system calls
+//----------------------------------------------------------------------------
+
+#ifdef HAVE_IO_URING
+
+#define URING_ENTRIES 256
+
+typedef struct _Uring {
+	int fd;
+	unsigned * sqTail;
+	unsigned * sqMask;
+	unsigned * sqArray;
+	unsigned * cqHead;
+	unsigned * cqTail;
+	unsigned * cqMask;
+	struct io_uring_sqe * sqes;
+	struct io_uring_cqe * cqes;
+	void * sqRing;
+	size_t sqRingSize;
+	void * cqRing;
+	size_t cqRingSize;
+	size_t sqesSize;
+} Uring;
+
+static void closeUring(Uring * u) {
+	if(u->sqes != NULL && u->sqes != MAP_FAILED) munmap(u->sqes, u->sqesSize);
+	if(u->cqRing != NULL && u->cqRing != MAP_FAILED) munmap(u->cqRing, u->cqRingSize);
+	if(u->sqRing != NULL && u->sqRing != MAP_FAILED) munmap(u->sqRing, u->sqRingSize);
+	if(u->fd >= 0) close(u->fd);
+}
+
+// Set up an io_uring. Returns 0 for success. Fails quietly if io_uring isn't available.
+static int openUring(Uring * u) {
+	*u = (Uring){ .fd = -1 };
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	u->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if(u->fd < 0) {
+		return 1;
+	}
+
+	u->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqRing = mmap(NULL, u->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	u->cqRing = mmap(NULL, u->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+	u->sqes = mmap(NULL, u->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if(u->sqRing == MAP_FAILED || u->cqRing == MAP_FAILED || u->sqes == MAP_FAILED) {
+		closeUring(u);
+		return 1;
+	}
+
+	u->sqTail = (unsigned *)((u8 *)u->sqRing + p.sq_off.tail);
+	u->sqMask = (unsigned *)((u8 *)u->sqRing + p.sq_off.ring_mask);
+	u->sqArray = (unsigned *)((u8 *)u->sqRing + p.sq_off.array);
+	u->cqHead = (unsigned *)((u8 *)u->cqRing + p.cq_off.head);
+	u->cqTail = (unsigned *)((u8 *)u->cqRing + p.cq_off.tail);
+	u->cqMask = (unsigned *)((u8 *)u->cqRing + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((u8 *)u->cqRing + p.cq_off.cqes);
+	return 0;
+}
+
+// Get the next free submission queue entry, cleared, tagged with userData.
+static struct io_uring_sqe * getSqe(Uring * u, unsigned * tail, u64 userData) {
+	unsigned idx = *tail & *u->sqMask;
+	struct io_uring_sqe * sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = userData;
+	u->sqArray[idx] = idx;
+	(*tail)++;
+	return sqe;
+}
+
+// Submit count entries queued up to tail, wait for them all, and put each result in results[user_data].
+// Returns 0 for success.
+static int runUring(Uring * u, unsigned tail, unsigned count, int * results) {
+	__atomic_store_n(u->sqTail, tail, __ATOMIC_RELEASE);
+	unsigned submitted = 0;
+	unsigned done = 0;
+	while(done < count) {
+		// the kernel may take only some of the entries (it doesn't wait then), so offer it the rest each time
+		long r = syscall(__NR_io_uring_enter, u->fd, count - submitted, count - done, IORING_ENTER_GETEVENTS, NULL, 0);
+		if(r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			return 1;
+		}
+		if(r > 0) {
+			submitted += (unsigned)r;
+		}
+		unsigned head = *u->cqHead;
+		unsigned cqTail = __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE);
+		while(head != cqTail) {
+			struct io_uring_cqe * cqe = &u->cqes[head & *u->cqMask];
+			results[cqe->user_data] = cqe->res;
+			head++;
+			done++;
+		}
+		__atomic_store_n(u->cqHead, head, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+// Write the files with io_uring: all the opens are submitted at once, then all the writes, then all the closes.
+// Returns -1 if io_uring isn't usable (nothing is reported), otherwise the number of files that failed.
+static int writeDumpFilesUring(DumpFile * allFiles, u32 allCount) {
+	Uring u;
+	if(openUring(&u) != 0) {
+		return -1;
+	}
+
+	int fails = 0;
+	int fds[URING_ENTRIES];
+	int results[URING_ENTRIES];
+	size_t written[URING_ENTRIES];
+	unsigned tail = *u.sqTail;
+
+	for(u32 start=0; start<allCount; start+=URING_ENTRIES) {
+		unsigned n = (allCount - start < URING_ENTRIES) ? allCount - start : URING_ENTRIES;
+		DumpFile * files = &allFiles[start];
+
+		// open
+		for(unsigned i=0; i<n; i++) {
+			struct io_uring_sqe * sqe = getSqe(&u, &tail, i);
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (u64)(uintptr_t)files[i].name;
+			sqe->len = 0644;
+			sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+		}
+		if(runUring(&u, tail, n, fds) != 0) {
+			closeUring(&u);
+			return -1;
+		}
+		if(start == 0 && (fds[0] == -EINVAL || fds[0] == -EOPNOTSUPP)) {
+			closeUring(&u);
+			return -1;		// kernel doesn't support IORING_OP_OPENAT
+		}
+
+		// write, until everything is written (regular files rarely take more than one go)
+		memset(written, 0, sizeof(written));
+		bool more = true;
+		while(more) {
+			unsigned count = 0;
+			for(unsigned i=0; i<n; i++) {
+				if(fds[i] >= 0 && written[i] < files[i].size) {
+					struct io_uring_sqe * sqe = getSqe(&u, &tail, i);
+					sqe->opcode = IORING_OP_WRITE;
+					sqe->fd = fds[i];
+					sqe->addr = (u64)(uintptr_t)&files[i].data[written[i]];
+					sqe->len = (u32)((files[i].size - written[i] > 0x40000000) ? 0x40000000 : files[i].size - written[i]);
+					sqe->off = written[i];
+					count++;
+				}
+			}
+			more = false;
+			if(count == 0) {
+				break;
+			}
+			for(unsigned i=0; i<n; i++) {
+				results[i] = 0;
+			}
+			if(runUring(&u, tail, count, results) != 0) {
+				closeUring(&u);
+				return -1;
+			}
+			for(unsigned i=0; i<n; i++) {
+				if(fds[i] >= 0 && written[i] < files[i].size) {
+					if(results[i] <= 0) {
+						written[i] = (size_t)-1;		// failed
+					} else {
+						written[i] += (size_t)results[i];
+						more = more || (written[i] < files[i].size);
+					}
+				}
+			}
+		}
+
+		// close
+		unsigned count = 0;
+		for(unsigned i=0; i<n; i++) {
+			if(fds[i] >= 0) {
+				struct io_uring_sqe * sqe = getSqe(&u, &tail, i);
+				sqe->opcode = IORING_OP_CLOSE;
+				sqe->fd = fds[i];
+				count++;
+			}
+		}
+		if(count > 0 && runUring(&u, tail, count, results) != 0) {
+			closeUring(&u);
+			return -1;
+		}
+
+		for(unsigned i=0; i<n; i++) {
+			if(fds[i] < 0 || written[i] != files[i].size) {
+				printf("ERROR: Failed to write data to file: '%s'\n", files[i].name);
+				if(fds[i] >= 0) {
+					remove(files[i].name);
+				}
+				fails++;
+			}
+		}
+	}
+
+	closeUring(&u);
+	return fails;
+}
+
+#endif
+
+
+//----------------------------------------------------------------------------
+//  COPY RANGE - copy a file's data from the source file, without it passing through user space
+//----------------------------------------------------------------------------
+
+#ifdef HAVE_COPY_RANGE
+
+// Copy f from srcFd with copy_file_range(), which can share extents on filesystems that support it. If the kernel or
+// filesystem can't do that, use sendfile(), and if that fails too, write the data from memory. Returns 0 for success.
+static int copyDumpFile(int srcFd, const DumpFile * f) {
+	int fd = open(f->name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		return 1;
+	}
+
+	size_t done = 0;
+#ifdef __NR_copy_file_range
+	loff_t inOffset = f->srcOffset;
+	while(done < f->size) {
+		long n = syscall(__NR_copy_file_range, srcFd, &inOffset, fd, NULL, f->size - done, 0);
+		if(n <= 0) {
+			break;
+		}
+		done += (size_t)n;
+	}
+#endif
+
+	off_t offset = (off_t)(f->srcOffset + (long long)done);
+	while(done < f->size) {
+		ssize_t n = sendfile(fd, srcFd, &offset, f->size - done);
+		if(n <= 0) {
+			break;
+		}
+		done += (size_t)n;
+	}
+
+	while(done < f->size) {
+		ssize_t n = write(fd, &f->data[done], f->size - done);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			break;
+		}
+		done += (size_t)n;
+	}
+
+	if(close(fd) != 0 || done != f->size) {
+		remove(f->name);
+		return 2;
+	}
+	return 0;
+}
+
+#endif
+
+
+//----------------------------------------------------------------------------
+//  WRITEDUMPLIST
+//----------------------------------------------------------------------------
+
+// Write every file in the list. On Linux, io_uring is used if it is available, and files added with addDumpRange()
+// are copied from list->srcFd. Returns 0 if every file was written. The order of the files in the list may change.
+int writeDumpList(DumpList * list) {
+	int r = 0;
+	u32 count = list->count;
+
+#ifdef HAVE_COPY_RANGE
+	if(list->srcFd >= 0) {
+		// move the files that can be copied from the source file to the end
+		for(u32 i=0; i<count; ) {
+			if(list->files[i].srcOffset >= 0) {
+				count--;
+				DumpFile tmp = list->files[i];
+				list->files[i] = list->files[count];
+				list->files[count] = tmp;
+			} else {
+				i++;
+			}
+		}
+		for(u32 i=count; i<list->count; i++) {
+			if(copyDumpFile(list->srcFd, &list->files[i]) != 0) {
+				printf("ERROR: Failed to write data to file: '%s'\n", list->files[i].name);
+				r = 1;
+			}
+		}
+	}
+#endif
+
+#ifdef HAVE_IO_URING
+	int fails = writeDumpFilesUring(list->files, count);
+	if(fails >= 0) {
+		return r || fails > 0;
+	}
+#endif
+
+	for(u32 i=0; i<count; i++) {
+		if(writeDumpFileStdio(&list->files[i]) != 0) {
+			printf("ERROR: Failed to write data to file: '%s'\n", list->files[i].name);
+			r = 1;
+		}
+	}
+	return r;
+}
+
+
+//----------------------------------------------------------------------------
+//  WRITEDUMPLISTTAR - write all the files as one tar archive
+//----------------------------------------------------------------------------
+
+// Write every file in the list to f, as a tar archive, in order. Returns 0 for success.
+int writeDumpListTar(DumpList * list, FILE * f) {
+	static const u8 zeros[TAR_BLOCK_SIZE * 2] = { 0 };
+	u8 header[TAR_BLOCK_SIZE];
+	i64 mtime = (i64)time(NULL);
+
+	for(u32 i=0; i<list->count; i++) {
+		DumpFile * file = &list->files[i];
+		if(makeTarHeader(header, file->name, file->size, mtime) != 0) {
+			printf("ERROR: Unable to add '%s' to the archive.\n", file->name);
+			return 1;
+		}
+		size_t padding = (TAR_BLOCK_SIZE - file->size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+		if(fwrite(header, 1, TAR_BLOCK_SIZE, f) != TAR_BLOCK_SIZE || fwrite(file->data, 1, file->size, f) != file->size
+				|| fwrite(zeros, 1, padding, f) != padding) {
+			printf("ERROR: Unable to write to the archive.\n");
+			return 1;
+		}
+	}
+
+	// the end of the archive is marked by two empty blocks
+	if(fwrite(zeros, 1, sizeof(zeros), f) != sizeof(zeros) || fflush(f) != 0) {
+		printf("ERROR: Unable to write to the archive.\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,31 @@
+// dumpio.h
+
+
+//----------------------------------------------------------------------------
+//  DUMPLIST - files to be written by dump, all at once
+//----------------------------------------------------------------------------
+
+// One output file. Its data is either owned (bytes), or points into memory that outlives the list (data).
+// If srcOffset isn't -1, the same data is also at srcOffset in the list's source file, and can be copied from there.
+typedef struct _DumpFile {
+	char name[1024];
+	Bytes * bytes;
+	const u8 * data;
+	size_t size;
+	long long srcOffset;
+} DumpFile;
+
+typedef struct _DumpList {
+	u32 count;
+	u32 capacity;
+	DumpFile * files;
+	int srcFd;				// source file for addDumpRange() files, or -1. Not owned by the list.
+} DumpList;
+
+DumpList * newDumpList(void);
+DumpList * deleteDumpList(DumpList * list);
+int addDumpBytes(DumpList * list, const char * name, Bytes * bytes);
+int addDumpData(DumpList * list, const char * name, const u8 * data, size_t size);
+int addDumpRange(DumpList * list, const char * name, const u8 * data, size_t size, long long srcOffset);
+int writeDumpList(DumpList * list);
+int writeDumpListTar(DumpList * list, FILE * f);
@@ -0,0 +1,491 @@
+/*  gif.c - writing animated GIF files
+
+	Da Watch Face Tool (dawft)
+	dawft: Watch Face Tool for MO YOUNG / DA FIT binary watch face files.
+
+	Copyright 2022 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+
+	All the frames share one palette of up to 256 colours, chosen by median cut from every pixel of every frame, so
+	each pixel is coloured with one table lookup. After the first, each frame only holds the rectangle that changed
+	from the frame before. The frames are LZW compressed by several threads at once.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#ifndef WINDOWS
+#include <pthread.h>
+#endif
+
+#include "dawft.h"
+#include "bmp.h"
+#include "gif.h"
+
+
+//----------------------------------------------------------------------------
+//  PALETTE - median cut over RGB565 colours
+//----------------------------------------------------------------------------
+
+// A box of RGB565 colours, from r0 to r1 (5 bits), g0 to g1 (6 bits) and b0 to b1 (5 bits), inclusive
+typedef struct _ColourBox {
+	u32 r0, r1, g0, g1, b0, b1;
+	u64 count;				// pixels in the box
+} ColourBox;
+
+#define rgb565(r,g,b) (((r) << 11) | ((g) << 5) | (b))
+
+static u64 countBox(const u32 * hist, const ColourBox * box) {
+	u64 count = 0;
+	for(u32 r=box->r0; r<=box->r1; r++) {
+		for(u32 g=box->g0; g<=box->g1; g++) {
+			for(u32 b=box->b0; b<=box->b1; b++) {
+				count += hist[rgb565(r, g, b)];
+			}
+		}
+	}
+	return count;
+}
+
+// Split box in two at the median of its widest channel (as 8-bit). Returns false if it is a single colour.
+static bool splitBox(const u32 * hist, ColourBox * box, ColourBox * other) {
+	u32 rw = (box->r1 - box->r0) * 8;
+	u32 gw = (box->g1 - box->g0) * 4;
+	u32 bw = (box->b1 - box->b0) * 8;
+	if(rw == 0 && gw == 0 && bw == 0) {
+		return false;
+	}
+	*other = *box;
+	u32 * lo;
+	u32 * hi;
+	u32 * otherLo;
+	if(rw >= gw && rw >= bw) {
+		lo = &box->r0; hi = &box->r1; otherLo = &other->r0;
+	} else if(gw >= bw) {
+		lo = &box->g0; hi = &box->g1; otherLo = &other->g0;
+	} else {
+		lo = &box->b0; hi = &box->b1; otherLo = &other->b0;
+	}
+
+	// find the slice where half the pixels are below, keeping at least one slice in each half
+	u32 first = *lo;
+	u32 last = *hi;
+	u64 below = 0;
+	u32 cut = first;
+	for(; cut < last - 1; cut++) {
+		*lo = cut;
+		*hi = cut;
+		below += countBox(hist, box);
+		if(below * 2 >= box->count) {
+			break;
+		}
+	}
+	*lo = first;
+	*hi = cut;
+	*otherLo = cut + 1;
+	box->count = countBox(hist, box);
+	other->count -= box->count;
+	return true;
+}
+
+// Choose up to 256 colours for the pixels counted in hist, putting them in palette (as RGB) and the index of the
+// colour for each RGB565 pixel in lut. Returns the number of colours.
+static u32 makePalette(const u32 * hist, u8 * palette, u8 * lut) {
+	// if there are few enough colours, use them all
+	u32 count = 0;
+	for(u32 c=0; c<65536 && count <= 256; c++) {
+		count += (hist[c] > 0) ? 1 : 0;
+	}
+	if(count <= 256) {
+		count = 0;
+		for(u32 c=0; c<65536; c++) {
+			if(hist[c] > 0) {
+				lut[c] = (u8)count;
+				palette[count * 3] = (u8)(((c & 0xF800) >> 8) | ((c & 0xE000) >> 13));
+				palette[count * 3 + 1] = (u8)(((c & 0x07E0) >> 3) | ((c & 0x0600) >> 9));
+				palette[count * 3 + 2] = (u8)(((c & 0x001F) << 3) | ((c & 0x001C) >> 2));
+				count++;
+			}
+		}
+		return (count > 0) ? count : 1;
+	}
+
+	// otherwise keep splitting the box with the most pixels in it, weighted by how wide it is
+	ColourBox boxes[256];
+	boxes[0] = (ColourBox){ .r1 = 31, .g1 = 63, .b1 = 31 };
+	boxes[0].count = countBox(hist, &boxes[0]);
+	u32 boxCount = 1;
+	while(boxCount < 256) {
+		u32 best = 256;
+		u64 bestScore = 0;
+		for(u32 i=0; i<boxCount; i++) {
+			u32 width = (boxes[i].r1 - boxes[i].r0) * 8;
+			width = ((boxes[i].g1 - boxes[i].g0) * 4 > width) ? (boxes[i].g1 - boxes[i].g0) * 4 : width;
+			width = ((boxes[i].b1 - boxes[i].b0) * 8 > width) ? (boxes[i].b1 - boxes[i].b0) * 8 : width;
+			u64 score = boxes[i].count * width;
+			if(score > bestScore) {
+				best = i;
+				bestScore = score;
+			}
+		}
+		if(best == 256 || !splitBox(hist, &boxes[best], &boxes[boxCount])) {
+			break;
+		}
+		boxCount++;
+	}
+
+	// each colour is the average of the pixels in its box
+	for(u32 i=0; i<boxCount; i++) {
+		const ColourBox * box = &boxes[i];
+		u64 sum[3] = { 0 };
+		for(u32 r=box->r0; r<=box->r1; r++) {
+			for(u32 g=box->g0; g<=box->g1; g++) {
+				for(u32 b=box->b0; b<=box->b1; b++) {
+					u32 c = rgb565(r, g, b);
+					lut[c] = (u8)i;
+					sum[0] += (u64)hist[c] * ((r << 3) | (r >> 2));
+					sum[1] += (u64)hist[c] * ((g << 2) | (g >> 4));
+					sum[2] += (u64)hist[c] * ((b << 3) | (b >> 2));
+				}
+			}
+		}
+		for(u32 j=0; j<3; j++) {
+			palette[i * 3 + j] = (u8)((box->count > 0) ? (sum[j] + box->count / 2) / box->count : 0);
+		}
+	}
+
+	// colours near the edge of a box may be nearer the colour of the box next to it
+	for(u32 c=0; c<65536; c++) {
+		if(hist[c] == 0) {
+			continue;
+		}
+		i32 r = (i32)(((c & 0xF800) >> 8) | ((c & 0xE000) >> 13));
+		i32 g = (i32)(((c & 0x07E0) >> 3) | ((c & 0x0600) >> 9));
+		i32 b = (i32)(((c & 0x001F) << 3) | ((c & 0x001C) >> 2));
+		i32 best = INT32_MAX;
+		for(u32 i=0; i<boxCount; i++) {
+			i32 dr = r - palette[i * 3], dg = g - palette[i * 3 + 1], db = b - palette[i * 3 + 2];
+			i32 d = dr * dr + dg * dg + db * db;
+			if(d < best) {
+				best = d;
+				lut[c] = (u8)i;
+			}
+		}
+	}
+	return boxCount;
+}
+
+
+//----------------------------------------------------------------------------
+//  LZW - GIF flavour, 8-bit pixels, codes up to 12 bits
+//----------------------------------------------------------------------------
+
+#define LZW_CLEAR 256
+#define LZW_END 257
+#define LZW_MAX_CODES 4096
+#define LZW_HASH_SIZE 8192			// power of 2, at least twice LZW_MAX_CODES
+
+typedef struct _LZWWriter {
+	u8 * dst;					// sub-blocks are made afterwards
+	size_t pos;
+	u32 bits;
+	u32 bitCount;
+	u32 codeSize;
+	u32 next;
+	u32 keys[LZW_HASH_SIZE];	// prefix code << 8 | pixel, plus 1, or 0 for empty
+	u16 codes[LZW_HASH_SIZE];
+} LZWWriter;
+
+static void putCode(LZWWriter * w, u32 code) {
+	w->bits |= code << w->bitCount;
+	w->bitCount += w->codeSize;
+	while(w->bitCount >= 8) {
+		w->dst[w->pos++] = (u8)w->bits;
+		w->bits >>= 8;
+		w->bitCount -= 8;
+	}
+}
+
+static void clearCodes(LZWWriter * w) {
+	memset(w->keys, 0, sizeof(w->keys));
+	w->codeSize = 9;
+	w->next = LZW_END + 1;
+}
+
+// Compress pixelCount indexes into w->dst, which must hold pixelCount * 2 + 16 bytes.
+static void compressLZW(LZWWriter * w, const u8 * pixels, size_t pixelCount) {
+	w->pos = 0;
+	w->bits = 0;
+	w->bitCount = 0;
+	clearCodes(w);
+	putCode(w, LZW_CLEAR);
+	u32 prefix = pixels[0];
+	for(size_t i=1; i<pixelCount; i++) {
+		u32 key = ((prefix << 8) | pixels[i]) + 1;
+		u32 h = (key * 2654435761u) >> (32 - 13);
+		while(w->keys[h] != 0 && w->keys[h] != key) {
+			h = (h + 1) & (LZW_HASH_SIZE - 1);
+		}
+		if(w->keys[h] == key) {
+			prefix = w->codes[h];
+			continue;
+		}
+		putCode(w, prefix);
+		if(w->next < LZW_MAX_CODES) {
+			w->keys[h] = key;
+			w->codes[h] = (u16)w->next++;
+			// the decoder is a code behind, so it widens its codes after reading the next one
+			if(w->next - 1 == (1u << w->codeSize)) {
+				w->codeSize++;
+			}
+		} else {
+			putCode(w, LZW_CLEAR);
+			clearCodes(w);
+		}
+		prefix = pixels[i];
+	}
+	putCode(w, prefix);
+	putCode(w, LZW_END);
+	if(w->bitCount > 0) {
+		w->dst[w->pos++] = (u8)w->bits;
+	}
+}
+
+
+//----------------------------------------------------------------------------
+//  GIF
+//----------------------------------------------------------------------------
+
+// One frame, compressed
+typedef struct _GIFFrame {
+	u32 x, y, w, h;				// the part that changed from the frame before
+	u8 * data;					// LZW data, in sub-blocks
+	size_t size;
+} GIFFrame;
+
+// Shared by the threads of newGIFFromFrames()
+typedef struct _GIFEncoder {
+	const u8 * const * frames;
+	u32 frameCount;
+	u32 width;
+	u32 height;
+	const u8 * lut;
+	GIFFrame * out;
+	u32 next;					// next frame to compress
+	bool failed;
+#ifndef WINDOWS
+	pthread_mutex_t lock;
+#endif
+} GIFEncoder;
+
+static u16 getPixel(const u8 * frame, u32 width, u32 x, u32 y) {
+	return (u16)((frame[(y * width + x) * 2] << 8) | frame[(y * width + x) * 2 + 1]);
+}
+
+// Find the rectangle of frame i that differs from frame i-1 (all of frame 0), then colour and compress it.
+static bool compressFrame(GIFEncoder * e, u32 i, LZWWriter * w) {
+	GIFFrame * f = &e->out[i];
+	const u8 * cur = e->frames[i];
+	*f = (GIFFrame){ .w = e->width, .h = e->height };
+	if(i > 0) {
+		const u8 * prev = e->frames[i - 1];
+		u32 x0 = e->width, y0 = e->height, x1 = 0, y1 = 0;
+		for(u32 y=0; y<e->height; y++) {
+			const u8 * a = &cur[y * e->width * 2];
+			const u8 * b = &prev[y * e->width * 2];
+			if(memcmp(a, b, e->width * 2) == 0) {
+				continue;
+			}
+			y0 = (y < y0) ? y : y0;
+			y1 = y + 1;
+			for(u32 x=0; x<e->width; x++) {
+				if(a[x * 2] != b[x * 2] || a[x * 2 + 1] != b[x * 2 + 1]) {
+					x0 = (x < x0) ? x : x0;
+					x1 = (x + 1 > x1) ? x + 1 : x1;
+				}
+			}
+		}
+		// a frame the same as the one before still needs a pixel, to show for its delay
+		*f = (x1 == 0) ? (GIFFrame){ .w = 1, .h = 1 } : (GIFFrame){ .x = x0, .y = y0, .w = x1 - x0, .h = y1 - y0 };
+	}
+
+	size_t pixelCount = (size_t)f->w * f->h;
+	u8 * indexes = malloc(pixelCount);
+	u8 * lzw = malloc(pixelCount * 2 + 16);
+	f->data = malloc(pixelCount * 2 + 16 + (pixelCount * 2 + 16) / 255 + 2);
+	if(indexes == NULL || lzw == NULL || f->data == NULL) {
+		free(indexes);
+		free(lzw);
+		return false;
+	}
+	for(u32 y=0; y<f->h; y++) {
+		for(u32 x=0; x<f->w; x++) {
+			indexes[y * f->w + x] = e->lut[getPixel(cur, e->width, f->x + x, f->y + y)];
+		}
+	}
+	w->dst = lzw;
+	compressLZW(w, indexes, pixelCount);
+
+	// split into sub-blocks of up to 255 bytes
+	for(size_t pos=0; pos<w->pos; pos+=255) {
+		size_t n = (w->pos - pos > 255) ? 255 : w->pos - pos;
+		f->data[f->size++] = (u8)n;
+		memcpy(&f->data[f->size], &lzw[pos], n);
+		f->size += n;
+	}
+	f->data[f->size++] = 0;
+	free(indexes);
+	free(lzw);
+	return true;
+}
+
+static void * gifEncoderThread(void * arg) {
+	GIFEncoder * e = arg;
+	LZWWriter * w = malloc(sizeof(LZWWriter));
+	while(1) {
+#ifndef WINDOWS
+		pthread_mutex_lock(&e->lock);
+#endif
+		u32 i = e->next++;
+#ifndef WINDOWS
+		pthread_mutex_unlock(&e->lock);
+#endif
+		if(i >= e->frameCount) {
+			break;
+		}
+		if(w == NULL || !compressFrame(e, i, w)) {
+#ifndef WINDOWS
+			pthread_mutex_lock(&e->lock);
+#endif
+			e->failed = true;
+#ifndef WINDOWS
+			pthread_mutex_unlock(&e->lock);
+#endif
+		}
+	}
+	free(w);
+	return NULL;
+}
+
+static void putGIFu16(u8 * p, u32 v) {
+	p[0] = (u8)v;
+	p[1] = (u8)(v >> 8);
+}
+
+// Build an animated GIF in *out, that loops forever, from frameCount frames of width*height big-endian RGB565 pixels,
+// each shown for delayMs. threadCount threads compress frames at once. Returns 0 for success. Delete *out with
+// deleteBytes.
+int newGIFFromFrames(const u8 * const * frames, u32 frameCount, u32 width, u32 height, u32 delayMs, u32 threadCount, Bytes ** out) {
+	if(frames == NULL || frameCount == 0 || width == 0 || height == 0 || width > 65535 || height > 65535 || out == NULL) {
+		return 3;
+	}
+	u32 * hist = calloc(65536, sizeof(u32));
+	u8 * lut = malloc(65536);
+	GIFFrame * gifFrames = calloc(frameCount, sizeof(GIFFrame));
+	if(hist == NULL || lut == NULL || gifFrames == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		free(hist);
+		free(lut);
+		free(gifFrames);
+		return 3;
+	}
+
+	u8 palette[256 * 3] = { 0 };
+	for(u32 i=0; i<frameCount; i++) {
+		for(size_t p=0; p<(size_t)width * height; p++) {
+			hist[(frames[i][p * 2] << 8) | frames[i][p * 2 + 1]]++;
+		}
+	}
+	u32 colourCount = makePalette(hist, palette, lut);
+	free(hist);
+	u32 tableBits = 1;
+	while((1u << tableBits) < colourCount) {
+		tableBits++;
+	}
+
+	GIFEncoder e = { .frames = frames, .frameCount = frameCount, .width = width, .height = height, .lut = lut, .out = gifFrames };
+#ifndef WINDOWS
+	pthread_mutex_init(&e.lock, NULL);
+	if(threadCount > frameCount) {
+		threadCount = frameCount;
+	}
+	pthread_t threads[256];
+	u32 started = 0;
+	for(; started + 1 < threadCount && started < 256; started++) {
+		if(pthread_create(&threads[started], NULL, gifEncoderThread, &e) != 0) {
+			break;
+		}
+	}
+	gifEncoderThread(&e);		// help out, and make sure it gets done even if no threads started
+	for(u32 i=0; i<started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&e.lock);
+#else
+	(void)threadCount;
+	gifEncoderThread(&e);
+#endif
+	free(lut);
+
+	size_t size = 13 + 3 * (1u << tableBits) + 19 + 1;
+	for(u32 i=0; i<frameCount; i++) {
+		size += 8 + 10 + 1 + gifFrames[i].size;
+	}
+	Bytes * b = e.failed ? NULL : malloc(sizeof(Bytes) + size);
+	if(b == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+	} else {
+		u8 * dst = b->data;
+		size_t pos = 0;
+		// header and logical screen descriptor, with the palette
+		memcpy(dst, "GIF89a", 6);
+		putGIFu16(&dst[6], width);
+		putGIFu16(&dst[8], height);
+		dst[10] = (u8)(0x80 | ((tableBits - 1) << 4) | (tableBits - 1));
+		dst[11] = 0;
+		dst[12] = 0;
+		pos = 13;
+		memcpy(&dst[pos], palette, 3 * (1u << tableBits));
+		pos += 3 * (1u << tableBits);
+		// loop forever
+		memcpy(&dst[pos], "\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00", 19);
+		pos += 19;
+
+		for(u32 i=0; i<frameCount; i++) {
+			const GIFFrame * f = &gifFrames[i];
+			// graphic control extension: leave the frame in place, and wait
+			memcpy(&dst[pos], "\x21\xF9\x04\x04", 4);
+			putGIFu16(&dst[pos + 4], (delayMs + 5) / 10);
+			dst[pos + 6] = 0;
+			dst[pos + 7] = 0;
+			pos += 8;
+			// image descriptor
+			dst[pos] = 0x2C;
+			putGIFu16(&dst[pos + 1], f->x);
+			putGIFu16(&dst[pos + 3], f->y);
+			putGIFu16(&dst[pos + 5], f->w);
+			putGIFu16(&dst[pos + 7], f->h);
+			dst[pos + 9] = 0;
+			dst[pos + 10] = 8;			// LZW minimum code size
+			pos += 11;
+			memcpy(&dst[pos], f->data, f->size);
+			pos += f->size;
+		}
+		dst[pos++] = 0x3B;
+		b->size = pos;
+	}
+
+	for(u32 i=0; i<frameCount; i++) {
+		free(gifFrames[i].data);
+	}
+	free(gifFrames);
+	if(b == NULL) {
+		return 3;
+	}
+	*out = b;
+	return 0; // SUCCESS
+}
@@ -0,0 +1,8 @@
+// gif.h
+
+
+//----------------------------------------------------------------------------
+//  GIF - write animated GIF files
+//----------------------------------------------------------------------------
+
+int newGIFFromFrames(const u8 * const * frames, u32 frameCount, u32 width, u32 height, u32 delayMs, u32 threadCount, Bytes ** out);
@@ -0,0 +1,722 @@
+/*  jpeg.c - decoding baseline JPEG files, with no dependencies
+
+	Da Watch Face Tool (dawft)
+	dawft: Watch Face Tool for MO YOUNG / DA FIT binary watch face files.
+
+	Copyright 2022 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+
+	Photos are usually much bigger than the watch screen. Each 8x8 block of coefficients can be turned into
+	8x8, 4x4, 2x2 or 1x1 pixels by an inverse DCT of that size, using only the low frequencies. So a photo is
+	decoded at 1/2, 1/4 or 1/8 of its size without ever making the full size image, and then only a small
+	resize is needed to fit the screen.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>		// for offsetof()
+
+#include "dawft.h"
+#include "bmp.h"
+#include "jpeg.h"
+
+
+//----------------------------------------------------------------------------
+//  HUFFMAN DECODING
+//----------------------------------------------------------------------------
+
+#define JPEG_FAST_BITS 9
+
+// Codes of up to JPEG_FAST_BITS bits are found with one lookup in fast
+typedef struct _JPEGHuffman {
+	u16 fast[1 << JPEG_FAST_BITS];	// (code length << 8) | value, or 0 for longer codes
+	u32 maxCode[18];				// one past the last code of each length, shifted to 16 bits
+	i32 delta[17];					// code + delta is the index of its value, for each length
+	u8 values[256];
+	bool defined;
+} JPEGHuffman;
+
+// Entropy-coded data is read most significant bit first. A marker stops the reading, and zeros are returned.
+typedef struct _JPEGBits {
+	const u8 * p;
+	const u8 * end;
+	u32 bits;
+	u32 count;
+	bool marker;				// reached a marker, at p
+} JPEGBits;
+
+// Build h from a DHT segment: 16 code counts, then the values. Returns the size used, or 0 for failure.
+static size_t buildJPEGHuffman(JPEGHuffman * h, const u8 * data, size_t size) {
+	if(size < 16) {
+		return 0;
+	}
+	u8 sizes[257];
+	u32 k = 0;
+	for(u32 i=1; i<=16; i++) {
+		for(u32 j=0; j<data[i-1]; j++) {
+			if(k == 256) {
+				return 0;
+			}
+			sizes[k++] = (u8)i;
+		}
+	}
+	sizes[k] = 0;
+	if(size < 16 + (size_t)k) {
+		return 0;
+	}
+	memcpy(h->values, &data[16], k);
+
+	u16 codes[256];
+	u32 code = 0;
+	u32 n = 0;
+	for(u32 j=1; j<=16; j++) {
+		h->delta[j] = (i32)n - (i32)code;
+		while(sizes[n] == j) {
+			codes[n++] = (u16)code++;
+		}
+		if(code > (1u << j)) {
+			return 0;		// over-subscribed
+		}
+		h->maxCode[j] = code << (16 - j);
+		code <<= 1;
+	}
+	h->maxCode[17] = 0xFFFFFFFF;
+
+	memset(h->fast, 0, sizeof(h->fast));
+	for(u32 i=0; i<n; i++) {
+		u32 s = sizes[i];
+		if(s <= JPEG_FAST_BITS) {
+			u32 first = (u32)codes[i] << (JPEG_FAST_BITS - s);
+			for(u32 j=0; j < (1u << (JPEG_FAST_BITS - s)); j++) {
+				h->fast[first + j] = (u16)((s << 8) | h->values[i]);
+			}
+		}
+	}
+	h->defined = true;
+	return 16 + (size_t)k;
+}
+
+// Make sure there are at least 25 bits in b->bits, unless a marker has been reached.
+static inline void fillJPEGBits(JPEGBits * b) {
+	while(b->count <= 24) {
+		u32 byte = 0;
+		if(!b->marker && b->p < b->end) {
+			byte = *b->p;
+			if(byte == 0xFF) {
+				u8 next = (b->p + 1 < b->end) ? b->p[1] : 0xD9;
+				if(next == 0) {
+					b->p += 2;			// stuffed 0xFF
+				} else {
+					b->marker = true;
+					byte = 0;
+				}
+			} else {
+				b->p++;
+			}
+		}
+		b->bits |= byte << (24 - b->count);
+		b->count += 8;
+	}
+}
+
+static inline u32 getJPEGBits(JPEGBits * b, u32 n) {
+	if(n == 0) {
+		return 0;
+	}
+	if(b->count < n) {
+		fillJPEGBits(b);
+	}
+	u32 v = b->bits >> (32 - n);
+	b->bits <<= n;
+	b->count -= n;
+	return v;
+}
+
+// Read an n bit value, and extend its sign
+static inline i32 receiveExtend(JPEGBits * b, u32 n) {
+	if(n == 0) {
+		return 0;
+	}
+	i32 v = (i32)getJPEGBits(b, n);
+	if(v < (1 << (n - 1))) {
+		v -= (1 << n) - 1;
+	}
+	return v;
+}
+
+// Decode one value. Returns -1 for an invalid code.
+static inline int decodeJPEGHuffman(JPEGBits * b, const JPEGHuffman * h) {
+	if(b->count < 16) {
+		fillJPEGBits(b);
+	}
+	u32 fast = h->fast[b->bits >> (32 - JPEG_FAST_BITS)];
+	if(fast != 0) {
+		u32 s = fast >> 8;
+		b->bits <<= s;
+		b->count -= s;
+		return (int)(fast & 0xFF);
+	}
+	u32 top = b->bits >> 16;
+	u32 s;
+	for(s=JPEG_FAST_BITS+1; top >= h->maxCode[s]; s++);
+	if(s == 17) {
+		return -1;
+	}
+	i32 c = (i32)(b->bits >> (32 - s)) + h->delta[s];
+	if(c < 0 || c > 255) {
+		return -1;
+	}
+	b->bits <<= s;
+	b->count -= s;
+	return h->values[c];
+}
+
+
+//----------------------------------------------------------------------------
+//  SCALED INVERSE DCT
+//----------------------------------------------------------------------------
+
+static const u8 zigzag[64] = {
+	 0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// C(u)/2 * cos((2x+1)u*pi/2N), * 4096, for an N point inverse DCT of the lowest N frequencies. [x][u]
+static const i32 idct1[1][1] = { { 1448 } };
+static const i32 idct2[2][2] = { { 1448, 1448 }, { 1448, -1448 } };
+static const i32 idct4[4][4] = {
+	{ 1448,  1892,  1448,   784 }, { 1448,   784, -1448, -1892 },
+	{ 1448,  -784, -1448,  1892 }, { 1448, -1892,  1448,  -784 },
+};
+static const i32 idct8[8][8] = {
+	{ 1448,  2009,  1892,  1703,  1448,  1138,   784,   400 }, { 1448,  1703,   784,  -400, -1448, -2009, -1892, -1138 },
+	{ 1448,  1138,  -784, -2009, -1448,   400,  1892,  1703 }, { 1448,   400, -1892, -1138,  1448,  1703,  -784, -2009 },
+	{ 1448,  -400, -1892,  1138,  1448, -1703,  -784,  2009 }, { 1448, -1138,  -784,  2009, -1448,  -400,  1892, -1703 },
+	{ 1448, -1703,   784,   400, -1448,  2009, -1892,  1138 }, { 1448, -2009,  1892, -1703,  1448, -1138,   784,  -400 },
+};
+
+static inline u8 clampSample(i64 v) {
+	return (u8)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+// Turn the coefficients of a block (natural order) into n x n samples at dst. If dcOnly, the other coefficients are 0.
+static void inverseDCT(const i32 * coef, bool dcOnly, u32 n, u8 * dst, size_t stride) {
+	const i32 * t = (n == 8) ? &idct8[0][0] : (n == 4) ? &idct4[0][0] : (n == 2) ? &idct2[0][0] : &idct1[0][0];
+	if(dcOnly) {
+		u8 v = clampSample((((i64)coef[0] * 1448 * 1448 + (1 << 23)) >> 24) + 128);
+		for(u32 y=0; y<n; y++) {
+			memset(&dst[y * stride], v, n);
+		}
+		return;
+	}
+
+	// columns, then rows. The first pass keeps 2 bits of fraction.
+	i64 tmp[8][8];
+	for(u32 u=0; u<n; u++) {
+		for(u32 y=0; y<n; y++) {
+			i64 sum = 0;
+			for(u32 v=0; v<n; v++) {
+				sum += (i64)coef[v * 8 + u] * t[y * n + v];
+			}
+			tmp[y][u] = (sum + (1 << 9)) >> 10;
+		}
+	}
+	for(u32 y=0; y<n; y++) {
+		for(u32 x=0; x<n; x++) {
+			i64 sum = 0;
+			for(u32 u=0; u<n; u++) {
+				sum += tmp[y][u] * t[x * n + u];
+			}
+			dst[y * stride + x] = clampSample(((sum + (1 << 13)) >> 14) + 128);
+		}
+	}
+}
+
+
+//----------------------------------------------------------------------------
+//  JPEG - read the markers and scans, into one plane of samples per component
+//----------------------------------------------------------------------------
+
+typedef struct _JPEGComponent {
+	u8 id;
+	u8 h;					// sampling factors
+	u8 v;
+	u8 tq;					// quantization table
+	u8 td;					// Huffman tables for the current scan
+	u8 ta;
+	i32 dcPred;
+	u32 blocksW;			// blocks in the plane, padded to whole MCUs
+	u32 blocksH;
+	u32 stride;				// plane width, in samples
+	u8 * plane;
+} JPEGComponent;
+
+typedef struct _JPEGDecoder {
+	u32 w;
+	u32 h;
+	u32 n;					// samples across each block: 8 / scale
+	u32 componentCount;
+	JPEGComponent c[3];
+	u8 hMax;
+	u8 vMax;
+	u32 mcusX;
+	u32 mcusY;
+	u16 quant[4][64];		// zigzag order
+	bool quantDefined[4];
+	JPEGHuffman dc[4];
+	JPEGHuffman ac[4];
+	u32 restartInterval;
+	bool rgb;				// Adobe marker says the components are RGB, not YCbCr
+} JPEGDecoder;
+
+// Returns true if bytes is a JPEG file.
+bool isJPEG(const Bytes * bytes) {
+	return bytes->size >= 4 && bytes->data[0] == 0xFF && bytes->data[1] == 0xD8 && bytes->data[2] == 0xFF;
+}
+
+// Decode one block of comp into its plane at block bx, by. Returns 0 for success.
+static int decodeJPEGBlock(JPEGDecoder * d, JPEGBits * b, JPEGComponent * comp, u32 bx, u32 by) {
+	const u16 * q = d->quant[comp->tq];
+	i32 coef[64] = { 0 };
+	int t = decodeJPEGHuffman(b, &d->dc[comp->td]);
+	if(t < 0 || t > 16) {
+		return 1;
+	}
+	comp->dcPred += receiveExtend(b, (u32)t);
+	coef[0] = comp->dcPred * q[0];
+
+	// the coefficients beyond n x n are read, and thrown away
+	bool dcOnly = true;
+	u32 n = d->n;
+	for(u32 k=1; k<64; ) {
+		int rs = decodeJPEGHuffman(b, &d->ac[comp->ta]);
+		if(rs < 0) {
+			return 1;
+		}
+		u32 r = (u32)rs >> 4;
+		u32 s = (u32)rs & 15;
+		if(s == 0) {
+			if(r != 15) {
+				break;			// end of block
+			}
+			k += 16;
+			continue;
+		}
+		k += r;
+		if(k > 63) {
+			return 1;
+		}
+		i32 v = receiveExtend(b, s);
+		u32 z = zigzag[k];
+		if((z & 7) < n && (z >> 3) < n) {
+			i64 dq = (i64)v * q[k];
+			coef[z] = (i32)(dq < -65536 ? -65536 : (dq > 65536 ? 65536 : dq));
+			dcOnly = false;
+		}
+		k++;
+	}
+
+	inverseDCT(coef, dcOnly, n, &comp->plane[(size_t)by * n * comp->stride + (size_t)bx * n], comp->stride);
+	return 0;
+}
+
+// Skip to the next marker after entropy-coded data. Returns a pointer to its 0xFF.
+static const u8 * findJPEGMarker(const u8 * p, const u8 * end) {
+	while(p + 1 < end && !(p[0] == 0xFF && p[1] != 0 && p[1] != 0xFF)) {
+		p++;
+	}
+	return p;
+}
+
+// Decode a scan of the components in scan[], from data. Returns a pointer to the next marker, or NULL for failure.
+static const u8 * decodeJPEGScan(JPEGDecoder * d, JPEGComponent ** scan, u32 scanCount, const u8 * data, const u8 * end) {
+	JPEGBits b = { .p = data, .end = end };
+	for(u32 i=0; i<scanCount; i++) {
+		scan[i]->dcPred = 0;
+		if(!d->dc[scan[i]->td].defined || !d->ac[scan[i]->ta].defined || !d->quantDefined[scan[i]->tq]) {
+			d_printf("ERROR: JPEG scan uses a table that isn't defined.\n");
+			return NULL;
+		}
+	}
+
+	// one component on its own is in plain block order. Otherwise blocks are interleaved in MCUs.
+	u32 unitsX = d->mcusX;
+	u32 unitsY = d->mcusY;
+	if(scanCount == 1) {
+		JPEGComponent * c = scan[0];
+		unitsX = ((d->w * c->h + d->hMax - 1) / d->hMax + 7) / 8;
+		unitsY = ((d->h * c->v + d->vMax - 1) / d->vMax + 7) / 8;
+	}
+
+	u32 unitCount = unitsX * unitsY;
+	for(u32 unit=0; unit<unitCount; unit++) {
+		if(d->restartInterval != 0 && unit != 0 && unit % d->restartInterval == 0) {
+			// skip to the restart marker, and start again
+			const u8 * p = findJPEGMarker(b.p, end);
+			if(p + 1 < end && p[1] >= 0xD0 && p[1] <= 0xD7) {
+				p += 2;
+			}
+			b = (JPEGBits){ .p = p, .end = end };
+			for(u32 i=0; i<scanCount; i++) {
+				scan[i]->dcPred = 0;
+			}
+		}
+		u32 ux = unit % unitsX;
+		u32 uy = unit / unitsX;
+		if(scanCount == 1) {
+			if(decodeJPEGBlock(d, &b, scan[0], ux, uy) != 0) {
+				d_printf("ERROR: JPEG image data is corrupt.\n");
+				return NULL;
+			}
+			continue;
+		}
+		for(u32 i=0; i<scanCount; i++) {
+			JPEGComponent * c = scan[i];
+			for(u32 y=0; y<c->v; y++) {
+				for(u32 x=0; x<c->h; x++) {
+					if(decodeJPEGBlock(d, &b, c, ux * c->h + x, uy * c->v + y) != 0) {
+						d_printf("ERROR: JPEG image data is corrupt.\n");
+						return NULL;
+					}
+				}
+			}
+		}
+	}
+	return findJPEGMarker(b.p, end);
+}
+
+// Read the frame header, and allocate the planes at 1/scale size. Returns 0 for success.
+static int readJPEGFrame(JPEGDecoder * d, const u8 * data, u32 size, u32 fitWidth, u32 fitHeight) {
+	if(size < 6 || data[0] != 8) {
+		d_printf("ERROR: JPEG must have 8-bit samples.\n");
+		return 1;
+	}
+	d->h = (u32)(data[1] << 8 | data[2]);
+	d->w = (u32)(data[3] << 8 | data[4]);
+	d->componentCount = data[5];
+	if(d->w == 0 || d->h == 0 || (u64)d->w * d->h > 0x10000000) {
+		d_printf("ERROR: JPEG is %ux%u, which is too small or too large.\n", d->w, d->h);
+		return 1;
+	}
+	if((d->componentCount != 1 && d->componentCount != 3) || size < 6 + 3 * d->componentCount) {
+		d_printf("ERROR: JPEG must be greyscale or YCbCr, not %u components.\n", d->componentCount);
+		return 1;
+	}
+	d->hMax = 1;
+	d->vMax = 1;
+	for(u32 i=0; i<d->componentCount; i++) {
+		JPEGComponent * c = &d->c[i];
+		c->id = data[6 + i * 3];
+		c->h = data[7 + i * 3] >> 4;
+		c->v = data[7 + i * 3] & 15;
+		c->tq = data[8 + i * 3];
+		if(c->h < 1 || c->h > 4 || c->v < 1 || c->v > 4 || c->tq > 3) {
+			d_printf("ERROR: JPEG frame header is invalid.\n");
+			return 1;
+		}
+		d->hMax = (c->h > d->hMax) ? c->h : d->hMax;
+		d->vMax = (c->v > d->vMax) ? c->v : d->vMax;
+	}
+
+	// the smallest scale that still covers fitWidth x fitHeight
+	u32 scale = 1;
+	while(fitWidth != 0 && fitHeight != 0 && scale < 8 && d->w / (scale * 2) >= fitWidth && d->h / (scale * 2) >= fitHeight) {
+		scale *= 2;
+	}
+	d->n = 8 / scale;
+
+	d->mcusX = (d->w + 8 * d->hMax - 1) / (8 * d->hMax);
+	d->mcusY = (d->h + 8 * d->vMax - 1) / (8 * d->vMax);
+	for(u32 i=0; i<d->componentCount; i++) {
+		JPEGComponent * c = &d->c[i];
+		c->blocksW = d->mcusX * c->h;
+		c->blocksH = d->mcusY * c->v;
+		c->stride = c->blocksW * d->n;
+		c->plane = calloc((size_t)c->stride * c->blocksH * d->n, 1);
+		if(c->plane == NULL) {
+			d_printf("ERROR: Out of memory.\n");
+			return 3;
+		}
+	}
+	return 0;
+}
+
+// Read all the markers and scans of a JPEG file into d. Returns 0 for success.
+static int readJPEG(JPEGDecoder * d, const Bytes * jpeg, u32 fitWidth, u32 fitHeight) {
+	const u8 * p = &jpeg->data[2];
+	const u8 * end = &jpeg->data[jpeg->size];
+	bool haveFrame = false;
+	bool haveScan = false;
+	while(p + 4 <= end) {
+		if(p[0] != 0xFF) {
+			d_printf("ERROR: JPEG marker expected.\n");
+			return 1;
+		}
+		u8 marker = p[1];
+		if(marker == 0xFF) {
+			p++;				// fill byte
+			continue;
+		}
+		if(marker == 0xD9) {
+			break;				// end of image
+		}
+		u32 size = (u32)(p[2] << 8 | p[3]);
+		if(size < 2 || size > (size_t)(end - p) - 2) {
+			d_printf("ERROR: JPEG is truncated.\n");
+			return 1;
+		}
+		const u8 * data = &p[4];
+		size -= 2;
+		p += 4 + size;
+
+		if(marker == 0xC0 || marker == 0xC1) {			// baseline, or extended sequential with Huffman coding
+			if(haveFrame || readJPEGFrame(d, data, size, fitWidth, fitHeight) != 0) {
+				return 1;
+			}
+			haveFrame = true;
+		} else if(marker == 0xC2) {
+			d_printf("ERROR: JPEG is progressive. Save it as a baseline JPEG.\n");
+			return 1;
+		} else if((marker >= 0xC3 && marker <= 0xCF) && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+			d_printf("ERROR: JPEG uses a coding process that isn't supported. Save it as a baseline JPEG.\n");
+			return 1;
+		} else if(marker == 0xC4) {						// Huffman tables
+			while(size > 0) {
+				u32 tc = data[0] >> 4;
+				u32 th = data[0] & 15;
+				if(tc > 1 || th > 3) {
+					d_printf("ERROR: JPEG Huffman table is invalid.\n");
+					return 1;
+				}
+				size_t used = buildJPEGHuffman(tc == 0 ? &d->dc[th] : &d->ac[th], &data[1], size - 1);
+				if(used == 0) {
+					d_printf("ERROR: JPEG Huffman table is invalid.\n");
+					return 1;
+				}
+				data += 1 + used;
+				size -= 1 + (u32)used;
+			}
+		} else if(marker == 0xDB) {						// quantization tables
+			while(size > 0) {
+				u32 pq = data[0] >> 4;
+				u32 tq = data[0] & 15;
+				u32 tableSize = pq ? 128 : 64;
+				if(pq > 1 || tq > 3 || size < 1 + tableSize) {
+					d_printf("ERROR: JPEG quantization table is invalid.\n");
+					return 1;
+				}
+				for(u32 k=0; k<64; k++) {
+					d->quant[tq][k] = pq ? (u16)(data[1 + k * 2] << 8 | data[2 + k * 2]) : data[1 + k];
+				}
+				d->quantDefined[tq] = true;
+				data += 1 + tableSize;
+				size -= 1 + tableSize;
+			}
+		} else if(marker == 0xDD) {						// restart interval
+			if(size < 2) {
+				return 1;
+			}
+			d->restartInterval = (u32)(data[0] << 8 | data[1]);
+		} else if(marker == 0xEE) {						// Adobe
+			if(size >= 12 && memcmp(data, "Adobe", 5) == 0) {
+				d->rgb = (data[11] == 0 && d->componentCount != 1);
+			}
+		} else if(marker == 0xDA) {						// start of scan
+			if(!haveFrame || size < 1 || data[0] < 1 || data[0] > d->componentCount || size < 1 + 2 * (u32)data[0] + 3) {
+				d_printf("ERROR: JPEG scan header is invalid.\n");
+				return 1;
+			}
+			JPEGComponent * scan[3];
+			u32 scanCount = data[0];
+			for(u32 i=0; i<scanCount; i++) {
+				scan[i] = NULL;
+				for(u32 j=0; j<d->componentCount; j++) {
+					if(d->c[j].id == data[1 + i * 2]) {
+						scan[i] = &d->c[j];
+					}
+				}
+				if(scan[i] == NULL || (data[2 + i * 2] >> 4) > 3 || (data[2 + i * 2] & 15) > 3) {
+					d_printf("ERROR: JPEG scan header is invalid.\n");
+					return 1;
+				}
+				scan[i]->td = data[2 + i * 2] >> 4;
+				scan[i]->ta = data[2 + i * 2] & 15;
+			}
+			p = decodeJPEGScan(d, scan, scanCount, p, end);
+			if(p == NULL) {
+				return 1;
+			}
+			haveScan = true;
+		}
+		// anything else (APPn, COM...) is skipped
+	}
+	if(!haveScan) {
+		d_printf("ERROR: JPEG has no image data.\n");
+		return 1;
+	}
+	return 0;
+}
+
+
+//----------------------------------------------------------------------------
+//  CONVERT - to a bmp file, fitted to the size wanted
+//----------------------------------------------------------------------------
+
+// Convert the decoded planes to R, G, B rows of w x h (the image size, at 1/scale)
+static void convertJPEGToRGB(const JPEGDecoder * d, u8 * rgb, u32 w, u32 h) {
+	for(u32 y=0; y<h; y++) {
+		const u8 * rows[3];
+		for(u32 i=0; i<d->componentCount; i++) {
+			const JPEGComponent * c = &d->c[i];
+			rows[i] = &c->plane[(size_t)(y * c->v / d->vMax) * c->stride];
+		}
+		u8 * dst = &rgb[(size_t)y * w * 3];
+		if(d->componentCount == 1) {
+			for(u32 x=0; x<w; x++) {
+				dst[x * 3] = dst[x * 3 + 1] = dst[x * 3 + 2] = rows[0][x];
+			}
+			continue;
+		}
+		const JPEGComponent * c = d->c;
+		for(u32 x=0; x<w; x++) {
+			i32 cy = rows[0][x * c[0].h / d->hMax];
+			i32 cb = rows[1][x * c[1].h / d->hMax];
+			i32 cr = rows[2][x * c[2].h / d->hMax];
+			if(d->rgb) {
+				dst[x * 3] = (u8)cy;
+				dst[x * 3 + 1] = (u8)cb;
+				dst[x * 3 + 2] = (u8)cr;
+				continue;
+			}
+			// JFIF YCbCr to RGB, with 16 bits of fraction
+			cb -= 128;
+			cr -= 128;
+			dst[x * 3]     = clampSample(cy + ((91881 * cr + 32768) >> 16));
+			dst[x * 3 + 1] = clampSample(cy - ((22554 * cb + 46802 * cr - 32768) >> 16));
+			dst[x * 3 + 2] = clampSample(cy + ((116130 * cb + 32768) >> 16));
+		}
+	}
+}
+
+// Resize srcW x srcH R, G, B pixels to cover dstW x dstH, keeping the shape, and crop the middle into a 24bpp bmp
+// file's rows. Each pixel is the average of the area of source pixels under it.
+static void fitRGBToBMP(const u8 * src, u32 srcW, u32 srcH, u8 * dst, u32 dstW, u32 dstH, size_t dstRowSize) {
+	// scale by the larger ratio, as a fraction num/den of source pixels per destination pixel
+	u64 num = srcW;
+	u64 den = dstW;
+	if((u64)srcH * dstW < (u64)srcW * dstH) {
+		num = srcH;
+		den = dstH;
+	}
+	u64 coverW = ((u64)srcW * den + num - 1) / num;
+	u64 coverH = ((u64)srcH * den + num - 1) / num;
+	u64 ox = (coverW - dstW) / 2;
+	u64 oy = (coverH - dstH) / 2;
+
+	for(u32 y=0; y<dstH; y++) {
+		u32 sy0 = (u32)(((oy + y) * num) / den);
+		u32 sy1 = (u32)(((oy + y + 1) * num) / den);
+		sy0 = (sy0 >= srcH) ? srcH - 1 : sy0;
+		sy1 = (sy1 > srcH) ? srcH : (sy1 <= sy0 ? sy0 + 1 : sy1);
+		u8 * row = &dst[(size_t)y * dstRowSize];
+		for(u32 x=0; x<dstW; x++) {
+			u32 sx0 = (u32)(((ox + x) * num) / den);
+			u32 sx1 = (u32)(((ox + x + 1) * num) / den);
+			sx0 = (sx0 >= srcW) ? srcW - 1 : sx0;
+			sx1 = (sx1 > srcW) ? srcW : (sx1 <= sx0 ? sx0 + 1 : sx1);
+			u32 sum[3] = { 0 };
+			for(u32 sy=sy0; sy<sy1; sy++) {
+				const u8 * s = &src[((size_t)sy * srcW + sx0) * 3];
+				for(u32 sx=sx0; sx<sx1; sx++, s+=3) {
+					sum[0] += s[0];
+					sum[1] += s[1];
+					sum[2] += s[2];
+				}
+			}
+			u32 count = (sy1 - sy0) * (sx1 - sx0);
+			row[x * 3]     = (u8)((sum[2] + count / 2) / count);		// B, G, R
+			row[x * 3 + 1] = (u8)((sum[1] + count / 2) / count);
+			row[x * 3 + 2] = (u8)((sum[0] + count / 2) / count);
+		}
+		memset(&row[(size_t)dstW * 3], 0, dstRowSize - (size_t)dstW * 3);
+	}
+}
+
+// Decode a baseline JPEG file, and build an RGB888 bmp file of it in *out. If fitWidth and fitHeight aren't 0, the
+// image is scaled down by 1/2, 1/4 or 1/8 while it is decoded (as far as it can be while still covering fitWidth x
+// fitHeight), then resized to cover exactly fitWidth x fitHeight, and the middle kept. Returns 0 for success.
+// Delete *out with deleteBytes.
+int newBMPFromJPEG(const Bytes * jpeg, u32 fitWidth, u32 fitHeight, Bytes ** out) {
+	if(!isJPEG(jpeg)) {
+		d_printf("ERROR: File is not a JPEG.\n");
+		return 1;
+	}
+	JPEGDecoder * d = calloc(1, sizeof(JPEGDecoder));
+	if(d == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		return 3;
+	}
+
+	int r = readJPEG(d, jpeg, fitWidth, fitHeight);
+	u32 scale = 8 / (d->n ? d->n : 8);
+	u32 w = (d->w + scale - 1) / scale;
+	u32 h = (d->h + scale - 1) / scale;
+	u8 * rgb = NULL;
+	if(r == 0) {
+		rgb = malloc((size_t)w * h * 3);
+		if(rgb == NULL) {
+			d_printf("ERROR: Out of memory.\n");
+			r = 3;
+		} else {
+			convertJPEGToRGB(d, rgb, w, h);
+		}
+	}
+	for(u32 i=0; i<d->componentCount && i<3; i++) {
+		free(d->c[i].plane);
+	}
+	free(d);
+	if(r != 0) {
+		free(rgb);
+		return r;
+	}
+
+	u32 outW = (fitWidth != 0 && fitHeight != 0) ? fitWidth : w;
+	u32 outH = (fitWidth != 0 && fitHeight != 0) ? fitHeight : h;
+	BMPHeaderV4 header;
+	setBMPHeaderV4(&header, outW, outH, 24);
+	size_t dstRowSize = header.imageDataSize / outH;
+	Bytes * b = malloc(sizeof(Bytes) + header.fileSize);
+	if(b == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		free(rgb);
+		return 3;
+	}
+	b->size = header.fileSize;
+	memcpy(b->data, &header, sizeof(header));
+	u8 * pixels = (u8 *)b + offsetof(Bytes, data) + sizeof(header);		// past the 16 bytes b->data[] is declared with
+
+	if(outW == w && outH == h) {
+		for(u32 y=0; y<h; y++) {
+			u8 * row = &pixels[y * dstRowSize];
+			const u8 * s = &rgb[(size_t)y * w * 3];
+			for(u32 x=0; x<w; x++) {
+				row[x * 3] = s[x * 3 + 2];
+				row[x * 3 + 1] = s[x * 3 + 1];
+				row[x * 3 + 2] = s[x * 3];
+			}
+			memset(&row[(size_t)w * 3], 0, dstRowSize - (size_t)w * 3);
+		}
+	} else {
+		fitRGBToBMP(rgb, w, h, pixels, outW, outH, dstRowSize);
+	}
+	free(rgb);
+
+	*out = b;
+	return 0; // SUCCESS
+}
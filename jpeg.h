@@ -0,0 +1,9 @@
+// jpeg.h
+
+
+//----------------------------------------------------------------------------
+//  JPEG - import baseline JPEG files, scaled down while decoding
+//----------------------------------------------------------------------------
+
+bool isJPEG(const Bytes * bytes);
+int newBMPFromJPEG(const Bytes * jpeg, u32 fitWidth, u32 fitHeight, Bytes ** out);
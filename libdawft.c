@@ -0,0 +1,839 @@
+/*  libdawft.c - in-memory watch face functions
+
+	Da Watch Face Tool (dawft)
+	dawft: Watch Face Tool for MO YOUNG / DA FIT binary watch face files.
+
+	Copyright 2022 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+#include "dawft.h"
+#include "bmp.h"
+#include "libdawft.h"
+
+#include "strutil.h"
+
+
+//----------------------------------------------------------------------------
+//  DIAGNOSTICS
+//----------------------------------------------------------------------------
+
+static DawftDiagFn diagFn = NULL;
+static void * diagCtx = NULL;
+
+// Send diagnostic messages to fn instead of stdout. Pass NULL to go back to stdout.
+void dawftSetDiagnostics(DawftDiagFn fn, void * ctx) {
+	diagFn = fn;
+	diagCtx = ctx;
+}
+
+// printf() for diagnostic messages from the library.
+void d_printf(const char * format, ...) {
+	char buf[1024];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+	if(diagFn != NULL) {
+		diagFn(diagCtx, buf);
+	} else {
+		fputs(buf, stdout);
+	}
+}
+
+
+//----------------------------------------------------------------------------
+//  DATA READING AND BYTE ORDER
+//----------------------------------------------------------------------------
+
+inline void set_u16(u8 * p, u16 v) {
+    p[0] = v&0xFF;
+    p[1] = v>>8;
+}
+
+
+//----------------------------------------------------------------------------
+//  BINARY FILE STRUCTURE
+//----------------------------------------------------------------------------
+
+/***
+
+fileType	FaceData size	Offset table start		Compression method				Different resolutions?
+TYPE A 		6				200						NONE/RLE_BASIC					No - always 240x240
+TYPE B		10				400						LZO of all data (not header)	Yes
+TYPE C 		10				400						NONE/RLE_LINE					Yes
+
+
+For reference:
+
+typedef struct _FaceDataA {
+	u8 type;				// type of object we are giving dimensions e.g. hours, day, steps etc.
+	u8 x;			
+	u8 y;
+	u8 w;
+	u8 h;
+	u8 idx;					// index into offset table
+} FaceDataA; 				// size is 6 bytes
+
+typedef struct _FaceHeaderA {
+	u8 fileID;	
+	u8 dataCount;
+	u8 blobCount;	
+	u16 faceNumber;	
+	FaceDataA faceData[32];	// sizeof(FaceDataA) = 6 bytes
+	u8 padding[3];	
+	u32 offsets[250];		// offsets of bitmap data for the face. Table starts at 200. Offsets start from end of header data i.e. at 1700.
+	u16 sizes[250];			// sizes of the bitmap data, in bytes. Unreliable. at 1600 is stored the animationFrame count. i.e. sizes[200]
+} FaceHeaderA;				// size is 1700 bytes
+
+***/
+
+void setHeader(FaceHeader * h, const u8 * buf, char fileType) {
+	if(fileType != 'A' && fileType != 'B' && fileType != 'C') {
+		d_printf("ERROR: Invalid fileType in setHeader!\n");
+		return;
+	}
+	
+	*h = (FaceHeader){ 0 };
+
+	h->fileID = buf[0];
+	h->dataCount = buf[1];
+	h->blobCount = buf[2];
+	h->faceNumber = get_u16(&buf[3]);
+
+	u32 idx = 5;
+	
+	// load faceData
+	if(fileType != 'A') {
+		for(int i=0; i<39; i++) {
+			h->faceData[i].type = buf[idx];
+			h->faceData[i].idx = buf[idx+1];
+			h->faceData[i].x = get_u16(&buf[idx+2]);
+			h->faceData[i].y = get_u16(&buf[idx+4]);
+			h->faceData[i].w = get_u16(&buf[idx+6]);
+			h->faceData[i].h = get_u16(&buf[idx+8]);
+			idx += 10;
+		}
+		memcpy(h->padding, &buf[idx], 5);
+		idx += 5;
+	} else { // fileType == 'A'
+		for(int i=0; i<32; i++) {
+			h->faceData[i].type = buf[idx];
+			h->faceData[i].idx = buf[idx+5];
+			h->faceData[i].x = buf[idx+1];
+			h->faceData[i].y = buf[idx+2];
+			h->faceData[i].w = buf[idx+3];
+			h->faceData[i].h = buf[idx+4];
+			idx += 6;
+		}
+		memcpy(h->padding, &buf[idx], 3);
+		idx += 3;
+	}
+	
+	// load offsets
+	for(int i=0; i<250; i++) {
+		h->offsets[i] = get_u32(&buf[idx]);
+		idx += 4;
+	}
+
+	// load sizes
+	for(int i=0; i<250; i++) {
+		h->sizes[i] = get_u16(&buf[idx]);
+		idx += 2;
+	}
+
+	// Note: if fileType == 'B', offsets are into the *decompressed* data. 
+}
+
+
+//----------------------------------------------------------------------------
+//  DATA TYPES
+//----------------------------------------------------------------------------
+
+// digits: only w, h of first digit. 0-9.
+const DataType dataTypes[] = {	
+	{ 0x00, "BACKGROUNDS", 		10, "Background (10 parts of 240x24). May contain example time (will be overwritten). Seen in Type A faces." },
+	{ 0x01, "BACKGROUND", 		1, 	"Background image, usually width and height of screen. Seen in Type B & C faces." },
+	{ 0x10, "MONTH_NAME", 		12, "JAN, FEB, MAR, APR, MAY, JUN, JUL, AUG, SEP, OCT, NOV, DEC." },
+	{ 0x11, "MONTH_NUM", 		10, "Month, digits." },
+	{ 0x12, "YEAR", 			10, "Year, 2 digits, left aligned." },
+	{ 0x30, "DAY_NUM", 			10, "Day number of the month, digits." },
+	{ 0x40, "TIME_H1", 			10, "Hh:mm" },
+	{ 0x41, "TIME_H2", 			10, "hH:mm" },
+	{ 0x43, "TIME_M1", 			10, "hh:Mm" },
+	{ 0x44, "TIME_M2", 			10, "hh:mM" },
+	{ 0x45, "TIME_AM", 			1,	"'AM'." },
+	{ 0x46, "TIME_PM", 			1,	"'PM'." },
+	{ 0x60, "DAY_NAME", 		7,	"SUN, MON, TUE, WED, THU, FRI, SAT." },
+	{ 0x61, "DAY_NAME_CN", 		7,	"SUN, MON, TUE, WED, THU, FRI, SAT, chinese symbol option." },
+	{ 0x62, "STEPS", 			10,	"Step count, left aligned, digits." },
+	{ 0x63, "STEPS_CA", 		10,	"Step count, centre aligned, digits." },
+	{ 0x64, "STEPS_RA", 		10,	"Step count, right aligned, digits." }, 
+	{ 0x65, "HR", 				10, "Heart rate, left aligned, digits. (Assumed)." },
+	{ 0x66, "HR_CA", 			10, "Heart rate, centre aligned, digits. (Assumed)." },
+	{ 0x67, "HR_RA", 			10, "Heart rate, right aligned, digits." }, 
+	{ 0x68, "KCAL", 			10, "kCals, left aligned, digits." },
+	{ 0x6b, "MONTH_NUM_B", 		10,	"Month, digits, alternate." },
+	{ 0x6c, "DAY_NUM_B", 		10,	"Day number of the month, digits, alternate." },
+	{ 0x70, "STEPS_PROGBAR",	11, "Steps progess bar 0,10,20...100%. 11 frames." },
+	{ 0x71, "STEPS_LOGO", 		1,	"Step count, static logo." },
+	{ 0x72, "STEPS_B", 			10, "Step count, left aligned, digits, alternate." },
+	{ 0x73, "STEPS_B_CA", 		10, "Step count, centre aligned, digits, alternate." },
+	{ 0x74, "STEPS_B_RA", 		10, "Step count, right aligned, digits, alternate." },
+	{ 0x76, "STEPS_GOAL", 		10, "Step goal, left aligned, digits." },
+	{ 0x80, "HR_PROGBAR", 		11, "Heart rate, progress bar 0,10,20...100%. 11 frames." },
+	{ 0x81, "HR_LOGO", 			1,  "Heart rate, static logo." },
+	{ 0x82, "HR_B", 			10,	"Heart rate, left aligned, digits, alternate." },
+	{ 0x83, "HR_B_CA", 			10, "Heart rate, centre aligned, digits, alternate." },
+	{ 0x84, "HR_B_RA", 			10, "Heart rate, right aligned, digits, alternate." },
+	{ 0x90, "KCAL_PROGBAR", 	11, "kCals progress bar 0,10,20...100%. 11 frames." },
+	{ 0x91, "KCAL_LOGO", 		1,  "kCals, static logo." },
+	{ 0x92, "KCAL_B", 			10, "kCals, left aligned, digits." },
+	{ 0x93, "KCAL_B_CA", 		10, "kCals, centre aligned, digits." },
+	{ 0x94, "KCAL_B_RA", 		10, "kCals, right aligned, digits." },
+	{ 0xA0, "DIST_PROGBAR", 	11, "Distance progress bar 0,10,20...100%. 11 frames." },
+	{ 0xA1, "DIST_LOGO", 		1, 	"Distance, static logo." },
+	{ 0xA2, "DIST", 			10, "Distance, left aligned, digits." },		// Has a decimal point - how wide?
+	{ 0xA3, "DIST_CA", 			10, "Distance, centre aligned, digits." },
+	{ 0xA4, "DIST_RA", 			10, "Distance, right aligned, digits." },
+	{ 0xA5, "DIST_KM", 			1,  "Distance unit 'KM'." },
+	{ 0xA6, "DIST_MI", 			1,  "Distance unit 'MI'." },
+	{ 0xC0, "BTLINK_UP", 		1,  "Bluetooth link up / connected." },
+	{ 0xC1, "BTLINK_DOWN", 		1,	"Bluetooth link down / not connected." },
+	{ 0xCE, "BATT_IMG", 		1,	"Battery level image." },
+	{ 0xD0, "BATT_IMG_B", 		1,	"Battery level image, alternate." },
+	{ 0xD1, "BATT_IMG_C", 		1,  "Battery level image, alternate." },
+	{ 0xD2, "BATT", 			10, "Battery level, left aligned, digits. (Assumed)." },
+	{ 0xD3, "BATT_CA", 			10, "Battery level, centre aligned, digits." },
+	{ 0xD4, "BATT_RA", 			10, "Battery level, right aligned, digits." },
+	{ 0xDA, "BATT_IMG_D", 		1,  "Battery level image, alternate." },
+	{ 0xD7, "WEATHER_TEMP", 	13, "Weather temperature, left aligned, 11 digits (0-9 and -) and a special 12 & 13th double-width characters for deg. C and deg. F." },
+	{ 0xD8, "WEATHER_TEMP_CA", 	13, "Weather temperature, centre aligned, 11 digits (0-9 and -) and a special 12 & 13th double-width characters for deg. C and deg. F." },
+	{ 0xD9, "WEATHER_TEMP_RA", 	13, "Weather temperature, right aligned, 11 digits (0-9 and -) and a special 12 & 13th double-width characters for deg. C and deg. F." },
+	{ 0xF0, "SEPERATOR", 		1,	"Static image used as date or time seperator e.g. / or :." },
+	{ 0xF1, "HAND_HOUR", 		1,	"Analog time hour hand, at 1200 position." },
+	{ 0xF2, "HAND_MINUTE", 		1,  "Analog time minute hand, at 1200 position." },
+	{ 0xF3, "HAND_SEC", 		1,	"Analog time second hand, at 1200 position." },
+	{ 0xF4, "HAND_PIN_UPPER", 	1,  "Top half of analog time centre pin." },
+	{ 0xF5, "HAND_PIN_LOWER", 	1,  "Bottom half of analog time centre pin." },
+	{ 0xF6, "TAP_TO_CHANGE", 	1,  "Series of images. Tap to change. Count is specified by animationFrames." },		// On #3156, #5315. #3135 has it as 3 images. Frame count at 1400 (Type C) or 1600 (Type A).
+	{ 0xF7, "ANIMATION",	 	1,  "Animation. Count is specified by animationFrames." }, 							// #3145, #163.  #3087, #3088 has it as a 7-frame animation. #3163 has it as a 36 frame animation. Frame count at 1400 (Type C) or 1600 (Type A)..
+	{ 0xF8, "ANIMATION_F8",   	1,  "Animation. Count is specified by animationFrames." }, 				// #3085, #3086. #3112 has it as a 14-frame animation. #3248 has it as a 10-frame animation. Frame count at 1400 (Type C) or 1600 (Type A).
+};		
+								
+const u32 dataTypeCount = sizeof(dataTypes) / sizeof(DataType);
+
+static const char dataTypeStrUnknown[12] = "UNKNOWN";
+
+// Returns the index into dataTypes of the type named s, or -1.
+int getDataTypeIdxFromStr(const char * s) {
+	for(int i=0; i<(int)dataTypeCount; i++) {
+		if(strcmp(dataTypes[i].str, s)==0 ) {
+			return i;
+		}
+	}
+	return -1; // failed to find
+}
+
+const char * getDataTypeStr(u8 type) {
+	for(int i=0; i<(int)dataTypeCount; i++) {
+		if(dataTypes[i].type == type) {
+			return dataTypes[i].str;
+		}
+	}
+	return dataTypeStrUnknown;
+}
+
+int getDataTypeIdx(u8 type) {
+	for(int i=0; i<(int)dataTypeCount; i++) {
+		if(dataTypes[i].type == type) {
+			return i;
+		}
+	}
+	return -1; // failed to find
+}
+
+
+// The number of blobs used by fd: the count for its data type, or animationFrames for animations.
+int getFaceDataBlobCount(const FaceData * fd, const ExtraFileInfo * xfi) {
+	int count = 1;
+	int typeIdx = getDataTypeIdx(fd->type);
+	if(typeIdx >= 0) {
+		if(fd->type >= 0xF6 && fd->type <= 0xF8) {
+			count = xfi->animationFrames;
+		} else {
+			count = dataTypes[typeIdx].count;
+		}
+	}
+	return count;
+}
+
+// Find the faceData index given an offset index. Returns -1 for failure, index for success.
+int getFaceDataIndexFromOffsetIndex(int offsetIndex, const FaceHeader * h, const ExtraFileInfo * xfi) {
+	int matchIdx = -1;
+	for(int fdi=0; fdi < h->dataCount; fdi++) {
+		int count = getFaceDataBlobCount(&h->faceData[fdi], xfi);
+		if(offsetIndex >= h->faceData[fdi].idx && offsetIndex < (h->faceData[fdi].idx + count)) {
+			matchIdx = fdi; // we found a match
+			break;
+		}
+	}
+	return matchIdx; // -1 for failure, index for success
+}
+
+
+//----------------------------------------------------------------------------
+//  AUTODETECT FILE TYPE
+//----------------------------------------------------------------------------
+
+char autodetectFileType(const u8 * fileData, size_t fileSize) {		// Auto-detect file type.
+	u8 blobCount = fileData[2];
+	int typeACount = 1;
+	u8 typeARunning = 1;
+	int typeBCount = 1;
+	u8 typeBRunning = 1;
+	u32 typeBMax = 0;
+	char fileType = 0;
+
+	// Count the offsets and compare to blobCount. Type A offset table starts at 200. Type B/C offset table starts at 400.
+	for(u32 i=1; i<250; i++) {
+		if(typeARunning) {
+			if(get_u32(&fileData[200+(i*4)]) != 0) {
+				typeACount += 1;
+			} else {
+				typeARunning = 0;
+			}
+		}
+		if(typeBRunning) {
+			u32 offset = get_u32(&fileData[400+(i*4)]);
+			if(offset != 0) {
+				typeBCount += 1;
+				typeBMax = offset;
+			} else {
+				typeBRunning = 0;
+			}
+		}
+	}		
+
+	if(typeACount == blobCount) {
+		d_printf("Autodetected fileType A\n");
+		fileType = 'A';			
+	} else if(typeBCount == blobCount) {
+		typeBMax += 1900; // add header size
+		// Type B will have offsets larger than the file size (as they are into the uncompressed data). Type C should be smaller than the file size.
+		if(typeBMax > fileSize) {
+			d_printf("Autodetected fileType B\n");
+			// (offset %u is greater than fileSize %zu)\n", typeBMax, fileSize);
+			fileType = 'B';
+		} else {
+			d_printf("Autodetected fileType C\n");
+			// (offset %u is less than fileSize %zu)\n", typeBMax, fileSize);
+			fileType = 'C';
+		}
+	} else {
+		d_printf("WARNING: Unable to autodetect fileType. Defaulting to type A.\n");
+		fileType = 'A';
+	}
+	return fileType;
+}
+
+
+//----------------------------------------------------------------------------
+//  PARSEWATCHFACETXT - Read a watchface.txt file
+//----------------------------------------------------------------------------
+
+// Parse the text of a watchface.txt file into spec. Returns 0 for success.
+int parseWatchFaceTxt(FaceSpec * spec, const Bytes * text) {
+	*spec = (FaceSpec){ 0 };
+	FaceHeader * h = &spec->h;
+	ExtraFileInfo * efi = &spec->efi;
+
+	char lineBuf[1024];
+	char * ptr = NULL;
+	size_t textPos = 0;
+	u32 lineNumber = 1;
+	spec->blobCompression[0] = TRY_RLE;
+
+	#define printWarning(s) d_printf("WARNING: in watchface.txt line %u: %s.\n", lineNumber, s)
+	#define printError(s) d_printf("ERROR: in watchface.txt line %u: %s.\n", lineNumber, s)
+
+	while(1) {
+		ptr = d_sgets(lineBuf, sizeof(lineBuf), (char *)text->data, text->size, &textPos);
+		if(ptr == NULL) break;				// stop if there's no more data to read
+		if(strlen(lineBuf)==0) continue;	// check for empty lines
+		if(lineBuf[0]=='#') continue;		// ignore comments
+
+		TokensIdx tok;
+		getTokensIdx(lineBuf, &tok);
+		if(tok.count < 2) {	// we don't have any single-token commands
+			continue;
+		}
+		if(streqn(tok.ptr[0], "fileType", 8)) {
+			efi->fileType = tok.ptr[1][0];
+		} else if(streqn(tok.ptr[0], "fileID", 6)) {
+			h->fileID = (u8)readNum(tok.ptr[1]);
+		} else if(streqn(tok.ptr[0], "faceNumber", 10)) {
+			h->faceNumber = (u16)readNum(tok.ptr[1]);
+		} else if(streqn(tok.ptr[0], "dataCount", 9)) {
+			// We'll calculate this ourselves
+		} else if(streqn(tok.ptr[0], "blobCount", 9)) {
+			u32 blobCount = readNum(tok.ptr[1]);
+			h->blobCount = (blobCount > 255) ? 255 : (u8)blobCount;		// so it fails the check below, rather than wrapping
+		} else if(streqn(tok.ptr[0], "animationFrames", 15)) {
+			efi->animationFrames = (u16)readNum(tok.ptr[1]);
+		} else if(streqn(tok.ptr[0], "blobCompression", 15)) {
+			if(tok.count >= 3) {
+				u32 blobIdx = readNum(tok.ptr[1]);
+				if(blobIdx >= 250) {
+					printError("Invalid blob index for blobCompression");
+					return DAWFT_ERR_FORMAT;
+				}
+				if(streqn(tok.ptr[2], "NONE", 4)) {
+					spec->blobCompression[blobIdx] = NONE;
+				} else if(streqn(tok.ptr[2], "RLE_LINE", 8)) {
+					spec->blobCompression[blobIdx] = RLE_LINE;
+				} else if(streqn(tok.ptr[2], "RLE_BASIC", 9)) {
+					spec->blobCompression[blobIdx] = RLE_BASIC;
+				} else if(streqn(tok.ptr[2], "TRY_RLE", 7)) {
+					spec->blobCompression[blobIdx] = TRY_RLE;
+				} else {
+					printWarning("Unsupported requested blobCompression");
+					continue;
+				}
+			}
+		} else if(streqn(tok.ptr[0], "faceData", 8)) {
+			// check enough tokens
+			if(tok.count < 7) {
+				printWarning("Insufficient tokens for faceData");
+				continue;
+			}
+			if(h->dataCount >= 39) {
+				printError("Too many faceData lines, the most is 39");
+				return DAWFT_ERR_FORMAT;
+			}
+			FaceData * fd = &h->faceData[h->dataCount];
+			// type could be a string:
+			if(isNum(tok.ptr[1])) {
+				fd->type = (u8)readNum(tok.ptr[1]);					// read the data type
+			} else {
+				char typeStr[32] = { 0 };							// look up string to find the data type
+				memcpy(typeStr, tok.ptr[1], tok.length[1] < sizeof(typeStr) - 1 ? tok.length[1] : sizeof(typeStr) - 1);
+				int dti = getDataTypeIdxFromStr(typeStr);
+				if(dti == -1) {
+					d_printf("ERROR: in watchface.txt line %u: Failed to recognise Data Type String '%s'.\n", lineNumber, typeStr);
+					return DAWFT_ERR_FORMAT;
+				}
+				fd->type = dataTypes[dti].type;
+			}
+			fd->idx = (u8)readNum(tok.ptr[2]);
+			fd->x = (u16)readNum(tok.ptr[3]);
+			fd->y = (u16)readNum(tok.ptr[4]);
+			fd->w = (u16)readNum(tok.ptr[5]);
+			fd->h = (u16)readNum(tok.ptr[6]);
+	
+			// handle a filename, if we're given one. it could also be a comment.
+			if(tok.count >= 8) {
+				if(tok.length[7] > 0 && tok.ptr[7][0] != '#' && tok.length[7] < 256) {
+					// get the filename
+					char buf[256] = { 0 };
+					memcpy(&buf[0], tok.ptr[7], tok.length[7]);
+					// see if it makes sense
+					// we assume the last 7 characters are [0-9][0-9][0-9].bmp (or .png)
+					if(strlen(buf) < 7) {
+						// don't bother with this one
+						d_printf("blobFileName specified isn't in the required prefix[0-9][0-9][0-9].bmp format\n");
+					} else {
+						// save it to all the following blob file names, with the same extension
+						u32 offset = (u32)strlen(buf) - 7;
+						u32 num = readNum(&buf[offset]);
+						char ext[5];
+						memcpy(ext, &buf[offset + 3], sizeof(ext));
+						u32 count = 1;
+						int dti = getDataTypeIdx(fd->type);
+						if(dti != -1) {
+							count = dataTypes[dti].count;
+						}
+						// TODO: Make sure ANIMATIONS have the correct count (and weather, etc.)
+						if(fd->idx >= 250 || count > 250u - fd->idx) {
+							printError("faceData blob index and count go beyond the 250 blobs");
+							return DAWFT_ERR_FORMAT;
+						}
+						for(u32 j=0; j<count; j++) {
+							snprintf(&buf[offset], sizeof(buf) - offset, "%03u%s", num+j, ext);
+							//d_printf("Determined file name for blob %03u would be: '%s'\n", fd->idx + j, buf);
+							strcpy(spec->blobFileNames[fd->idx + j], buf);
+						}
+					}
+				}
+			}
+
+			h->dataCount ++;
+		} else if(streqn(tok.ptr[0], "atlas", 5)) {
+			// blobs cut from one bitmap, with the cells listed in a .txt file beside it
+			if(tok.count < 4 || tok.length[3] >= 256) {
+				printWarning("Insufficient tokens for atlas");
+				continue;
+			}
+			if(!isNum(tok.ptr[1]) || !isNum(tok.ptr[2])) {
+				printError("Blob index and count for atlas must be numbers");
+				return DAWFT_ERR_FORMAT;
+			}
+			u32 idx = readNum(tok.ptr[1]);
+			u32 count = readNum(tok.ptr[2]);
+			if(count < 1 || idx >= 250 || count > 250 - idx) {
+				printError("Invalid blob index or count for atlas");
+				return DAWFT_ERR_FORMAT;
+			}
+			for(u32 j=0; j<count; j++) {
+				memcpy(spec->blobFileNames[idx + j], tok.ptr[3], tok.length[3]);
+				spec->blobFileNames[idx + j][tok.length[3]] = 0;
+				spec->blobAtlas[idx + j] = 1;
+			}
+		} else {
+			printWarning("Unrecognised token");
+		}
+
+		lineNumber ++;
+	}
+
+	// Do some sanity checks
+	if(efi->fileType != 'C') {
+		printError("fileType is not (yet) supported");
+		return DAWFT_ERR_UNSUPPORTED;
+	}
+	if(h->dataCount < 1) {
+		printError("No faceData lines founds");
+		return DAWFT_ERR_FORMAT;
+	}
+
+	if(h->blobCount < 1) {
+		printError("blobCount must be at least 1");
+		return DAWFT_ERR_FORMAT;
+	}
+	if(h->blobCount > 250) {
+		printError("blobCount must be at most 250");
+		return DAWFT_ERR_FORMAT;
+	}
+
+	#undef printWarning
+	#undef printError
+
+	// Save animation frames
+	if(efi->fileType == 'A') {
+		h->sizes[200] = efi->animationFrames;
+	} else {
+		h->sizes[0] = efi->animationFrames;
+	}
+
+	// Map each blob to its faceData
+	for(int i=0; i<250; i++) {
+		spec->blobFaceData[i] = (signed char)getFaceDataIndexFromOffsetIndex(i, h, efi);
+	}
+
+	return DAWFT_OK;
+}
+
+
+
+//----------------------------------------------------------------------------
+//  NEWBYTESFROMFILE - read entire file into memory
+//----------------------------------------------------------------------------
+
+// Read all of f, which doesn't need to be seekable (a pipe, for example), into a buffer that grows as needed.
+// Returns NULL on failure.
+Bytes * newBytesFromStream(FILE * f) {
+	size_t capacity = 65536;
+	Bytes * b = (Bytes *)malloc(sizeof(Bytes)+capacity);
+	if(b == NULL) {
+		d_printf("ERROR: Unable to allocate enough memory to read input.\n");
+		return NULL;
+	}
+	b->size = 0;
+
+	while(1) {
+		if(b->size == capacity) {
+			capacity *= 2;
+			Bytes * nb = (Bytes *)realloc(b, sizeof(Bytes)+capacity);
+			if(nb == NULL) {
+				d_printf("ERROR: Unable to allocate enough memory to read input.\n");
+				free(b);
+				return NULL;
+			}
+			b = nb;
+		}
+		size_t n = fread(&b->data[b->size], 1, capacity - b->size, f);
+		b->size += n;
+		if(n == 0) {
+			break;
+		}
+	}
+
+	if(ferror(f)) {
+		d_printf("ERROR: Read failed.\n");
+		free(b);
+		return NULL;
+	}
+	return b;
+}
+
+// Read file into struct Bytes. Delete with deleteBytes. 0123456sss
+Bytes * newBytesFromFile(char * fileName) {
+	// Open the binary input file
+    FILE * f = fopen(fileName, "rb");
+    if(f==NULL) {
+		d_printf("ERROR: Failed to open input file: '%s'\n", fileName);
+		return NULL;
+    }
+
+	// Check file size
+	long ftr = -1;
+	if(fseek(f,0,SEEK_END) == 0) {
+		ftr = ftell(f);
+	}
+	if(ftr < 0 || fseek(f,0,SEEK_SET) != 0) {
+		// not seekable, e.g. a named pipe
+		Bytes * b = newBytesFromStream(f);
+		fclose(f);
+		return b;
+	}
+	size_t fileSize = (size_t)ftr;
+
+	// Allocate buffer
+	Bytes * b = (Bytes *)malloc(sizeof(Bytes)+fileSize);
+	if(b == NULL) {
+		d_printf("ERROR: Unable to allocate enough memory to open file.\n");
+		fclose(f);
+		return NULL;
+	}
+
+	b->size = fileSize;	
+ 	// Read whole file
+	if(fread(b->data, 1, fileSize, f) != fileSize) {
+		d_printf("ERROR: Read failed.\n");
+		fclose(f);
+		free(b);
+		return NULL;
+	}
+
+	// Now file is loaded, close the file
+	fclose(f);
+
+	// Return the allocated memory filled with the file data
+	return b;
+}
+
+Bytes * deleteBytes(Bytes * b) {
+	if(b != NULL) {
+		free(b);
+		b = NULL;
+	}
+	return b;
+}
+
+
+//----------------------------------------------------------------------------
+//  BUFFER API - work on bin files and images already in memory
+//----------------------------------------------------------------------------
+
+// Read the header of the bin file in data. fileType is 'A', 'B', 'C', or 0 to autodetect.
+int dawftParseHeader(const u8 * data, size_t size, char fileType, FaceHeader * h, ExtraFileInfo * xfi) {
+	if(data == NULL || h == NULL || xfi == NULL) {
+		return DAWFT_ERR_ARG;
+	}
+	if(size < 1700) {
+		d_printf("ERROR: File is less than the minimum header size (1700 bytes)!\n");
+		return DAWFT_ERR_TRUNCATED;
+	}
+	if(fileType == 0) {
+		fileType = autodetectFileType(data, size);
+	}
+	if(fileType != 'A' && fileType != 'B' && fileType != 'C') {
+		return DAWFT_ERR_ARG;
+	}
+	u32 headerSize = (fileType == 'A') ? 1700 : 1900;
+	if(size < headerSize) {
+		d_printf("ERROR: File is less than the header size (%u bytes)!\n", headerSize);
+		return DAWFT_ERR_TRUNCATED;
+	}
+
+	setHeader(h, data, fileType);
+	if(h->dataCount > 39 || h->blobCount > 250) {
+		d_printf("ERROR: Header has %u faceData and %u blobs, the most is 39 and 250!\n", h->dataCount, h->blobCount);
+		return DAWFT_ERR_FORMAT;
+	}
+	*xfi = (ExtraFileInfo){ .fileType = fileType, .animationFrames = 0 };
+	for(u32 i=0; i<(sizeof(h->faceData)/sizeof(h->faceData[0])); i++) {
+		u8 type = h->faceData[i].type;
+		if(type >= 0xF6 && type <= 0xF8) {
+			xfi->animationFrames = (fileType == 'A') ? h->sizes[200] : h->sizes[0];
+		}
+	}
+	return DAWFT_OK;
+}
+
+// Find each blob in the bin file in data, and the dimensions to decode it with, as dump does.
+// Blobs which aren't images have a width and height of 0.
+int dawftListBlobs(const u8 * data, size_t size, const FaceHeader * h, const ExtraFileInfo * xfi, DawftBlob blobs[250], u32 * count) {
+	if(data == NULL || h == NULL || xfi == NULL || blobs == NULL || count == NULL) {
+		return DAWFT_ERR_ARG;
+	}
+	if(xfi->fileType == 'B') {
+		return DAWFT_ERR_UNSUPPORTED;		// the blobs are inside one big compressed blob
+	}
+	u32 headerSize = (xfi->fileType == 'A') ? 1700 : 1900;
+	*count = 0;
+
+	for(u32 i=0; i<h->blobCount && i<250; i++) {
+		DawftBlob * b = &blobs[i];
+		*b = (DawftBlob){ .offset = headerSize + h->offsets[i], .faceDataIdx = -1 };
+		if(h->offsets[i] >= size || b->offset + 2 > size) {
+			d_printf("ERROR: Offset %u is greater than file size.\n", h->offsets[i]);
+			return DAWFT_ERR_FORMAT;
+		}
+		if(i<249 && h->offsets[i+1] > h->offsets[i]) {
+			b->size = h->offsets[i+1] - h->offsets[i];
+		} else {
+			b->size = (u32)(size - b->offset);
+		}
+		if(b->offset + b->size > size) {
+			b->size = (u32)(size - b->offset);
+		}
+		if(get_u16(&data[b->offset]) == 0x2108) {
+			b->compression = (xfi->fileType == 'A') ? RLE_BASIC : RLE_LINE;
+		} else {
+			b->compression = NONE;
+		}
+
+		int fdi = getFaceDataIndexFromOffsetIndex((int)i, h, xfi);
+		b->faceDataIdx = fdi;
+		if(fdi != -1) {
+			const FaceData * fd = &h->faceData[fdi];
+			b->width = fd->w;
+			b->height = fd->h;
+			if(fd->type == 0x00 && xfi->fileType == 'A') {
+				b->width = 240;				// backgrounds of type 0x00 are always 240x24
+				b->height = 24;
+			}
+			if(fd->type >= 0xD7 && fd->type <= 0xD9 && i > (u32)(fd->idx + 10)) {
+				b->width *= 2;				// double-width degC degF
+			}
+		} else if(i == (u32)(h->blobCount - 1)) {
+			b->width = 140;					// small preview image, used when selecting faces
+			b->height = 163;
+		}
+		*count = i + 1;
+	}
+	return DAWFT_OK;
+}
+
+// Decode a blob into dst, as w*h big-endian RGB565 pixels.
+int dawftDecodeBlob(const u8 * src, size_t srcSize, u32 w, u32 h, u32 compression, u8 * dst, size_t dstSize) {
+	if(src == NULL || dst == NULL || w == 0 || h == 0) {
+		return DAWFT_ERR_ARG;
+	}
+	if(compression != NONE && compression != RLE_LINE && compression != RLE_BASIC) {
+		return DAWFT_ERR_ARG;
+	}
+	int r = decodeImgData(src, srcSize, w, h, compression, dst, dstSize);
+	if(r == 3) {
+		return DAWFT_ERR_BUFFER;
+	} else if(r != 0) {
+		return DAWFT_ERR_TRUNCATED;
+	}
+	return DAWFT_OK;
+}
+
+// Decode the spanW x spanH rectangle at x, y of a w x h blob into dst, as big-endian RGB565 pixels with rows
+// dstStride bytes apart. Rows above the rectangle aren't decoded, if the blob is NONE or RLE_LINE.
+int dawftDecodeSpan(const u8 * src, size_t srcSize, u32 w, u32 h, u32 compression, u32 x, u32 y, u32 spanW, u32 spanH, u8 * dst, size_t dstStride) {
+	if(src == NULL || dst == NULL || spanW == 0 || spanH == 0 || (u64)x + spanW > w || (u64)y + spanH > h || dstStride < (size_t)spanW * 2) {
+		return DAWFT_ERR_ARG;
+	}
+	if(compression != NONE && compression != RLE_LINE && compression != RLE_BASIC) {
+		return DAWFT_ERR_ARG;
+	}
+	if(decodeImgSpan(src, srcSize, w, h, compression, x, y, spanW, spanH, dst, dstStride) != 0) {
+		return DAWFT_ERR_TRUNCATED;
+	}
+	return DAWFT_OK;
+}
+
+// The largest number of bytes dawftEncodeImage() can need, or 0 if compression isn't supported.
+size_t dawftEncodeBound(u32 w, u32 h, u32 compression) {
+	size_t rawSize = (size_t)w * h * 2;
+	size_t rleSize = (2 + (size_t)h * 2) + ((size_t)w * h * 3);	// worst case
+	if(compression == NONE) {
+		return rawSize;
+	} else if(compression == RLE_LINE || compression == TRY_RLE) {
+		return rleSize;
+	}
+	return 0;
+}
+
+// Encode w*h big-endian RGB565 pixels into dst. TRY_RLE uses RLE_LINE only if it is smaller.
+int dawftEncodeImage(const u8 * pixels, u32 w, u32 h, u32 compression, u8 * dst, size_t dstSize, size_t * outSize) {
+	if(pixels == NULL || dst == NULL || outSize == NULL || w == 0 || h == 0) {
+		return DAWFT_ERR_ARG;
+	}
+	size_t rawSize = (size_t)w * h * 2;
+	*outSize = 0;
+
+	if(compression == RLE_LINE || compression == TRY_RLE) {
+		size_t size = encodeRLELine(pixels, w, h, dst, dstSize);
+		if(size != 0 && (compression == RLE_LINE || size < rawSize)) {
+			*outSize = size;
+			return DAWFT_OK;
+		}
+		if(compression == RLE_LINE) {
+			return (dstSize < dawftEncodeBound(w, h, RLE_LINE)) ? DAWFT_ERR_BUFFER : DAWFT_ERR_UNSUPPORTED;
+		}
+	} else if(compression != NONE) {
+		return DAWFT_ERR_UNSUPPORTED;
+	}
+
+	if(dstSize < rawSize) {
+		return DAWFT_ERR_BUFFER;
+	}
+	memcpy(dst, pixels, rawSize);
+	*outSize = rawSize;
+	return DAWFT_OK;
+}
+
+// Assemble a type C bin file from a header and h->blobCount (at most 250) encoded blobs. The offsets in h are filled in.
+// If dstSize is too small, *outSize is set to the size needed and DAWFT_ERR_BUFFER is returned.
+int dawftAssembleBin(FaceHeader * h, const u8 * const blobs[], const size_t sizes[], u8 * dst, size_t dstSize, size_t * outSize) {
+	if(h == NULL || blobs == NULL || sizes == NULL || outSize == NULL || h->blobCount > 250) {
+		return DAWFT_ERR_ARG;
+	}
+	size_t total = sizeof(FaceHeader);
+	for(u32 i=0; i<h->blobCount; i++) {
+		if(total - sizeof(FaceHeader) > 0xFFFFFFFF) {
+			return DAWFT_ERR_UNSUPPORTED;
+		}
+		h->offsets[i] = (u32)(total - sizeof(FaceHeader));
+		total += sizes[i];
+	}
+	*outSize = total;
+	if(dst == NULL || dstSize < total) {
+		return DAWFT_ERR_BUFFER;
+	}
+
+	memcpy(dst, h, sizeof(FaceHeader));
+	size_t pos = sizeof(FaceHeader);
+	for(u32 i=0; i<h->blobCount; i++) {
+		if(sizes[i] > 0) {
+			memcpy(&dst[pos], blobs[i], sizes[i]);
+		}
+		pos += sizes[i];
+	}
+	return DAWFT_OK;
+}
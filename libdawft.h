@@ -0,0 +1,78 @@
+// libdawft.h
+//
+// In-memory functions for reading and writing watch face bin files. Nothing in here calls exit(),
+// and diagnostic messages go through d_printf(), which can be redirected with dawftSetDiagnostics().
+// Requires dawft.h and bmp.h to be included first.
+
+
+//----------------------------------------------------------------------------
+//  ERRORS AND DIAGNOSTICS
+//----------------------------------------------------------------------------
+
+typedef enum _DawftError {
+	DAWFT_OK = 0,
+	DAWFT_ERR_ARG,				// invalid argument
+	DAWFT_ERR_NOMEM,			// out of memory
+	DAWFT_ERR_TRUNCATED,		// input data is too short
+	DAWFT_ERR_FORMAT,			// input data is not in the expected format
+	DAWFT_ERR_UNSUPPORTED,		// valid, but not (yet) supported
+	DAWFT_ERR_BUFFER,			// output buffer is too small
+} DawftError;
+
+// Receives each diagnostic message (ERROR:, WARNING:, etc.) from the library
+typedef void (*DawftDiagFn)(void * ctx, const char * msg);
+
+void dawftSetDiagnostics(DawftDiagFn fn, void * ctx);
+
+
+//----------------------------------------------------------------------------
+//  DATA TYPES
+//----------------------------------------------------------------------------
+
+typedef struct _DataType {
+	u8 type;
+	const char str[16];
+	u8 count;
+	const char * description;
+} DataType;
+
+extern const DataType dataTypes[];
+extern const u32 dataTypeCount;
+
+int getDataTypeIdxFromStr(const char * s);
+const char * getDataTypeStr(u8 type);
+int getDataTypeIdx(u8 type);
+
+
+//----------------------------------------------------------------------------
+//  HEADERS AND WATCHFACE.TXT
+//----------------------------------------------------------------------------
+
+void setHeader(FaceHeader * h, const u8 * buf, char fileType);
+char autodetectFileType(const u8 * fileData, size_t fileSize);
+int getFaceDataBlobCount(const FaceData * fd, const ExtraFileInfo * xfi);
+int getFaceDataIndexFromOffsetIndex(int offsetIndex, const FaceHeader * h, const ExtraFileInfo * xfi);
+int parseWatchFaceTxt(FaceSpec * spec, const Bytes * text);
+
+
+//----------------------------------------------------------------------------
+//  BUFFER API
+//----------------------------------------------------------------------------
+
+// Where a blob is, and how to decode it
+typedef struct _DawftBlob {
+	u32 offset;					// from start of file data
+	u32 size;					// estimated from the offset table
+	int faceDataIdx;			// index into h->faceData, or -1
+	u32 width;
+	u32 height;
+	u32 compression;			// ImgCompression
+} DawftBlob;
+
+int dawftParseHeader(const u8 * data, size_t size, char fileType, FaceHeader * h, ExtraFileInfo * xfi);
+int dawftListBlobs(const u8 * data, size_t size, const FaceHeader * h, const ExtraFileInfo * xfi, DawftBlob blobs[250], u32 * count);
+int dawftDecodeBlob(const u8 * src, size_t srcSize, u32 w, u32 h, u32 compression, u8 * dst, size_t dstSize);
+int dawftDecodeSpan(const u8 * src, size_t srcSize, u32 w, u32 h, u32 compression, u32 x, u32 y, u32 spanW, u32 spanH, u8 * dst, size_t dstStride);
+size_t dawftEncodeBound(u32 w, u32 h, u32 compression);
+int dawftEncodeImage(const u8 * pixels, u32 w, u32 h, u32 compression, u8 * dst, size_t dstSize, size_t * outSize);
+int dawftAssembleBin(FaceHeader * h, const u8 * const blobs[], const size_t sizes[], u8 * dst, size_t dstSize, size_t * outSize);
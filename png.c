@@ -0,0 +1,789 @@
+/*  png.c - decoding PNG files, with no dependencies
+
+	Da Watch Face Tool (dawft)
+	dawft: Watch Face Tool for MO YOUNG / DA FIT binary watch face files.
+
+	Copyright 2022 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>		// for offsetof()
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PNG_SSE2
+#endif
+
+#include "dawft.h"
+#include "bmp.h"
+#include "png.h"
+
+
+//----------------------------------------------------------------------------
+//  INFLATE - zlib stream decompression (RFC 1950, RFC 1951)
+//----------------------------------------------------------------------------
+
+#define HUFF_FAST_BITS 9
+
+// Canonical Huffman code. Codes of up to HUFF_FAST_BITS bits are found with one lookup in fast.
+typedef struct _Huffman {
+	u16 fast[1 << HUFF_FAST_BITS];	// (code length << 9) | symbol, or 0 for longer codes
+	u16 firstCode[16];
+	u32 maxCode[17];				// one past the last code of each length, shifted to 16 bits
+	u16 firstSymbol[16];
+	u8 size[288];
+	u16 value[288];
+} Huffman;
+
+typedef struct _Inflater {
+	const u8 * src;
+	const u8 * srcEnd;
+	u64 bits;						// bits not yet used, least significant first
+	u32 bitCount;
+	u32 padBytes;					// zero bytes added past the end of src
+	u8 * out;
+	size_t outSize;
+	size_t outPos;
+	Huffman lit;
+	Huffman dist;
+} Inflater;
+
+static const u16 lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const u8 lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const u16 distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const u8 distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const u8 codeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static u32 reverseBits(u32 v, u32 count) {
+	u32 r = 0;
+	for(u32 i=0; i<count; i++) {
+		r = (r << 1) | (v & 1);
+		v >>= 1;
+	}
+	return r;
+}
+
+// Build h from the code length of each of count symbols. Returns 0 for success.
+static int buildHuffman(Huffman * h, const u8 * sizes, u32 count) {
+	u32 sizeCount[17] = { 0 };
+	u32 nextCode[16];
+	memset(h->fast, 0, sizeof(h->fast));
+	for(u32 i=0; i<count; i++) {
+		sizeCount[sizes[i]]++;
+	}
+	sizeCount[0] = 0;
+
+	u32 code = 0;
+	u32 k = 0;
+	for(u32 i=1; i<16; i++) {
+		nextCode[i] = code;
+		h->firstCode[i] = (u16)code;
+		h->firstSymbol[i] = (u16)k;
+		code += sizeCount[i];
+		if(sizeCount[i] != 0 && code - 1 >= (1u << i)) {
+			return 1;		// over-subscribed
+		}
+		h->maxCode[i] = code << (16 - i);
+		code <<= 1;
+		k += sizeCount[i];
+	}
+	h->maxCode[16] = 0x10000;
+
+	for(u32 i=0; i<count; i++) {
+		u32 s = sizes[i];
+		if(s == 0) {
+			continue;
+		}
+		u32 c = nextCode[s] - h->firstCode[s] + h->firstSymbol[s];
+		h->size[c] = (u8)s;
+		h->value[c] = (u16)i;
+		if(s <= HUFF_FAST_BITS) {
+			for(u32 j=reverseBits(nextCode[s], s); j < (1u << HUFF_FAST_BITS); j += (1u << s)) {
+				h->fast[j] = (u16)((s << 9) | i);
+			}
+		}
+		nextCode[s]++;
+	}
+	return 0;
+}
+
+// Make sure there are at least 56 bits in z->bits. Past the end of the data, zeros are added.
+static inline void refillBits(Inflater * z) {
+	while(z->bitCount <= 56) {
+		u64 b = 0;
+		if(z->src < z->srcEnd) {
+			b = *z->src++;
+		} else {
+			z->padBytes++;
+		}
+		z->bits |= b << z->bitCount;
+		z->bitCount += 8;
+	}
+}
+
+static inline u32 getBits(Inflater * z, u32 count) {
+	if(z->bitCount < count) {
+		refillBits(z);
+	}
+	u32 v = (u32)(z->bits & ((1u << count) - 1));
+	z->bits >>= count;
+	z->bitCount -= count;
+	return v;
+}
+
+// Decode one symbol. Returns -1 for an invalid code.
+static inline int decodeSymbol(Inflater * z, const Huffman * h) {
+	if(z->bitCount < 16) {
+		refillBits(z);
+	}
+	u32 fast = h->fast[z->bits & ((1u << HUFF_FAST_BITS) - 1)];
+	if(fast != 0) {
+		u32 s = fast >> 9;
+		z->bits >>= s;
+		z->bitCount -= s;
+		return (int)(fast & 511);
+	}
+
+	// codes are stored most significant bit first, so reverse them to compare with maxCode
+	u32 k = reverseBits((u32)(z->bits & 0xFFFF), 16);
+	u32 s;
+	for(s=HUFF_FAST_BITS+1; k >= h->maxCode[s]; s++);
+	if(s >= 16) {
+		return -1;
+	}
+	u32 c = (k >> (16 - s)) - h->firstCode[s] + h->firstSymbol[s];
+	if(c >= 288 || h->size[c] != s) {
+		return -1;
+	}
+	z->bits >>= s;
+	z->bitCount -= s;
+	return h->value[c];
+}
+
+// Decode a block of compressed data with the codes in z->lit and z->dist. Returns 0 for success.
+static int inflateCodes(Inflater * z) {
+	for(;;) {
+		int sym = decodeSymbol(z, &z->lit);
+		if(sym < 0) {
+			return 1;
+		}
+		if(sym < 256) {
+			if(z->outPos >= z->outSize) {
+				return 2;
+			}
+			z->out[z->outPos++] = (u8)sym;
+			continue;
+		}
+		if(sym == 256) {
+			return 0;
+		}
+
+		sym -= 257;
+		if(sym >= 29) {
+			return 1;
+		}
+		size_t len = lengthBase[sym] + getBits(z, lengthExtra[sym]);
+		int dsym = decodeSymbol(z, &z->dist);
+		if(dsym < 0 || dsym >= 30) {
+			return 1;
+		}
+		size_t dist = distBase[dsym] + getBits(z, distExtra[dsym]);
+		if(dist > z->outPos || len > z->outSize - z->outPos) {
+			return 2;
+		}
+
+		u8 * dst = &z->out[z->outPos];
+		const u8 * src = dst - dist;
+		z->outPos += len;
+		if(dist == 1) {
+			memset(dst, *src, len);
+		} else if(dist >= len) {
+			memcpy(dst, src, len);
+		} else {
+			while(len--) {
+				*dst++ = *src++;	// the copy overlaps what it is writing
+			}
+		}
+	}
+}
+
+static int inflateStored(Inflater * z) {
+	getBits(z, z->bitCount & 7);		// skip to a byte boundary
+	u32 len = getBits(z, 16);
+	u32 nlen = getBits(z, 16);
+	if((len ^ 0xFFFF) != nlen || len > z->outSize - z->outPos) {
+		return 1;
+	}
+	// use up the bytes already read into z->bits, then copy the rest straight from the source
+	while(len > 0 && z->bitCount >= 8) {
+		z->out[z->outPos++] = (u8)getBits(z, 8);
+		len--;
+	}
+	if(len > (size_t)(z->srcEnd - z->src)) {
+		return 1;
+	}
+	memcpy(&z->out[z->outPos], z->src, len);
+	z->src += len;
+	z->outPos += len;
+	return 0;
+}
+
+static int inflateFixed(Inflater * z) {
+	u8 sizes[288 + 30];
+	memset(&sizes[0], 8, 144);
+	memset(&sizes[144], 9, 112);
+	memset(&sizes[256], 7, 24);
+	memset(&sizes[280], 8, 8);
+	memset(&sizes[288], 5, 30);
+	if(buildHuffman(&z->lit, sizes, 288) != 0 || buildHuffman(&z->dist, &sizes[288], 30) != 0) {
+		return 1;
+	}
+	return inflateCodes(z);
+}
+
+static int inflateDynamic(Inflater * z) {
+	u32 litCount = getBits(z, 5) + 257;
+	u32 distCount = getBits(z, 5) + 1;
+	u32 codeLengthCount = getBits(z, 4) + 4;
+	u8 codeLengthSizes[19] = { 0 };
+	for(u32 i=0; i<codeLengthCount; i++) {
+		codeLengthSizes[codeLengthOrder[i]] = (u8)getBits(z, 3);
+	}
+	Huffman * codeLengths = &z->lit;		// used for the code lengths, then rebuilt
+	if(buildHuffman(codeLengths, codeLengthSizes, 19) != 0) {
+		return 1;
+	}
+
+	u8 sizes[288 + 32];
+	u32 n = 0;
+	while(n < litCount + distCount) {
+		int c = decodeSymbol(z, codeLengths);
+		if(c < 0) {
+			return 1;
+		}
+		if(c < 16) {
+			sizes[n++] = (u8)c;
+			continue;
+		}
+		u8 fill = 0;
+		u32 repeat;
+		if(c == 16) {
+			if(n == 0) {
+				return 1;
+			}
+			fill = sizes[n - 1];
+			repeat = getBits(z, 2) + 3;
+		} else if(c == 17) {
+			repeat = getBits(z, 3) + 3;
+		} else {
+			repeat = getBits(z, 7) + 11;
+		}
+		if(repeat > litCount + distCount - n) {
+			return 1;
+		}
+		memset(&sizes[n], fill, repeat);
+		n += repeat;
+	}
+	if(sizes[256] == 0) {
+		return 1;			// no end of block code
+	}
+	if(buildHuffman(&z->lit, sizes, litCount) != 0 || buildHuffman(&z->dist, &sizes[litCount], distCount) != 0) {
+		return 1;
+	}
+	return inflateCodes(z);
+}
+
+// Decompress the zlib stream in src into out, which must be exactly the size of the decompressed data.
+// Returns 0 for success.
+static int inflateZlib(const u8 * src, size_t srcSize, u8 * out, size_t outSize) {
+	if(srcSize < 2) {
+		return 1;
+	}
+	u32 cmf = src[0];
+	u32 flg = src[1];
+	if((cmf & 15) != 8 || ((cmf << 8) | flg) % 31 != 0 || (flg & 32) != 0) {
+		return 1;		// not deflate, bad check bits, or a preset dictionary
+	}
+
+	Inflater * z = malloc(sizeof(Inflater));
+	if(z == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		return 3;
+	}
+	z->src = src + 2;
+	z->srcEnd = src + srcSize;
+	z->bits = 0;
+	z->bitCount = 0;
+	z->padBytes = 0;
+	z->out = out;
+	z->outSize = outSize;
+	z->outPos = 0;
+
+	int r = 0;
+	bool last = false;
+	while(!last && r == 0) {
+		last = getBits(z, 1);
+		u32 type = getBits(z, 2);
+		if(type == 0) {
+			r = inflateStored(z);
+		} else if(type == 1) {
+			r = inflateFixed(z);
+		} else if(type == 2) {
+			r = inflateDynamic(z);
+		} else {
+			r = 1;
+		}
+	}
+	if(r == 0 && (z->padBytes * 8 > z->bitCount || z->outPos != outSize)) {
+		r = 1;			// ran out of data. The adler32 checksum that follows isn't checked.
+	}
+	free(z);
+	return r;
+}
+
+
+//----------------------------------------------------------------------------
+//  UNFILTER - undo the filter applied to each row before compression
+//----------------------------------------------------------------------------
+
+static inline u8 paethPredictor(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = abs(p - a);
+	int pb = abs(p - b);
+	int pc = abs(p - c);
+	if(pa <= pb && pa <= pc) {
+		return (u8)a;
+	}
+	return (u8)((pb <= pc) ? b : c);
+}
+
+#ifdef PNG_SSE2
+
+// Pixels of 3 or 4 bytes are unfiltered a pixel at a time, with each byte in its own lane.
+static inline __m128i loadPixel(const u8 * p, u32 bpp) {
+	u32 v = 0;
+	memcpy(&v, p, bpp);
+	return _mm_cvtsi32_si128((int)v);
+}
+
+static inline void storePixel(u8 * p, __m128i v, u32 bpp) {
+	u32 x = (u32)_mm_cvtsi128_si32(v);
+	memcpy(p, &x, bpp);
+}
+
+static inline __m128i absI16(__m128i x) {
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+static inline __m128i selectI16(__m128i mask, __m128i a, __m128i b) {
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// Unfilter a row of 3 or 4 byte pixels. Returns false if it isn't a filter this can do.
+static bool unfilterRowSSE2(u8 filter, u8 * row, const u8 * prev, size_t rowSize, u32 bpp) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = zero;
+	if(filter == 1) {			// Sub
+		for(size_t x=0; x<rowSize; x+=bpp) {
+			a = _mm_add_epi8(a, loadPixel(&row[x], bpp));
+			storePixel(&row[x], a, bpp);
+		}
+	} else if(filter == 3) {	// Average, rounding down
+		for(size_t x=0; x<rowSize; x+=bpp) {
+			__m128i b = loadPixel(&prev[x], bpp);
+			__m128i avg = _mm_avg_epu8(a, b);
+			avg = _mm_sub_epi8(avg, _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+			a = _mm_add_epi8(loadPixel(&row[x], bpp), avg);
+			storePixel(&row[x], a, bpp);
+		}
+	} else if(filter == 4) {	// Paeth, in 16-bit lanes
+		__m128i c = zero;
+		for(size_t x=0; x<rowSize; x+=bpp) {
+			__m128i b = _mm_unpacklo_epi8(loadPixel(&prev[x], bpp), zero);
+			__m128i d = _mm_unpacklo_epi8(loadPixel(&row[x], bpp), zero);
+			__m128i pa = _mm_sub_epi16(b, c);			// p - a
+			__m128i pb = _mm_sub_epi16(a, c);			// p - b
+			__m128i pc = _mm_add_epi16(pa, pb);			// p - c
+			pa = absI16(pa);
+			pb = absI16(pb);
+			pc = absI16(pc);
+			__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+			__m128i nearest = selectI16(_mm_cmpeq_epi16(smallest, pa), a, selectI16(_mm_cmpeq_epi16(smallest, pb), b, c));
+			d = _mm_add_epi8(d, nearest);		// wraps within the low byte of each lane
+			storePixel(&row[x], _mm_packus_epi16(d, d), bpp);
+			c = b;
+			a = d;
+		}
+	} else {
+		return false;
+	}
+	return true;
+}
+
+#endif
+
+// Undo the filter on one row of rowSize bytes, where prev is the row above (unfiltered), or zeros.
+// bpp is the number of bytes per pixel, rounded up. Returns 0 for success.
+static int unfilterRow(u8 filter, u8 * row, const u8 * prev, size_t rowSize, u32 bpp) {
+	if(filter == 0) {			// None
+		return 0;
+	}
+	if(filter == 2) {			// Up
+		size_t x = 0;
+#ifdef PNG_SSE2
+		for(; x + 16 <= rowSize; x += 16) {
+			__m128i v = _mm_add_epi8(_mm_loadu_si128((const __m128i *)&row[x]), _mm_loadu_si128((const __m128i *)&prev[x]));
+			_mm_storeu_si128((__m128i *)&row[x], v);
+		}
+#endif
+		for(; x<rowSize; x++) {
+			row[x] = (u8)(row[x] + prev[x]);
+		}
+		return 0;
+	}
+#ifdef PNG_SSE2
+	if((bpp == 3 || bpp == 4) && unfilterRowSSE2(filter, row, prev, rowSize, bpp)) {
+		return 0;
+	}
+#endif
+
+	// the first pixel has nothing to its left
+	size_t x = 0;
+	if(filter == 1) {			// Sub
+		for(x=bpp; x<rowSize; x++) {
+			row[x] = (u8)(row[x] + row[x - bpp]);
+		}
+	} else if(filter == 3) {	// Average
+		for(; x<bpp; x++) {
+			row[x] = (u8)(row[x] + (prev[x] >> 1));
+		}
+		for(; x<rowSize; x++) {
+			row[x] = (u8)(row[x] + ((row[x - bpp] + prev[x]) >> 1));
+		}
+	} else if(filter == 4) {	// Paeth
+		for(; x<bpp; x++) {
+			row[x] = (u8)(row[x] + prev[x]);
+		}
+		for(; x<rowSize; x++) {
+			row[x] = (u8)(row[x] + paethPredictor(row[x - bpp], prev[x], prev[x - bpp]));
+		}
+	} else {
+		return 1;
+	}
+	return 0;
+}
+
+
+//----------------------------------------------------------------------------
+//  PNG - read the chunks, and convert the pixels to a bmp file
+//----------------------------------------------------------------------------
+
+#define get_u32_be(p) (u32)( ((u32)((const u8*)p)[0] << 24) | ((u32)((const u8*)p)[1] << 16) | ((u32)((const u8*)p)[2] << 8) | (u32)((const u8*)p)[3] )
+
+static const u8 pngSignature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+
+// What we need from the chunks before the pixels
+typedef struct _PNGInfo {
+	u32 w;
+	u32 h;
+	u8 bitDepth;
+	u8 colorType;			// 0 = grey, 2 = RGB, 3 = palette, 4 = grey + alpha, 6 = RGBA
+	u8 channels;
+	bool hasAlpha;			// from the color type, or a tRNS chunk
+	u32 paletteCount;
+	u8 palette[256][4];		// R, G, B, A
+	bool hasKey;			// tRNS for grey or RGB: samples matching key are transparent
+	u16 key[3];
+} PNGInfo;
+
+// Returns true if bytes is a PNG file.
+bool isPNG(const Bytes * bytes) {
+	return bytes->size >= sizeof(pngSignature) && memcmp(bytes->data, pngSignature, sizeof(pngSignature)) == 0;
+}
+
+// Read sample i of a row of unfiltered data, scaled to 8 bits, and the raw value (for comparing with a tRNS key).
+static inline u8 getSample(const PNGInfo * p, const u8 * row, u32 i, u16 * raw) {
+	u32 depth = p->bitDepth;
+	if(depth == 8) {
+		*raw = row[i];
+		return row[i];
+	}
+	if(depth == 16) {
+		*raw = (u16)((row[i * 2] << 8) | row[i * 2 + 1]);
+		return row[i * 2];
+	}
+	u32 bit = i * depth;
+	u32 v = (row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1u << depth) - 1);
+	*raw = (u16)v;
+	if(p->colorType == 3) {
+		return (u8)v;		// a palette index
+	}
+	return (u8)(v * 255 / ((1u << depth) - 1));
+}
+
+// Convert row y of unfiltered PNG data to B, G, R (and A, if dstBpp is 4) bytes.
+static void convertPNGRow(const PNGInfo * p, const u8 * row, u8 * dst, u32 dstBpp) {
+	u32 w = p->w;
+	if(p->bitDepth == 8 && p->colorType == 6 && dstBpp == 4) {
+		for(u32 x=0; x<w; x++) {
+			dst[x * 4]     = row[x * 4 + 2];
+			dst[x * 4 + 1] = row[x * 4 + 1];
+			dst[x * 4 + 2] = row[x * 4];
+			dst[x * 4 + 3] = row[x * 4 + 3];
+		}
+		return;
+	}
+	if(p->bitDepth == 8 && p->colorType == 2 && dstBpp == 3) {
+		for(u32 x=0; x<w; x++) {
+			dst[x * 3]     = row[x * 3 + 2];
+			dst[x * 3 + 1] = row[x * 3 + 1];
+			dst[x * 3 + 2] = row[x * 3];
+		}
+		return;
+	}
+
+	for(u32 x=0; x<w; x++) {
+		u8 r, g, b, a = 255;
+		u16 raw[4] = { 0 };
+		u32 i = x * p->channels;
+		if(p->colorType == 3) {
+			u8 index = getSample(p, row, i, &raw[0]);
+			const u8 * c = (index < p->paletteCount) ? p->palette[index] : p->palette[0];
+			r = c[0];
+			g = c[1];
+			b = c[2];
+			a = c[3];
+		} else if(p->colorType == 0 || p->colorType == 4) {
+			r = g = b = getSample(p, row, i, &raw[0]);
+			if(p->colorType == 4) {
+				a = getSample(p, row, i + 1, &raw[1]);
+			} else if(p->hasKey && raw[0] == p->key[0]) {
+				a = 0;
+			}
+		} else {
+			r = getSample(p, row, i, &raw[0]);
+			g = getSample(p, row, i + 1, &raw[1]);
+			b = getSample(p, row, i + 2, &raw[2]);
+			if(p->colorType == 6) {
+				a = getSample(p, row, i + 3, &raw[3]);
+			} else if(p->hasKey && raw[0] == p->key[0] && raw[1] == p->key[1] && raw[2] == p->key[2]) {
+				a = 0;
+			}
+		}
+		dst[x * dstBpp]     = b;
+		dst[x * dstBpp + 1] = g;
+		dst[x * dstBpp + 2] = r;
+		if(dstBpp == 4) {
+			dst[x * dstBpp + 3] = a;
+		}
+	}
+}
+
+// Check the IHDR chunk, and fill in p. Returns 0 for success.
+static int readPNGHeader(PNGInfo * p, const u8 * data, u32 size) {
+	if(size != 13) {
+		d_printf("ERROR: PNG header is the wrong size.\n");
+		return 1;
+	}
+	p->w = get_u32_be(&data[0]);
+	p->h = get_u32_be(&data[4]);
+	p->bitDepth = data[8];
+	p->colorType = data[9];
+	if(p->w < 1 || p->h < 1 || (u64)p->w * p->h > 0x4000000) {
+		d_printf("ERROR: PNG is %ux%u, which is too small or too large.\n", p->w, p->h);
+		return 1;
+	}
+	if(data[10] != 0 || data[11] != 0) {
+		d_printf("ERROR: PNG compression or filter method is unknown.\n");
+		return 1;
+	}
+	if(data[12] != 0) {
+		d_printf("ERROR: PNG is interlaced. Save it without interlacing.\n");
+		return 1;
+	}
+
+	u8 d = p->bitDepth;
+	bool ok = false;
+	switch(p->colorType) {
+		case 0: p->channels = 1; ok = (d == 1 || d == 2 || d == 4 || d == 8 || d == 16); break;
+		case 2: p->channels = 3; ok = (d == 8 || d == 16); break;
+		case 3: p->channels = 1; ok = (d == 1 || d == 2 || d == 4 || d == 8); break;
+		case 4: p->channels = 2; ok = (d == 8 || d == 16); break;
+		case 6: p->channels = 4; ok = (d == 8 || d == 16); break;
+		default: break;
+	}
+	if(!ok) {
+		d_printf("ERROR: PNG color type %u with bit depth %u is invalid.\n", p->colorType, d);
+		return 1;
+	}
+	p->hasAlpha = (p->colorType == 4 || p->colorType == 6);
+	return 0;
+}
+
+// Decode a PNG file, and build a bmp file of the same image in *out: ARGB8888 if it has any transparency (so it is
+// blended against the background), otherwise RGB888. Returns 0 for success. Delete *out with deleteBytes.
+int newBMPFromPNG(const Bytes * png, Bytes ** out) {
+	if(!isPNG(png)) {
+		d_printf("ERROR: File is not a PNG.\n");
+		return 1;
+	}
+
+	// read the chunks we need. Chunk CRCs aren't checked.
+	PNGInfo * p = calloc(1, sizeof(PNGInfo));
+	if(p == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		return 3;
+	}
+	bool haveHeader = false;
+	u32 idatCount = 0;
+	size_t idatSize = 0;
+	const u8 * firstIdat = NULL;
+	size_t pos = sizeof(pngSignature);
+	while(pos + 12 <= png->size) {
+		u32 size = get_u32_be(&png->data[pos]);
+		const u8 * type = &png->data[pos + 4];
+		const u8 * data = &png->data[pos + 8];
+		if(size > png->size - pos - 12) {
+			d_printf("ERROR: PNG is truncated.\n");
+			free(p);
+			return 1;
+		}
+		pos += 12 + (size_t)size;
+
+		if(memcmp(type, "IHDR", 4) == 0) {
+			if(readPNGHeader(p, data, size) != 0) {
+				free(p);
+				return 1;
+			}
+			haveHeader = true;
+		} else if(memcmp(type, "PLTE", 4) == 0) {
+			p->paletteCount = size / 3;
+			if(p->paletteCount > 256) {
+				p->paletteCount = 256;
+			}
+			for(u32 i=0; i<p->paletteCount; i++) {
+				memcpy(p->palette[i], &data[i * 3], 3);
+				p->palette[i][3] = 255;
+			}
+		} else if(memcmp(type, "tRNS", 4) == 0 && haveHeader) {
+			if(p->colorType == 3) {
+				for(u32 i=0; i<size && i<256; i++) {
+					p->palette[i][3] = data[i];
+				}
+				p->hasAlpha = true;
+			} else if((p->colorType == 0 && size >= 2) || (p->colorType == 2 && size >= 6)) {
+				for(u32 i=0; i<p->channels; i++) {
+					p->key[i] = (u16)((data[i * 2] << 8) | data[i * 2 + 1]);
+				}
+				p->hasKey = true;
+				p->hasAlpha = true;
+			}
+		} else if(memcmp(type, "IDAT", 4) == 0) {
+			if(idatCount++ == 0) {
+				firstIdat = data;
+			}
+			idatSize += size;
+		} else if(memcmp(type, "IEND", 4) == 0) {
+			break;
+		}
+	}
+	if(!haveHeader || idatCount == 0 || (p->colorType == 3 && p->paletteCount == 0)) {
+		d_printf("ERROR: PNG is missing its header, palette or image data.\n");
+		free(p);
+		return 1;
+	}
+
+	// the compressed data can be split over several IDAT chunks. If it is, join them together.
+	u8 * joined = NULL;
+	const u8 * zdata = firstIdat;
+	if(idatCount > 1) {
+		joined = malloc(idatSize);
+		if(joined == NULL) {
+			d_printf("ERROR: Out of memory.\n");
+			free(p);
+			return 3;
+		}
+		size_t joinedSize = 0;
+		for(pos = sizeof(pngSignature); pos + 12 <= png->size; ) {
+			u32 size = get_u32_be(&png->data[pos]);
+			if(memcmp(&png->data[pos + 4], "IDAT", 4) == 0) {
+				memcpy(&joined[joinedSize], &png->data[pos + 8], size);
+				joinedSize += size;
+			} else if(memcmp(&png->data[pos + 4], "IEND", 4) == 0) {
+				break;
+			}
+			pos += 12 + (size_t)size;
+		}
+		zdata = joined;
+	}
+
+	// each row is a filter byte, then the samples
+	u32 bitsPerPixel = (u32)p->channels * p->bitDepth;
+	u32 filterBpp = (bitsPerPixel + 7) / 8;
+	size_t rowSize = ((size_t)p->w * bitsPerPixel + 7) / 8;
+	size_t rawSize = (rowSize + 1) * p->h;
+	u8 * raw = malloc(rawSize);
+	u8 * zeroRow = calloc(1, rowSize);
+	if(raw == NULL || zeroRow == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		free(raw);
+		free(zeroRow);
+		free(joined);
+		free(p);
+		return 3;
+	}
+	int r = inflateZlib(zdata, idatSize, raw, rawSize);
+	free(joined);
+	if(r != 0) {
+		d_printf("ERROR: PNG image data is corrupt.\n");
+		free(raw);
+		free(zeroRow);
+		free(p);
+		return 1;
+	}
+
+	// build the bmp file, top-down, converting each row as soon as it is unfiltered
+	u32 dstBpp = p->hasAlpha ? 4 : 3;
+	BMPHeaderV4 header;
+	setBMPHeaderV4(&header, p->w, p->h, (u8)(dstBpp * 8));
+	size_t dstRowSize = header.imageDataSize / p->h;
+	Bytes * b = malloc(sizeof(Bytes) + header.fileSize);
+	if(b == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		free(raw);
+		free(zeroRow);
+		free(p);
+		return 3;
+	}
+	b->size = header.fileSize;
+	memcpy(b->data, &header, sizeof(header));
+	u8 * pixels = (u8 *)b + offsetof(Bytes, data) + sizeof(header);		// not &b->data[...], which is declared with only 16 bytes
+
+	const u8 * prev = zeroRow;
+	for(u32 y=0; y<p->h && r == 0; y++) {
+		u8 * row = &raw[y * (rowSize + 1)];
+		r = unfilterRow(row[0], &row[1], prev, rowSize, filterBpp);
+		u8 * dst = &pixels[y * dstRowSize];
+		convertPNGRow(p, &row[1], dst, dstBpp);
+		memset(&dst[(size_t)p->w * dstBpp], 0, dstRowSize - (size_t)p->w * dstBpp);
+		prev = &row[1];
+	}
+	free(raw);
+	free(zeroRow);
+	free(p);
+	if(r != 0) {
+		d_printf("ERROR: PNG has an unknown row filter.\n");
+		deleteBytes(b);
+		return 1;
+	}
+
+	*out = b;
+	return 0; // SUCCESS
+}
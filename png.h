@@ -0,0 +1,9 @@
+// png.h
+
+
+//----------------------------------------------------------------------------
+//  PNG - import PNG files, by converting them to bmp files in memory
+//----------------------------------------------------------------------------
+
+bool isPNG(const Bytes * bytes);
+int newBMPFromPNG(const Bytes * png, Bytes ** out);
@@ -0,0 +1,258 @@
+/*  qoi.c - reading and writing QOI ("Quite OK Image") files
+
+	Da Watch Face Tool (dawft)
+	dawft: Watch Face Tool for MO YOUNG / DA FIT binary watch face files.
+
+	Copyright 2022 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>		// for offsetof()
+
+#include "dawft.h"
+#include "bmp.h"
+#include "qoi.h"
+
+
+//----------------------------------------------------------------------------
+//  QOI - see https://qoiformat.org/qoi-specification.pdf
+//----------------------------------------------------------------------------
+
+#define QOI_HEADER_SIZE 14
+#define QOI_END_SIZE 8
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+#define QOI_OP_RGB 0xFE
+#define QOI_OP_RGBA 0xFF
+
+// A pixel, as R, G, B, A from the least significant byte
+typedef u32 QOIPixel;
+
+#define qoiR(p) ((p) & 0xFF)
+#define qoiG(p) (((p) >> 8) & 0xFF)
+#define qoiB(p) (((p) >> 16) & 0xFF)
+#define qoiA(p) ((p) >> 24)
+#define qoiPixel(r,g,b,a) ((QOIPixel)(r) | ((QOIPixel)(g) << 8) | ((QOIPixel)(b) << 16) | ((QOIPixel)(a) << 24))
+#define qoiHash(p) ((qoiR(p) * 3 + qoiG(p) * 5 + qoiB(p) * 7 + qoiA(p) * 11) & 63)
+
+static const u8 qoiEnd[QOI_END_SIZE] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+// Returns true if bytes is a QOI file.
+bool isQOI(const Bytes * bytes) {
+	return bytes->size >= QOI_HEADER_SIZE + QOI_END_SIZE && memcmp(bytes->data, "qoif", 4) == 0;
+}
+
+static u32 getQOIu32(const u8 * p) {
+	return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | (u32)p[3];
+}
+
+static void setQOIu32(u8 * p, u32 v) {
+	p[0] = (u8)(v >> 24);
+	p[1] = (u8)(v >> 16);
+	p[2] = (u8)(v >> 8);
+	p[3] = (u8)v;
+}
+
+// Decode a QOI file, and build a bmp file of the same image in *out: ARGB8888 if it has an alpha channel (so it is
+// blended against the background), otherwise RGB888. Returns 0 for success. Delete *out with deleteBytes.
+int newBMPFromQOI(const Bytes * qoi, Bytes ** out) {
+	if(!isQOI(qoi)) {
+		d_printf("ERROR: File is not a QOI.\n");
+		return 1;
+	}
+	u32 w = getQOIu32(&qoi->data[4]);
+	u32 h = getQOIu32(&qoi->data[8]);
+	u8 channels = qoi->data[12];
+	if(w < 1 || h < 1 || (u64)w * h > 0x4000000 || (channels != 3 && channels != 4)) {
+		d_printf("ERROR: QOI header doesn't make sense (%ux%u, %u channels).\n", w, h, channels);
+		return 1;
+	}
+
+	u32 dstBpp = channels;
+	BMPHeaderV4 header;
+	setBMPHeaderV4(&header, w, h, (u8)(dstBpp * 8));
+	size_t dstRowSize = header.imageDataSize / h;
+	Bytes * b = malloc(sizeof(Bytes) + header.fileSize);
+	if(b == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		return 3;
+	}
+	b->size = header.fileSize;
+	memcpy(b->data, &header, sizeof(header));
+	u8 * pixels = (u8 *)b + offsetof(Bytes, data) + sizeof(header);		// b->data[] is declared with only 16 bytes
+
+	QOIPixel index[64] = { 0 };
+	QOIPixel px = qoiPixel(0, 0, 0, 255);
+	const u8 * src = qoi->data;
+	size_t pos = QOI_HEADER_SIZE;
+	size_t end = qoi->size - QOI_END_SIZE;
+	u32 run = 0;
+	for(u32 y=0; y<h; y++) {
+		u8 * dst = &pixels[y * dstRowSize];
+		for(u32 x=0; x<w; x++) {
+			if(run > 0) {
+				run--;
+			} else {
+				if(pos >= end) {
+					d_printf("ERROR: QOI image data is truncated.\n");
+					deleteBytes(b);
+					return 1;
+				}
+				u8 b1 = src[pos++];
+				if(b1 == QOI_OP_RGB) {
+					px = qoiPixel(src[pos], src[pos + 1], src[pos + 2], qoiA(px));
+					pos += 3;
+				} else if(b1 == QOI_OP_RGBA) {
+					px = qoiPixel(src[pos], src[pos + 1], src[pos + 2], src[pos + 3]);
+					pos += 4;
+				} else if((b1 & 0xC0) == QOI_OP_INDEX) {
+					px = index[b1];
+				} else if((b1 & 0xC0) == QOI_OP_DIFF) {
+					u32 r = (qoiR(px) + ((b1 >> 4) & 3) - 2) & 0xFF;
+					u32 g = (qoiG(px) + ((b1 >> 2) & 3) - 2) & 0xFF;
+					u32 bl = (qoiB(px) + (b1 & 3) - 2) & 0xFF;
+					px = qoiPixel(r, g, bl, qoiA(px));
+				} else if((b1 & 0xC0) == QOI_OP_LUMA) {
+					u8 b2 = src[pos++];
+					u32 dg = (u32)(b1 & 0x3F) - 32;
+					u32 r = (qoiR(px) + dg - 8 + ((b2 >> 4) & 15)) & 0xFF;
+					u32 g = (qoiG(px) + dg) & 0xFF;
+					u32 bl = (qoiB(px) + dg - 8 + (b2 & 15)) & 0xFF;
+					px = qoiPixel(r, g, bl, qoiA(px));
+				} else {
+					run = b1 & 0x3F;		// this pixel, and run more
+				}
+				index[qoiHash(px)] = px;
+			}
+			dst[x * dstBpp]     = (u8)qoiB(px);
+			dst[x * dstBpp + 1] = (u8)qoiG(px);
+			dst[x * dstBpp + 2] = (u8)qoiR(px);
+			if(dstBpp == 4) {
+				dst[x * dstBpp + 3] = (u8)qoiA(px);
+			}
+		}
+		memset(&dst[(size_t)w * dstBpp], 0, dstRowSize - (size_t)w * dstBpp);
+	}
+
+	*out = b;
+	return 0; // SUCCESS
+}
+
+// Build a QOI file (RGB, no alpha) in *out from imgWidth*imgHeight big-endian RGB565 pixels.
+// Returns 0 for success. Delete *out with deleteBytes.
+int newQOIFromPixels(const u8 * pixels, u32 imgWidth, u32 imgHeight, Bytes ** out) {
+	size_t pixelCount = (size_t)imgWidth * imgHeight;
+	size_t maxSize = QOI_HEADER_SIZE + pixelCount * 4 + QOI_END_SIZE;
+	Bytes * b = malloc(sizeof(Bytes) + maxSize);
+	if(b == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		return 3;
+	}
+	u8 * dst = b->data;
+	memcpy(dst, "qoif", 4);
+	setQOIu32(&dst[4], imgWidth);
+	setQOIu32(&dst[8], imgHeight);
+	dst[12] = 3;			// RGB
+	dst[13] = 0;			// sRGB with linear alpha
+	size_t pos = QOI_HEADER_SIZE;
+
+	QOIPixel index[64] = { 0 };
+	QOIPixel prev = qoiPixel(0, 0, 0, 255);
+	u32 run = 0;
+	for(size_t i=0; i<pixelCount; i++) {
+		// expand RGB565 to RGB888 by repeating the top bits, so it converts back to the same pixel
+		u16 v = (u16)((pixels[i * 2] << 8) | pixels[i * 2 + 1]);
+		u32 r = ((v & 0xF800) >> 8) | ((v & 0xE000) >> 13);
+		u32 g = ((v & 0x07E0) >> 3) | ((v & 0x0600) >> 9);
+		u32 bl = ((v & 0x001F) << 3) | ((v & 0x001C) >> 2);
+		QOIPixel px = qoiPixel(r, g, bl, 255);
+
+		if(px == prev) {
+			run++;
+			if(run == 62) {
+				dst[pos++] = (u8)(QOI_OP_RUN | (run - 1));
+				run = 0;
+			}
+			continue;
+		}
+		if(run > 0) {
+			dst[pos++] = (u8)(QOI_OP_RUN | (run - 1));
+			run = 0;
+		}
+
+		u32 hash = qoiHash(px);
+		if(index[hash] == px) {
+			dst[pos++] = (u8)(QOI_OP_INDEX | hash);
+		} else {
+			index[hash] = px;
+			int dr = (int)(signed char)(u8)(r - qoiR(prev));
+			int dg = (int)(signed char)(u8)(g - qoiG(prev));
+			int db = (int)(signed char)(u8)(bl - qoiB(prev));
+			int drg = dr - dg;
+			int dbg = db - dg;
+			if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+				dst[pos++] = (u8)(QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+			} else if(dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+				dst[pos++] = (u8)(QOI_OP_LUMA | (dg + 32));
+				dst[pos++] = (u8)(((drg + 8) << 4) | (dbg + 8));
+			} else {
+				dst[pos++] = QOI_OP_RGB;
+				dst[pos++] = (u8)r;
+				dst[pos++] = (u8)g;
+				dst[pos++] = (u8)bl;
+			}
+		}
+		prev = px;
+	}
+	if(run > 0) {
+		dst[pos++] = (u8)(QOI_OP_RUN | (run - 1));
+	}
+	memcpy(&dst[pos], qoiEnd, QOI_END_SIZE);
+	pos += QOI_END_SIZE;
+
+	b->size = pos;
+	Bytes * shrunk = realloc(b, sizeof(Bytes) + pos);
+	*out = (shrunk != NULL) ? shrunk : b;
+	return 0; // SUCCESS
+}
+
+// Build a QOI file in *out from blob data, like newBMP16FromData(). Returns 0 for success. Delete *out with deleteBytes.
+int newQOIFromData(const u8 * srcData, size_t srcDataSize, u32 imgWidth, u32 imgHeight, bool basicRLE, Bytes ** out) {
+	// Check we have at least a little data available
+	if(srcDataSize < 2) {
+		d_printf("ERROR: srcDataSize < 2 bytes!\n");
+		return 100;
+	}
+
+	// Check if this bitmap has the RLE encoded identifier
+	u16 identifier = get_u16(&srcData[0]);
+	int isRLE = (identifier == 0x2108);
+	u32 compression = isRLE ? (basicRLE ? RLE_BASIC : RLE_LINE) : NONE;
+	if(!imgFitsData(srcDataSize, imgWidth, imgHeight, compression)) {
+		d_printf("ERROR: %ux%u image doesn't fit in %zu bytes of srcData.\n", imgWidth, imgHeight, srcDataSize);
+		return 104;
+	}
+
+	size_t pixelsSize = (size_t)imgWidth * imgHeight * 2;
+	u8 * pixels = malloc(pixelsSize);
+	if(pixels == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		return 3;
+	}
+	int r = decodeImgData(srcData, srcDataSize, imgWidth, imgHeight, compression, pixels, pixelsSize);
+	if(r == 0) {
+		r = newQOIFromPixels(pixels, imgWidth, imgHeight, out);
+	}
+	free(pixels);
+	return r;
+}
@@ -0,0 +1,11 @@
+// qoi.h
+
+
+//----------------------------------------------------------------------------
+//  QOI - import QOI files, and dump bitmaps as QOI files
+//----------------------------------------------------------------------------
+
+bool isQOI(const Bytes * bytes);
+int newBMPFromQOI(const Bytes * qoi, Bytes ** out);
+int newQOIFromPixels(const u8 * pixels, u32 imgWidth, u32 imgHeight, Bytes ** out);
+int newQOIFromData(const u8 * srcData, size_t srcDataSize, u32 imgWidth, u32 imgHeight, bool basicRLE, Bytes ** out);
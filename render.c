@@ -0,0 +1,900 @@
+/*  render.c - drawing a frame of a watch face, as the watch would show it
+
+	Da Watch Face Tool (dawft)
+	dawft: Watch Face Tool for MO YOUNG / DA FIT binary watch face files.
+
+	Copyright 2022 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+
+	Every bitmap is decoded once, when the renderer is made. Drawing a frame is then just copying rows of pixels into
+	the frame, so thousands of frames a second can be drawn. Hands are turned with sin and cos tables in fixed point,
+	looking only at the part of each row of the screen that falls on the visible part of the hand.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "dawft.h"
+#include "bmp.h"
+#include "libdawft.h"
+#include "render.h"
+
+
+//----------------------------------------------------------------------------
+//  FACE STATE
+//----------------------------------------------------------------------------
+
+// Day of the week (0 is Sunday) of a date in the Gregorian calendar
+u8 getWeekday(u32 year, u32 month, u32 day) {
+	static const u8 t[12] = { 0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4 };
+	if(month < 1 || month > 12) {
+		return 0;
+	}
+	if(month < 3) {
+		year -= 1;
+	}
+	return (u8)((year + year / 4 - year / 100 + year / 400 + t[month - 1] + day) % 7);
+}
+
+// Fill s with an example of what a watch might be showing, for previews
+void setDefaultFaceState(FaceState * s) {
+	*s = (FaceState){
+		.year = 2022, .month = 6, .day = 15, .hour = 10, .minute = 8, .second = 36,
+		.steps = 6789, .stepsGoal = 10000, .hr = 72, .kcal = 345, .kcalGoal = 500, .dist = 5, .distGoal = 8,
+		.battery = 80, .temp = 21, .btConnected = true,
+	};
+	s->weekday = getWeekday(s->year, s->month, s->day);
+}
+
+// Move s on by one second, and to the next animation frame
+void tickFaceState(FaceState * s) {
+	static const u8 daysInMonth[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	s->frame++;
+	if(++s->second < 60) {
+		return;
+	}
+	s->second = 0;
+	if(++s->minute < 60) {
+		return;
+	}
+	s->minute = 0;
+	if(++s->hour < 24) {
+		return;
+	}
+	s->hour = 0;
+	bool leap = (s->year % 4 == 0 && s->year % 100 != 0) || s->year % 400 == 0;
+	u32 days = (s->month == 2 && leap) ? 29 : daysInMonth[(s->month + 11) % 12];
+	if(++s->day > days) {
+		s->day = 1;
+		if(++s->month > 12) {
+			s->month = 1;
+			s->year++;
+		}
+	}
+	s->weekday = (u8)((s->weekday + 1) % 7);
+}
+
+
+//----------------------------------------------------------------------------
+//  FACE RENDERER
+//----------------------------------------------------------------------------
+
+// Find where each row of blob b (at src) starts in its data, and where the last one ends, so the number of bytes
+// that must be decoded to draw part of it can be counted. Returns NULL if out of memory.
+static u32 * newRowStarts(const u8 * src, const DawftBlob * b) {
+	u32 * rowStarts = malloc(((size_t)b->height + 1) * sizeof(u32));
+	if(rowStarts == NULL) {
+		return NULL;
+	}
+	if(b->compression == RLE_LINE) {
+		// the line end offset table gives it directly
+		rowStarts[0] = 2 + 2 * b->height;
+		for(u32 y=1; y<=b->height; y++) {
+			u32 end = get_u16(&src[2 + (y - 1) * 2]);
+			rowStarts[y] = (end > b->size) ? b->size : ((end < rowStarts[y - 1]) ? rowStarts[y - 1] : end);
+		}
+	} else if(b->compression == RLE_BASIC) {
+		// the run each row starts in
+		u64 pos = 0;
+		u64 pixelCount = (u64)b->width * b->height;
+		u32 y = 0;
+		size_t srcIdx = 2;
+		while(pos < pixelCount && srcIdx + 2 < b->size) {
+			u32 count = src[srcIdx + 2];
+			while(y < b->height && (u64)y * b->width < pos + count && (u64)y * b->width >= pos) {
+				rowStarts[y++] = (u32)srcIdx;
+			}
+			pos += count;
+			srcIdx += 3;
+		}
+		while(y <= b->height) {
+			rowStarts[y++] = (u32)srcIdx;
+		}
+	} else {
+		for(u32 y=0; y<=b->height; y++) {
+			rowStarts[y] = y * b->width * 2;
+		}
+	}
+	return rowStarts;
+}
+
+// The smallest rectangle holding every pixel of a w x h bitmap that isn't black (transparent, for hands)
+static FaceRect getOpaqueRect(const u8 * pixels, u32 w, u32 h) {
+	u32 x0 = w, y0 = h, x1 = 0, y1 = 0;
+	for(u32 y=0; y<h; y++) {
+		for(u32 x=0; x<w; x++) {
+			if(pixels[(y * w + x) * 2] | pixels[(y * w + x) * 2 + 1]) {
+				x0 = (x < x0) ? x : x0;
+				x1 = (x + 1 > x1) ? x + 1 : x1;
+				y0 = (y < y0) ? y : y0;
+				y1 = y + 1;
+			}
+		}
+	}
+	if(x1 == 0) {
+		return (FaceRect){ 0 };
+	}
+	return (FaceRect){ .x = (i32)x0, .y = (i32)y0, .w = (i32)(x1 - x0), .h = (i32)(y1 - y0) };
+}
+
+// Parse the bin file in data, and decode all its bitmaps. fileType is 'A', 'B', 'C', or 0 to autodetect.
+// Returns NULL for failure. Delete with deleteFaceRenderer.
+FaceRenderer * newFaceRenderer(const u8 * data, size_t size, char fileType) {
+	FaceRenderer * r = calloc(1, sizeof(FaceRenderer));
+	if(r == NULL) {
+		d_printf("ERROR: Out of memory.\n");
+		return NULL;
+	}
+	if(dawftParseHeader(data, size, fileType, &r->h, &r->xfi) != DAWFT_OK) {
+		return deleteFaceRenderer(r);
+	}
+	int e = dawftListBlobs(data, size, &r->h, &r->xfi, r->blobs, &r->blobCount);
+	if(e == DAWFT_ERR_UNSUPPORTED) {
+		d_printf("ERROR: Type B files are compressed, and can't be rendered.\n");
+	}
+	if(e != DAWFT_OK) {
+		return deleteFaceRenderer(r);
+	}
+
+	// the screen is the size of the background, if there is one, or big enough for everything on it
+	u32 maxFaceData = (r->xfi.fileType == 'A') ? 32 : 39;
+	r->width = 0;
+	r->height = 0;
+	for(u32 i=0; i<r->h.dataCount && i<maxFaceData; i++) {
+		const FaceData * fd = &r->h.faceData[i];
+		if(fd->type == 0x01) {
+			r->width = fd->w;
+			r->height = fd->h;
+			break;
+		}
+		r->width = (fd->x + fd->w > r->width) ? (u32)(fd->x + fd->w) : r->width;
+		r->height = (fd->y + fd->h > r->height) ? (u32)(fd->y + fd->h) : r->height;
+	}
+	if(r->xfi.fileType == 'A' || r->width == 0 || r->height == 0) {
+		r->width = 240;
+		r->height = 240;
+	}
+
+	// the preview image, and anything else that isn't part of a faceData, is never drawn
+	for(u32 i=0; i<r->blobCount; i++) {
+		DawftBlob * b = &r->blobs[i];
+		if(b->faceDataIdx == -1 || b->width == 0 || b->height == 0) {
+			continue;
+		}
+		if(!imgFitsData(b->size, b->width, b->height, b->compression)) {
+			d_printf("WARNING: Blob %u can't be decoded, and won't be drawn.\n", i);
+			continue;
+		}
+		size_t pixelsSize = (size_t)b->width * b->height * 2;
+		r->pixels[i] = malloc(pixelsSize);
+		if(r->pixels[i] == NULL) {
+			d_printf("ERROR: Out of memory.\n");
+			return deleteFaceRenderer(r);
+		}
+		if(dawftDecodeBlob(&data[b->offset], b->size, b->width, b->height, b->compression, r->pixels[i], pixelsSize) != DAWFT_OK) {
+			d_printf("WARNING: Blob %u can't be decoded, and won't be drawn.\n", i);
+			free(r->pixels[i]);
+			r->pixels[i] = NULL;
+			continue;
+		}
+		r->rowStarts[i] = newRowStarts(&data[b->offset], b);
+		if(r->rowStarts[i] == NULL) {
+			d_printf("ERROR: Out of memory.\n");
+			return deleteFaceRenderer(r);
+		}
+		r->opaque[i] = getOpaqueRect(r->pixels[i], b->width, b->height);
+	}
+	return r;
+}
+
+FaceRenderer * deleteFaceRenderer(FaceRenderer * r) {
+	if(r != NULL) {
+		for(u32 i=0; i<250; i++) {
+			free(r->pixels[i]);
+			free(r->rowStarts[i]);
+		}
+		free(r);
+	}
+	return NULL;
+}
+
+
+//----------------------------------------------------------------------------
+//  HANDS - rotating bitmaps about a pivot, in fixed point
+//----------------------------------------------------------------------------
+
+// sin() of 0 to 90 degrees, scaled by 1 << 14
+static const i32 sinTable[91] = {
+	0, 286, 572, 857, 1143, 1428, 1713, 1997, 2280, 2563, 2845, 3126, 3406, 3686, 3964, 4240,
+	4516, 4790, 5063, 5334, 5604, 5872, 6138, 6402, 6664, 6924, 7182, 7438, 7692, 7943, 8192, 8438,
+	8682, 8923, 9162, 9397, 9630, 9860, 10087, 10311, 10531, 10749, 10963, 11174, 11381, 11585, 11786, 11982,
+	12176, 12365, 12551, 12733, 12911, 13085, 13255, 13421, 13583, 13741, 13894, 14044, 14189, 14330, 14466, 14598,
+	14726, 14849, 14968, 15082, 15191, 15296, 15396, 15491, 15582, 15668, 15749, 15826, 15897, 15964, 16026, 16083,
+	16135, 16182, 16225, 16262, 16294, 16322, 16344, 16362, 16374, 16382, 16384
+};
+
+// sin() and cos() of a whole number of degrees, scaled by 1 << 14
+static i32 sinQ14(u32 angle) {
+	angle %= 360;
+	if(angle <= 90) return sinTable[angle];
+	if(angle <= 180) return sinTable[180 - angle];
+	if(angle <= 270) return -sinTable[angle - 180];
+	return -sinTable[360 - angle];
+}
+
+static i32 cosQ14(u32 angle) {
+	return sinQ14(angle + 90);
+}
+
+// Floor of a / b, for b > 0
+static i64 floorDiv(i64 a, i64 b) {
+	return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+static FaceRect intersectRect(FaceRect a, FaceRect b) {
+	i32 x0 = (a.x > b.x) ? a.x : b.x;
+	i32 y0 = (a.y > b.y) ? a.y : b.y;
+	i32 x1 = (a.x + a.w < b.x + b.w) ? a.x + a.w : b.x + b.w;
+	i32 y1 = (a.y + a.h < b.y + b.h) ? a.y + a.h : b.y + b.h;
+	if(x1 <= x0 || y1 <= y0) {
+		return (FaceRect){ 0 };
+	}
+	return (FaceRect){ .x = x0, .y = y0, .w = x1 - x0, .h = y1 - y0 };
+}
+
+// The smallest rectangle covering a and b. Empty rectangles cover nothing.
+static FaceRect unionRect(FaceRect a, FaceRect b) {
+	if(a.w <= 0 || a.h <= 0) {
+		return b;
+	}
+	if(b.w <= 0 || b.h <= 0) {
+		return a;
+	}
+	i32 x0 = (a.x < b.x) ? a.x : b.x;
+	i32 y0 = (a.y < b.y) ? a.y : b.y;
+	i32 x1 = (a.x + a.w > b.x + b.w) ? a.x + a.w : b.x + b.w;
+	i32 y1 = (a.y + a.h > b.y + b.h) ? a.y + a.h : b.y + b.h;
+	return (FaceRect){ .x = x0, .y = y0, .w = x1 - x0, .h = y1 - y0 };
+}
+
+// The screen rectangle covered by a w x h bitmap at x, y, when it is turned angle degrees clockwise about the corner
+// between pixels at pivotX, pivotY.
+FaceRect getRotatedRect(u32 w, u32 h, i32 x, i32 y, i32 pivotX, i32 pivotY, u32 angle) {
+	i64 c = cosQ14(angle);
+	i64 s = sinQ14(angle);
+	i64 minX = INT64_MAX, minY = INT64_MAX, maxX = INT64_MIN, maxY = INT64_MIN;
+	for(u32 i=0; i<4; i++) {
+		i64 cx = (i64)(x - pivotX + ((i & 1) ? (i32)w : 0));
+		i64 cy = (i64)(y - pivotY + ((i & 2) ? (i32)h : 0));
+		i64 rx = cx * c - cy * s;
+		i64 ry = cx * s + cy * c;
+		minX = (rx < minX) ? rx : minX;
+		maxX = (rx > maxX) ? rx : maxX;
+		minY = (ry < minY) ? ry : minY;
+		maxY = (ry > maxY) ? ry : maxY;
+	}
+	// a pixel of margin, for rounding
+	i32 x0 = (i32)floorDiv(minX, 1 << 14) - 1 + pivotX;
+	i32 y0 = (i32)floorDiv(minY, 1 << 14) - 1 + pivotY;
+	i32 x1 = (i32)floorDiv(maxX + (1 << 14) - 1, 1 << 14) + 1 + pivotX;
+	i32 y1 = (i32)floorDiv(maxY + (1 << 14) - 1, 1 << 14) + 1 + pivotY;
+	return (FaceRect){ .x = x0, .y = y0, .w = x1 - x0, .h = y1 - y0 };
+}
+
+// Narrow [*x0, *x1) to the steps x where lo <= f0 + k * x < hi. Everything is 16.16 fixed point except x.
+static void clipSteps(i64 f0, i64 k, i64 lo, i64 hi, i64 * x0, i64 * x1) {
+	i64 first, last;
+	if(k == 0) {
+		if(f0 < lo || f0 >= hi) {
+			*x1 = *x0;
+		}
+		return;
+	} else if(k > 0) {
+		first = floorDiv(lo - f0 + k - 1, k);
+		last = floorDiv(hi - f0 - 1, k);
+	} else {
+		first = floorDiv(f0 - hi, -k) + 1;
+		last = floorDiv(f0 - lo, -k);
+	}
+	// a step of margin, for rounding; each pixel is still checked
+	*x0 = (first - 1 > *x0) ? first - 1 : *x0;
+	*x1 = (last + 2 < *x1) ? last + 2 : *x1;
+}
+
+// Draw a w x h bitmap of big-endian RGB565 pixels, which would be at x, y unturned, turned angle degrees clockwise
+// about the corner between pixels at pivotX, pivotY. Black pixels are transparent. Only the part inside clip is drawn,
+// into frame, which is frameWidth pixels wide. Each screen pixel takes the bitmap pixel its centre turns back onto.
+// If opaque isn't NULL, it is the part of the bitmap that isn't transparent, and each row of the screen is cut down
+// to the pixels that turn back onto it before any are looked at. Otherwise every pixel in the rotated rectangle is.
+void drawRotatedPixels(const u8 * pixels, u32 w, u32 h, const FaceRect * opaque, i32 x, i32 y, i32 pivotX, i32 pivotY,
+		u32 angle, FaceRect clip, u8 * frame, u32 frameWidth) {
+	FaceRect d = intersectRect(getRotatedRect(w, h, x, y, pivotX, pivotY, angle), clip);
+	FaceRect src = (opaque != NULL) ? intersectRect(*opaque, (FaceRect){ .w = (i32)w, .h = (i32)h }) : (FaceRect){ .w = (i32)w, .h = (i32)h };
+	if(d.w == 0 || src.w == 0) {
+		return;
+	}
+	// turning back by angle: u = dx * cos + dy * sin, v = dy * cos - dx * sin, in 16.16 fixed point
+	i64 c = cosQ14(angle);
+	i64 s = sinQ14(angle);
+	i64 du = c * 4;
+	i64 dv = -s * 4;
+	i64 dx = ((i64)(d.x - pivotX) * 65536) + 0x8000;
+	for(i32 row=0; row<d.h; row++) {
+		i64 dy = ((i64)(d.y + row - pivotY) * 65536) + 0x8000;
+		i64 u = ((dx * c + dy * s) >> 14) + ((i64)(pivotX - x) * 65536);
+		i64 v = ((dy * c - dx * s) >> 14) + ((i64)(pivotY - y) * 65536);
+		i64 x0 = 0;
+		i64 x1 = d.w;
+		if(opaque != NULL) {
+			clipSteps(u, du, (i64)src.x * 65536, (i64)(src.x + src.w) * 65536, &x0, &x1);
+			clipSteps(v, dv, (i64)src.y * 65536, (i64)(src.y + src.h) * 65536, &x0, &x1);
+		}
+		u8 * dst = &frame[((size_t)(d.y + row) * frameWidth + d.x) * 2];
+		u += du * x0;
+		v += dv * x0;
+		for(i64 i=x0; i<x1; i++, u+=du, v+=dv) {
+			if(u < 0 || v < 0 || (u >> 16) >= w || (v >> 16) >= h) {
+				continue;
+			}
+			const u8 * p = &pixels[(((size_t)(v >> 16)) * w + (size_t)(u >> 16)) * 2];
+			if(p[0] | p[1]) {
+				dst[i * 2] = p[0];
+				dst[i * 2 + 1] = p[1];
+			}
+		}
+	}
+}
+
+
+//----------------------------------------------------------------------------
+//  DRAWING
+//----------------------------------------------------------------------------
+
+typedef enum _Align {
+	ALIGN_LEFT = 0,
+	ALIGN_CENTRE = 1,
+	ALIGN_RIGHT = 2,
+} Align;
+
+#define DIGIT_SPACING 2
+
+// Digits of weather temperatures are followed by these glyphs
+#define GLYPH_MINUS 10
+#define GLYPH_DEGC 11
+#define GLYPH_DEGF 12
+
+// One blob, drawn at x, y
+typedef struct _DrawOp {
+	u8 blob;
+	u8 faceData;
+	i32 angle;					// degrees clockwise about the centre of the screen, for hands, or -1
+	i32 x;
+	i32 y;
+} DrawOp;
+
+// Everything drawn for a frame, in order. No faceData draws more than 13 blobs.
+typedef struct _DrawList {
+	u32 count;
+	DrawOp ops[39 * 13];
+} DrawList;
+
+static void addOp(DrawList * list, u32 fdi, u32 blob, i32 x, i32 y) {
+	if(list->count < sizeof(list->ops) / sizeof(list->ops[0]) && blob < 250) {
+		list->ops[list->count++] = (DrawOp){ .blob = (u8)blob, .faceData = (u8)fdi, .angle = -1, .x = x, .y = y };
+	}
+}
+
+// Add a hand, turned angle degrees clockwise from 12 o'clock
+static void addHand(DrawList * list, const FaceRenderer * r, u32 fdi, u32 angle) {
+	const FaceData * fd = &r->h.faceData[fdi];
+	addOp(list, fdi, fd->idx, fd->x, fd->y);
+	if(list->count > 0 && list->ops[list->count - 1].faceData == fdi) {
+		list->ops[list->count - 1].angle = (i32)(angle % 360);
+	}
+}
+
+// Add glyphs (offsets from fd->idx) in a row, 2px apart. The digit box of fd is the left end, middle or right
+// end of the row.
+static void addGlyphs(DrawList * list, const FaceRenderer * r, u32 fdi, const u8 * glyphs, u32 count, Align align) {
+	const FaceData * fd = &r->h.faceData[fdi];
+	i32 total = 0;
+	for(u32 i=0; i<count; i++) {
+		u32 idx = fd->idx + glyphs[i];
+		total += (idx < r->blobCount) ? (i32)r->blobs[idx].width : fd->w;
+		total += (i > 0) ? DIGIT_SPACING : 0;
+	}
+	i32 x = fd->x;
+	if(align == ALIGN_CENTRE) {
+		x = fd->x + (fd->w - total) / 2;
+	} else if(align == ALIGN_RIGHT) {
+		x = fd->x + fd->w - total;
+	}
+	for(u32 i=0; i<count; i++) {
+		u32 idx = fd->idx + glyphs[i];
+		addOp(list, fdi, idx, x, fd->y);
+		x += ((idx < r->blobCount) ? (i32)r->blobs[idx].width : fd->w) + DIGIT_SPACING;
+	}
+}
+
+// Add value as digits, with at least minDigits (leading zeros)
+static void addNumber(DrawList * list, const FaceRenderer * r, u32 fdi, u32 value, u32 minDigits, Align align) {
+	u8 glyphs[10];
+	u32 count = 0;
+	do {
+		glyphs[9 - count++] = (u8)(value % 10);
+		value /= 10;
+	} while(value > 0 || count < minDigits);
+	addGlyphs(list, r, fdi, &glyphs[10 - count], count, align);
+}
+
+// Add the weather temperature, with its minus sign and degree symbol
+static void addTemp(DrawList * list, const FaceRenderer * r, u32 fdi, i32 temp, bool fahrenheit, Align align) {
+	u8 glyphs[13];
+	u32 count = 0;
+	u32 value = (temp < 0) ? (u32)-(i64)temp : (u32)temp;
+	glyphs[12 - count++] = fahrenheit ? GLYPH_DEGF : GLYPH_DEGC;
+	do {
+		glyphs[12 - count++] = (u8)(value % 10);
+		value /= 10;
+	} while(value > 0);
+	if(temp < 0) {
+		glyphs[12 - count++] = GLYPH_MINUS;
+	}
+	addGlyphs(list, r, fdi, &glyphs[13 - count], count, align);
+}
+
+// Add the frame of a progress bar (0%, 10%... 100%) for value out of goal
+static void addProgress(DrawList * list, const FaceRenderer * r, u32 fdi, u32 value, u32 goal) {
+	const FaceData * fd = &r->h.faceData[fdi];
+	u32 step = (goal == 0) ? 10 : (u32)(((u64)value * 10) / goal);
+	addOp(list, fdi, fd->idx + ((step > 10) ? 10 : step), fd->x, fd->y);
+}
+
+// List everything drawn for state s, in the order it is drawn
+static void getDrawList(const FaceRenderer * r, const FaceState * s, DrawList * list) {
+	list->count = 0;
+	u32 hour = s->hour;
+	if(s->hour12) {
+		hour = (s->hour % 12 == 0) ? 12 : s->hour % 12;
+	}
+	u32 maxFaceData = (r->xfi.fileType == 'A') ? 32 : 39;
+
+	// in the order they are in the file, so later ones are drawn on top
+	for(u32 i=0; i<r->h.dataCount && i<maxFaceData; i++) {
+		const FaceData * fd = &r->h.faceData[i];
+		switch(fd->type) {
+			case 0x00:		// BACKGROUNDS, 10 strips of 240x24
+				for(u32 j=0; j<10; j++) {
+					addOp(list, i, fd->idx + j, fd->x, fd->y + (i32)(j * 24));
+				}
+				break;
+			case 0x10:		// MONTH_NAME
+				addOp(list, i, fd->idx + (s->month + 11) % 12, fd->x, fd->y);
+				break;
+			case 0x11:		// MONTH_NUM
+			case 0x6b:		// MONTH_NUM_B
+				addNumber(list, r, i, s->month, 2, ALIGN_LEFT);
+				break;
+			case 0x12:		// YEAR
+				addNumber(list, r, i, s->year % 100, 2, ALIGN_LEFT);
+				break;
+			case 0x30:		// DAY_NUM
+			case 0x6c:		// DAY_NUM_B
+				addNumber(list, r, i, s->day, 2, ALIGN_LEFT);
+				break;
+			case 0x40:		// TIME_H1
+				addOp(list, i, fd->idx + hour / 10, fd->x, fd->y);
+				break;
+			case 0x41:		// TIME_H2
+				addOp(list, i, fd->idx + hour % 10, fd->x, fd->y);
+				break;
+			case 0x43:		// TIME_M1
+				addOp(list, i, fd->idx + s->minute / 10, fd->x, fd->y);
+				break;
+			case 0x44:		// TIME_M2
+				addOp(list, i, fd->idx + s->minute % 10, fd->x, fd->y);
+				break;
+			case 0x45:		// TIME_AM
+			case 0x46:		// TIME_PM
+				if(s->hour12 && (s->hour >= 12) == (fd->type == 0x46)) {
+					addOp(list, i, fd->idx, fd->x, fd->y);
+				}
+				break;
+			case 0x60:		// DAY_NAME
+			case 0x61:		// DAY_NAME_CN
+				addOp(list, i, fd->idx + s->weekday % 7, fd->x, fd->y);
+				break;
+			case 0x62:		// STEPS
+			case 0x63:
+			case 0x64:
+				addNumber(list, r, i, s->steps, 1, (Align)(fd->type - 0x62));
+				break;
+			case 0x72:		// STEPS_B
+			case 0x73:
+			case 0x74:
+				addNumber(list, r, i, s->steps, 1, (Align)(fd->type - 0x72));
+				break;
+			case 0x76:		// STEPS_GOAL
+				addNumber(list, r, i, s->stepsGoal, 1, ALIGN_LEFT);
+				break;
+			case 0x65:		// HR
+			case 0x66:
+			case 0x67:
+				addNumber(list, r, i, s->hr, 1, (Align)(fd->type - 0x65));
+				break;
+			case 0x82:		// HR_B
+			case 0x83:
+			case 0x84:
+				addNumber(list, r, i, s->hr, 1, (Align)(fd->type - 0x82));
+				break;
+			case 0x68:		// KCAL
+				addNumber(list, r, i, s->kcal, 1, ALIGN_LEFT);
+				break;
+			case 0x92:		// KCAL_B
+			case 0x93:
+			case 0x94:
+				addNumber(list, r, i, s->kcal, 1, (Align)(fd->type - 0x92));
+				break;
+			case 0xA2:		// DIST
+			case 0xA3:
+			case 0xA4:
+				addNumber(list, r, i, s->dist, 1, (Align)(fd->type - 0xA2));
+				break;
+			case 0xD2:		// BATT
+			case 0xD3:
+			case 0xD4:
+				addNumber(list, r, i, s->battery, 1, (Align)(fd->type - 0xD2));
+				break;
+			case 0xD7:		// WEATHER_TEMP
+			case 0xD8:
+			case 0xD9:
+				addTemp(list, r, i, s->temp, s->fahrenheit, (Align)(fd->type - 0xD7));
+				break;
+			case 0x70:		// STEPS_PROGBAR
+				addProgress(list, r, i, s->steps, s->stepsGoal);
+				break;
+			case 0x80:		// HR_PROGBAR, out of 200 bpm
+				addProgress(list, r, i, s->hr, 200);
+				break;
+			case 0x90:		// KCAL_PROGBAR
+				addProgress(list, r, i, s->kcal, s->kcalGoal);
+				break;
+			case 0xA0:		// DIST_PROGBAR
+				addProgress(list, r, i, s->dist, s->distGoal);
+				break;
+			case 0xA5:		// DIST_KM
+			case 0xA6:		// DIST_MI
+				if(s->miles == (fd->type == 0xA6)) {
+					addOp(list, i, fd->idx, fd->x, fd->y);
+				}
+				break;
+			case 0xC0:		// BTLINK_UP
+			case 0xC1:		// BTLINK_DOWN
+				if(s->btConnected == (fd->type == 0xC0)) {
+					addOp(list, i, fd->idx, fd->x, fd->y);
+				}
+				break;
+			case 0xF1:		// HAND_HOUR
+				addHand(list, r, i, (s->hour % 12) * 30 + s->minute / 2);
+				break;
+			case 0xF2:		// HAND_MINUTE
+				addHand(list, r, i, s->minute * 6 + s->second / 10);
+				break;
+			case 0xF3:		// HAND_SEC
+				addHand(list, r, i, s->second * 6);
+				break;
+			case 0xF6:		// TAP_TO_CHANGE, ANIMATION, ANIMATION_F8
+			case 0xF7:
+			case 0xF8:
+				addOp(list, i, fd->idx + ((r->xfi.animationFrames > 0) ? s->frame % r->xfi.animationFrames : 0), fd->x, fd->y);
+				break;
+			default:		// BACKGROUND, logos, battery images, SEPERATOR, HAND_PIN_UPPER/LOWER...
+				if(getDataTypeIdx(fd->type) != -1) {
+					addOp(list, i, fd->idx, fd->x, fd->y);
+				}
+				break;
+		}
+	}
+}
+
+// The screen rectangle op covers
+static FaceRect getOpRect(const FaceRenderer * r, const DrawOp * op) {
+	if(op->blob >= r->blobCount) {
+		return (FaceRect){ 0 };
+	}
+	if(op->angle >= 0) {
+		return getRotatedRect(r->blobs[op->blob].width, r->blobs[op->blob].height, op->x, op->y, (i32)r->width / 2,
+			(i32)r->height / 2, (u32)op->angle);
+	}
+	return (FaceRect){ .x = op->x, .y = op->y, .w = (i32)r->blobs[op->blob].width, .h = (i32)r->blobs[op->blob].height };
+}
+
+// Copy the part of op inside clip into frame. Returns the number of bytes of blob data that would be decoded to
+// draw it: only the rows needed for NONE and RLE_LINE, or everything up to the last of them for RLE_BASIC.
+static u64 drawOp(const FaceRenderer * r, const DrawOp * op, FaceRect clip, u8 * frame) {
+	if(op->blob >= r->blobCount || r->pixels[op->blob] == NULL) {
+		return 0;
+	}
+	FaceRect d = intersectRect(getOpRect(r, op), clip);
+	if(d.w == 0) {
+		return 0;
+	}
+	const DawftBlob * b = &r->blobs[op->blob];
+	if(op->angle >= 0) {
+		// all of a hand is decoded
+		drawRotatedPixels(r->pixels[op->blob], b->width, b->height, &r->opaque[op->blob], op->x, op->y, (i32)r->width / 2,
+			(i32)r->height / 2, (u32)op->angle, d, frame, r->width);
+		return r->rowStarts[op->blob][b->height] - ((b->compression == RLE_LINE) ? r->rowStarts[op->blob][0] : 0);
+	}
+	u32 bx = (u32)(d.x - op->x);
+	u32 by = (u32)(d.y - op->y);
+	for(i32 y=0; y<d.h; y++) {
+		const u8 * src = &r->pixels[op->blob][((size_t)(by + y) * b->width + bx) * 2];
+		memcpy(&frame[((size_t)(d.y + y) * r->width + d.x) * 2], src, (size_t)d.w * 2);
+	}
+
+	const u32 * rowStarts = r->rowStarts[op->blob];
+	if(b->compression == RLE_LINE) {
+		return rowStarts[by + d.h] - rowStarts[by];
+	} else if(b->compression == RLE_BASIC) {
+		return rowStarts[by + d.h];
+	}
+	return (u64)d.w * d.h * 2;
+}
+
+// Draw the part of list inside clip into frame, over black. Returns the number of bytes of blob data decoded.
+static u64 drawList(const FaceRenderer * r, const DrawList * list, FaceRect clip, u8 * frame) {
+	for(i32 y=0; y<clip.h; y++) {
+		memset(&frame[((size_t)(clip.y + y) * r->width + clip.x) * 2], 0, (size_t)clip.w * 2);
+	}
+	u64 bytes = 0;
+	for(u32 i=0; i<list->count; i++) {
+		bytes += drawOp(r, &list->ops[i], clip, frame);
+	}
+	return bytes;
+}
+
+// Draw a frame of the face for state s into frame, which is r->width * r->height big-endian RGB565 pixels.
+// Returns 0 for success.
+int renderFace(const FaceRenderer * r, const FaceState * s, u8 * frame) {
+	if(r == NULL || s == NULL || frame == NULL) {
+		return DAWFT_ERR_ARG;
+	}
+	DrawList list;
+	getDrawList(r, s, &list);
+	drawList(r, &list, (FaceRect){ .w = (i32)r->width, .h = (i32)r->height }, frame);
+	return DAWFT_OK;
+}
+
+
+//----------------------------------------------------------------------------
+//  TICKS - redraw only what changed
+//----------------------------------------------------------------------------
+
+static bool sameOps(const DrawOp * a, u32 aCount, const DrawOp * b, u32 bCount) {
+	if(aCount != bCount) {
+		return false;
+	}
+	for(u32 i=0; i<aCount; i++) {
+		if(a[i].blob != b[i].blob || a[i].angle != b[i].angle || a[i].x != b[i].x || a[i].y != b[i].y) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Update frame, which shows the face in state prev, to show it in state s. Only the rectangles covering faceData
+// that changed are drawn again. What was drawn, and what it cost, is put in tick. Returns 0 for success.
+int renderFaceTick(const FaceRenderer * r, const FaceState * prev, const FaceState * s, u8 * frame, FaceTick * tick) {
+	if(r == NULL || prev == NULL || s == NULL || frame == NULL || tick == NULL) {
+		return DAWFT_ERR_ARG;
+	}
+	DrawList before;
+	DrawList after;
+	getDrawList(r, prev, &before);
+	getDrawList(r, s, &after);
+	*tick = (FaceTick){ 0 };
+
+	// each faceData that draws something different needs the area of its old and new blobs drawn again
+	u32 maxFaceData = (r->xfi.fileType == 'A') ? 32 : 39;
+	u32 b = 0;
+	u32 a = 0;
+	for(u32 fdi=0; fdi<r->h.dataCount && fdi<maxFaceData; fdi++) {
+		u32 b0 = b;
+		u32 a0 = a;
+		while(b < before.count && before.ops[b].faceData == fdi) {
+			b++;
+		}
+		while(a < after.count && after.ops[a].faceData == fdi) {
+			a++;
+		}
+		if(sameOps(&before.ops[b0], b - b0, &after.ops[a0], a - a0)) {
+			continue;
+		}
+		FaceRect dirty = { 0 };
+		for(u32 i=b0; i<b; i++) {
+			dirty = unionRect(dirty, getOpRect(r, &before.ops[i]));
+		}
+		for(u32 i=a0; i<a; i++) {
+			dirty = unionRect(dirty, getOpRect(r, &after.ops[i]));
+		}
+		dirty = intersectRect(dirty, (FaceRect){ .w = (i32)r->width, .h = (i32)r->height });
+		tick->dirtyFaceData |= (u64)1 << fdi;
+		if(dirty.w > 0) {
+			tick->rects[tick->rectCount++] = dirty;
+		}
+	}
+
+	// merge rectangles that overlap, so nothing is drawn twice
+	for(bool merged = true; merged; ) {
+		merged = false;
+		for(u32 i=0; i<tick->rectCount; i++) {
+			for(u32 j=i+1; j<tick->rectCount; j++) {
+				if(intersectRect(tick->rects[i], tick->rects[j]).w > 0) {
+					tick->rects[i] = unionRect(tick->rects[i], tick->rects[j]);
+					tick->rects[j--] = tick->rects[--tick->rectCount];
+					merged = true;
+				}
+			}
+		}
+	}
+
+	for(u32 i=0; i<tick->rectCount; i++) {
+		tick->pixels += (u64)tick->rects[i].w * tick->rects[i].h;
+		tick->bytes += drawList(r, &after, tick->rects[i], frame);
+	}
+	return DAWFT_OK;
+}
+
+
+//----------------------------------------------------------------------------
+//  PREVIEW - a frame, shrunk
+//----------------------------------------------------------------------------
+
+// For each of dstW pixels, the first of the srcW pixels under it (in start), and how much of each of them is (from
+// weights[first[x]] to weights[first[x + 1] - 1]). A destination pixel is srcW units wide and a source pixel dstW, so
+// every weight is a whole number, and each destination pixel's add up to srcW. start has dstW entries, first dstW + 1
+// and weights srcW + dstW.
+static void getAreaWeights(u32 srcW, u32 dstW, u32 * start, u32 * first, u32 * weights) {
+	u32 w = 0;
+	for(u32 x=0; x<dstW; x++) {
+		u64 lo = (u64)x * srcW;
+		u64 hi = lo + srcW;
+		start[x] = (u32)(lo / dstW);
+		first[x] = w;
+		for(u64 s=start[x]; s * dstW < hi; s++) {
+			u64 a = (s * dstW > lo) ? s * dstW : lo;
+			u64 b = ((s + 1) * dstW < hi) ? (s + 1) * dstW : hi;
+			weights[w++] = (u32)(b - a);
+		}
+	}
+	first[dstW] = w;
+}
+
+// Shrink srcW x srcH big-endian RGB565 pixels to dstW x dstH (no bigger than the source), each pixel being the
+// average of the area of source pixels under it. The rows under each destination row are added up first, with each
+// channel in its own row, so most of the work is straight runs of multiply-adds that the compiler can vectorize.
+// Returns 0 for success.
+int shrinkPixels(const u8 * src, u32 srcW, u32 srcH, u8 * dst, u32 dstW, u32 dstH) {
+	if(src == NULL || dst == NULL || dstW == 0 || dstH == 0 || dstW > srcW || dstH > srcH || (u64)srcW * srcH > (1 << 24)) {
+		return DAWFT_ERR_ARG;
+	}
+	if(dstW == srcW && dstH == srcH) {
+		memcpy(dst, src, (size_t)srcW * srcH * 2);
+		return DAWFT_OK;
+	}
+	u32 * startX = malloc(dstW * sizeof(u32));
+	u32 * firstX = malloc((dstW + 1) * sizeof(u32));
+	u32 * weightsX = malloc((srcW + dstW) * sizeof(u32));
+	u32 * startY = malloc(dstH * sizeof(u32));
+	u32 * firstY = malloc((dstH + 1) * sizeof(u32));
+	u32 * weightsY = malloc((srcH + dstH) * sizeof(u32));
+	u32 * planes = malloc((size_t)srcW * 3 * sizeof(u32));		// one source row, as R, G, B rows
+	u32 * sums = malloc((size_t)srcW * 3 * sizeof(u32));			// the rows under one destination row, added up
+	int r = DAWFT_ERR_NOMEM;
+	if(startX == NULL || firstX == NULL || weightsX == NULL || startY == NULL || firstY == NULL || weightsY == NULL ||
+			planes == NULL || sums == NULL) {
+		goto done;
+	}
+	getAreaWeights(srcW, dstW, startX, firstX, weightsX);
+	getAreaWeights(srcH, dstH, startY, firstY, weightsY);
+
+	// the sums are at most 255 * srcW * srcH, which fits
+	u32 total = srcW * srcH;
+	double scale = 1.0 / total;
+	u32 unpacked = srcH;			// the source row in planes
+	for(u32 y=0; y<dstH; y++) {
+		memset(sums, 0, (size_t)srcW * 3 * sizeof(u32));
+		for(u32 i=0; i<firstY[y + 1] - firstY[y]; i++) {
+			// the last row under one destination row is often the first under the next
+			if(startY[y] + i != unpacked) {
+				unpacked = startY[y] + i;
+				const u8 * p = &src[(size_t)unpacked * srcW * 2];
+				for(u32 x=0; x<srcW; x++) {
+					u32 v = ((u32)p[x * 2] << 8) | p[x * 2 + 1];
+					planes[x] = ((v & 0xF800) >> 8) | ((v & 0xE000) >> 13);
+					planes[srcW + x] = ((v & 0x07E0) >> 3) | ((v & 0x0600) >> 9);
+					planes[srcW * 2 + x] = ((v & 0x001F) << 3) | ((v & 0x001C) >> 2);
+				}
+			}
+			u32 weight = weightsY[firstY[y] + i];
+			for(u32 x=0; x<srcW * 3; x++) {
+				sums[x] += planes[x] * weight;
+			}
+		}
+
+		// then across. n / total is never within 1 / total below a whole number, so the small nudge up makes up for the
+		// reciprocal being inexact without ever rounding up wrongly.
+		u8 * d = &dst[(size_t)y * dstW * 2];
+		for(u32 x=0; x<dstW; x++) {
+			const u32 * weights = &weightsX[firstX[x]];
+			u32 taps = firstX[x + 1] - firstX[x];
+			u32 rgb[3];
+			for(u32 c=0; c<3; c++) {
+				const u32 * in = &sums[srcW * c + startX[x]];
+				u32 sum = 0;
+				for(u32 i=0; i<taps; i++) {
+					sum += in[i] * weights[i];
+				}
+				rgb[c] = (u32)((sum + total / 2) * scale + 1e-9);
+			}
+			u16 v = (u16)(((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3));
+			d[x * 2] = (u8)(v >> 8);
+			d[x * 2 + 1] = (u8)v;
+		}
+	}
+	r = DAWFT_OK;
+
+done:
+	free(startX);
+	free(firstX);
+	free(weightsX);
+	free(startY);
+	free(firstY);
+	free(weightsY);
+	free(planes);
+	free(sums);
+	return r;
+}
+
+// Draw a frame of the face for state s, shrunk to w x h, into pixels (big-endian RGB565). The whole screen is
+// squeezed to fit, so w x h should be about the same shape. Returns 0 for success.
+int renderPreview(const FaceRenderer * r, const FaceState * s, u32 w, u32 h, u8 * pixels) {
+	if(r == NULL || s == NULL || pixels == NULL) {
+		return DAWFT_ERR_ARG;
+	}
+	u8 * frame = malloc((size_t)r->width * r->height * 2);
+	if(frame == NULL) {
+		return DAWFT_ERR_NOMEM;
+	}
+	int e = renderFace(r, s, frame);
+	if(e == DAWFT_OK) {
+		e = shrinkPixels(frame, r->width, r->height, pixels, w, h);
+	}
+	free(frame);
+	return e;
+}
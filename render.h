@@ -0,0 +1,76 @@
+// render.h
+//
+// Draw a frame of a watch face, as the watch would show it. Requires dawft.h, bmp.h and libdawft.h to be
+// included first.
+
+
+//----------------------------------------------------------------------------
+//  RENDER
+//----------------------------------------------------------------------------
+
+// What the watch is showing
+typedef struct _FaceState {
+	u16 year;
+	u8 month;					// 1 to 12
+	u8 day;						// 1 to 31
+	u8 weekday;					// 0 is Sunday
+	u8 hour;					// 0 to 23
+	u8 minute;
+	u8 second;
+	bool hour12;				// show hours as 1 to 12, with AM or PM
+	u32 steps;
+	u32 stepsGoal;
+	u32 hr;
+	u32 kcal;
+	u32 kcalGoal;
+	u32 dist;					// in the units shown (DIST_KM or DIST_MI)
+	u32 distGoal;
+	bool miles;
+	u32 battery;				// percent
+	i32 temp;
+	bool fahrenheit;
+	bool btConnected;
+	u32 frame;					// animation or tap-to-change frame
+} FaceState;
+
+typedef struct _FaceRect {
+	i32 x;
+	i32 y;
+	i32 w;
+	i32 h;
+} FaceRect;
+
+// A bin file, with every bitmap decoded and ready to draw
+typedef struct _FaceRenderer {
+	FaceHeader h;
+	ExtraFileInfo xfi;
+	u32 width;					// screen size
+	u32 height;
+	u32 blobCount;
+	DawftBlob blobs[250];
+	u8 * pixels[250];			// big-endian RGB565, or NULL for blobs that aren't drawn
+	u32 * rowStarts[250];		// offset of each row in the blob data, and of its end
+	FaceRect opaque[250];		// the part of each bitmap that isn't black
+} FaceRenderer;
+
+// What was drawn again for one tick
+typedef struct _FaceTick {
+	u32 rectCount;
+	FaceRect rects[39];			// no two overlap
+	u64 pixels;					// pixels drawn
+	u64 bytes;					// bytes of blob data decoded to draw them
+	u64 dirtyFaceData;			// bit n set if faceData n changed
+} FaceTick;
+
+void setDefaultFaceState(FaceState * s);
+u8 getWeekday(u32 year, u32 month, u32 day);
+FaceRenderer * newFaceRenderer(const u8 * data, size_t size, char fileType);
+FaceRenderer * deleteFaceRenderer(FaceRenderer * r);
+int renderFace(const FaceRenderer * r, const FaceState * s, u8 * frame);
+int renderFaceTick(const FaceRenderer * r, const FaceState * prev, const FaceState * s, u8 * frame, FaceTick * tick);
+void tickFaceState(FaceState * s);
+FaceRect getRotatedRect(u32 w, u32 h, i32 x, i32 y, i32 pivotX, i32 pivotY, u32 angle);
+void drawRotatedPixels(const u8 * pixels, u32 w, u32 h, const FaceRect * opaque, i32 x, i32 y, i32 pivotX, i32 pivotY,
+	u32 angle, FaceRect clip, u8 * frame, u32 frameWidth);
+int shrinkPixels(const u8 * src, u32 srcW, u32 srcH, u8 * dst, u32 dstW, u32 dstH);
+int renderPreview(const FaceRenderer * r, const FaceState * s, u32 w, u32 h, u8 * pixels);
@@ -111,3 +111,20 @@ size_t d_strlcat(char * dst, const char * src, size_t dstSize) {
 	dst[dstLen + i] = 0;
 	return(dstLen + i);
 }
+
+// Read a line from a memory buffer into dst, like fgets(). *pos is the read position in src, and is advanced.
+// Returns NULL when there is no more data.
+char * d_sgets(char * dst, size_t dstSize, const char * src, size_t srcSize, size_t * pos) {
+	if(*pos >= srcSize || dstSize < 2) {
+		return NULL;
+	}
+	size_t i = 0;
+	while(*pos < srcSize && i < dstSize - 1) {
+		char c = src[*pos];
+		dst[i++] = c;
+		*pos += 1;
+		if(c == '\n') break;
+	}
+	dst[i] = 0;
+	return dst;
+}
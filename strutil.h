@@ -11,5 +11,6 @@ void getTokensIdx(char * s, TokensIdx * t);
 int isNum(char * s);
 uint32_t readNum(char * s);
 size_t d_strlcat(char * dst, const char * src, size_t dstSize);
+char * d_sgets(char * dst, size_t dstSize, const char * src, size_t srcSize, size_t * pos);
 
 
@@ -0,0 +1,302 @@
+/*  tar.c - reading and writing ustar archives
+
+	Da Watch Face Tool (dawft)
+	dawft: Watch Face Tool for MO YOUNG / DA FIT binary watch face files.
+
+	Copyright 2022 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "dawft.h"
+#include "tar.h"
+
+
+//----------------------------------------------------------------------------
+//  HEADER FIELDS
+//----------------------------------------------------------------------------
+
+// Read an octal number field. Returns false if it isn't one.
+static bool readTarOctal(const u8 * field, size_t fieldSize, u64 * out) {
+	size_t i = 0;
+	u64 v = 0;
+	while(i < fieldSize && field[i] == ' ') {
+		i++;
+	}
+	if(i == fieldSize || field[i] < '0' || field[i] > '7') {
+		return false;
+	}
+	while(i < fieldSize && field[i] >= '0' && field[i] <= '7') {
+		v = (v << 3) | (u64)(field[i] - '0');
+		i++;
+	}
+	*out = v;
+	return true;
+}
+
+static u32 tarChecksum(const u8 * header) {
+	u32 sum = 0;
+	for(u32 i=0; i<TAR_BLOCK_SIZE; i++) {
+		sum += (i >= 148 && i < 156) ? ' ' : header[i];		// the checksum field counts as spaces
+	}
+	return sum;
+}
+
+// Copy a field that may not be NUL-terminated
+static void copyTarString(char * dst, const u8 * field, size_t fieldSize) {
+	size_t n = 0;
+	while(n < fieldSize && field[n] != 0) {
+		n++;
+	}
+	memcpy(dst, field, n);
+	dst[n] = 0;
+}
+
+// Fill in a ustar header for a regular file. Names longer than 100 bytes are split into prefix and name at a '/'.
+// Returns 0 for success.
+int makeTarHeader(u8 header[TAR_BLOCK_SIZE], const char * name, size_t size, i64 mtime) {
+	memset(header, 0, TAR_BLOCK_SIZE);
+
+	while(*name == '/') {
+		name++;				// archives hold relative names
+	}
+	char path[256];
+	size_t len = strlen(name);
+	if(len == 0 || len >= sizeof(path)) {
+		return 1;
+	}
+	memcpy(path, name, len + 1);
+#ifdef WINDOWS
+	for(size_t i=0; i<len; i++) {
+		if(path[i] == '\\') {
+			path[i] = '/';
+		}
+	}
+#endif
+
+	if(len <= 100) {
+		memcpy(&header[0], path, len);
+	} else {
+		// find the first '/' that leaves a name of 100 bytes or less, and a prefix of 155 bytes or less
+		size_t split = len;
+		for(size_t i=len-1; i>0 && len-i-1 <= 100; i--) {
+			if(path[i] == '/') {
+				split = i;
+			}
+		}
+		if(split == len || split > 155) {
+			return 1;
+		}
+		memcpy(&header[345], path, split);
+		memcpy(&header[0], &path[split+1], len - split - 1);
+	}
+
+	if((u64)size > 077777777777ULL || mtime < 0) {
+		return 1;
+	}
+	snprintf((char *)&header[100], 8, "%07o", 0644);
+	snprintf((char *)&header[108], 8, "%07o", 0);
+	snprintf((char *)&header[116], 8, "%07o", 0);
+	snprintf((char *)&header[124], 12, "%011llo", (unsigned long long)size);
+	snprintf((char *)&header[136], 12, "%011llo", (unsigned long long)mtime & 077777777777ULL);
+	header[156] = '0';
+	memcpy(&header[257], "ustar", 6);
+	memcpy(&header[263], "00", 2);
+	snprintf((char *)&header[148], 8, "%06o", tarChecksum(header));
+	header[155] = ' ';
+	return 0;
+}
+
+
+//----------------------------------------------------------------------------
+//  ARCHIVE
+//----------------------------------------------------------------------------
+
+// Index the regular files in the tar archive in bytes. The archive takes ownership of bytes, even on failure.
+// Returns NULL on failure.
+Archive * newArchiveFromBytes(Bytes * bytes) {
+	Archive * a = calloc(1, sizeof(Archive));
+	if(a == NULL) {
+		printf("ERROR: Out of memory.\n");
+		deleteBytes(bytes);
+		return NULL;
+	}
+	a->bytes = bytes;
+
+	u32 capacity = 0;
+	char longName[256] = { 0 };		// from a GNU long name entry, for the next entry
+	size_t pos = 0;
+	while(pos + TAR_BLOCK_SIZE <= bytes->size) {
+		const u8 * header = &bytes->data[pos];
+
+		// two blocks of zeros mark the end, but one is enough for us
+		bool empty = true;
+		for(u32 i=0; i<TAR_BLOCK_SIZE && empty; i++) {
+			empty = (header[i] == 0);
+		}
+		if(empty) {
+			break;
+		}
+
+		u64 checksum = 0;
+		u64 size = 0;
+		if(!readTarOctal(&header[148], 8, &checksum) || checksum != tarChecksum(header) || !readTarOctal(&header[124], 12, &size)) {
+			printf("ERROR: Invalid tar header at offset %zu.\n", pos);
+			return deleteArchive(a);
+		}
+		pos += TAR_BLOCK_SIZE;
+		if(size > bytes->size - pos) {
+			printf("ERROR: Tar archive is truncated.\n");
+			return deleteArchive(a);
+		}
+		const u8 * data = &bytes->data[pos];
+		pos += (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+
+		u8 type = header[156];
+		if(type == 'L') {
+			size_t n = (size < sizeof(longName)) ? (size_t)size : sizeof(longName) - 1;
+			copyTarString(longName, data, n);
+			continue;
+		}
+		if(type != '0' && type != 0) {
+			longName[0] = 0;
+			continue;		// directories, links, pax headers...
+		}
+
+		if(a->count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			TarEntry * entries = realloc(a->entries, capacity * sizeof(TarEntry));
+			if(entries == NULL) {
+				printf("ERROR: Out of memory.\n");
+				return deleteArchive(a);
+			}
+			a->entries = entries;
+		}
+		TarEntry * e = &a->entries[a->count++];
+		if(longName[0] != 0) {
+			snprintf(e->name, sizeof(e->name), "%s", longName);
+			longName[0] = 0;
+		} else if(memcmp(&header[257], "ustar", 5) == 0 && header[345] != 0) {
+			char prefix[156];
+			char name[101];
+			copyTarString(prefix, &header[345], 155);
+			copyTarString(name, &header[0], 100);
+			snprintf(e->name, sizeof(e->name), "%s/%s", prefix, name);
+		} else {
+			copyTarString(e->name, &header[0], 100);
+		}
+		e->data = data;
+		e->size = (size_t)size;
+		e->owned = NULL;
+		e->hash = 0;
+	}
+	return a;
+}
+
+// Make an archive with no files, to fill with setArchiveEntry(). Returns NULL on failure.
+Archive * newEmptyArchive(void) {
+	Archive * a = calloc(1, sizeof(Archive));
+	if(a == NULL) {
+		printf("ERROR: Out of memory.\n");
+	}
+	return a;
+}
+
+// Delete an Archive, and its bytes. Safe to use on already deleted Archive.
+Archive * deleteArchive(Archive * a) {
+	if(a != NULL) {
+		for(u32 i=0; i<a->count; i++) {
+			deleteBytes(a->entries[i].owned);
+		}
+		deleteBytes(a->bytes);
+		free(a->entries);
+		free(a);
+	}
+	return NULL;
+}
+
+// Add the file called name, with the contents data, or replace the file with exactly that name. Takes ownership of
+// data, even on failure. hash is kept with it, for the caller. Returns 0 for success.
+int setArchiveEntry(Archive * a, const char * name, Bytes * data, u64 hash) {
+	if(strlen(name) >= sizeof(a->entries[0].name)) {
+		deleteBytes(data);
+		return 1;
+	}
+	TarEntry * e = NULL;
+	for(u32 i=0; i<a->count && e == NULL; i++) {
+		if(strcmp(a->entries[i].name, name) == 0) {
+			e = &a->entries[i];
+		}
+	}
+	if(e == NULL) {
+		TarEntry * entries = realloc(a->entries, (a->count + 1) * sizeof(TarEntry));
+		if(entries == NULL) {
+			printf("ERROR: Out of memory.\n");
+			deleteBytes(data);
+			return 1;
+		}
+		a->entries = entries;
+		e = &a->entries[a->count++];
+		*e = (TarEntry){ 0 };
+		snprintf(e->name, sizeof(e->name), "%s", name);
+	}
+	deleteBytes(e->owned);
+	e->owned = data;
+	e->data = data->data;
+	e->size = data->size;
+	e->hash = hash;
+	return 0;
+}
+
+// Remove the file with exactly the name name, if there is one.
+void removeArchiveEntry(Archive * a, const char * name) {
+	for(u32 i=0; i<a->count; i++) {
+		if(strcmp(a->entries[i].name, name) == 0) {
+			deleteBytes(a->entries[i].owned);
+			a->count--;
+			memmove(&a->entries[i], &a->entries[i + 1], (a->count - i) * sizeof(TarEntry));
+			return;
+		}
+	}
+}
+
+// Find the file called name, in any folder of the archive. A file with exactly that name is used first, then the first
+// of any others. Returns NULL if it isn't there.
+const TarEntry * findArchiveEntry(const Archive * a, const char * name) {
+	size_t len = strlen(name);
+	const TarEntry * found = NULL;
+	for(u32 i=0; i<a->count; i++) {
+		const TarEntry * e = &a->entries[i];
+		size_t n = strlen(e->name);
+		if(n == len && strcmp(e->name, name) == 0) {
+			return e;
+		}
+		if(found == NULL && n > len && strcmp(&e->name[n-len], name) == 0 && e->name[n-len-1] == '/') {
+			found = e;
+		}
+	}
+	return found;
+}
+
+// Load a copy of the file called name, in any folder of the archive. Returns NULL if it isn't there.
+Bytes * newBytesFromArchive(const Archive * a, const char * name) {
+	const TarEntry * e = findArchiveEntry(a, name);
+	if(e == NULL) {
+		return NULL;
+	}
+	Bytes * b = malloc(sizeof(Bytes) + e->size);
+	if(b == NULL) {
+		printf("ERROR: Out of memory.\n");
+		return NULL;
+	}
+	b->size = e->size;
+	memcpy(b->data, e->data, e->size);
+	return b;
+}
@@ -0,0 +1,32 @@
+// tar.h
+
+
+//----------------------------------------------------------------------------
+//  TAR - dump folders as one archive, and create from one
+//----------------------------------------------------------------------------
+
+#define TAR_BLOCK_SIZE 512
+
+// One regular file in an archive. data points into the archive's bytes, or to owned.
+typedef struct _TarEntry {
+	char name[257];			// prefix, '/' and name
+	const u8 * data;
+	size_t size;
+	Bytes * owned;			// the data of an entry set with setArchiveEntry(), or NULL
+	u64 hash;				// of the data, if it was given to setArchiveEntry(), or 0
+} TarEntry;
+
+typedef struct _Archive {
+	Bytes * bytes;
+	u32 count;
+	TarEntry * entries;
+} Archive;
+
+Archive * newArchiveFromBytes(Bytes * bytes);
+Archive * newEmptyArchive(void);
+Archive * deleteArchive(Archive * a);
+int setArchiveEntry(Archive * a, const char * name, Bytes * data, u64 hash);
+void removeArchiveEntry(Archive * a, const char * name);
+const TarEntry * findArchiveEntry(const Archive * a, const char * name);
+Bytes * newBytesFromArchive(const Archive * a, const char * name);
+int makeTarHeader(u8 header[TAR_BLOCK_SIZE], const char * name, size_t size, i64 mtime);